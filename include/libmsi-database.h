@@ -46,6 +46,9 @@ LibmsiDatabase *    libmsi_database_new                 (const gchar *path,
                                                          guint flags,
                                                          const char *persist,
                                                          GError **error);
+LibmsiDatabase *    libmsi_database_snapshot            (LibmsiDatabase *db,
+                                                         const char *persist,
+                                                         GError **error);
 
 gboolean            libmsi_database_is_readonly         (LibmsiDatabase *db);
 LibmsiRecord *      libmsi_database_get_primary_keys    (LibmsiDatabase *db,
@@ -54,13 +57,43 @@ LibmsiRecord *      libmsi_database_get_primary_keys    (LibmsiDatabase *db,
 gboolean            libmsi_database_apply_transform     (LibmsiDatabase *db,
                                                          const char *file,
                                                          GError **error);
+gboolean            libmsi_database_apply_transforms    (LibmsiDatabase *db,
+                                                         const char * const *transforms,
+                                                         const char * const *outputs,
+                                                         GError **error);
+gboolean            libmsi_database_generate_transform  (LibmsiDatabase *db,
+                                                         LibmsiDatabase *ref,
+                                                         const char *file,
+                                                         GError **error);
 gboolean            libmsi_database_export              (LibmsiDatabase *db,
                                                          const char *table,
                                                          int fd,
                                                          GError **error);
+gboolean            libmsi_database_export_all          (LibmsiDatabase *db,
+                                                         const char *dir,
+                                                         GError **error);
+gboolean            libmsi_database_extract_stream_to_fd (LibmsiDatabase *db,
+                                                         const char *name,
+                                                         int fd,
+                                                         GError **error);
+gboolean            libmsi_database_extract_streams     (LibmsiDatabase *db,
+                                                         const char *pattern,
+                                                         const char *dir,
+                                                         GError **error);
+gboolean            libmsi_database_diff                (LibmsiDatabase *db,
+                                                         LibmsiDatabase *other,
+                                                         guint flags,
+                                                         int fd,
+                                                         guint *count,
+                                                         GError **error);
+GVariant *          libmsi_database_get_stats           (LibmsiDatabase *db,
+                                                         GError **error);
 gboolean            libmsi_database_import              (LibmsiDatabase *db,
                                                          const char *path,
                                                          GError **error);
+gboolean            libmsi_database_import_tables       (LibmsiDatabase *db,
+                                                         const char * const *paths,
+                                                         GError **error);
 gboolean            libmsi_database_is_table_persistent (LibmsiDatabase *db,
                                                          const char *table,
                                                          GError **error);
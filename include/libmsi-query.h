@@ -58,6 +58,10 @@ void              libmsi_query_get_error         (LibmsiQuery *query,
 LibmsiRecord *    libmsi_query_get_column_info   (LibmsiQuery *query,
                                                   LibmsiColInfo info,
                                                   GError **error);
+gchar *           libmsi_query_get_plan          (LibmsiQuery *query,
+                                                  GError **error);
+void              libmsi_query_set_profiling     (LibmsiQuery *query,
+                                                  gboolean profiling);
 
 G_END_DECLS
 
@@ -81,6 +81,11 @@ typedef enum LibmsiDbFlags
     LIBMSI_DB_FLAGS_PATCH      = 1 << 3,
 } LibmsiDbFlags;
 
+typedef enum LibmsiDiffFlags
+{
+    LIBMSI_DIFF_FLAGS_FAST     = 1 << 0,
+} LibmsiDiffFlags;
+
 typedef enum LibmsiDBError
 {
     LIBMSI_DB_ERROR_SUCCESS, /* FIXME: remove me */
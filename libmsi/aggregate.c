@@ -0,0 +1,398 @@
+/*
+ * Implementation of the Microsoft Installer (msi.dll)
+ *
+ * Copyright (C) 2026 msitools contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+
+#include "debug.h"
+#include "libmsi.h"
+#include "msipriv.h"
+
+#include "query.h"
+
+
+/* COUNT, MIN, MAX and SUM over the rows of a query, producing a single row */
+typedef struct _LibmsiAggregateColumn
+{
+    unsigned function;
+    unsigned col;      /* column of the underlying view, 0 for COUNT(*) */
+    unsigned type;     /* type of that column */
+    char    *name;
+} LibmsiAggregateColumn;
+
+typedef struct _LibmsiAggregateView
+{
+    LibmsiView        view;
+    LibmsiDatabase   *db;
+    LibmsiView       *table;
+    bool               executed;
+    unsigned           num_cols;
+    unsigned          *values;
+    LibmsiAggregateColumn cols[1];
+} LibmsiAggregateView;
+
+static const char *aggregate_function_name( unsigned function )
+{
+    switch( function )
+    {
+    case AGGREGATE_COUNT: return "COUNT";
+    case AGGREGATE_MIN: return "MIN";
+    case AGGREGATE_MAX: return "MAX";
+    case AGGREGATE_SUM: return "SUM";
+    }
+    return NULL;
+}
+
+static unsigned aggregate_view_fetch_int( LibmsiView *view, unsigned row, unsigned col, unsigned *val )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+
+    TRACE("%p %d %d %p\n", av, row, col, val );
+
+    if( !av->executed || row != 0 )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    if( col == 0 || col > av->num_cols )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    *val = av->values[col - 1];
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned aggregate_view_get_row( LibmsiView *view, unsigned row, LibmsiRecord **rec )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+
+    TRACE("%p %d %p\n", av, row, rec);
+
+    return msi_view_get_row( av->db, view, row, rec );
+}
+
+static unsigned aggregate_view_execute( LibmsiView *view, LibmsiRecord *record )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+    int64_t start = msi_view_profile_begin( view );
+    int64_t *count, *result;
+    unsigned r, i, j, row_count = 0, raw;
+    bool scan = false;
+
+    TRACE("%p %p\n", av, record);
+
+    if( !av->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    msi_view_profile_child( view, av->table );
+    r = av->table->ops->execute( av->table, record );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    r = av->table->ops->get_dimensions( av->table, &row_count, NULL );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    count = msi_alloc_zero( av->num_cols * sizeof(*count) );
+    result = msi_alloc_zero( av->num_cols * sizeof(*result) );
+    if( !count || !result )
+    {
+        r = LIBMSI_RESULT_OUTOFMEMORY;
+        goto done;
+    }
+
+    for( j = 0; j < av->num_cols; j++ )
+    {
+        if( av->cols[j].col )
+            scan = true;
+        else
+            count[j] = row_count;
+    }
+
+    /* COUNT(*) alone is answered from the dimensions of the view below */
+    for( i = 0; scan && i < row_count; i++ )
+    {
+        for( j = 0; j < av->num_cols; j++ )
+        {
+            const LibmsiAggregateColumn *col = &av->cols[j];
+            int64_t val;
+
+            if( !col->col )
+                continue;
+
+            r = av->table->ops->fetch_int( av->table, i, col->col, &raw );
+            if( r != LIBMSI_RESULT_SUCCESS )
+                goto done;
+            if( !raw )
+                continue;
+
+            if( (col->type & MSI_DATASIZEMASK) == 2 )
+                val = (int)raw - 0x8000;
+            else
+                val = (int)(raw ^ 0x80000000);
+
+            if( !count[j] ||
+                (col->function == AGGREGATE_MIN && val < result[j]) ||
+                (col->function == AGGREGATE_MAX && val > result[j]) )
+                result[j] = val;
+            else if( col->function == AGGREGATE_SUM )
+                result[j] += val;
+            count[j]++;
+        }
+    }
+
+    msi_free( av->values );
+    av->executed = false;
+    av->values = msi_alloc( av->num_cols * sizeof(*av->values) );
+    if( !av->values )
+    {
+        r = LIBMSI_RESULT_OUTOFMEMORY;
+        goto done;
+    }
+    for( j = 0; j < av->num_cols; j++ )
+    {
+        int64_t val = av->cols[j].function == AGGREGATE_COUNT ? count[j] : result[j];
+
+        if( val < G_MININT32 || val > G_MAXINT32 )
+        {
+            g_warning("%s does not fit in an integer\n", av->cols[j].name);
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+            goto done;
+        }
+
+        /* MIN, MAX and SUM of no values are NULL */
+        if( av->cols[j].function != AGGREGATE_COUNT && !count[j] )
+            av->values[j] = 0;
+        else
+            av->values[j] = (unsigned)val ^ 0x80000000;
+    }
+
+    av->executed = true;
+    msi_view_profile_end( view, start, row_count, 1 );
+    r = LIBMSI_RESULT_SUCCESS;
+
+done:
+    msi_free( count );
+    msi_free( result );
+    return r;
+}
+
+static unsigned aggregate_view_close( LibmsiView *view )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+
+    TRACE("%p\n", av );
+
+    if( !av->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    msi_free( av->values );
+    av->values = NULL;
+    av->executed = false;
+
+    return av->table->ops->close( av->table );
+}
+
+static unsigned aggregate_view_get_dimensions( LibmsiView *view, unsigned *rows, unsigned *cols )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+
+    TRACE("%p %p %p\n", av, rows, cols );
+
+    if( rows ) *rows = av->executed ? 1 : 0;
+    if( cols ) *cols = av->num_cols;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned aggregate_view_get_column_info( LibmsiView *view, unsigned n, const char **name,
+                                      unsigned *type, bool *temporary, const char **table_name )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+
+    TRACE("%p %d %p %p %p %p\n", av, n, name, type, temporary, table_name );
+
+    if( n == 0 || n > av->num_cols )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    if( name ) *name = av->cols[n - 1].name;
+    if( type ) *type = MSITYPE_VALID | MSITYPE_NULLABLE | 4;
+    if( temporary ) *temporary = true;
+    if( table_name ) *table_name = szEmpty;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned aggregate_view_delete( LibmsiView *view )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+    unsigned i;
+
+    TRACE("%p\n", av );
+
+    if( av->table )
+        av->table->ops->delete( av->table );
+
+    for( i = 0; i < av->num_cols; i++ )
+        g_free( av->cols[i].name );
+    msi_free( av->values );
+    g_object_unref(av->db);
+    msi_free( av );
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned aggregate_view_find_matching_rows( LibmsiView *view, unsigned col,
+    unsigned val, unsigned *row, MSIITERHANDLE *handle )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+
+    TRACE("%p, %d, %u, %p\n", view, col, val, *handle);
+
+    if( col == 0 || col > av->num_cols )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    if( *handle || !av->executed || av->values[col - 1] != val )
+        return NO_MORE_ITEMS;
+
+    *row = 0;
+    *handle = (MSIITERHANDLE)(uintptr_t)1;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned aggregate_view_explain( LibmsiView *view, GString *str, unsigned depth )
+{
+    LibmsiAggregateView *av = (LibmsiAggregateView*)view;
+    unsigned i;
+
+    TRACE("%p %p %u\n", view, str, depth);
+
+    if( !av->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    g_string_append_printf( str, "%*sAGGREGATE", depth * 2, "" );
+    for( i = 0; i < av->num_cols; i++ )
+        g_string_append_printf( str, "%s %s", i ? "," : "", av->cols[i].name );
+    msi_view_explain_end( view, str );
+
+    return msi_view_explain( av->table, str, depth + 1 );
+}
+
+static const LibmsiViewOps aggregate_ops =
+{
+    aggregate_view_fetch_int,
+    NULL,
+    aggregate_view_get_row,
+    NULL,
+    NULL,
+    NULL,
+    aggregate_view_execute,
+    aggregate_view_close,
+    aggregate_view_get_dimensions,
+    aggregate_view_get_column_info,
+    aggregate_view_delete,
+    aggregate_view_find_matching_rows,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    aggregate_view_explain,
+};
+
+static unsigned aggregate_view_add_column( LibmsiAggregateView *av, const column_info *column )
+{
+    LibmsiAggregateColumn *col = &av->cols[av->num_cols];
+    unsigned r;
+
+    TRACE("%p adding %d(%s.%s)\n", av, column->type, debugstr_a( column->table ),
+          debugstr_a( column->column ));
+
+    col->function = column->type;
+    if( !aggregate_function_name( col->function ) )
+        return LIBMSI_RESULT_BAD_QUERY_SYNTAX;
+
+    if( !column->column )
+    {
+        /* only COUNT accepts '*' */
+        if( col->function != AGGREGATE_COUNT )
+            return LIBMSI_RESULT_BAD_QUERY_SYNTAX;
+        col->name = g_strdup( "COUNT(*)" );
+        av->num_cols++;
+        return LIBMSI_RESULT_SUCCESS;
+    }
+
+    r = _libmsi_view_find_column( av->table, column->column, column->table, &col->col );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    r = av->table->ops->get_column_info( av->table, col->col, NULL, &col->type, NULL, NULL );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    /* MIN, MAX and SUM work on integer columns only */
+    if( col->function != AGGREGATE_COUNT && (col->type & MSITYPE_STRING) )
+        return LIBMSI_RESULT_BAD_QUERY_SYNTAX;
+
+    col->name = g_strdup_printf( "%s(%s)", aggregate_function_name( col->function ),
+                                 column->column );
+    av->num_cols++;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+unsigned aggregate_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table,
+                        const column_info *columns )
+{
+    LibmsiAggregateView *av;
+    const column_info *column;
+    unsigned count = 0, r = LIBMSI_RESULT_SUCCESS, i;
+
+    TRACE("%p %p\n", db, table );
+
+    for( column = columns; column; column = column->next )
+        count++;
+
+    av = msi_alloc_zero( sizeof *av + count * sizeof (LibmsiAggregateColumn) );
+    if( !av )
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    av->view.ops = &aggregate_ops;
+    av->table = table;
+
+    for( column = columns; column; column = column->next )
+    {
+        r = aggregate_view_add_column( av, column );
+        if( r != LIBMSI_RESULT_SUCCESS )
+            break;
+    }
+
+    if( r != LIBMSI_RESULT_SUCCESS )
+    {
+        for( i = 0; i < av->num_cols; i++ )
+            g_free( av->cols[i].name );
+        msi_free( av );
+        return r;
+    }
+
+    av->db = g_object_ref(db);
+    *view = &av->view;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
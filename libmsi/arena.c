@@ -0,0 +1,86 @@
+/*
+ * Implementation of the Microsoft Installer (msi.dll)
+ *
+ * Copyright (C) 2026 msitools contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+
+#include "debug.h"
+#include "libmsi.h"
+#include "msipriv.h"
+
+
+/* a query of a few columns and conditions fits in the first block */
+#define ARENA_BLOCK_SIZE   1024
+#define ARENA_BLOCK_MAX    16384
+#define ARENA_ALIGN        (2 * sizeof(void *))
+
+struct _LibmsiArenaBlock
+{
+    LibmsiArenaBlock *prev;
+    size_t            size;
+    size_t            used;
+};
+
+/* the data of a block follows its header, suitably aligned */
+#define ARENA_HEADER_SIZE  ((sizeof(LibmsiArenaBlock) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+void msi_arena_init( LibmsiArena *arena )
+{
+    arena->block = NULL;
+}
+
+void *msi_arena_alloc( LibmsiArena *arena, size_t sz )
+{
+    LibmsiArenaBlock *block = arena->block;
+    size_t size;
+
+    sz = (sz + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if( !block || block->size - block->used < sz )
+    {
+        /* each block is twice as large as the previous one, up to a point */
+        size = block ? MIN( block->size * 2, ARENA_BLOCK_MAX ) : ARENA_BLOCK_SIZE;
+        size = MAX( size, sz );
+
+        block = msi_alloc( ARENA_HEADER_SIZE + size );
+        if( !block )
+            return NULL;
+
+        block->prev = arena->block;
+        block->size = size;
+        block->used = 0;
+        arena->block = block;
+    }
+
+    block->used += sz;
+    return (char *)block + ARENA_HEADER_SIZE + block->used - sz;
+}
+
+void msi_arena_free( LibmsiArena *arena )
+{
+    LibmsiArenaBlock *block, *prev;
+
+    for( block = arena->block; block; block = prev )
+    {
+        prev = block->prev;
+        msi_free( block );
+    }
+
+    arena->block = NULL;
+}
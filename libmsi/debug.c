@@ -1,4 +1,5 @@
 #include <glib.h>
+#include <unistd.h>
 #include "debug.h"
 
 G_GNUC_INTERNAL
@@ -23,3 +24,283 @@ const char *wine_dbg_sprintf( const char *format, ...)
     return p_ret[i];
 }
 
+
+/* see debug.h */
+MsiProfileMode msi_profile_mode;
+uint64_t msi_counters[MSI_COUNTER_LAST];
+
+static const char *counter_names[MSI_COUNTER_LAST] = {
+    "rows-scanned",
+    "index-probes",
+    "strings-interned",
+    "iconv-conversions",
+    "stream-bytes-read",
+    "stream-bytes-written",
+};
+
+typedef struct
+{
+    const char *name;
+    int64_t start;
+    int64_t duration;
+    unsigned tid;
+} MsiSpan;
+
+typedef struct
+{
+    uint64_t count;
+    int64_t total;
+    int64_t max;
+} MsiSpanTotal;
+
+typedef struct
+{
+    uint64_t read;
+    uint64_t written;
+} MsiStreamBytes;
+
+static GMutex profile_lock;
+static GPrivate profile_tid;
+static unsigned profile_threads;
+static char *profile_path;
+static int64_t profile_epoch;
+static GArray *profile_spans;       /* MsiSpan, for traces */
+static GHashTable *profile_totals;  /* name -> MsiSpanTotal, for summaries */
+static GHashTable *profile_streams; /* name -> MsiStreamBytes */
+
+static unsigned profile_thread_id( void )
+{
+    unsigned tid = GPOINTER_TO_UINT( g_private_get( &profile_tid ) );
+
+    if (!tid)
+    {
+        tid = __sync_add_and_fetch( &profile_threads, 1 );
+        g_private_set( &profile_tid, GUINT_TO_POINTER( tid ) );
+    }
+    return tid;
+}
+
+G_GNUC_INTERNAL
+void msi_profile_span( const char *name, int64_t start )
+{
+    int64_t duration = g_get_monotonic_time() - start;
+    MsiSpanTotal *total;
+    MsiSpan span;
+
+    g_mutex_lock( &profile_lock );
+    if (msi_profile_mode == MSI_PROFILE_TRACE)
+    {
+        span.name = name;
+        span.start = start - profile_epoch;
+        span.duration = duration;
+        span.tid = profile_thread_id();
+        g_array_append_val( profile_spans, span );
+    }
+    else
+    {
+        total = g_hash_table_lookup( profile_totals, name );
+        if (!total)
+        {
+            total = g_new0( MsiSpanTotal, 1 );
+            g_hash_table_insert( profile_totals, (char *)name, total );
+        }
+        total->count++;
+        total->total += duration;
+        total->max = MAX( total->max, duration );
+    }
+    g_mutex_unlock( &profile_lock );
+}
+
+G_GNUC_INTERNAL
+void msi_profile_stream( const char *name, uint64_t read, uint64_t written )
+{
+    MsiStreamBytes *bytes;
+
+    msi_count( MSI_COUNTER_STREAM_BYTES_READ, read );
+    msi_count( MSI_COUNTER_STREAM_BYTES_WRITTEN, written );
+
+    g_mutex_lock( &profile_lock );
+    bytes = g_hash_table_lookup( profile_streams, name );
+    if (!bytes)
+    {
+        bytes = g_new0( MsiStreamBytes, 1 );
+        g_hash_table_insert( profile_streams, g_strdup( name ), bytes );
+    }
+    bytes->read += read;
+    bytes->written += written;
+    g_mutex_unlock( &profile_lock );
+}
+
+static gint compare_names( gconstpointer a, gconstpointer b )
+{
+    return strcmp( *(const char **)a, *(const char **)b );
+}
+
+/* the keys of a hash table, sorted, so that the output is stable */
+static GPtrArray *sorted_keys( GHashTable *table )
+{
+    GHashTableIter iter;
+    GPtrArray *keys;
+    gpointer key;
+
+    keys = g_ptr_array_new();
+    g_hash_table_iter_init( &iter, table );
+    while (g_hash_table_iter_next( &iter, &key, NULL ))
+        g_ptr_array_add( keys, key );
+    g_ptr_array_sort( keys, compare_names );
+    return keys;
+}
+
+static void profile_write_summary( FILE *out )
+{
+    MsiStreamBytes *bytes;
+    MsiSpanTotal *total;
+    GPtrArray *keys;
+    unsigned i;
+
+    fprintf( out, "libmsi profile\n\n" );
+    for (i = 0; i < MSI_COUNTER_LAST; i++)
+        fprintf( out, "%-24s %16" G_GUINT64_FORMAT "\n", counter_names[i], msi_counters[i] );
+
+    fprintf( out, "\n%-24s %8s %12s %12s\n", "span", "count", "total ms", "max ms" );
+    keys = sorted_keys( profile_totals );
+    for (i = 0; i < keys->len; i++)
+    {
+        total = g_hash_table_lookup( profile_totals, keys->pdata[i] );
+        fprintf( out, "%-24s %8" G_GUINT64_FORMAT " %12.3f %12.3f\n", (char *)keys->pdata[i],
+                 total->count, total->total / 1000.0, total->max / 1000.0 );
+    }
+    g_ptr_array_free( keys, TRUE );
+
+    fprintf( out, "\n%-24s %16s %16s\n", "stream", "read", "written" );
+    keys = sorted_keys( profile_streams );
+    for (i = 0; i < keys->len; i++)
+    {
+        char *name = g_strescape( keys->pdata[i], NULL );
+
+        bytes = g_hash_table_lookup( profile_streams, keys->pdata[i] );
+        fprintf( out, "%-24s %16" G_GUINT64_FORMAT " %16" G_GUINT64_FORMAT "\n",
+                 name, bytes->read, bytes->written );
+        g_free( name );
+    }
+    g_ptr_array_free( keys, TRUE );
+}
+
+static void profile_write_json_string( FILE *out, const char *str )
+{
+    fputc( '"', out );
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fprintf( out, "\\%c", *str );
+        else if ((unsigned char)*str < 0x20)
+            fprintf( out, "\\u%04x", *str );
+        else
+            fputc( *str, out );
+    }
+    fputc( '"', out );
+}
+
+/* the Trace Event Format: complete events for the spans, then the
+ * counters and the bytes of each stream as counter events */
+static void profile_write_trace( FILE *out )
+{
+    int64_t now = g_get_monotonic_time() - profile_epoch;
+    int pid = getpid();
+    MsiStreamBytes *bytes;
+    MsiSpan *span;
+    GPtrArray *keys;
+    unsigned i;
+
+    fprintf( out, "{\"traceEvents\":[\n" );
+    for (i = 0; i < profile_spans->len; i++)
+    {
+        span = &g_array_index( profile_spans, MsiSpan, i );
+        fprintf( out, "{\"name\":\"%s\",\"cat\":\"libmsi\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT
+                 ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u},\n",
+                 span->name, span->start, span->duration, pid, span->tid );
+    }
+
+    fprintf( out, "{\"name\":\"counters\",\"cat\":\"libmsi\",\"ph\":\"C\",\"ts\":%"
+             G_GINT64_FORMAT ",\"pid\":%d,\"args\":{", now, pid );
+    for (i = 0; i < MSI_COUNTER_LAST; i++)
+        fprintf( out, "%s\"%s\":%" G_GUINT64_FORMAT, i ? "," : "",
+                 counter_names[i], msi_counters[i] );
+    fprintf( out, "}}" );
+
+    keys = sorted_keys( profile_streams );
+    for (i = 0; i < keys->len; i++)
+    {
+        bytes = g_hash_table_lookup( profile_streams, keys->pdata[i] );
+        fprintf( out, ",\n{\"name\":" );
+        profile_write_json_string( out, keys->pdata[i] );
+        fprintf( out, ",\"cat\":\"libmsi.stream\",\"ph\":\"C\",\"ts\":%" G_GINT64_FORMAT
+                 ",\"pid\":%d,\"args\":{\"read\":%" G_GUINT64_FORMAT ",\"written\":%"
+                 G_GUINT64_FORMAT "}}", now, pid, bytes->read, bytes->written );
+    }
+    g_ptr_array_free( keys, TRUE );
+
+    fprintf( out, "\n]}\n" );
+}
+
+static void profile_dump( void )
+{
+    FILE *out = stderr;
+
+    g_mutex_lock( &profile_lock );
+    if (profile_path)
+    {
+        out = fopen( profile_path, "w" );
+        if (!out)
+        {
+            g_warning( "cannot write the libmsi profile to %s", profile_path );
+            g_mutex_unlock( &profile_lock );
+            return;
+        }
+    }
+
+    if (msi_profile_mode == MSI_PROFILE_TRACE)
+        profile_write_trace( out );
+    else
+        profile_write_summary( out );
+
+    if (out != stderr)
+        fclose( out );
+    g_mutex_unlock( &profile_lock );
+}
+
+/* called once, when the first database is created */
+G_GNUC_INTERNAL
+void msi_profile_init( void )
+{
+    const char *env = g_getenv( "LIBMSI_PROFILE" );
+    MsiProfileMode mode;
+    const char *path;
+
+    if (!env || !*env)
+        return;
+
+    if (g_str_has_prefix( env, "summary" ))
+        mode = MSI_PROFILE_SUMMARY;
+    else if (g_str_has_prefix( env, "trace" ))
+        mode = MSI_PROFILE_TRACE;
+    else
+    {
+        g_warning( "unknown LIBMSI_PROFILE mode: %s", env );
+        return;
+    }
+
+    path = strchr( env, ':' );
+    if (path && path[1])
+        profile_path = g_strdup( path + 1 );
+    else if (mode == MSI_PROFILE_TRACE)
+        profile_path = g_strdup_printf( "libmsi-trace-%d.json", (int)getpid() );
+
+    profile_epoch = g_get_monotonic_time();
+    profile_spans = g_array_new( FALSE, FALSE, sizeof(MsiSpan) );
+    profile_totals = g_hash_table_new_full( g_str_hash, g_str_equal, NULL, g_free );
+    profile_streams = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+    atexit( profile_dump );
+
+    msi_profile_mode = mode;
+}
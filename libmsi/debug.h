@@ -98,6 +98,68 @@ static inline const char *debugstr_a( const char *s )  { return wine_dbgstr_an(
   }                                             \
 }G_STMT_END
 
+/*
+ * Runtime counters and timing spans, for profiling without a debugger.
+ * They are enabled by the LIBMSI_PROFILE environment variable:
+ *
+ *   LIBMSI_PROFILE=summary[:FILE]  totals, on stderr or in FILE
+ *   LIBMSI_PROFILE=trace[:FILE]    a Chrome trace (chrome://tracing), in
+ *                                  FILE or libmsi-trace-PID.json
+ *
+ * The output is written when the process exits.  When profiling is off,
+ * each counter or span costs a test of msi_profile_mode.
+ */
+
+typedef enum
+{
+    MSI_PROFILE_OFF,
+    MSI_PROFILE_SUMMARY,
+    MSI_PROFILE_TRACE,
+} MsiProfileMode;
+
+typedef enum
+{
+    MSI_COUNTER_ROWS_SCANNED,
+    MSI_COUNTER_INDEX_PROBES,
+    MSI_COUNTER_STRINGS_INTERNED,
+    MSI_COUNTER_ICONV,
+    MSI_COUNTER_STREAM_BYTES_READ,
+    MSI_COUNTER_STREAM_BYTES_WRITTEN,
+    MSI_COUNTER_LAST
+} MsiCounter;
+
+extern MsiProfileMode msi_profile_mode;
+extern uint64_t msi_counters[MSI_COUNTER_LAST];
+
+void msi_profile_init( void );
+void msi_profile_span( const char *name, int64_t start );
+void msi_profile_stream( const char *name, uint64_t read, uint64_t written );
+
+static inline void msi_count( MsiCounter counter, uint64_t n )
+{
+    if (G_UNLIKELY(msi_profile_mode))
+        __sync_add_and_fetch( &msi_counters[counter], n );
+}
+
+static inline int64_t msi_span_begin( void )
+{
+    return G_UNLIKELY(msi_profile_mode) ? g_get_monotonic_time() : 0;
+}
+
+/* name must be a string constant */
+static inline void msi_span_end( const char *name, int64_t start )
+{
+    if (G_UNLIKELY(msi_profile_mode))
+        msi_profile_span( name, start );
+}
+
+/* bytes read from or written to a stream, by its decoded name */
+static inline void msi_count_stream( const char *name, uint64_t read, uint64_t written )
+{
+    if (G_UNLIKELY(msi_profile_mode))
+        msi_profile_stream( name, read, written );
+}
+
 G_END_DECLS
 
 #endif  /* __WINE_WINE_DEBUG_H */
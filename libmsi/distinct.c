@@ -43,6 +43,8 @@ typedef struct _LibmsiDistinctView
     LibmsiView       *table;
     unsigned           row_count;
     unsigned          *translation;
+    unsigned           limit;
+    unsigned           offset;
 } LibmsiDistinctView;
 
 static LibmsiDistinctSet ** distinct_insert( LibmsiDistinctSet **x, unsigned val, unsigned row )
@@ -102,14 +104,16 @@ static unsigned distinct_view_fetch_int( LibmsiView *view, unsigned row, unsigne
 static unsigned distinct_view_execute( LibmsiView *view, LibmsiRecord *record )
 {
     LibmsiDistinctView *dv = (LibmsiDistinctView*)view;
-    unsigned r, i, j, r_count, c_count;
+    unsigned r, i, j, r_count, c_count, max_rows;
     LibmsiDistinctSet *rowset = NULL;
+    int64_t start = msi_view_profile_begin( view );
 
     TRACE("%p %p\n", dv, record);
 
     if( !dv->table )
          return LIBMSI_RESULT_FUNCTION_FAILED;
 
+    msi_view_profile_child( view, dv->table );
     r = dv->table->ops->execute( dv->table, record );
     if( r != LIBMSI_RESULT_SUCCESS )
         return r;
@@ -122,8 +126,10 @@ static unsigned distinct_view_execute( LibmsiView *view, LibmsiRecord *record )
     if( !dv->translation )
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
+    max_rows = dv->limit > G_MAXUINT - dv->offset ? G_MAXUINT : dv->offset + dv->limit;
+
     /* build it */
-    for( i=0; i<r_count; i++ )
+    for( i=0; i<r_count && dv->row_count < max_rows; i++ )
     {
         LibmsiDistinctSet **x = &rowset;
 
@@ -158,6 +164,18 @@ static unsigned distinct_view_execute( LibmsiView *view, LibmsiRecord *record )
 
     distinct_free( rowset );
 
+    /* LIMIT and OFFSET count distinct rows */
+    if( dv->offset )
+    {
+        unsigned skip = MIN( dv->offset, dv->row_count );
+
+        memmove( dv->translation, dv->translation + skip,
+                 (dv->row_count - skip) * sizeof(unsigned) );
+        dv->row_count -= skip;
+    }
+
+    msi_view_profile_end( view, start, r_count, dv->row_count );
+
     return LIBMSI_RESULT_SUCCESS;
 }
 
@@ -247,6 +265,35 @@ static unsigned distinct_view_find_matching_rows( LibmsiView *view, unsigned col
     return r;
 }
 
+static unsigned distinct_view_explain( LibmsiView *view, GString *str, unsigned depth )
+{
+    LibmsiDistinctView *dv = (LibmsiDistinctView*)view;
+
+    TRACE("%p %p %u\n", view, str, depth);
+
+    if( !dv->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    g_string_append_printf( str, "%*sDISTINCT", depth * 2, "" );
+    if( dv->limit != NO_LIMIT )
+        g_string_append_printf( str, " LIMIT %u", dv->limit );
+    if( dv->offset )
+        g_string_append_printf( str, " OFFSET %u", dv->offset );
+    msi_view_explain_end( view, str );
+
+    return msi_view_explain( dv->table, str, depth + 1 );
+}
+
+static unsigned distinct_view_limit( LibmsiView *view, unsigned limit, unsigned offset )
+{
+    LibmsiDistinctView *dv = (LibmsiDistinctView*)view;
+
+    TRACE("%p %u %u\n", view, limit, offset);
+
+    msi_narrow_limit( &dv->limit, &dv->offset, limit, offset );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
 static const LibmsiViewOps distinct_ops =
 {
     distinct_view_fetch_int,
@@ -267,6 +314,8 @@ static const LibmsiViewOps distinct_ops =
     NULL,
     NULL,
     NULL,
+    distinct_view_explain,
+    distinct_view_limit,
 };
 
 unsigned distinct_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table )
@@ -293,6 +342,7 @@ unsigned distinct_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView
     dv->table = table;
     dv->translation = NULL;
     dv->row_count = 0;
+    dv->limit = NO_LIMIT;
     *view = (LibmsiView*) dv;
 
     return LIBMSI_RESULT_SUCCESS;
@@ -0,0 +1,261 @@
+/*
+ * Implementation of the Microsoft Installer (msi.dll)
+ *
+ * Copyright (C) 2026 msitools contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+
+#include "debug.h"
+#include "libmsi.h"
+#include "msipriv.h"
+
+#include "query.h"
+
+
+/* EXPLAIN returns the plan of a query, one row per line of text; the
+ * lines are kept out of the string table of the database */
+typedef struct _LibmsiExplainView
+{
+    LibmsiView        view;
+    LibmsiDatabase   *db;
+    LibmsiView       *table;
+    GPtrArray        *lines;
+} LibmsiExplainView;
+
+static unsigned explain_view_num_rows( LibmsiExplainView *ev )
+{
+    return ev->lines ? ev->lines->len : 0;
+}
+
+/* only lines that are in the string table anyway have an id */
+static unsigned explain_view_fetch_int( LibmsiView *view, unsigned row, unsigned col, unsigned *val )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+
+    TRACE("%p %d %d %p\n", ev, row, col, val );
+
+    if( col != 1 )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    if( row >= explain_view_num_rows( ev ) )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    return _libmsi_id_from_string_utf8( ev->db->strings,
+                                        g_ptr_array_index( ev->lines, row ), val );
+}
+
+static unsigned explain_view_get_row( LibmsiView *view, unsigned row, LibmsiRecord **rec )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+
+    TRACE("%p %d %p\n", ev, row, rec);
+
+    if( row >= explain_view_num_rows( ev ) )
+        return NO_MORE_ITEMS;
+
+    *rec = libmsi_record_new( 1 );
+    if( !*rec )
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    libmsi_record_set_string( *rec, 1, g_ptr_array_index( ev->lines, row ) );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned explain_view_execute( LibmsiView *view, LibmsiRecord *record )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+    GString *str;
+    char **lines;
+    unsigned r, i;
+
+    TRACE("%p %p\n", ev, record);
+
+    if( !ev->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    str = g_string_new( NULL );
+    r = msi_view_explain( ev->table, str, 0 );
+    if( r != LIBMSI_RESULT_SUCCESS )
+    {
+        g_string_free( str, TRUE );
+        return r;
+    }
+
+    /* the plan ends with a newline, which does not start another row */
+    if( str->len && str->str[str->len - 1] == '\n' )
+        g_string_truncate( str, str->len - 1 );
+
+    lines = g_strsplit( str->str, "\n", -1 );
+    g_string_free( str, TRUE );
+
+    if( ev->lines )
+        g_ptr_array_free( ev->lines, TRUE );
+    ev->lines = g_ptr_array_new_with_free_func( g_free );
+    for( i = 0; lines[i]; i++ )
+        g_ptr_array_add( ev->lines, lines[i] );
+
+    g_free( lines );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned explain_view_close( LibmsiView *view )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+
+    TRACE("%p\n", ev );
+
+    if( ev->lines )
+        g_ptr_array_free( ev->lines, TRUE );
+    ev->lines = NULL;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned explain_view_get_dimensions( LibmsiView *view, unsigned *rows, unsigned *cols )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+
+    TRACE("%p %p %p\n", ev, rows, cols );
+
+    if( rows ) *rows = explain_view_num_rows( ev );
+    if( cols ) *cols = 1;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned explain_view_get_column_info( LibmsiView *view, unsigned n, const char **name,
+                                      unsigned *type, bool *temporary, const char **table_name )
+{
+    TRACE("%p %d %p %p %p %p\n", view, n, name, type, temporary, table_name );
+
+    if( n != 1 )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    if( name ) *name = "Plan";
+    if( type ) *type = MSITYPE_STRING | MSITYPE_VALID | MSITYPE_NULLABLE;
+    if( temporary ) *temporary = true;
+    if( table_name ) *table_name = szEmpty;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned explain_view_delete( LibmsiView *view )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+
+    TRACE("%p\n", ev );
+
+    if( ev->table )
+        ev->table->ops->delete( ev->table );
+
+    if( ev->lines )
+        g_ptr_array_free( ev->lines, TRUE );
+    g_object_unref(ev->db);
+    msi_free( ev );
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned explain_view_find_matching_rows( LibmsiView *view, unsigned col,
+    unsigned val, unsigned *row, MSIITERHANDLE *handle )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+    unsigned index = (uintptr_t)*handle, num_rows = explain_view_num_rows( ev );
+    const char *str;
+
+    TRACE("%p, %d, %u, %p\n", view, col, val, *handle);
+
+    if( col != 1 )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    str = msi_string_lookup_id( ev->db->strings, val );
+    if( !str )
+        return NO_MORE_ITEMS;
+
+    while( index < num_rows )
+    {
+        if( !strcmp( g_ptr_array_index( ev->lines, index ), str ) )
+        {
+            *row = index;
+            break;
+        }
+        index++;
+    }
+
+    *handle = (MSIITERHANDLE)(uintptr_t)++index;
+    if( index > num_rows )
+        return NO_MORE_ITEMS;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned explain_view_explain( LibmsiView *view, GString *str, unsigned depth )
+{
+    LibmsiExplainView *ev = (LibmsiExplainView*)view;
+
+    TRACE("%p %p %u\n", view, str, depth);
+
+    if( !ev->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    g_string_append_printf( str, "%*sEXPLAIN", depth * 2, "" );
+    msi_view_explain_end( view, str );
+
+    return msi_view_explain( ev->table, str, depth + 1 );
+}
+
+static const LibmsiViewOps explain_ops =
+{
+    explain_view_fetch_int,
+    NULL,
+    explain_view_get_row,
+    NULL,
+    NULL,
+    NULL,
+    explain_view_execute,
+    explain_view_close,
+    explain_view_get_dimensions,
+    explain_view_get_column_info,
+    explain_view_delete,
+    explain_view_find_matching_rows,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    explain_view_explain,
+};
+
+unsigned explain_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table )
+{
+    LibmsiExplainView *ev;
+
+    TRACE("%p %p\n", db, table );
+
+    ev = msi_alloc_zero( sizeof *ev );
+    if( !ev )
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    ev->view.ops = &explain_ops;
+    ev->db = g_object_ref(db);
+    ev->table = table;
+    *view = (LibmsiView*) ev;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
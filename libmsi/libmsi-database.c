@@ -20,9 +20,11 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include "libmsi-enums.h"
 #include "libmsi-database.h"
@@ -32,6 +34,10 @@
 #include "msipriv.h"
 #include "query.h"
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 enum
 {
     PROP_0,
@@ -65,16 +71,31 @@ typedef struct _LibmsiTransform {
     GsfInfile *stg;
 } LibmsiTransform;
 
+/* a row of the _Streams or _Storages table */
+typedef struct _LibmsiCatalogRow {
+    unsigned str_index;
+    unsigned row;
+} LibmsiCatalogRow;
+
+/* the rows of the _Streams or _Storages table, built when first queried
+ * and then kept in step with the entries of the database */
+struct _LibmsiCatalog {
+    GPtrArray *rows;
+    GHashTable *by_name;
+};
+
 typedef struct _LibmsiStorage {
     struct list entry;
     char *name;
     GsfInfile *stg;
+    LibmsiCatalogRow cat;
 } LibmsiStorage;
 
 typedef struct _LibmsiStream {
     struct list entry;
     char *name;
     GsfInput *stm;
+    LibmsiCatalogRow cat;
 } LibmsiStream;
 
 GQuark
@@ -96,6 +117,8 @@ libmsi_database_init (LibmsiDatabase *self)
     list_init (&self->transforms);
     list_init (&self->streams);
     list_init (&self->storages);
+    self->stream_index = g_hash_table_new (g_str_hash, g_str_equal);
+    self->storage_index = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
 static void
@@ -125,6 +148,8 @@ libmsi_database_finalize (GObject *object)
     _libmsi_database_close (self, false);
     free_cached_tables (self);
     free_transforms (self);
+    g_hash_table_destroy (self->stream_index);
+    g_hash_table_destroy (self->storage_index);
 
     g_free (self->path);
 
@@ -187,6 +212,8 @@ libmsi_database_class_init (LibmsiDatabaseClass *klass)
     object_class->get_property = libmsi_database_get_property;
     object_class->constructed = libmsi_database_constructed;
 
+    msi_profile_init ();
+
     g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_PATH,
         g_param_spec_string ("path", "path", "path", NULL,
                              G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
@@ -203,19 +230,103 @@ libmsi_database_class_init (LibmsiDatabaseClass *klass)
                              G_PARAM_STATIC_STRINGS));
 }
 
+static LibmsiCatalog *catalog_new( void )
+{
+    LibmsiCatalog *cat = msi_alloc( sizeof *cat );
+
+    cat->rows = g_ptr_array_new();
+    cat->by_name = g_hash_table_new( NULL, NULL );
+    return cat;
+}
+
+static void catalog_free( LibmsiCatalog *cat )
+{
+    if (!cat)
+        return;
+
+    g_ptr_array_free( cat->rows, TRUE );
+    g_hash_table_destroy( cat->by_name );
+    msi_free( cat );
+}
+
+static void catalog_add( LibmsiDatabase *db, LibmsiCatalog *cat,
+                         LibmsiCatalogRow *row, const char *name )
+{
+    row->str_index = _libmsi_add_string( db->strings, name, -1, 1, StringNonPersistent );
+    row->row = cat->rows->len;
+    g_ptr_array_add( cat->rows, row );
+    g_hash_table_insert( cat->by_name, GUINT_TO_POINTER(row->str_index), row );
+}
+
+static void catalog_remove( LibmsiCatalog *cat, LibmsiCatalogRow *row )
+{
+    unsigned i;
+
+    g_ptr_array_remove_index( cat->rows, row->row );
+    for (i = row->row; i < cat->rows->len; i++)
+        ((LibmsiCatalogRow *)g_ptr_array_index( cat->rows, i ))->row = i;
+
+    if (g_hash_table_lookup( cat->by_name, GUINT_TO_POINTER(row->str_index) ) == row)
+        g_hash_table_remove( cat->by_name, GUINT_TO_POINTER(row->str_index) );
+}
+
+static unsigned catalog_find( LibmsiCatalog *cat, unsigned name, unsigned *row )
+{
+    LibmsiCatalogRow *found;
+
+    found = g_hash_table_lookup( cat->by_name, GUINT_TO_POINTER(name) );
+    if (!found)
+        return NO_MORE_ITEMS;
+
+    *row = found->row;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static void catalog_add_stream( LibmsiDatabase *db, LibmsiStream *stream )
+{
+    g_autofree char *decoded = decode_streamname( stream->name );
+
+    TRACE("stream -> %s %s\n", debugstr_a(stream->name), debugstr_a(decoded));
+    catalog_add( db, db->stream_catalog, &stream->cat, decoded );
+}
+
+/* the lists keep the order of the entries, which are found through the
+ * indexes; both hold every entry */
+static void add_storage( LibmsiDatabase *db, LibmsiStorage *storage )
+{
+    list_add_tail( &db->storages, &storage->entry );
+    g_hash_table_insert( db->storage_index, storage->name, storage );
+    if (db->storage_catalog)
+        catalog_add( db, db->storage_catalog, &storage->cat, storage->name );
+}
+
+static void free_storage( LibmsiDatabase *db, LibmsiStorage *storage )
+{
+    list_remove( &storage->entry );
+    if (g_hash_table_lookup( db->storage_index, storage->name ) == storage)
+        g_hash_table_remove( db->storage_index, storage->name );
+    if (db->storage_catalog)
+        catalog_remove( db->storage_catalog, &storage->cat );
+    g_object_unref(G_OBJECT(storage->stg));
+    msi_free( storage->name );
+    msi_free( storage );
+}
+
+static LibmsiStorage *find_storage( LibmsiDatabase *db, const char *name )
+{
+    return g_hash_table_lookup( db->storage_index, name );
+}
+
 unsigned msi_open_storage( LibmsiDatabase *db, const char *stname )
 {
     unsigned r = LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
     LibmsiStorage *storage;
     GsfInput *in;
 
-    LIST_FOR_EACH_ENTRY( storage, &db->storages, LibmsiStorage, entry )
+    if (find_storage( db, stname ))
     {
-        if( !strcmp( stname, storage->name ) )
-        {
-            TRACE("found %s\n", debugstr_a(stname));
-            return r;
-        }
+        TRACE("found %s\n", debugstr_a(stname));
+        return r;
     }
 
     if (!(storage = msi_alloc_zero( sizeof(LibmsiStorage) ))) return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
@@ -231,7 +342,7 @@ unsigned msi_open_storage( LibmsiDatabase *db, const char *stname )
     if (!storage->stg)
         goto done;
 
-    list_add_tail( &db->storages, &storage->entry );
+    add_storage( db, storage );
     r = LIBMSI_RESULT_SUCCESS;
 
 done:
@@ -248,19 +359,16 @@ unsigned msi_create_storage( LibmsiDatabase *db, const char *stname, GsfInput *s
     LibmsiStorage *storage;
     GsfInfile *origstg = NULL;
     bool found = false;
-    unsigned r;
+    unsigned r = LIBMSI_RESULT_FUNCTION_FAILED;
 
     if (db->flags & LIBMSI_DB_FLAGS_READONLY)
         return LIBMSI_RESULT_ACCESS_DENIED;
 
-    LIST_FOR_EACH_ENTRY( storage, &db->storages, LibmsiStorage, entry )
+    storage = find_storage( db, stname );
+    if (storage)
     {
-        if( !strcmp( stname, storage->name ) )
-        {
-            TRACE("found %s\n", debugstr_a(stname));
-            found = true;
-            break;
-        }
+        TRACE("found %s\n", debugstr_a(stname));
+        found = true;
     }
 
     if (!found) {
@@ -281,7 +389,7 @@ unsigned msi_create_storage( LibmsiDatabase *db, const char *stname, GsfInput *s
         if (storage->stg)
             g_object_unref(G_OBJECT(storage->stg));
     } else {
-        list_add_tail( &db->storages, &storage->entry );
+        add_storage( db, storage );
     }
 
     storage->stg = origstg;
@@ -305,37 +413,42 @@ done:
 
 void msi_destroy_storage( LibmsiDatabase *db, const char *stname )
 {
-    LibmsiStorage *storage, *storage2;
+    LibmsiStorage *storage = find_storage( db, stname );
 
-    LIST_FOR_EACH_ENTRY_SAFE( storage, storage2, &db->storages, LibmsiStorage, entry )
+    if (storage)
     {
-        if (!strcmp( stname, storage->name ))
-        {
-            TRACE("destroying %s\n", debugstr_a(stname));
-
-            list_remove( &storage->entry );
-            g_object_unref(G_OBJECT(storage->stg));
-            msi_free( storage );
-            break;
-        }
+        TRACE("destroying %s\n", debugstr_a(stname));
+        free_storage( db, storage );
     }
 }
 
+static void free_stream( LibmsiDatabase *db, LibmsiStream *stream )
+{
+    list_remove( &stream->entry );
+    if (g_hash_table_lookup( db->stream_index, stream->name ) == stream)
+        g_hash_table_remove( db->stream_index, stream->name );
+    if (db->stream_catalog)
+        catalog_remove( db->stream_catalog, &stream->cat );
+    g_object_unref(G_OBJECT(stream->stm));
+    msi_free( stream->name );
+    msi_free( stream );
+}
+
+static LibmsiStream *find_stream( LibmsiDatabase *db, const char *name )
+{
+    return g_hash_table_lookup( db->stream_index, name );
+}
+
 static unsigned find_infile_stream( LibmsiDatabase *db, const char *name, GsfInput **stm )
 {
-    LibmsiStream *stream;
+    LibmsiStream *stream = find_stream( db, name );
 
-    LIST_FOR_EACH_ENTRY( stream, &db->streams, LibmsiStream, entry )
-    {
-        if( !strcmp( name, stream->name ) )
-        {
-            TRACE("found %s\n", debugstr_a(name));
-            *stm = stream->stm;
-            return LIBMSI_RESULT_SUCCESS;
-        }
-    }
+    if (!stream)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
 
-    return LIBMSI_RESULT_FUNCTION_FAILED;
+    TRACE("found %s\n", debugstr_a(name));
+    *stm = stream->stm;
+    return LIBMSI_RESULT_SUCCESS;
 }
 
 static unsigned msi_alloc_stream( LibmsiDatabase *db, const char *stname, GsfInput *stm)
@@ -345,40 +458,36 @@ static unsigned msi_alloc_stream( LibmsiDatabase *db, const char *stname, GsfInp
     TRACE("%p %s %p", db, debugstr_a(stname), stm);
     if (!(stream = msi_alloc( sizeof(LibmsiStream) ))) return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
     stream->name = strdup( stname );
+    if (!stream->name)
+    {
+        msi_free( stream );
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+    }
     stream->stm = stm;
     g_object_ref(G_OBJECT(stm));
     list_add_tail( &db->streams, &stream->entry );
+    g_hash_table_insert( db->stream_index, stream->name, stream );
+    if (db->stream_catalog)
+        catalog_add_stream( db, stream );
     return LIBMSI_RESULT_SUCCESS;
 }
 
+/* the stream takes data, which must come from g_malloc */
 unsigned write_raw_stream_data( LibmsiDatabase *db, const char *stname,
-                        const void *data, unsigned sz, GsfInput **outstm )
+                        void *data, unsigned sz, GsfInput **outstm )
 {
     unsigned ret = LIBMSI_RESULT_FUNCTION_FAILED;
     GsfInput *stm = NULL;
-    guint8 *mem;
-    LibmsiStream *stream;
 
     if (db->flags & LIBMSI_DB_FLAGS_READONLY)
-        return LIBMSI_RESULT_FUNCTION_FAILED;
-
-    LIST_FOR_EACH_ENTRY( stream, &db->streams, LibmsiStream, entry )
     {
-        if( !strcmp( stname, stream->name ) )
-        {
-            msi_destroy_stream( db, stname );
-            break;
-        }
-    }
-
-    mem = g_try_malloc(sz == 0 ? 1 : sz);
-    if (!mem)
+        g_free(data);
         return LIBMSI_RESULT_FUNCTION_FAILED;
+    }
 
-    if (data || sz)
-        memcpy(mem, data, sz);
+    msi_destroy_stream( db, stname );
 
-    stm = gsf_input_memory_new(mem, sz, true);
+    stm = gsf_input_memory_new(data, sz, true);
     ret = msi_alloc_stream( db, stname, stm);
     *outstm = stm;
     return ret;
@@ -389,23 +498,14 @@ unsigned msi_create_stream( LibmsiDatabase *db, const char *stname, GsfInput *st
     LibmsiStream *stream;
     char *encname = NULL;
     unsigned r = LIBMSI_RESULT_FUNCTION_FAILED;
-    bool found = false;
 
     if (db->flags & LIBMSI_DB_FLAGS_READONLY)
         return LIBMSI_RESULT_ACCESS_DENIED;
 
     encname = encode_streamname(false, stname);
 
-    LIST_FOR_EACH_ENTRY( stream, &db->streams, LibmsiStream, entry )
-    {
-        if( !strcmp( encname, stream->name ) )
-        {
-            found = true;
-            break;
-        }
-    }
-
-    if (found) {
+    stream = find_stream( db, encname );
+    if (stream) {
         if (stream->stm)
             g_object_unref(G_OBJECT(stream->stm));
         stream->stm = stm;
@@ -515,44 +615,103 @@ unsigned msi_get_raw_stream( LibmsiDatabase *db, const char *stname, GsfInput **
 
 void msi_destroy_stream( LibmsiDatabase *db, const char *stname )
 {
-    LibmsiStream *stream, *stream2;
+    LibmsiStream *stream = find_stream( db, stname );
 
-    LIST_FOR_EACH_ENTRY_SAFE( stream, stream2, &db->streams, LibmsiStream, entry )
+    if (stream)
     {
-        if (!strcmp( stname, stream->name ))
-        {
-            TRACE("destroying %s\n", debugstr_a(stname));
-
-            list_remove( &stream->entry );
-            g_object_unref(G_OBJECT(stream->stm));
-            msi_free( stream );
-            break;
-        }
+        TRACE("destroying %s\n", debugstr_a(stname));
+        free_stream( db, stream );
     }
 }
 
 static void free_storages( LibmsiDatabase *db )
 {
+    catalog_free( db->storage_catalog );
+    db->storage_catalog = NULL;
     while( !list_empty( &db->storages ) )
-    {
-        LibmsiStorage *s = LIST_ENTRY(list_head( &db->storages ), LibmsiStorage, entry);
-        list_remove( &s->entry );
-        g_object_unref(G_OBJECT(s->stg));
-        msi_free( s->name );
-        msi_free( s );
-    }
+        free_storage( db, LIST_ENTRY(list_head( &db->storages ), LibmsiStorage, entry) );
 }
 
 static void free_streams( LibmsiDatabase *db )
 {
+    catalog_free( db->stream_catalog );
+    db->stream_catalog = NULL;
     while( !list_empty( &db->streams ) )
+        free_stream( db, LIST_ENTRY(list_head( &db->streams ), LibmsiStream, entry) );
+}
+
+static LibmsiCatalog *stream_catalog( LibmsiDatabase *db )
+{
+    LibmsiStream *stream;
+
+    if (!db->stream_catalog)
+    {
+        db->stream_catalog = catalog_new();
+        LIST_FOR_EACH_ENTRY( stream, &db->streams, LibmsiStream, entry )
+            catalog_add_stream( db, stream );
+    }
+    return db->stream_catalog;
+}
+
+static LibmsiCatalog *storage_catalog( LibmsiDatabase *db )
+{
+    LibmsiStorage *storage;
+
+    if (!db->storage_catalog)
     {
-        LibmsiStream *s = LIST_ENTRY(list_head( &db->streams ), LibmsiStream, entry);
-        list_remove( &s->entry );
-        g_object_unref(G_OBJECT(s->stm));
-        msi_free( s->name );
-        msi_free( s );
+        db->storage_catalog = catalog_new();
+        LIST_FOR_EACH_ENTRY( storage, &db->storages, LibmsiStorage, entry )
+            catalog_add( db, db->storage_catalog, &storage->cat, storage->name );
     }
+    return db->storage_catalog;
+}
+
+unsigned msi_get_stream_rows( LibmsiDatabase *db )
+{
+    return stream_catalog( db )->rows->len;
+}
+
+unsigned msi_get_stream_row( LibmsiDatabase *db, unsigned row,
+                             unsigned *name, GsfInput **stm )
+{
+    LibmsiCatalog *cat = stream_catalog( db );
+    LibmsiStream *stream;
+
+    if (row >= cat->rows->len)
+        return NO_MORE_ITEMS;
+
+    stream = LIST_ENTRY( g_ptr_array_index( cat->rows, row ), LibmsiStream, cat );
+    if (name)
+        *name = stream->cat.str_index;
+    if (stm)
+        *stm = g_object_ref( stream->stm );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+unsigned msi_find_stream_row( LibmsiDatabase *db, unsigned name, unsigned *row )
+{
+    return catalog_find( stream_catalog( db ), name, row );
+}
+
+unsigned msi_get_storage_rows( LibmsiDatabase *db )
+{
+    return storage_catalog( db )->rows->len;
+}
+
+unsigned msi_get_storage_row( LibmsiDatabase *db, unsigned row, unsigned *name )
+{
+    LibmsiCatalog *cat = storage_catalog( db );
+
+    if (row >= cat->rows->len)
+        return NO_MORE_ITEMS;
+
+    *name = ((LibmsiCatalogRow *)g_ptr_array_index( cat->rows, row ))->str_index;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+unsigned msi_find_storage_row( LibmsiDatabase *db, unsigned name, unsigned *row )
+{
+    return catalog_find( storage_catalog( db ), name, row );
 }
 
 void append_storage_to_db( LibmsiDatabase *db, GsfInfile *stg )
@@ -678,87 +837,186 @@ end:
     return ret;
 }
 
-static char *msi_read_text_archive(const char *path, unsigned *len)
+/* reads a text archive a line at a time, without loading all of it */
+typedef struct
+{
+    FILE *file;
+    char *buf;
+    size_t size;
+    size_t start;
+    size_t end;
+    bool eof;
+    char **fields;
+    unsigned max_fields;
+} IDTREADER;
+
+#define IDT_BUFFER_SIZE 0x10000
+
+static unsigned idt_reader_open(IDTREADER *rd, const char *path)
 {
-    char *data;
-    size_t nread;
+    memset(rd, 0, sizeof *rd);
 
-    if (!g_file_get_contents(path, &data, &nread, NULL))
-        return NULL;
+    rd->file = g_fopen(path, "rb");
+    if (!rd->file)
+        return LIBMSI_RESULT_OPEN_FAILED;
+
+    rd->size = IDT_BUFFER_SIZE;
+    rd->buf = msi_alloc(rd->size);
+    rd->max_fields = 64;
+    rd->fields = msi_alloc(rd->max_fields * sizeof(char *));
+    if (!rd->buf || !rd->fields)
+        return LIBMSI_RESULT_OUTOFMEMORY;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
 
-    while (!data[nread - 1]) nread--;
-    *len = nread;
-    return data;
+static void idt_reader_close(IDTREADER *rd)
+{
+    if (rd->file)
+        fclose(rd->file);
+    msi_free(rd->buf);
+    msi_free(rd->fields);
 }
 
-static void msi_parse_line(char **line, char ***entries, unsigned *num_entries, unsigned *len)
+/* read more of the file after the unparsed data, doubling the buffer
+ * when a line does not fit in it */
+static unsigned idt_reader_fill(IDTREADER *rd)
 {
-    char *ptr = *line;
-    char *save;
-    unsigned i, count = 1, chars_left = *len;
+    size_t n;
+    char *p;
 
-    *entries = NULL;
+    if (rd->start)
+    {
+        memmove(rd->buf, rd->buf + rd->start, rd->end - rd->start);
+        rd->end -= rd->start;
+        rd->start = 0;
+    }
 
-    /* stay on this line */
-    while (chars_left && *ptr != '\n')
+    /* keep a byte to terminate the last line */
+    if (rd->end + 1 >= rd->size)
     {
-        /* entries are separated by tabs */
-        if (*ptr == '\t')
-            count++;
+        p = msi_realloc(rd->buf, rd->size * 2);
+        if (!p)
+            return LIBMSI_RESULT_OUTOFMEMORY;
+        rd->buf = p;
+        rd->size *= 2;
+    }
+
+    n = fread(rd->buf + rd->end, 1, rd->size - rd->end - 1, rd->file);
+    if (!n)
+    {
+        if (ferror(rd->file))
+            return LIBMSI_RESULT_FUNCTION_FAILED;
 
-        ptr++;
-        chars_left--;
+        /* the file may be padded with nulls */
+        rd->eof = true;
+        while (rd->end > rd->start && !rd->buf[rd->end - 1])
+            rd->end--;
     }
+    rd->end += n;
 
-    *entries = msi_alloc(count * sizeof(char *));
-    if (!*entries)
-        return;
+    return LIBMSI_RESULT_SUCCESS;
+}
 
-    /* store pointers into the data */
-    chars_left = *len;
-    for (i = 0, ptr = *line; i < count; i++)
+/*
+ * Split the next line in tab separated fields, which stay valid until the
+ * next call.  Blank lines are skipped, a carriage return ends a field,
+ * embedded nulls are converted to \n and \x11\x19 to \r\n.
+ */
+static unsigned idt_read_line(IDTREADER *rd, char ***fields, unsigned *num_fields)
+{
+    char *ptr, *lim, *save, *nl = NULL, **p;
+    unsigned r, i, count;
+
+    for (;;)
     {
-        while (chars_left && *ptr == '\r')
+        while (rd->start < rd->end &&
+               (rd->buf[rd->start] == '\n' || rd->buf[rd->start] == '\r'))
+            rd->start++;
+
+        if (rd->start < rd->end)
         {
-            ptr++;
-            chars_left--;
+            nl = memchr(rd->buf + rd->start, '\n', rd->end - rd->start);
+            if (nl || rd->eof)
+                break;
         }
+        else if (rd->eof)
+            return NO_MORE_ITEMS;
+
+        r = idt_reader_fill(rd);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    /* there's a field more than there are tabs */
+    ptr = rd->buf + rd->start;
+    lim = nl ? nl : rd->buf + rd->end;
+    for (count = 1; ptr < lim; ptr++)
+        if (*ptr == '\t')
+            count++;
+
+    if (count > rd->max_fields)
+    {
+        p = msi_realloc(rd->fields, MAX(count, rd->max_fields * 2) * sizeof(char *));
+        if (!p)
+            return LIBMSI_RESULT_OUTOFMEMORY;
+        rd->fields = p;
+        rd->max_fields = MAX(count, rd->max_fields * 2);
+    }
+
+    ptr = rd->buf + rd->start;
+    for (i = 0; i < count; i++)
+    {
+        while (ptr < lim && *ptr == '\r')
+            ptr++;
         save = ptr;
 
-        while (chars_left && *ptr != '\t' && *ptr != '\n' && *ptr != '\r')
+        while (ptr < lim && *ptr != '\t' && *ptr != '\r')
         {
-            if (!*ptr) *ptr = '\n'; /* convert embedded nulls to \n */
-            if (ptr > *line && *ptr == '\x19' && *(ptr - 1) == '\x11')
+            if (!*ptr)
+                *ptr = '\n';
+            if (ptr > save && *ptr == '\x19' && ptr[-1] == '\x11')
             {
+                ptr[-1] = '\r';
                 *ptr = '\n';
-                *(ptr - 1) = '\r';
             }
             ptr++;
-            chars_left--;
         }
 
-        /* NULL-separate the data */
-        if (*ptr == '\n' || *ptr == '\r')
+        if (ptr < lim && *ptr == '\r')
         {
-            while (chars_left && (*ptr == '\n' || *ptr == '\r'))
-            {
+            while (ptr < lim && *ptr == '\r')
                 *(ptr++) = 0;
-                chars_left--;
-            }
         }
-        else if (*ptr)
-        {
+        else if (ptr < lim)
             *(ptr++) = 0;
-            chars_left--;
-        }
-        (*entries)[i] = save;
+        else
+            *lim = 0;
+
+        rd->fields[i] = save;
     }
 
-    /* move to the next line if there's more, else EOF */
-    *line = ptr;
-    *len = chars_left;
-    if (num_entries)
-        *num_entries = count;
+    /* what is left of the line after a carriage return is another one */
+    rd->start = ptr < lim ? ptr - rd->buf : lim - rd->buf + (nl != NULL);
+
+    *fields = rd->fields;
+    *num_fields = count;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* copy of the fields of a line, padded with empty ones up to count */
+static char **idt_copy_fields(char **fields, unsigned num_fields, unsigned count)
+{
+    char **copy;
+    unsigned i;
+
+    count = MAX(count, num_fields);
+    copy = g_new(char *, count + 1);
+    for (i = 0; i < count; i++)
+        copy[i] = g_strdup(i < num_fields ? fields[i] : szEmpty);
+    copy[count] = NULL;
+
+    return copy;
 }
 
 static char *msi_build_createsql_prelude(char *table)
@@ -961,192 +1219,161 @@ done:
     return r;
 }
 
-static unsigned construct_record(unsigned num_columns, char **types,
-                             char **data, const char *name, LibmsiRecord **rec)
+/* the three lines at the start of a text archive */
+typedef struct
 {
-    unsigned i;
-
-    *rec = libmsi_record_new(num_columns);
-    if (!*rec)
-        return LIBMSI_RESULT_OUTOFMEMORY;
-
-    for (i = 0; i < num_columns; i++)
-    {
-        switch (types[i][0])
-        {
-            case 'L': case 'l': case 'S': case 's':
-                libmsi_record_set_string(*rec, i + 1, data[i]);
-                break;
-            case 'I': case 'i':
-                if (*data[i])
-                    libmsi_record_set_int(*rec, i + 1, atoi(data[i]));
-                break;
-            case 'V': case 'v':
-                if (*data[i])
-                {
-                    unsigned r;
-                    char *file = g_build_filename (name, data[i], NULL);
-                    r = _libmsi_record_load_stream_from_file(*rec, i + 1, file);
-                    g_free (file);
-                    if (r != LIBMSI_RESULT_SUCCESS)
-                        return LIBMSI_RESULT_FUNCTION_FAILED;
-                }
-                break;
-            default:
-                g_critical("Unhandled column type: %c\n", types[i][0]);
-                g_object_unref(*rec);
-                return LIBMSI_RESULT_FUNCTION_FAILED;
-        }
-    }
-
-    return LIBMSI_RESULT_SUCCESS;
-}
+    char **columns;
+    char **types;
+    char **labels;
+    unsigned num_columns;
+    unsigned num_types;
+    unsigned num_labels;
+} IDTHEADER;
 
-static unsigned msi_add_records_to_table(LibmsiDatabase *db, char **columns, char **types,
-                                     char **labels, char ***records,
-                                     int num_columns, int num_records)
+static unsigned idt_read_header(IDTREADER *rd, IDTHEADER *hdr)
 {
-    unsigned r, num_rows, num_cols;
-    int i;
-    LibmsiView *view;
-    LibmsiRecord *rec;
+    char **fields;
+    unsigned r;
 
-    r = table_view_create(db, labels[0], &view);
+    r = idt_read_line( rd, &fields, &hdr->num_columns );
     if (r != LIBMSI_RESULT_SUCCESS)
-        return r;
+        return r == NO_MORE_ITEMS ? LIBMSI_RESULT_FUNCTION_FAILED : r;
+    hdr->columns = idt_copy_fields( fields, hdr->num_columns, 0 );
 
-    r = view->ops->get_dimensions( view, &num_rows, &num_cols );
+    r = idt_read_line( rd, &fields, &hdr->num_types );
     if (r != LIBMSI_RESULT_SUCCESS)
-        return r;
+        return r == NO_MORE_ITEMS ? LIBMSI_RESULT_FUNCTION_FAILED : r;
+    hdr->types = idt_copy_fields( fields, hdr->num_types, 0 );
 
-    while (num_rows > 0)
-    {
-        r = view->ops->delete_row(view, --num_rows);
-        if (r != LIBMSI_RESULT_SUCCESS)
-            goto done;
-    }
+    r = idt_read_line( rd, &fields, &hdr->num_labels );
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r == NO_MORE_ITEMS ? LIBMSI_RESULT_FUNCTION_FAILED : r;
+    hdr->labels = idt_copy_fields( fields, hdr->num_labels, 0 );
 
-    for (i = 0; i < num_records; i++)
-    {
-        r = construct_record(num_columns, types, records[i], labels[0], &rec);
-        if (r != LIBMSI_RESULT_SUCCESS)
-            goto done;
+    return LIBMSI_RESULT_SUCCESS;
+}
 
-        r = view->ops->insert_row(view, rec, -1, false);
-        if (r != LIBMSI_RESULT_SUCCESS)
-        {
-            g_object_unref(rec);
-            goto done;
-        }
+static void idt_free_header(IDTHEADER *hdr)
+{
+    g_strfreev(hdr->columns);
+    g_strfreev(hdr->types);
+    g_strfreev(hdr->labels);
+}
 
-        g_object_unref(rec);
-    }
+/* returns the fields of the next row, or NO_MORE_ITEMS */
+typedef unsigned (*IDTNEXTROW)(void *source, char ***fields, unsigned *num_fields);
 
-done:
-    msi_free(view);
-    return r;
+static unsigned idt_next_line(void *source, char ***fields, unsigned *num_fields)
+{
+    return idt_read_line( source, fields, num_fields );
 }
 
-static unsigned _libmsi_database_import(LibmsiDatabase *db, const char *path)
+static bool idt_is_codepage(const IDTHEADER *hdr)
 {
-    unsigned r = LIBMSI_RESULT_OUTOFMEMORY;
-    unsigned len, i;
-    unsigned num_labels = 0;
-    unsigned num_types = 0;
-    unsigned num_columns = 0;
-    unsigned num_records = 0;
-    char **columns = NULL;
-    char **types = NULL;
-    char **labels = NULL;
-    char *ptr;
-    char *data = NULL;
-    char ***records = NULL;
-    char ***temp_records;
+    static const char forcecodepage[] = "_ForceCodepage";
+
+    return hdr->num_columns == 1 && !hdr->columns[0][0] &&
+           hdr->num_labels == 1 && !hdr->labels[0][0] &&
+           hdr->num_types == 2 && !strcmp( hdr->types[1], forcecodepage );
+}
 
+static bool idt_is_suminfo(const IDTHEADER *hdr)
+{
     static const char suminfo[] = "_SummaryInformation";
-    static const char forcecodepage[] = "_ForceCodepage";
 
-    TRACE("%p %s\n", db, debugstr_a(path));
+    return !strcmp( hdr->labels[0], suminfo );
+}
 
-    data = msi_read_text_archive( path, &len );
-    if (!data)
-        goto done;
+static unsigned idt_import_suminfo(LibmsiDatabase *db, IDTHEADER *hdr, IDTNEXTROW next, void *source)
+{
+    unsigned r, num_fields;
+    char **fields;
+    GPtrArray *records;
 
-    ptr = data;
-    msi_parse_line( &ptr, &columns, &num_columns, &len );
-    msi_parse_line( &ptr, &types, &num_types, &len );
-    msi_parse_line( &ptr, &labels, &num_labels, &len );
+    /* the properties come in pairs of columns */
+    records = g_ptr_array_new_with_free_func( (GDestroyNotify) g_strfreev );
+    while ((r = next( source, &fields, &num_fields )) == LIBMSI_RESULT_SUCCESS)
+        g_ptr_array_add( records, idt_copy_fields( fields, num_fields, hdr->num_columns + 1 ) );
 
-    if (num_columns == 1 && !columns[0][0] && num_labels == 1 && !labels[0][0] &&
-        num_types == 2 && !strcmp( types[1], forcecodepage ))
+    if (r == NO_MORE_ITEMS)
     {
-        r = msi_set_string_table_codepage( db->strings, atoi( types[0] ) );
-        goto done;
+        r = msi_add_suminfo( db, (char ***) records->pdata, records->len, hdr->num_columns );
+        if (r != LIBMSI_RESULT_SUCCESS)
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
     }
 
-    if (num_columns != num_types)
-    {
-        r = LIBMSI_RESULT_FUNCTION_FAILED;
-        goto done;
-    }
+    g_ptr_array_free( records, TRUE );
+    return r;
+}
 
-    records = msi_alloc(sizeof(char **));
-    if (!records)
+/* creates the table if needed, and starts replacing its rows */
+static unsigned idt_import_begin(LibmsiDatabase *db, IDTHEADER *hdr, LibmsiTableImport **ti)
+{
+    unsigned r;
+
+    if (!table_view_exists(db, hdr->labels[0]))
     {
-        r = LIBMSI_RESULT_OUTOFMEMORY;
-        goto done;
+        r = msi_add_table_to_db( db, hdr->columns, hdr->types, hdr->labels,
+                                 hdr->num_labels, hdr->num_columns );
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return LIBMSI_RESULT_FUNCTION_FAILED;
     }
 
-    /* read in the table records */
-    while (len)
-    {
-        msi_parse_line( &ptr, &records[num_records], NULL, &len );
+    return msi_table_import_begin( db, hdr->labels[0], ti );
+}
 
-        num_records++;
-        temp_records = msi_realloc(records, (num_records + 1) * sizeof(char **));
-        if (!temp_records)
-        {
-            r = LIBMSI_RESULT_OUTOFMEMORY;
-            goto done;
-        }
-        records = temp_records;
-    }
+static unsigned idt_import(LibmsiDatabase *db, IDTHEADER *hdr, IDTNEXTROW next, void *source)
+{
+    unsigned r, num_fields;
+    char **fields;
+    LibmsiTableImport *ti;
+
+    if (idt_is_codepage(hdr))
+        return msi_set_string_table_codepage( db->strings, atoi( hdr->types[0] ) );
+
+    if (hdr->num_columns != hdr->num_types)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    if (idt_is_suminfo(hdr))
+        return idt_import_suminfo( db, hdr, next, source );
+
+    r = idt_import_begin( db, hdr, &ti );
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
 
-    if (!strcmp(labels[0], suminfo))
+    /* the rows replace the ones of the table once all of them are read */
+    while ((r = next( source, &fields, &num_fields )) == LIBMSI_RESULT_SUCCESS)
     {
-        r = msi_add_suminfo( db, records, num_records, num_columns );
+        r = msi_table_import_strings( ti, fields, num_fields );
+        if (r == LIBMSI_RESULT_SUCCESS)
+            r = msi_table_import_row( ti, fields, num_fields, hdr->labels[0] );
         if (r != LIBMSI_RESULT_SUCCESS)
-        {
-            r = LIBMSI_RESULT_FUNCTION_FAILED;
-            goto done;
-        }
+            break;
     }
-    else
-    {
-        if (!table_view_exists(db, labels[0]))
-        {
-            r = msi_add_table_to_db( db, columns, types, labels, num_labels, num_columns );
-            if (r != LIBMSI_RESULT_SUCCESS)
-            {
-                r = LIBMSI_RESULT_FUNCTION_FAILED;
-                goto done;
-            }
-        }
 
-        r = msi_add_records_to_table( db, columns, types, labels, records, num_columns, num_records);
-    }
+    if (r == NO_MORE_ITEMS)
+        return msi_table_import_end( ti, true );
 
-done:
-    msi_free(data);
-    msi_free(columns);
-    msi_free(types);
-    msi_free(labels);
+    msi_table_import_end( ti, false );
+    return r;
+}
+
+static unsigned _libmsi_database_import(LibmsiDatabase *db, const char *path)
+{
+    IDTHEADER hdr = { NULL };
+    IDTREADER rd;
+    unsigned r;
 
-    for (i = 0; i < num_records; i++)
-        msi_free(records[i]);
+    TRACE("%p %s\n", db, debugstr_a(path));
 
-    msi_free(records);
+    r = idt_reader_open( &rd, path );
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = idt_read_header( &rd, &hdr );
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = idt_import( db, &hdr, idt_next_line, &rd );
 
+    idt_free_header( &hdr );
+    idt_reader_close( &rd );
     return r;
 }
 
@@ -1183,8 +1410,347 @@ libmsi_database_import (LibmsiDatabase *db,
     return r == LIBMSI_RESULT_SUCCESS;
 }
 
+/* the rows of a text archive, read in memory */
+typedef struct
+{
+    GStringChunk *chunk;
+    GPtrArray *rows;
+    unsigned current;
+} IDTROWS;
+
+static unsigned idt_read_rows(IDTREADER *rd, IDTROWS *rows)
+{
+    char **fields, **row;
+    unsigned r, i, num_fields;
+
+    while ((r = idt_read_line( rd, &fields, &num_fields )) == LIBMSI_RESULT_SUCCESS)
+    {
+        row = g_new(char *, num_fields + 1);
+        for (i = 0; i < num_fields; i++)
+            row[i] = g_string_chunk_insert( rows->chunk, fields[i] );
+        row[num_fields] = NULL;
+        g_ptr_array_add( rows->rows, row );
+    }
+
+    return r == NO_MORE_ITEMS ? LIBMSI_RESULT_SUCCESS : r;
+}
+
+static void idt_free_rows(IDTROWS *rows)
+{
+    if (rows->rows)
+        g_ptr_array_free( rows->rows, TRUE );
+    if (rows->chunk)
+        g_string_chunk_free( rows->chunk );
+    rows->rows = NULL;
+    rows->chunk = NULL;
+}
+
+static unsigned idt_next_row(void *source, char ***fields, unsigned *num_fields)
+{
+    IDTROWS *rows = source;
+
+    if (rows->current == rows->rows->len)
+        return NO_MORE_ITEMS;
+
+    *fields = g_ptr_array_index( rows->rows, rows->current++ );
+    *num_fields = g_strv_length( *fields );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* text archives read and encoded on a thread pool.  Their strings are
+ * added to the database in the order the files were given, so that they
+ * get the same ids as when importing one file at a time, and their rows
+ * are installed in that order too */
+typedef struct
+{
+    LibmsiDatabase *db;
+    GMutex lock;
+    GCond cond;
+    unsigned next;
+    unsigned installed;
+    unsigned r;
+    const char *failed;
+} IDTIMPORT;
+
+typedef struct
+{
+    unsigned index;
+    const char *path;
+} IDTJOB;
+
+static void import_file (gpointer data, gpointer user_data)
+{
+    IDTJOB *job = data;
+    IDTIMPORT *import = user_data;
+    IDTHEADER hdr = { NULL };
+    IDTROWS rows = { NULL };
+    IDTREADER rd;
+    LibmsiTableImport *ti = NULL;
+    bool suminfo = false;
+    char **fields;
+    unsigned r, i;
+
+    TRACE("%u %s\n", job->index, debugstr_a(job->path));
+
+    rows.chunk = g_string_chunk_new( IDT_BUFFER_SIZE );
+    rows.rows = g_ptr_array_new_with_free_func( g_free );
+
+    r = idt_reader_open( &rd, job->path );
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = idt_read_header( &rd, &hdr );
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = idt_read_rows( &rd, &rows );
+    idt_reader_close( &rd );
+
+    /* only the string table and the table creation need the lock */
+    g_mutex_lock( &import->lock );
+    while (import->next != job->index)
+        g_cond_wait( &import->cond, &import->lock );
+
+    if (import->r == LIBMSI_RESULT_SUCCESS && r == LIBMSI_RESULT_SUCCESS)
+    {
+        if (idt_is_codepage( &hdr ))
+            r = msi_set_string_table_codepage( import->db->strings, atoi( hdr.types[0] ) );
+        else if (hdr.num_columns != hdr.num_types)
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+        else if (idt_is_suminfo( &hdr ))
+            suminfo = true;
+        else
+            r = idt_import_begin( import->db, &hdr, &ti );
+
+        for (i = 0; ti && r == LIBMSI_RESULT_SUCCESS && i < rows.rows->len; i++)
+        {
+            fields = g_ptr_array_index( rows.rows, i );
+            r = msi_table_import_strings( ti, fields, g_strv_length( fields ) );
+        }
+    }
+
+    import->next++;
+    g_cond_broadcast( &import->cond );
+    g_mutex_unlock( &import->lock );
+
+    /* converting, checking and sorting the rows only uses the import */
+    for (i = 0; ti && r == LIBMSI_RESULT_SUCCESS && i < rows.rows->len; i++)
+    {
+        fields = g_ptr_array_index( rows.rows, i );
+        r = msi_table_import_row( ti, fields, g_strv_length( fields ), hdr.labels[0] );
+    }
+    if (ti && r == LIBMSI_RESULT_SUCCESS)
+        r = msi_table_import_prepare( ti );
+
+    /* the summary information is only added with the other tables */
+    if (!suminfo)
+        idt_free_rows( &rows );
+
+    g_mutex_lock( &import->lock );
+    while (import->installed != job->index)
+        g_cond_wait( &import->cond, &import->lock );
+
+    if (import->r == LIBMSI_RESULT_SUCCESS && r == LIBMSI_RESULT_SUCCESS)
+    {
+        if (suminfo)
+            r = idt_import_suminfo( import->db, &hdr, idt_next_row, &rows );
+        else if (ti)
+            r = msi_table_import_end( ti, true );
+        ti = NULL;
+    }
+    if (ti)
+        msi_table_import_end( ti, false );
+
+    if (import->r == LIBMSI_RESULT_SUCCESS && r != LIBMSI_RESULT_SUCCESS)
+    {
+        import->r = r;
+        import->failed = job->path;
+    }
+
+    import->installed++;
+    g_cond_broadcast( &import->cond );
+    g_mutex_unlock( &import->lock );
+
+    idt_free_header( &hdr );
+    idt_free_rows( &rows );
+}
+
+static gint compare_paths (gconstpointer a, gconstpointer b)
+{
+    return strcmp( *(char * const *)a, *(char * const *)b );
+}
+
+/* a table file, or the .idt files of a directory ordered by name */
+static unsigned idt_list_files(const char *path, GPtrArray *files)
+{
+    const char *name;
+    GPtrArray *names;
+    GDir *dir;
+    unsigned i;
+
+    if (!g_file_test( path, G_FILE_TEST_IS_DIR ))
+    {
+        g_ptr_array_add( files, g_strdup( path ) );
+        return LIBMSI_RESULT_SUCCESS;
+    }
+
+    dir = g_dir_open( path, 0, NULL );
+    if (!dir)
+        return LIBMSI_RESULT_OPEN_FAILED;
+
+    names = g_ptr_array_new();
+    while ((name = g_dir_read_name( dir )))
+    {
+        if (strlen( name ) > 4 && !g_ascii_strcasecmp( name + strlen( name ) - 4, ".idt" ))
+            g_ptr_array_add( names, g_build_filename( path, name, NULL ) );
+    }
+    g_dir_close( dir );
+
+    g_ptr_array_sort( names, compare_paths );
+    for (i = 0; i < names->len; i++)
+        g_ptr_array_add( files, g_ptr_array_index( names, i ) );
+    g_ptr_array_free( names, TRUE );
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/**
+ * libmsi_database_import_tables:
+ * @db: a %LibmsiDatabase
+ * @paths: (array zero-terminated=1): table files, or directories whose
+ * .idt files are imported
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Import tables to the database like libmsi_database_import() does for
+ * each file.  The files are read and their rows converted in parallel;
+ * their strings are added to @db and their rows installed one file at a
+ * time in the order of @paths, the files of a directory ordered by name.
+ * The files after one that fails to import are not installed, but the
+ * strings and tables of those already being read may have been added.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+libmsi_database_import_tables (LibmsiDatabase *db,
+                               const char * const *paths,
+                               GError **error)
+{
+    IDTIMPORT import = { NULL };
+    IDTJOB *jobs;
+    GPtrArray *files;
+    GThreadPool *pool;
+    unsigned i, r = LIBMSI_RESULT_SUCCESS;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (paths, FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    files = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; paths[i] && r == LIBMSI_RESULT_SUCCESS; i++)
+        r = idt_list_files (paths[i], files);
+
+    if (r != LIBMSI_RESULT_SUCCESS)
+    {
+        g_set_error (error, LIBMSI_RESULT_ERROR, r,
+                     "failed to open %s", paths[i - 1]);
+        g_ptr_array_free (files, TRUE);
+        return FALSE;
+    }
+
+    TRACE("%p %u\n", db, files->len);
+
+    g_object_ref(db);
+    import.db = db;
+    g_mutex_init (&import.lock);
+    g_cond_init (&import.cond);
+
+    jobs = g_new0 (IDTJOB, files->len);
+    pool = g_thread_pool_new (import_file, &import,
+                              MAX (MIN (files->len, g_get_num_processors ()), 1),
+                              FALSE, NULL);
+    for (i = 0; i < files->len; i++)
+    {
+        jobs[i].index = i;
+        jobs[i].path = g_ptr_array_index (files, i);
+        g_thread_pool_push (pool, &jobs[i], NULL);
+    }
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+    if (import.r != LIBMSI_RESULT_SUCCESS)
+        g_set_error (error, LIBMSI_RESULT_ERROR, import.r,
+                     "failed to import table %s", import.failed);
+
+    g_mutex_clear (&import.lock);
+    g_cond_clear (&import.cond);
+    g_free (jobs);
+    g_ptr_array_free (files, TRUE);
+    g_object_unref(db);
+
+    return import.r == LIBMSI_RESULT_SUCCESS;
+}
+
+/* the output of an export, written to the file in large blocks */
+typedef struct
+{
+    int fd;
+    unsigned len;
+    char data[0x10000];
+} EXPORTBUF;
+
+static unsigned full_write(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len)
+    {
+        n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return LIBMSI_RESULT_FUNCTION_FAILED;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned export_flush(EXPORTBUF *buf)
+{
+    unsigned r;
+
+    r = full_write(buf->fd, buf->data, buf->len);
+    buf->len = 0;
+    return r;
+}
+
+static unsigned export_write(EXPORTBUF *buf, const char *data, size_t len)
+{
+    unsigned r;
+
+    if (len > sizeof(buf->data) - buf->len)
+    {
+        r = export_flush(buf);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+
+        /* too big to be worth copying */
+        if (len >= sizeof(buf->data))
+            return full_write(buf->fd, data, len);
+    }
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned export_int(EXPORTBUF *buf, int val)
+{
+    char number[16];
+
+    return export_write(buf, number, sprintf(number, "%d", val));
+}
+
 static gboolean
-msi_export_stream (GsfInput *gsfin, GFile *table_dir, gchar **str,
+msi_export_stream (GsfInput *gsfin, GFile *table_dir, const gchar **str,
                    GError **error)
 {
     GError *err = NULL;
@@ -1202,7 +1768,7 @@ msi_export_stream (GsfInput *gsfin, GFile *table_dir, gchar **str,
         goto end;
     }
 
-    *str = g_strdup (g_object_get_data (G_OBJECT (gsfin), "stname"));
+    *str = g_object_get_data (G_OBJECT (gsfin), "stname");
     file = g_file_get_child (table_dir, *str);
     out = G_OUTPUT_STREAM (g_file_replace (file, NULL, FALSE, 0, NULL, error));
     in = G_INPUT_STREAM (libmsi_istream_new (gsfin));
@@ -1220,96 +1786,125 @@ end:
     return spliced != -1;
 
 }
-static unsigned msi_export_record(int fd, LibmsiRecord *row,
-                                  unsigned start, GFile *table_dir,
-                                  GError **error)
+
+/* the header lines, which have no streams */
+static unsigned msi_export_record(EXPORTBUF *buf, LibmsiRecord *row, unsigned start)
 {
-    GsfInput *in = NULL;
-    unsigned i, count;
-    unsigned success = LIBMSI_RESULT_FUNCTION_FAILED;
+    unsigned i, count, r = LIBMSI_RESULT_SUCCESS;
+    const char *str;
 
     count = libmsi_record_get_field_count (row);
-    for (i = start; i <= count; i++) {
-        char *str;
+    for (i = start; i <= count && r == LIBMSI_RESULT_SUCCESS; i++) {
+        str = _libmsi_record_get_string_raw (row, i);
+        if (str)
+            r = export_write (buf, str, strlen (str));
+        else if (!libmsi_record_is_null (row, i))
+            r = export_int (buf, libmsi_record_get_int (row, i));
 
-        _libmsi_record_get_gsf_input (row, i, &in);
-        if (in) {
-            if (!msi_export_stream (in, table_dir, &str, error))
-                goto end;
-            g_object_unref (in);
-            in = NULL;
-        } else {
-            str = libmsi_record_get_string (row, i);
-            if (!str)
-                goto end;
-        }
+        if (r == LIBMSI_RESULT_SUCCESS)
+            r = export_write (buf, i < count ? "\t" : "\r\n", i < count ? 1 : 2);
+    }
 
-        /* TODO full_write */
-        if (write (fd, str, strlen (str)) != strlen (str)) {
-            g_free (str);
-            goto end;
-        }
+    return r;
+}
 
-        g_free (str);
+/* the strings are written straight from the string table */
+static unsigned msi_export_row(EXPORTBUF *buf, LibmsiDatabase *db, LibmsiView *view,
+                               unsigned row, const unsigned *types, unsigned count,
+                               GFile *table_dir, GError **error)
+{
+    GsfInput *stm;
+    const char *str;
+    unsigned i, ival, r = LIBMSI_RESULT_SUCCESS;
+
+    for (i = 1; i <= count && r == LIBMSI_RESULT_SUCCESS; i++) {
+        if (MSITYPE_IS_BINARY (types[i - 1])) {
+            stm = NULL;
+            if (view->ops->fetch_stream (view, row, i, &stm) != LIBMSI_RESULT_SUCCESS || !stm)
+                g_warning ("failed to get stream\n");
+            else {
+                if (!msi_export_stream (stm, table_dir, &str, error))
+                    r = LIBMSI_RESULT_FUNCTION_FAILED;
+                else
+                    r = export_write (buf, str, strlen (str));
+                g_object_unref (G_OBJECT (stm));
+            }
+        } else if (view->ops->fetch_int (view, row, i, &ival) != LIBMSI_RESULT_SUCCESS)
+            g_critical ("Error fetching data for %d\n", i);
+        else if (!ival)
+            ;
+        else if (types[i - 1] & MSITYPE_STRING) {
+            str = msi_string_lookup_id (db->strings, ival);
+            if (str)
+                r = export_write (buf, str, strlen (str));
+        } else if ((types[i - 1] & MSI_DATASIZEMASK) == 2)
+            r = export_int (buf, ival - (1<<15));
+        else
+            r = export_int (buf, ival - (1<<31));
 
-        const char *sep = (i < count) ? "\t" : "\r\n";
-        if (write (fd, sep, strlen (sep)) != strlen (sep))
-            goto end;
+        if (r == LIBMSI_RESULT_SUCCESS)
+            r = export_write (buf, i < count ? "\t" : "\r\n", i < count ? 1 : 2);
     }
 
-    success = LIBMSI_RESULT_SUCCESS;
+    return r;
+}
 
-end:
-    if (in)
-        g_object_unref (in);
+static unsigned msi_export_rows(EXPORTBUF *buf, LibmsiDatabase *db, LibmsiQuery *query,
+                                GFile *table_dir, GError **error)
+{
+    LibmsiView *view;
+    unsigned *types = NULL;
+    unsigned i, row, count = 0, r;
 
-    return success;
-}
+    r = _libmsi_query_execute (query, NULL);
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
 
-typedef struct _ExportRow {
-    int fd;
-    GFile *table_dir;
-    GError **error;
-} ExportRow;
+    view = query->view;
+    r = view->ops->get_dimensions (view, NULL, &count);
+    if (r == LIBMSI_RESULT_SUCCESS && !count)
+        r = LIBMSI_RESULT_INVALID_PARAMETER;
+    if (r == LIBMSI_RESULT_SUCCESS) {
+        types = g_new0 (unsigned, count);
+        for (i = 0; i < count && r == LIBMSI_RESULT_SUCCESS; i++)
+            r = view->ops->get_column_info (view, i + 1, NULL, &types[i], NULL, NULL);
+    }
 
-static unsigned msi_export_row( LibmsiRecord *row, void *arg )
-{
-    ExportRow *export = arg;
+    for (row = 0; r == LIBMSI_RESULT_SUCCESS; row++) {
+        r = msi_view_row_available (view, row);
+        if (r == LIBMSI_RESULT_SUCCESS)
+            r = msi_export_row (buf, db, view, row, types, count, table_dir, error);
+    }
 
-    return msi_export_record (export->fd, row, 1,
-                              export->table_dir, export->error);
+    g_free (types);
+    libmsi_query_close (query, NULL);
+
+    return r == NO_MORE_ITEMS ? LIBMSI_RESULT_SUCCESS : r;
 }
 
 static LibmsiResult msi_export_forcecodepage( int fd, unsigned codepage )
 {
     static const char fmt[] = "\r\n\r\n%u\t_ForceCodepage\r\n";
     char data[sizeof(fmt) + 10];
-    unsigned sz;
 
     sprintf( data, fmt, codepage );
 
-    sz = strlen(data) + 1;
-    if (write( fd, data, sz ) != sz)
-        return LIBMSI_RESULT_FUNCTION_FAILED;
-
-    return LIBMSI_RESULT_SUCCESS;
+    return full_write( fd, data, strlen(data) + 1 );
 }
 
-static LibmsiResult msi_export_summaryinfo (LibmsiDatabase *db, int fd, GError **error)
+static LibmsiResult msi_export_summaryinfo (LibmsiDatabase *db, EXPORTBUF *buf, GError **error)
 {
     static const char header[] =
         "PropertyId\tValue\r\ni2\tl255\r\n_SummaryInformation\tPropertyId\r\n";
     LibmsiResult result = LIBMSI_RESULT_FUNCTION_FAILED;
     LibmsiSummaryInfo *si = libmsi_summary_info_new (db, 0, error);
     gchar *str = NULL;
-    gssize sz;
     int i;
 
     if (!si)
         goto end;
 
-    sz = strlen (header);
-    if (write (fd, header, sz) != sz)
+    if (export_write (buf, header, strlen (header)) != LIBMSI_RESULT_SUCCESS)
         goto end;
 
     for (i = 0; i < MSI_MAX_PROPS; i++)
@@ -1318,14 +1913,13 @@ static LibmsiResult msi_export_summaryinfo (LibmsiDatabase *db, int fd, GError *
             if (!val)
                 goto end;
             str = g_strdup_printf ("%d\t%s\r\n", i, val);
-            sz = strlen (str);
-            if (write (fd, str, sz) != sz)
+            if (export_write (buf, str, strlen (str)) != LIBMSI_RESULT_SUCCESS)
                 goto end;
             g_free (str);
             str = NULL;
         }
 
-    result = LIBMSI_RESULT_SUCCESS;
+    result = export_flush (buf);
 
 end:
     g_free (str);
@@ -1334,12 +1928,16 @@ end:
     return result;
 }
 
+/* the files of binary columns go to a directory named after the table,
+ * in dir or the current directory */
 static LibmsiResult _libmsi_database_export(LibmsiDatabase *db, const char *table,
-                                        int fd, GError **error)
+                                        int fd, const char *dir, GError **error)
 {
     static const char query[] = "select * from %s";
     LibmsiRecord *rec = NULL;
     LibmsiQuery *view = NULL;
+    EXPORTBUF *buf;
+    GFile *table_dir;
     LibmsiResult r;
 
     TRACE("%p %s %d\n", db, debugstr_a(table), fd );
@@ -1347,50 +1945,70 @@ static LibmsiResult _libmsi_database_export(LibmsiDatabase *db, const char *tabl
     if (!strcmp(table, "_ForceCodepage")) {
         unsigned codepage = msi_get_string_table_codepage (db->strings);
         return msi_export_forcecodepage (fd, codepage);
-    } else if (!strcmp (table, "_SummaryInformation")) {
-        return msi_export_summaryinfo (db, fd, error);
+    }
+
+    buf = msi_alloc( sizeof *buf );
+    if (!buf)
+        return LIBMSI_RESULT_OUTOFMEMORY;
+    buf->fd = fd;
+    buf->len = 0;
+
+    if (!strcmp (table, "_SummaryInformation")) {
+        r = msi_export_summaryinfo (db, buf, error);
+        msi_free( buf );
+        return r;
     }
 
     r = _libmsi_query_open( db, &view, query, table );
     if (r == LIBMSI_RESULT_SUCCESS)
     {
+        unsigned w = LIBMSI_RESULT_SUCCESS;
+
         /* write out row 1, the column names */
         r = _libmsi_query_get_column_info(view, LIBMSI_COL_INFO_NAMES, &rec);
         if (r == LIBMSI_RESULT_SUCCESS)
         {
-            msi_export_record( fd, rec, 1, NULL, error);
+            w = msi_export_record( buf, rec, 1 );
             g_object_unref(rec);
         }
 
         /* write out row 2, the column types */
         r = _libmsi_query_get_column_info(view, LIBMSI_COL_INFO_TYPES, &rec);
+        if (r == LIBMSI_RESULT_SUCCESS && w == LIBMSI_RESULT_SUCCESS)
+            w = msi_export_record( buf, rec, 1 );
         if (r == LIBMSI_RESULT_SUCCESS)
-        {
-            msi_export_record( fd, rec, 1, NULL, error);
             g_object_unref(rec);
-        }
 
         /* write out row 3, the table name + keys */
         r = _libmsi_database_get_primary_keys( db, table, &rec );
         if (r == LIBMSI_RESULT_SUCCESS)
         {
             libmsi_record_set_string( rec, 0, table );
-            msi_export_record( fd, rec, 0, NULL, error);
+            if (w == LIBMSI_RESULT_SUCCESS)
+                w = msi_export_record( buf, rec, 0 );
             g_object_unref(rec);
         }
 
         /* write out row 4 onwards, the data */
-        ExportRow export = {
-            .fd = fd,
-            .table_dir = g_file_new_for_path (table),
-            .error = error
-        };
-        r = _libmsi_query_iterate_records( view, 0, msi_export_row, &export);
-
-        g_object_unref (export.table_dir);
-        g_object_unref (view);
+        if (w == LIBMSI_RESULT_SUCCESS)
+        {
+            char *path = dir ? g_build_filename (dir, table, NULL) : g_strdup (table);
+
+            table_dir = g_file_new_for_path (path);
+            g_free (path);
+            r = msi_export_rows( buf, db, view, table_dir, error );
+            g_object_unref (table_dir);
+        }
+        else
+            r = w;
+
+        if (r == LIBMSI_RESULT_SUCCESS)
+            r = export_flush( buf );
+
+        g_object_unref (view);
     }
 
+    msi_free( buf );
     return r;
 }
 
@@ -1430,7 +2048,7 @@ libmsi_database_export (LibmsiDatabase *db,
     g_return_val_if_fail (!error || *error == NULL, FALSE);
 
     g_object_ref(db);
-    r = _libmsi_database_export (db, table, fd, error);
+    r = _libmsi_database_export (db, table, fd, NULL, error);
     g_object_unref(db);
 
     if (r != LIBMSI_RESULT_SUCCESS && error && !*error)
@@ -1439,6 +2057,394 @@ libmsi_database_export (LibmsiDatabase *db,
     return r == LIBMSI_RESULT_SUCCESS;
 }
 
+static unsigned database_snapshot( LibmsiDatabase *base, const char *outpath,
+                                   bool own_storage, LibmsiDatabase **pdb, bool *shared );
+
+/* writes the file of a table or stream to dir */
+typedef unsigned (*LibmsiExportFile)( LibmsiDatabase *db, const char *dir,
+                                      const char *name, GError **error );
+
+/* the files still to write, taken in turn by the workers */
+typedef struct
+{
+    const char *dir;
+    GPtrArray *names;
+    LibmsiExportFile export;
+    gint next;
+    gint failed;
+} LibmsiExportAll;
+
+typedef struct
+{
+    LibmsiExportAll *all;
+    LibmsiDatabase *db;
+    unsigned r;
+    GError *error;
+} LibmsiExportWorker;
+
+static unsigned export_table_file( LibmsiDatabase *db, const char *dir,
+                                   const char *table, GError **error )
+{
+    char *name, *path;
+    unsigned r;
+    int fd;
+
+    name = g_strconcat( table, ".idt", NULL );
+    path = g_build_filename( dir, name, NULL );
+    fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644 );
+    if (fd == -1)
+        r = LIBMSI_RESULT_OPEN_FAILED;
+    else
+    {
+        r = _libmsi_database_export( db, table, fd, dir, error );
+        if (close( fd ) && r == LIBMSI_RESULT_SUCCESS)
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+    }
+
+    if (r != LIBMSI_RESULT_SUCCESS && !*error)
+        g_set_error( error, LIBMSI_RESULT_ERROR, r, "failed to export %s", path );
+
+    g_free( name );
+    g_free( path );
+    return r;
+}
+
+static void export_worker (gpointer data, gpointer user_data)
+{
+    LibmsiExportWorker *worker = data;
+    LibmsiExportAll *all = worker->all;
+    unsigned i;
+
+    while (!g_atomic_int_get( &all->failed ))
+    {
+        i = g_atomic_int_add( &all->next, 1 );
+        if (i >= all->names->len)
+            break;
+
+        worker->r = all->export( worker->db, all->dir,
+                                 g_ptr_array_index( all->names, i ),
+                                 &worker->error );
+        if (worker->r != LIBMSI_RESULT_SUCCESS)
+            g_atomic_int_set( &all->failed, 1 );
+    }
+}
+
+/* write the files of names in parallel, each worker reading its own
+ * copy of the database */
+static unsigned export_files( LibmsiDatabase *db, const char *dir, GPtrArray *names,
+                              LibmsiExportFile export, GError **error )
+{
+    LibmsiExportAll all = { dir, names, export };
+    LibmsiExportWorker *workers;
+    GThreadPool *pool;
+    unsigned i, n, r = LIBMSI_RESULT_SUCCESS;
+    bool shared = false;
+
+    if (!names->len)
+        return LIBMSI_RESULT_SUCCESS;
+
+    n = MIN (names->len, g_get_num_processors ());
+    workers = g_new0 (LibmsiExportWorker, n);
+    for (i = 0; i < n; i++)
+    {
+        workers[i].all = &all;
+        if (n > 1 && database_snapshot (db, NULL, true, &workers[i].db, &shared)
+                     != LIBMSI_RESULT_SUCCESS)
+            break;
+    }
+
+    /* or it is done here with db itself */
+    if (i < n || shared)
+    {
+        while (i--)
+            g_object_unref (workers[i].db);
+        n = 1;
+        workers[0].db = g_object_ref (db);
+    }
+
+    pool = g_thread_pool_new (export_worker, NULL, n, FALSE, NULL);
+    for (i = 0; i < n; i++)
+        g_thread_pool_push (pool, &workers[i], NULL);
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+    for (i = 0; i < n; i++)
+    {
+        if (workers[i].r != LIBMSI_RESULT_SUCCESS && r == LIBMSI_RESULT_SUCCESS)
+        {
+            r = workers[i].r;
+            g_propagate_error (error, workers[i].error);
+        }
+        else
+            g_clear_error (&workers[i].error);
+        g_object_unref (workers[i].db);
+    }
+    g_free (workers);
+
+    return r;
+}
+
+static unsigned list_tables( LibmsiDatabase *db, GPtrArray *tables )
+{
+    static const char query[] = "SELECT `Name` FROM `_Tables`";
+    LibmsiQuery *view;
+    LibmsiRecord *rec;
+    unsigned r;
+
+    r = _libmsi_query_open( db, &view, query );
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
+
+    r = _libmsi_query_execute( view, NULL );
+    while (r == LIBMSI_RESULT_SUCCESS && _libmsi_query_fetch( view, &rec ) == LIBMSI_RESULT_SUCCESS)
+    {
+        g_ptr_array_add( tables, g_strdup( _libmsi_record_get_string_raw( rec, 1 ) ) );
+        g_object_unref( rec );
+    }
+
+    libmsi_query_close( view, NULL );
+    g_object_unref( view );
+    return r;
+}
+
+static unsigned export_list_tables( LibmsiDatabase *db, GPtrArray *tables )
+{
+    g_ptr_array_add( tables, g_strdup( "_SummaryInformation" ) );
+    g_ptr_array_add( tables, g_strdup( "_ForceCodepage" ) );
+
+    return list_tables( db, tables );
+}
+
+/**
+ * libmsi_database_export_all:
+ * @db: a %LibmsiDatabase
+ * @dir: an existing directory
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Writes each table of the database to a file in @dir named after it,
+ * with the .idt extension, in the format of libmsi_database_export().
+ * The summary information and code page are written to
+ * _SummaryInformation.idt and _ForceCodepage.idt, and the files of binary
+ * columns to a directory of @dir named after their table.  The tables
+ * are exported in parallel.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+libmsi_database_export_all (LibmsiDatabase *db,
+                            const char *dir,
+                            GError **error)
+{
+    GPtrArray *tables;
+    unsigned r;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (dir, FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    TRACE("%p %s\n", db, debugstr_a(dir));
+
+    g_object_ref(db);
+    tables = g_ptr_array_new_with_free_func (g_free);
+    r = export_list_tables (db, tables);
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = export_files (db, dir, tables, export_table_file, error);
+    else
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+
+    g_ptr_array_free (tables, TRUE);
+    g_object_unref(db);
+
+    return r == LIBMSI_RESULT_SUCCESS;
+}
+
+/* large reads let the compound file return runs of contiguous sectors
+ * with a single read of the file, or straight from memory */
+#define EXTRACT_CHUNK_SIZE (1024 * 1024)
+
+static unsigned copy_input_to_fd( const char *name, GsfInput *in, int fd )
+{
+    const guint8 *data;
+    gsf_off_t left;
+    size_t len;
+    unsigned r;
+
+    gsf_input_seek( in, 0, G_SEEK_SET );
+    left = gsf_input_size( in );
+    while (left > 0)
+    {
+        len = MIN( left, EXTRACT_CHUNK_SIZE );
+        data = gsf_input_read( in, len, NULL );
+        if (!data)
+            return LIBMSI_RESULT_FUNCTION_FAILED;
+
+        r = full_write( fd, (const char *)data, len );
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+        left -= len;
+        msi_count_stream( name, len, 0 );
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* names that cannot be encoded, like \005SummaryInformation, are
+ * stored as they are */
+static unsigned get_stream_by_name( LibmsiDatabase *db, const char *name, GsfInput **stm )
+{
+    char *encname;
+    unsigned r;
+
+    r = msi_get_raw_stream( db, name, stm );
+    if (r == LIBMSI_RESULT_SUCCESS)
+        return r;
+
+    encname = encode_streamname( false, name );
+    if (!encname)
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+    r = msi_get_raw_stream( db, encname, stm );
+    msi_free( encname );
+    return r;
+}
+
+static unsigned extract_stream( LibmsiDatabase *db, const char *name, int fd, GError **error )
+{
+    GsfInput *in = NULL;
+    unsigned r;
+
+    r = get_stream_by_name( db, name, &in );
+    if (r != LIBMSI_RESULT_SUCCESS)
+    {
+        g_set_error( error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_INVALID_PARAMETER,
+                     "stream %s not found", name );
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+    }
+
+    r = copy_input_to_fd( name, in, fd );
+    if (r != LIBMSI_RESULT_SUCCESS)
+        g_set_error( error, LIBMSI_RESULT_ERROR, r,
+                     "failed to extract stream %s", name );
+
+    g_object_unref( in );
+    return r;
+}
+
+/**
+ * libmsi_database_extract_stream_to_fd:
+ * @db: a %LibmsiDatabase
+ * @name: the name of a stream, as listed in the _Streams table
+ * @fd: a file descriptor to write to
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Writes the data of the stream @name to @fd.  This is the same as
+ * reading the Data column of its row in _Streams, without going through
+ * a query and a #GInputStream.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+libmsi_database_extract_stream_to_fd (LibmsiDatabase *db,
+                                      const char *name,
+                                      int fd,
+                                      GError **error)
+{
+    unsigned r;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (name, FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    TRACE("%p %s %d\n", db, debugstr_a(name), fd);
+
+    g_object_ref(db);
+    r = extract_stream (db, name, fd, error);
+    g_object_unref(db);
+
+    return r == LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned extract_stream_file( LibmsiDatabase *db, const char *dir,
+                                     const char *name, GError **error )
+{
+    char *path;
+    unsigned r;
+    int fd;
+
+    path = g_build_filename( dir, name, NULL );
+    fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644 );
+    if (fd == -1)
+    {
+        r = LIBMSI_RESULT_OPEN_FAILED;
+        g_set_error( error, LIBMSI_RESULT_ERROR, r, "failed to open %s", path );
+    }
+    else
+    {
+        r = extract_stream( db, name, fd, error );
+        if (close( fd ) && r == LIBMSI_RESULT_SUCCESS)
+        {
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+            g_set_error( error, LIBMSI_RESULT_ERROR, r, "failed to write %s", path );
+        }
+    }
+
+    g_free( path );
+    return r;
+}
+
+/**
+ * libmsi_database_extract_streams:
+ * @db: a %LibmsiDatabase
+ * @pattern: (allow-none): a glob pattern, or %NULL for every stream
+ * @dir: an existing directory
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Writes each stream of the _Streams table whose name matches @pattern
+ * to a file in @dir with that name.  The streams are written in the
+ * order of the _Streams table, in parallel.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+libmsi_database_extract_streams (LibmsiDatabase *db,
+                                 const char *pattern,
+                                 const char *dir,
+                                 GError **error)
+{
+    GPatternSpec *spec = NULL;
+    LibmsiStream *stream;
+    GPtrArray *names;
+    char *name;
+    unsigned r;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (dir, FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    TRACE("%p %s %s\n", db, debugstr_a(pattern), debugstr_a(dir));
+
+    g_object_ref(db);
+    if (pattern)
+        spec = g_pattern_spec_new (pattern);
+
+    names = g_ptr_array_new_with_free_func (g_free);
+    LIST_FOR_EACH_ENTRY( stream, &db->streams, LibmsiStream, entry )
+    {
+        name = decode_streamname (stream->name);
+        if (!spec || g_pattern_match_string (spec, name))
+            g_ptr_array_add (names, name);
+        else
+            g_free (name);
+    }
+
+    r = export_files (db, dir, names, extract_stream_file, error);
+
+    g_ptr_array_free (names, TRUE);
+    if (spec)
+        g_pattern_spec_free (spec);
+    g_object_unref(db);
+
+    return r == LIBMSI_RESULT_SUCCESS;
+}
+
 typedef struct _tagMERGETABLE
 {
     struct list entry;
@@ -1464,7 +2470,9 @@ typedef struct _tagMERGEDATA
     LibmsiDatabase *db;
     LibmsiDatabase *merge;
     MERGETABLE *curtable;
-    LibmsiQuery *curview;
+    GHashTable *dbrows;
+    unsigned *keycols;
+    unsigned numkeys;
     struct list *tabledata;
 } MERGEDATA;
 
@@ -1577,64 +2585,67 @@ done:
     return r;
 }
 
-static char *get_key_value(LibmsiQuery *view, const char *key, LibmsiRecord *rec)
+/* the primary key values of a row, in a form that compares equal between
+ * databases with different string pools */
+static char *row_key(const unsigned *keycols, unsigned numkeys, LibmsiRecord *rec)
 {
-    LibmsiRecord *colnames;
-    char *str;
-    unsigned r, i = 0;
-    int cmp;
+    GString *key;
+    const char *str;
+    unsigned i, field;
 
-    r = _libmsi_query_get_column_info(view, LIBMSI_COL_INFO_NAMES, &colnames);
-    if (r != LIBMSI_RESULT_SUCCESS)
-        return NULL;
-
-    do
+    key = g_string_sized_new(64);
+    for (i = 0; i < numkeys; i++)
     {
-        str = msi_dup_record_field(colnames, ++i);
-        cmp = strcmp( key, str );
-        msi_free(str);
-    } while (cmp);
+        field = keycols[i];
+        if (libmsi_record_is_null(rec, field))
+            g_string_append_c(key, 'n');
+        else if ((str = _libmsi_record_get_string_raw(rec, field)))
+            g_string_append_printf(key, "s%u:%s", (unsigned)strlen(str), str);
+        else
+            g_string_append_printf(key, "i%d", libmsi_record_get_int(rec, field));
+        g_string_append_c(key, ';');
+    }
 
-    g_object_unref(colnames);
+    return g_string_free(key, FALSE);
+}
 
-    if (_libmsi_record_get_string_raw(rec, i))  /* check record field is a string */
-        /* quote string record fields */
-        str = g_strdup_printf ("'%s'", _libmsi_record_get_string_raw (rec, i));
-    else
-        str = libmsi_record_get_string (rec, i);
+static char *merge_row_key(const MERGEDATA *data, LibmsiRecord *rec)
+{
+    return row_key(data->keycols, data->numkeys, rec);
+}
+
+static unsigned merge_hash_row(LibmsiRecord *rec, void *param)
+{
+    MERGEDATA *data = param;
 
-    return str;
+    g_hash_table_replace(data->dbrows, merge_row_key(data, rec), g_object_ref(rec));
+    return LIBMSI_RESULT_SUCCESS;
 }
 
-static char *create_diff_row_query(LibmsiDatabase *merge, LibmsiQuery *view,
-                                    char *table, LibmsiRecord *rec)
+/* hash the rows of the target table once, by primary key */
+static unsigned merge_hash_table(MERGEDATA *data, MERGETABLE *table, LibmsiQuery *dbview)
 {
-    GString *query;
-    char *val;
-    const char *key;
-    LibmsiRecord *keys;
-    unsigned r, i, count;
+    unsigned i, j;
 
-    r = _libmsi_database_get_primary_keys(merge, table, &keys);
-    if (r != LIBMSI_RESULT_SUCCESS)
-        return NULL;
+    data->numkeys = table->numlabels - 1;
+    data->keycols = msi_alloc(data->numkeys * sizeof(*data->keycols));
+    if (!data->keycols)
+        return LIBMSI_RESULT_OUTOFMEMORY;
 
-    query = g_string_sized_new(256);
-    g_string_printf (query, "SELECT * FROM %s WHERE ", table);
-    count = libmsi_record_get_field_count(keys);
-    for (i = 1; i <= count; i++)
+    for (i = 0; i < data->numkeys; i++)
     {
-        key = _libmsi_record_get_string_raw(keys, i);
-        val = get_key_value(view, key, rec);
+        for (j = 0; j < table->numcolumns; j++)
+            if (!strcmp(table->labels[i + 1], table->columns[j]))
+                break;
 
-        if (i == count)
-            g_string_append_printf (query, "`%s` = %s", key, val);
-        else
-            g_string_append_printf (query, "`%s` = %s AND ", key, val);
+        if (j == table->numcolumns)
+            return LIBMSI_RESULT_DATATYPE_MISMATCH;
+
+        data->keycols[i] = j + 1;
     }
 
-    g_object_unref(keys);
-    return  g_string_free (query, FALSE);
+    data->dbrows = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+    return _libmsi_query_iterate_records(dbview, NULL, merge_hash_row, data);
 }
 
 static unsigned merge_diff_row(LibmsiRecord *rec, void *param)
@@ -1642,63 +2653,37 @@ static unsigned merge_diff_row(LibmsiRecord *rec, void *param)
     MERGEDATA *data = param;
     MERGETABLE *table = data->curtable;
     MERGEROW *mergerow;
-    LibmsiQuery *dbview = NULL;
-    LibmsiRecord *row = NULL;
-    char *query = NULL;
-    unsigned r = LIBMSI_RESULT_SUCCESS;
-    GError *err = NULL;
+    LibmsiRecord *row;
+    char *key;
 
-    if (table_view_exists(data->db, table->name))
+    if (data->dbrows)
     {
-        query = create_diff_row_query(data->merge, data->curview, table->name, rec);
-        if (!query)
-            return LIBMSI_RESULT_OUTOFMEMORY;
-
-        dbview = libmsi_query_new(data->db, query, &err);
-        if (err)
-            goto done;
-
-        r = _libmsi_query_execute(dbview, NULL);
-        if (r != LIBMSI_RESULT_SUCCESS)
-            goto done;
+        key = merge_row_key(data, rec);
+        row = g_hash_table_lookup(data->dbrows, key);
+        g_free(key);
 
-        r = _libmsi_query_fetch(dbview, &row);
-        if (r == LIBMSI_RESULT_SUCCESS && !_libmsi_record_compare(rec, row))
+        /* identical rows are already there, others are conflicts */
+        if (row)
         {
-            table->numconflicts++;
-            goto done;
+            if (!_libmsi_record_compare(rec, row))
+                table->numconflicts++;
+            return LIBMSI_RESULT_SUCCESS;
         }
-        else if (r != NO_MORE_ITEMS)
-            goto done;
-
-        r = LIBMSI_RESULT_SUCCESS;
     }
 
     mergerow = msi_alloc(sizeof(MERGEROW));
     if (!mergerow)
-    {
-        r = LIBMSI_RESULT_OUTOFMEMORY;
-        goto done;
-    }
+        return LIBMSI_RESULT_OUTOFMEMORY;
 
     mergerow->data = _libmsi_record_clone(rec);
     if (!mergerow->data)
     {
-        r = LIBMSI_RESULT_OUTOFMEMORY;
         msi_free(mergerow);
-        goto done;
+        return LIBMSI_RESULT_OUTOFMEMORY;
     }
 
     list_add_tail(&table->rows, &mergerow->entry);
-
-done:
-    if (err)
-        g_critical("%s", err->message);
-    g_clear_error(&err);
-    msi_free(query);
-    g_object_unref(row);
-    g_object_unref(dbview);
-    return r;
+    return LIBMSI_RESULT_SUCCESS;
 }
 
 static unsigned msi_get_table_labels(LibmsiDatabase *db, const char *table, char ***labels, unsigned *numlabels)
@@ -1796,7 +2781,7 @@ static void merge_free_rows(MERGETABLE *table)
         MERGEROW *row = LIST_ENTRY(item, MERGEROW, entry);
 
         list_remove(&row->entry);
-        g_object_unref(row);
+        g_object_unref(row->data);
         msi_free(row);
     }
 }
@@ -1918,8 +2903,17 @@ static unsigned merge_diff_tables(LibmsiRecord *rec, void *param)
     if (r != LIBMSI_RESULT_SUCCESS)
         goto done;
 
+    if (dbview)
+    {
+        r = merge_hash_table(data, table, dbview);
+        if (r != LIBMSI_RESULT_SUCCESS)
+        {
+            free_merge_table(table);
+            goto done;
+        }
+    }
+
     data->curtable = table;
-    data->curview = mergeview;
     r = _libmsi_query_iterate_records(mergeview, NULL, merge_diff_row, data);
     if (r != LIBMSI_RESULT_SUCCESS)
     {
@@ -1930,6 +2924,11 @@ static unsigned merge_diff_tables(LibmsiRecord *rec, void *param)
     list_add_tail(data->tabledata, &table->entry);
 
 done:
+    if (data->dbrows)
+        g_hash_table_destroy(data->dbrows);
+    data->dbrows = NULL;
+    msi_free(data->keycols);
+    data->keycols = NULL;
     g_object_unref(dbview);
     g_object_unref(mergeview);
     return r;
@@ -1949,6 +2948,8 @@ static unsigned gather_merge_data(LibmsiDatabase *db, LibmsiDatabase *merge,
 
     data.db = db;
     data.merge = merge;
+    data.dbrows = NULL;
+    data.keycols = NULL;
     data.tabledata = tabledata;
     r = _libmsi_query_iterate_records(view, NULL, merge_diff_tables, &data);
     g_object_unref(view);
@@ -2073,22 +3074,818 @@ libmsi_database_merge (LibmsiDatabase *db,
         }
     }
 
-    LIST_FOR_EACH_SAFE(item, cursor, &tabledata)
+    LIST_FOR_EACH_SAFE(item, cursor, &tabledata)
+    {
+        table = LIST_ENTRY(item, MERGETABLE, entry);
+        list_remove(&table->entry);
+        free_merge_table(table);
+    }
+
+    if (conflicts)
+        r = LIBMSI_RESULT_FUNCTION_FAILED;
+
+done:
+    if (r != LIBMSI_RESULT_SUCCESS)
+        g_set_error (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+    g_object_unref(db);
+    g_object_unref(merge);
+    return r == LIBMSI_RESULT_SUCCESS;
+}
+
+/* a row of the new side of a table, by primary key */
+typedef struct _tagDIFFROW
+{
+    LibmsiRecord *rec;
+    bool matched;
+} DIFFROW;
+
+typedef struct _tagDIFFDATA
+{
+    EXPORTBUF *buf;
+    unsigned flags;
+    unsigned changes;
+    const char *table;
+    bool changed;
+    MERGETABLE *old;
+    MERGETABLE *new;
+    unsigned *oldkeys;
+    unsigned *newkeys;
+    unsigned numkeys;
+    unsigned *colmap;
+    GHashTable *rows;
+    GPtrArray *order;
+} DIFFDATA;
+
+static unsigned diff_printf( DIFFDATA *data, const char *fmt, ... ) G_GNUC_PRINTF(2,3);
+
+static unsigned diff_printf( DIFFDATA *data, const char *fmt, ... )
+{
+    va_list va;
+    char *line;
+    unsigned r;
+
+    va_start( va, fmt );
+    line = g_strdup_vprintf( fmt, va );
+    va_end( va );
+
+    data->changes++;
+    r = export_write( data->buf, line, strlen( line ) );
+    g_free( line );
+    return r;
+}
+
+/* a difference inside of the current table; the fast mode only names the
+ * table and stops comparing it */
+static unsigned diff_change( DIFFDATA *data, const char *fmt, ... ) G_GNUC_PRINTF(2,3);
+
+static unsigned diff_change( DIFFDATA *data, const char *fmt, ... )
+{
+    va_list va;
+    char *line;
+    unsigned r;
+
+    data->changed = true;
+    if (data->flags & LIBMSI_DIFF_FLAGS_FAST)
+    {
+        r = diff_printf( data, "~ table %s\n", data->table );
+        return r == LIBMSI_RESULT_SUCCESS ? NO_MORE_ITEMS : r;
+    }
+
+    va_start( va, fmt );
+    line = g_strdup_vprintf( fmt, va );
+    va_end( va );
+
+    r = diff_printf( data, "%s\n", line );
+    g_free( line );
+    return r;
+}
+
+static void diff_append_value( GString *str, LibmsiRecord *rec, unsigned field )
+{
+    GsfInput *stm;
+    const char *p;
+
+    if (libmsi_record_is_null( rec, field ))
+        g_string_append( str, "NULL" );
+    else if (_libmsi_record_get_gsf_input( rec, field, &stm ) == LIBMSI_RESULT_SUCCESS)
+    {
+        g_string_append_printf( str, "<%" G_GINT64_FORMAT " bytes>",
+                                (gint64)gsf_input_size( stm ) );
+        g_object_unref( stm );
+    }
+    else if ((p = _libmsi_record_get_string_raw( rec, field )))
+    {
+        g_string_append_c( str, '\'' );
+        for (; *p; p++)
+        {
+            switch (*p)
+            {
+            case '\n': g_string_append( str, "\\n" ); break;
+            case '\r': g_string_append( str, "\\r" ); break;
+            case '\t': g_string_append( str, "\\t" ); break;
+            case '\'':
+            case '\\': g_string_append_c( str, '\\' );
+                /* fall through */
+            default: g_string_append_c( str, *p ); break;
+            }
+        }
+        g_string_append_c( str, '\'' );
+    }
+    else
+        g_string_append_printf( str, "%d", libmsi_record_get_int( rec, field ) );
+}
+
+/* "<sign> row <table> [<keys>]", and the other columns of added and
+ * removed rows */
+static void diff_append_row( GString *str, char sign, const char *table,
+                             LibmsiRecord *rec, MERGETABLE *columns,
+                             const unsigned *keycols, unsigned numkeys )
+{
+    unsigned i, j;
+
+    g_string_append_printf( str, "%c row %s [", sign, table );
+    for (i = 0; i < numkeys; i++)
+    {
+        if (i)
+            g_string_append( str, ", " );
+        diff_append_value( str, rec, keycols[i] );
+    }
+    g_string_append_c( str, ']' );
+
+    if (!columns)
+        return;
+
+    for (i = 1; i <= columns->numcolumns; i++)
+    {
+        for (j = 0; j < numkeys; j++)
+            if (keycols[j] == i)
+                break;
+
+        if (j == numkeys)
+        {
+            g_string_append_printf( str, " %s=", columns->columns[i - 1] );
+            diff_append_value( str, rec, i );
+        }
+    }
+}
+
+/* binary columns are only compared by length, their content is checked
+ * with the streams */
+static bool diff_fields_equal( LibmsiRecord *a, unsigned i, LibmsiRecord *b, unsigned j )
+{
+    GsfInput *sa = NULL, *sb = NULL;
+    const char *stra, *strb;
+    bool equal;
+
+    if (libmsi_record_is_null( a, i ) || libmsi_record_is_null( b, j ))
+        return libmsi_record_is_null( a, i ) && libmsi_record_is_null( b, j );
+
+    _libmsi_record_get_gsf_input( a, i, &sa );
+    _libmsi_record_get_gsf_input( b, j, &sb );
+    if (sa || sb)
+    {
+        equal = sa && sb && gsf_input_size( sa ) == gsf_input_size( sb );
+        if (sa)
+            g_object_unref( sa );
+        if (sb)
+            g_object_unref( sb );
+        return equal;
+    }
+
+    stra = _libmsi_record_get_string_raw( a, i );
+    strb = _libmsi_record_get_string_raw( b, j );
+    if (stra || strb)
+        return stra && strb && !strcmp( stra, strb );
+
+    return libmsi_record_get_int( a, i ) == libmsi_record_get_int( b, j );
+}
+
+static unsigned *diff_key_columns( MERGETABLE *table )
+{
+    unsigned *keycols;
+    unsigned i, j;
+
+    keycols = msi_alloc_zero( table->numlabels * sizeof(*keycols) );
+    if (!keycols)
+        return NULL;
+
+    for (i = 0; i < table->numlabels - 1; i++)
+    {
+        for (j = 0; j < table->numcolumns; j++)
+            if (!strcmp( table->labels[i + 1], table->columns[j] ))
+                break;
+
+        if (j == table->numcolumns)
+        {
+            msi_free( keycols );
+            return NULL;
+        }
+
+        keycols[i] = j + 1;
+    }
+
+    return keycols;
+}
+
+static void diff_free_row( gpointer data )
+{
+    DIFFROW *row = data;
+
+    g_object_unref( row->rec );
+    msi_free( row );
+}
+
+static unsigned diff_hash_row( LibmsiRecord *rec, void *param )
+{
+    DIFFDATA *data = param;
+    DIFFROW *row;
+
+    row = msi_alloc( sizeof *row );
+    if (!row)
+        return LIBMSI_RESULT_OUTOFMEMORY;
+
+    row->rec = g_object_ref( rec );
+    row->matched = false;
+    g_ptr_array_add( data->order, row );
+    g_hash_table_replace( data->rows, row_key( data->newkeys, data->numkeys, rec ), row );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* join a row of the old side with the new rows */
+static unsigned diff_row( LibmsiRecord *rec, void *param )
+{
+    DIFFDATA *data = param;
+    DIFFROW *row = NULL;
+    GString *line;
+    unsigned i, r = LIBMSI_RESULT_SUCCESS;
+    char *key;
+
+    if (data->rows)
+    {
+        key = row_key( data->oldkeys, data->numkeys, rec );
+        row = g_hash_table_lookup( data->rows, key );
+        g_free( key );
+    }
+
+    line = g_string_new( NULL );
+    if (!row)
+    {
+        diff_append_row( line, '-', data->table, rec, data->old,
+                         data->oldkeys, data->numkeys );
+        r = diff_change( data, "%s", line->str );
+    }
+    else
+    {
+        row->matched = true;
+        for (i = 0; i < data->old->numcolumns && r == LIBMSI_RESULT_SUCCESS; i++)
+        {
+            if (!data->colmap[i] || diff_fields_equal( rec, i + 1, row->rec, data->colmap[i] ))
+                continue;
+
+            g_string_truncate( line, 0 );
+            diff_append_row( line, '~', data->table, rec, NULL,
+                             data->oldkeys, data->numkeys );
+            g_string_append_printf( line, " %s: ", data->old->columns[i] );
+            diff_append_value( line, rec, i + 1 );
+            g_string_append( line, " -> " );
+            diff_append_value( line, row->rec, data->colmap[i] );
+            r = diff_change( data, "%s", line->str );
+        }
+    }
+
+    g_string_free( line, TRUE );
+    return r;
+}
+
+static unsigned diff_added_rows( DIFFDATA *data )
+{
+    DIFFROW *row;
+    GString *line;
+    unsigned i, r = LIBMSI_RESULT_SUCCESS;
+
+    line = g_string_new( NULL );
+    for (i = 0; i < data->order->len && r == LIBMSI_RESULT_SUCCESS; i++)
+    {
+        row = g_ptr_array_index( data->order, i );
+        if (row->matched)
+            continue;
+
+        g_string_truncate( line, 0 );
+        diff_append_row( line, '+', data->table, row->rec, data->new,
+                         data->newkeys, data->numkeys );
+        r = diff_change( data, "%s", line->str );
+    }
+
+    g_string_free( line, TRUE );
+    return r == NO_MORE_ITEMS ? LIBMSI_RESULT_SUCCESS : r;
+}
+
+/* rows can only be joined when both sides have the same primary key */
+static unsigned diff_columns( DIFFDATA *data )
+{
+    MERGETABLE *old = data->old, *new = data->new;
+    bool keys = old->numlabels == new->numlabels;
+    unsigned i, j, r = LIBMSI_RESULT_SUCCESS;
+
+    for (i = 1; keys && i < old->numlabels; i++)
+        keys = !strcmp( old->labels[i], new->labels[i] );
+
+    if (!keys)
+    {
+        r = diff_change( data, "~ table %s: primary key changed", data->table );
+        return r == LIBMSI_RESULT_SUCCESS ? NO_MORE_ITEMS : r;
+    }
+
+    data->colmap = msi_alloc_zero( old->numcolumns * sizeof(*data->colmap) );
+    if (!data->colmap)
+        return LIBMSI_RESULT_OUTOFMEMORY;
+
+    for (i = 0; i < old->numcolumns && r == LIBMSI_RESULT_SUCCESS; i++)
+    {
+        for (j = 0; j < new->numcolumns; j++)
+            if (!strcmp( old->columns[i], new->columns[j] ))
+                break;
+
+        if (j == new->numcolumns)
+            r = diff_change( data, "- column %s.%s", data->table, old->columns[i] );
+        else
+        {
+            data->colmap[i] = j + 1;
+            if (strcmp( old->types[i], new->types[j] ))
+                r = diff_change( data, "~ column %s.%s: %s -> %s", data->table,
+                                 old->columns[i], old->types[i], new->types[j] );
+        }
+    }
+
+    for (j = 0; j < new->numcolumns && r == LIBMSI_RESULT_SUCCESS; j++)
+    {
+        for (i = 0; i < old->numcolumns; i++)
+            if (data->colmap[i] == j + 1)
+                break;
+
+        if (i == old->numcolumns)
+            r = diff_change( data, "+ column %s.%s %s", data->table,
+                             new->columns[j], new->types[j] );
+    }
+
+    return r;
+}
+
+static unsigned diff_open_table( LibmsiDatabase *db, const char *name,
+                                 MERGETABLE **table, unsigned **keycols,
+                                 LibmsiQuery **view )
+{
+    static const char query[] = "SELECT * FROM `%s`";
+    unsigned r;
+
+    r = msi_get_merge_table( db, name, table );
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
+
+    *keycols = diff_key_columns( *table );
+    if (!*keycols)
+        return LIBMSI_RESULT_DATATYPE_MISMATCH;
+
+    return _libmsi_query_open( db, view, query, name );
+}
+
+static unsigned diff_table( DIFFDATA *data, LibmsiDatabase *db,
+                            LibmsiDatabase *other, const char *name )
+{
+    LibmsiQuery *oldview = NULL, *newview = NULL;
+    bool in_old, in_new;
+    unsigned r = LIBMSI_RESULT_SUCCESS;
+
+    TRACE("%s\n", debugstr_a(name));
+
+    data->table = name;
+    data->changed = false;
+    in_old = table_view_exists( db, name );
+    in_new = table_view_exists( other, name );
+
+    if (in_old)
+    {
+        r = diff_open_table( db, name, &data->old, &data->oldkeys, &oldview );
+        data->numkeys = data->old ? data->old->numlabels - 1 : 0;
+    }
+    if (in_new && r == LIBMSI_RESULT_SUCCESS)
+    {
+        r = diff_open_table( other, name, &data->new, &data->newkeys, &newview );
+        data->numkeys = data->new ? data->new->numlabels - 1 : 0;
+    }
+    if (r != LIBMSI_RESULT_SUCCESS)
+        goto done;
+
+    if (in_old && in_new)
+        r = diff_columns( data );
+    else
+    {
+        r = diff_printf( data, "%c table %s\n", in_old ? '-' : '+', name );
+        if (data->flags & LIBMSI_DIFF_FLAGS_FAST)
+            goto done;
+    }
+
+    if (in_new && r == LIBMSI_RESULT_SUCCESS)
+    {
+        data->rows = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
+        data->order = g_ptr_array_new_with_free_func( diff_free_row );
+        r = _libmsi_query_iterate_records( newview, NULL, diff_hash_row, data );
+    }
+    if (in_old && r == LIBMSI_RESULT_SUCCESS)
+        r = _libmsi_query_iterate_records( oldview, NULL, diff_row, data );
+    if (in_new && r == LIBMSI_RESULT_SUCCESS &&
+        !(data->changed && (data->flags & LIBMSI_DIFF_FLAGS_FAST)))
+        r = diff_added_rows( data );
+
+done:
+    if (r == NO_MORE_ITEMS)
+        r = LIBMSI_RESULT_SUCCESS;
+
+    if (data->rows)
+        g_hash_table_destroy( data->rows );
+    if (data->order)
+        g_ptr_array_free( data->order, TRUE );
+    if (data->old)
+        free_merge_table( data->old );
+    if (data->new)
+        free_merge_table( data->new );
+    msi_free( data->oldkeys );
+    msi_free( data->newkeys );
+    msi_free( data->colmap );
+    data->rows = NULL;
+    data->order = NULL;
+    data->old = data->new = NULL;
+    data->oldkeys = data->newkeys = data->colmap = NULL;
+
+    if (oldview)
+        g_object_unref( oldview );
+    if (newview)
+        g_object_unref( newview );
+    return r;
+}
+
+/* the SHA-256 of a stream, read in large chunks rather than in one piece */
+static unsigned diff_stream_digest( GsfInput *stm, char **digest )
+{
+    const guint8 *data;
+    GChecksum *sum;
+    GsfInput *in;
+    gsf_off_t left;
+    size_t len;
+
+    in = gsf_input_dup( stm, NULL );
+    if (!in)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    sum = g_checksum_new( G_CHECKSUM_SHA256 );
+    gsf_input_seek( in, 0, G_SEEK_SET );
+    left = gsf_input_size( in );
+    while (left > 0)
+    {
+        len = MIN( left, EXTRACT_CHUNK_SIZE );
+        data = gsf_input_read( in, len, NULL );
+        if (!data)
+            break;
+
+        g_checksum_update( sum, data, len );
+        left -= len;
+    }
+
+    if (!left)
+        *digest = g_strdup( g_checksum_get_string( sum ) );
+
+    g_checksum_free( sum );
+    g_object_unref( in );
+    return left ? LIBMSI_RESULT_FUNCTION_FAILED : LIBMSI_RESULT_SUCCESS;
+}
+
+/* streams of different lengths differ without reading them */
+static unsigned diff_stream( DIFFDATA *data, const char *name,
+                             GsfInput *old, GsfInput *new )
+{
+    char *olddigest = NULL, *newdigest = NULL;
+    gsf_off_t oldsize, newsize;
+    unsigned r;
+
+    oldsize = gsf_input_size( old );
+    newsize = gsf_input_size( new );
+    if (oldsize != newsize)
+        return diff_printf( data, "~ stream %s: %" G_GINT64_FORMAT " -> %"
+                            G_GINT64_FORMAT " bytes\n", name,
+                            (gint64)oldsize, (gint64)newsize );
+
+    r = diff_stream_digest( old, &olddigest );
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = diff_stream_digest( new, &newdigest );
+    if (r == LIBMSI_RESULT_SUCCESS && strcmp( olddigest, newdigest ))
+        r = diff_printf( data, "~ stream %s: sha256 %s -> %s\n",
+                         name, olddigest, newdigest );
+
+    g_free( olddigest );
+    g_free( newdigest );
+    return r;
+}
+
+static unsigned diff_streams( DIFFDATA *data, LibmsiDatabase *db, LibmsiDatabase *other )
+{
+    LibmsiStream *stream, *match;
+    LibmsiStorage *storage;
+    unsigned r = LIBMSI_RESULT_SUCCESS;
+    char *name;
+
+    LIST_FOR_EACH_ENTRY( stream, &db->streams, LibmsiStream, entry )
+    {
+        name = decode_streamname( stream->name );
+        match = find_stream( other, stream->name );
+        if (match)
+            r = diff_stream( data, name, stream->stm, match->stm );
+        else
+            r = diff_printf( data, "- stream %s\n", name );
+        g_free( name );
+
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    LIST_FOR_EACH_ENTRY( stream, &other->streams, LibmsiStream, entry )
+    {
+        if (find_stream( db, stream->name ))
+            continue;
+
+        name = decode_streamname( stream->name );
+        r = diff_printf( data, "+ stream %s\n", name );
+        g_free( name );
+
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    LIST_FOR_EACH_ENTRY( storage, &db->storages, LibmsiStorage, entry )
+        if (r == LIBMSI_RESULT_SUCCESS && !find_storage( other, storage->name ))
+            r = diff_printf( data, "- storage %s\n", storage->name );
+
+    LIST_FOR_EACH_ENTRY( storage, &other->storages, LibmsiStorage, entry )
+        if (r == LIBMSI_RESULT_SUCCESS && !find_storage( db, storage->name ))
+            r = diff_printf( data, "+ storage %s\n", storage->name );
+
+    return r;
+}
+
+/**
+ * libmsi_database_diff:
+ * @db: a %LibmsiDatabase
+ * @other: the %LibmsiDatabase to compare @db with
+ * @flags: #LibmsiDiffFlags
+ * @fd: a file descriptor to write the differences to
+ * @count: (out) (allow-none): return location for the number of
+ *   differences, or %NULL
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Writes the differences from @db to @other to @fd, one per line.  The
+ * rows of a table are matched by primary key, so that the order of the
+ * rows does not matter, and are reported as added ("+ row"), removed
+ * ("- row"), or with the old and new value of each changed column
+ * ("~ row").  Streams are compared by length, then by SHA-256 checksum.
+ *
+ * With %LIBMSI_DIFF_FLAGS_FAST, only the names of the tables that differ
+ * are written, and each table is compared up to its first difference.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+libmsi_database_diff (LibmsiDatabase *db,
+                      LibmsiDatabase *other,
+                      guint flags,
+                      int fd,
+                      guint *count,
+                      GError **error)
+{
+    unsigned oldcp, newcp;
+    GPtrArray *tables;
+    DIFFDATA data;
+    unsigned r, i, n;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (other), FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    TRACE("%p %p %x %d\n", db, other, flags, fd);
+
+    memset( &data, 0, sizeof data );
+    data.flags = flags;
+    data.buf = msi_alloc( sizeof *data.buf );
+    if (!data.buf)
+    {
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_OUTOFMEMORY, G_STRFUNC);
+        return FALSE;
+    }
+    data.buf->fd = fd;
+    data.buf->len = 0;
+
+    g_object_ref(db);
+    g_object_ref(other);
+    tables = g_ptr_array_new_with_free_func (g_free);
+
+    r = LIBMSI_RESULT_SUCCESS;
+    oldcp = msi_get_string_table_codepage (db->strings);
+    newcp = msi_get_string_table_codepage (other->strings);
+    if (oldcp != newcp)
+        r = diff_printf (&data, "~ codepage %u -> %u\n", oldcp, newcp);
+
+    /* the tables of db in order, then the ones only in other */
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = list_tables (db, tables);
+    n = tables->len;
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = list_tables (other, tables);
+
+    for (i = 0; i < tables->len && r == LIBMSI_RESULT_SUCCESS; i++)
+    {
+        const char *name = g_ptr_array_index (tables, i);
+
+        if (i >= n && table_view_exists (db, name))
+            continue;
+
+        r = diff_table (&data, db, other, name);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            g_set_error (error, LIBMSI_RESULT_ERROR, r,
+                         "failed to compare table %s", name);
+    }
+
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = diff_streams (&data, db, other);
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = export_flush (data.buf);
+    if (r != LIBMSI_RESULT_SUCCESS && error && !*error)
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+
+    if (count)
+        *count = data.changes;
+
+    g_ptr_array_free (tables, TRUE);
+    msi_free (data.buf);
+    g_object_unref(db);
+    g_object_unref(other);
+
+    return r == LIBMSI_RESULT_SUCCESS;
+}
+
+#define STATS_LARGEST_STREAMS 10
+
+static gint compare_stream_sizes (gconstpointer a, gconstpointer b)
+{
+    gsf_off_t sa = gsf_input_size ((*(LibmsiStream * const *)a)->stm);
+    gsf_off_t sb = gsf_input_size ((*(LibmsiStream * const *)b)->stm);
+
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+static guint64 stats_table_stream_size( LibmsiDatabase *db, const char *name )
+{
+    GsfInput *stm = NULL;
+    guint64 size = 0;
+    char *encname;
+
+    encname = encode_streamname( true, name );
+    if (db->infile)
+        stm = gsf_infile_child_by_name( db->infile, encname );
+    msi_free( encname );
+
+    if (stm)
+    {
+        size = gsf_input_size( stm );
+        g_object_unref( stm );
+    }
+    return size;
+}
+
+/**
+ * libmsi_database_get_stats:
+ * @db: a %LibmsiDatabase
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Collects the sizes of the tables, string pool and streams of @db, in
+ * one pass and without reading the tables that are not loaded yet.  The
+ * result is a dictionary with the following entries:
+ *
+ * - "codepage" (u)
+ * - "bytes-per-strref" (u): the size of a string reference in the table
+ *   streams, 2 or 3
+ * - "strings" (u), "string-bytes" (t), "string-refs" (t): the number of
+ *   strings in use, their total length and their total reference count
+ * - "string-pool-bytes" (t): the size of the _StringPool and
+ *   _StringData streams the database was opened with
+ * - "string-memory" (t): an estimate of the memory of the string table
+ * - "tables" (a(suuttt)): the name, row count, column count and stream
+ *   size of each table, with estimates of the memory of its rows and of
+ *   the column hash indexes built so far
+ * - "streams" (u), "stream-bytes" (t): the streams of _Streams
+ * - "largest-streams" (a(st)): the names and sizes of the largest streams
+ * - "memory" (t): the sum of the memory estimates
+ *
+ * Returns: (transfer full): a #GVariant of type a{sv}, or %NULL on error
+ **/
+GVariant *
+libmsi_database_get_stats (LibmsiDatabase *db, GError **error)
+{
+    GVariantBuilder builder, tables, largest;
+    LibmsiStringStats strings;
+    LibmsiTableStats stats;
+    LibmsiStream *stream;
+    GPtrArray *names, *streams;
+    GVariant *result = NULL;
+    guint64 memory, stream_bytes = 0;
+    unsigned r, i;
+    char *name;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), NULL);
+    g_return_val_if_fail (!error || *error == NULL, NULL);
+
+    TRACE("%p\n", db);
+
+    g_object_ref(db);
+    names = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (names, g_strdup ("_Tables"));
+    g_ptr_array_add (names, g_strdup ("_Columns"));
+    r = list_tables (db, names);
+    if (r != LIBMSI_RESULT_SUCCESS)
+    {
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+        goto end;
+    }
+
+    msi_get_string_table_stats (db->strings, &strings);
+    memory = strings.memory;
+
+    g_variant_builder_init (&tables, G_VARIANT_TYPE ("a(suuttt)"));
+    for (i = 0; i < names->len; i++)
+    {
+        name = g_ptr_array_index (names, i);
+        r = msi_get_table_stats (db, name, &stats);
+        if (r != LIBMSI_RESULT_SUCCESS)
+        {
+            g_set_error (error, LIBMSI_RESULT_ERROR, r, "failed to read table %s", name);
+            g_variant_builder_clear (&tables);
+            goto end;
+        }
+
+        memory += stats.data_bytes + stats.index_bytes;
+        g_variant_builder_add (&tables, "(suuttt)", name, stats.rows, stats.columns,
+                               (guint64)stats.stream_bytes, (guint64)stats.data_bytes,
+                               (guint64)stats.index_bytes);
+    }
+
+    streams = g_ptr_array_new ();
+    LIST_FOR_EACH_ENTRY( stream, &db->streams, LibmsiStream, entry )
+    {
+        g_ptr_array_add (streams, stream);
+        stream_bytes += gsf_input_size (stream->stm);
+    }
+    g_ptr_array_sort (streams, compare_stream_sizes);
+
+    g_variant_builder_init (&largest, G_VARIANT_TYPE ("a(st)"));
+    for (i = 0; i < streams->len && i < STATS_LARGEST_STREAMS; i++)
     {
-        table = LIST_ENTRY(item, MERGETABLE, entry);
-        list_remove(&table->entry);
-        free_merge_table(table);
+        stream = g_ptr_array_index (streams, i);
+        name = decode_streamname (stream->name);
+        g_variant_builder_add (&largest, "(st)", name, (guint64)gsf_input_size (stream->stm));
+        g_free (name);
     }
 
-    if (conflicts)
-        r = LIBMSI_RESULT_FUNCTION_FAILED;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&builder, "{sv}", "codepage",
+                           g_variant_new_uint32 (msi_get_string_table_codepage (db->strings)));
+    g_variant_builder_add (&builder, "{sv}", "bytes-per-strref",
+                           g_variant_new_uint32 (db->bytes_per_strref));
+    g_variant_builder_add (&builder, "{sv}", "strings",
+                           g_variant_new_uint32 (strings.count));
+    g_variant_builder_add (&builder, "{sv}", "string-bytes",
+                           g_variant_new_uint64 (strings.bytes));
+    g_variant_builder_add (&builder, "{sv}", "string-refs",
+                           g_variant_new_uint64 (strings.refs));
+    g_variant_builder_add (&builder, "{sv}", "string-pool-bytes",
+                           g_variant_new_uint64 (stats_table_stream_size (db, szStringPool) +
+                                                 stats_table_stream_size (db, szStringData)));
+    g_variant_builder_add (&builder, "{sv}", "string-memory",
+                           g_variant_new_uint64 (strings.memory));
+    g_variant_builder_add (&builder, "{sv}", "tables",
+                           g_variant_builder_end (&tables));
+    g_variant_builder_add (&builder, "{sv}", "streams",
+                           g_variant_new_uint32 (streams->len));
+    g_variant_builder_add (&builder, "{sv}", "stream-bytes",
+                           g_variant_new_uint64 (stream_bytes));
+    g_variant_builder_add (&builder, "{sv}", "largest-streams",
+                           g_variant_builder_end (&largest));
+    g_variant_builder_add (&builder, "{sv}", "memory",
+                           g_variant_new_uint64 (memory));
+    result = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+    g_ptr_array_free (streams, TRUE);
 
-done:
-    if (r != LIBMSI_RESULT_SUCCESS)
-        g_set_error (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+end:
+    g_ptr_array_free (names, TRUE);
     g_object_unref(db);
-    g_object_unref(merge);
-    return r == LIBMSI_RESULT_SUCCESS;
+    return result;
 }
 
 /**
@@ -2109,6 +3906,7 @@ libmsi_database_is_readonly (LibmsiDatabase *db)
 
 static void cache_infile_structure( LibmsiDatabase *db )
 {
+    int64_t start = msi_span_begin();
     int i, n;
     unsigned r;
 
@@ -2151,10 +3949,13 @@ static void cache_infile_structure( LibmsiDatabase *db )
         }
 
     }
+
+    msi_span_end( "cache_infile_structure", start );
 }
 
 LibmsiResult _libmsi_database_open(LibmsiDatabase *db)
 {
+    int64_t start = msi_span_begin();
     GsfInput *in;
     GsfInfile *stg;
     uint8_t uuid[16];
@@ -2215,6 +4016,7 @@ end:
         db->infile = NULL;
     }
     g_object_unref(G_OBJECT(stg));
+    msi_span_end( "open", start );
     return ret;
 }
 
@@ -2287,6 +4089,318 @@ libmsi_database_apply_transform (LibmsiDatabase *db,
     return r == LIBMSI_RESULT_SUCCESS;
 }
 
+static unsigned database_save (LibmsiDatabase *db, GError **error);
+
+typedef struct _LibmsiVariant {
+    LibmsiDatabase *db;
+    const char *transform;
+    unsigned r;
+    GError *error;
+} LibmsiVariant;
+
+/*
+ * A snapshot is a copy of base, written to outpath if there is one.  It
+ * shares the rows of the tables and the strings of base until either
+ * database changes them.  With @own_storage it reads the streams of the
+ * file through a storage of its own, so that snapshots can be written from
+ * several threads; inputs it still has to share with base are reported
+ * through @shared.  Otherwise it shares the streams of base as well.
+ */
+static unsigned database_snapshot( LibmsiDatabase *base, const char *outpath,
+                                   bool own_storage, LibmsiDatabase **pdb, bool *shared )
+{
+    LibmsiDatabase *db;
+    LibmsiStream *stream;
+    LibmsiStorage *storage, *s;
+    LibmsiTransform *transform, *t;
+    GsfInput *in;
+    unsigned r = LIBMSI_RESULT_SUCCESS;
+
+    TRACE("%p %s\n", base, debugstr_a(outpath));
+
+    db = g_object_new (LIBMSI_TYPE_DATABASE,
+                       "path", base->path,
+                       "outpath", outpath,
+                       "flags", base->flags & LIBMSI_DB_FLAGS_PATCH,
+                       NULL);
+
+    if (base->infile && !own_storage)
+        db->infile = g_object_ref (base->infile);
+    else if (base->infile)
+    {
+        in = gsf_input_stdio_new (base->path, NULL);
+        if (in)
+        {
+            db->infile = gsf_infile_msole_new (in, NULL);
+            g_object_unref (G_OBJECT(in));
+        }
+        if (!db->infile)
+        {
+            r = LIBMSI_RESULT_OPEN_FAILED;
+            goto end;
+        }
+    }
+
+    db->strings = msi_clone_string_table (base->strings);
+    if (!db->strings)
+    {
+        r = LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+        goto end;
+    }
+    db->bytes_per_strref = base->bytes_per_strref;
+    db->media_transform_offset = base->media_transform_offset;
+    db->media_transform_disk_id = base->media_transform_disk_id;
+
+    r = msi_table_share_tables (db, base);
+    if (r != LIBMSI_RESULT_SUCCESS)
+        goto end;
+
+    LIST_FOR_EACH_ENTRY( stream, &base->streams, LibmsiStream, entry )
+    {
+        GsfInfile *container = gsf_input_container (stream->stm);
+
+        if (!own_storage)
+            in = g_object_ref (stream->stm);
+        else if (db->infile && container == base->infile)
+            in = gsf_infile_child_by_name (db->infile, stream->name);
+        else
+        {
+            /* memory and file inputs can be duplicated safely */
+            if (container)
+                *shared = true;
+            in = gsf_input_dup (stream->stm, NULL);
+        }
+        if (!in)
+        {
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+            goto end;
+        }
+
+        r = msi_alloc_stream (db, stream->name, in);
+        g_object_unref (G_OBJECT(in));
+        if (r != LIBMSI_RESULT_SUCCESS)
+            goto end;
+    }
+
+    LIST_FOR_EACH_ENTRY( storage, &base->storages, LibmsiStorage, entry )
+    {
+        if (!(s = msi_alloc_zero (sizeof(LibmsiStorage))))
+        {
+            r = LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+            goto end;
+        }
+        s->name = strdup (storage->name);
+
+        if (own_storage && db->infile &&
+            gsf_input_container (GSF_INPUT(storage->stg)) == base->infile)
+        {
+            in = gsf_infile_child_by_name (db->infile, storage->name);
+            if (in && GSF_IS_INFILE(in))
+                s->stg = GSF_INFILE(in);
+            else if (in)
+                g_object_unref (G_OBJECT(in));
+        }
+        else
+        {
+            if (own_storage)
+                *shared = true;
+            s->stg = g_object_ref (storage->stg);
+        }
+
+        if (!s->stg)
+        {
+            msi_free (s->name);
+            msi_free (s);
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+            goto end;
+        }
+        add_storage( db, s );
+    }
+
+    LIST_FOR_EACH_ENTRY( transform, &base->transforms, LibmsiTransform, entry )
+    {
+        if (own_storage)
+            *shared = true;
+        if (!(t = msi_alloc( sizeof *t )))
+        {
+            r = LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+            goto end;
+        }
+        t->stg = g_object_ref (transform->stg);
+        list_add_tail( &db->transforms, &t->entry );
+    }
+
+    if (outpath)
+        r = _libmsi_database_start_transaction (db);
+
+end:
+    if (r != LIBMSI_RESULT_SUCCESS)
+        g_object_unref (db);
+    else
+        *pdb = db;
+    return r;
+}
+
+static void apply_variant (gpointer data, gpointer user_data)
+{
+    LibmsiVariant *v = data;
+
+    v->r = _libmsi_database_apply_transform (v->db, v->transform);
+    if (v->r != LIBMSI_RESULT_SUCCESS)
+        g_set_error (&v->error, LIBMSI_RESULT_ERROR, v->r,
+                     "failed to apply transform %s", v->transform);
+    else
+        v->r = database_save (v->db, &v->error);
+
+    _libmsi_database_close (v->db, v->r == LIBMSI_RESULT_SUCCESS);
+}
+
+/**
+ * libmsi_database_apply_transforms:
+ * @db: a %LibmsiDatabase
+ * @transforms: (array zero-terminated=1): MST transform file paths
+ * @outputs: (array zero-terminated=1): the MSI file paths to write, one
+ * for each transform
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Writes one copy of @db for each transform, with that transform applied.
+ * @db itself is left unchanged.  The copies share the tables of @db until
+ * a transform changes them, and they are written in parallel.
+ *
+ * Returns: %TRUE if every output was written
+ **/
+gboolean
+libmsi_database_apply_transforms (LibmsiDatabase *db,
+                                  const char * const *transforms,
+                                  const char * const *outputs,
+                                  GError **error)
+{
+    LibmsiVariant *variants;
+    GThreadPool *pool;
+    unsigned i, n, r = LIBMSI_RESULT_SUCCESS;
+    bool shared = false;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (transforms, FALSE);
+    g_return_val_if_fail (outputs, FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    n = g_strv_length ((gchar **) transforms);
+    g_return_val_if_fail (g_strv_length ((gchar **) outputs) == n, FALSE);
+
+    TRACE("%p %u\n", db, n);
+
+    g_object_ref(db);
+    variants = g_new0 (LibmsiVariant, n);
+    for (i = 0; i < n && r == LIBMSI_RESULT_SUCCESS; i++)
+    {
+        variants[i].transform = transforms[i];
+        r = database_snapshot (db, outputs[i], true, &variants[i].db, &shared);
+    }
+
+    if (r != LIBMSI_RESULT_SUCCESS)
+        g_set_error (error, LIBMSI_RESULT_ERROR, r,
+                     "failed to open %s", outputs[i - 1]);
+    else
+    {
+        /* inputs shared with db can only be read from one thread */
+        pool = g_thread_pool_new (apply_variant, NULL,
+                                  shared ? 1 : (int) g_get_num_processors (),
+                                  FALSE, NULL);
+        for (i = 0; i < n; i++)
+            g_thread_pool_push (pool, &variants[i], NULL);
+        g_thread_pool_free (pool, FALSE, TRUE);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (variants[i].error)
+        {
+            if (r == LIBMSI_RESULT_SUCCESS)
+            {
+                r = variants[i].r;
+                g_propagate_error (error, variants[i].error);
+            }
+            else
+                g_error_free (variants[i].error);
+        }
+        if (variants[i].db)
+            g_object_unref (variants[i].db);
+    }
+    g_free (variants);
+    g_object_unref(db);
+
+    return r == LIBMSI_RESULT_SUCCESS;
+}
+
+/**
+ * libmsi_database_generate_transform:
+ * @db: a %LibmsiDatabase
+ * @ref: the %LibmsiDatabase the transform applies to
+ * @file: the MST transform file path to write
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Writes a transform that turns @ref into @db when applied with
+ * libmsi_database_apply_transform().  Rows are matched on their primary
+ * keys; the tables of both databases must have the same columns, except
+ * for columns added at the end of a table in @db.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+libmsi_database_generate_transform (LibmsiDatabase *db,
+                                    LibmsiDatabase *ref,
+                                    const char *file,
+                                    GError **error)
+{
+    unsigned r = LIBMSI_RESULT_SUCCESS;
+    GsfOutput *out;
+    GsfOutfile *stg;
+
+    TRACE("%p %p %s\n", db, ref, debugstr_a(file));
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (ref), FALSE);
+    g_return_val_if_fail (file, FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    out = gsf_output_stdio_new (file, NULL);
+    if (!out) {
+        g_set_error (error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_OPEN_FAILED,
+                     "failed to open %s", file);
+        return FALSE;
+    }
+
+    stg = gsf_outfile_msole_new (out);
+    g_object_unref (out);
+    if (!stg) {
+        g_set_error (error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_OPEN_FAILED,
+                     "failed to create %s", file);
+        return FALSE;
+    }
+
+    g_object_ref (db);
+    g_object_ref (ref);
+
+    if (!gsf_outfile_msole_set_class_id (GSF_OUTFILE_MSOLE (stg), clsid_msi_transform))
+        r = LIBMSI_RESULT_FUNCTION_FAILED;
+
+    if (r == LIBMSI_RESULT_SUCCESS)
+        r = msi_table_generate_transform (db, ref, stg);
+
+    if (!gsf_output_close (GSF_OUTPUT (stg)) && r == LIBMSI_RESULT_SUCCESS)
+        r = LIBMSI_RESULT_FUNCTION_FAILED;
+    g_object_unref (stg);
+
+    g_object_unref (ref);
+    g_object_unref (db);
+
+    if (r != LIBMSI_RESULT_SUCCESS)
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+
+    return r == LIBMSI_RESULT_SUCCESS;
+}
+
 static int gsf_infile_copy(GsfInfile *inf, GsfOutfile *outf)
 {
     int n = gsf_infile_num_children(inf);
@@ -2355,6 +4469,7 @@ static unsigned commit_stream( const char *name, GsfInput *stm, void *opaque)
     if ( !gsf_input_copy( stm, outstm ))
         goto end;
 
+    msi_count_stream( decname, 0, gsf_input_size( stm ) );
     ret = LIBMSI_RESULT_SUCCESS;
 
 end:
@@ -2363,59 +4478,82 @@ end:
     return ret;
 }
 
-/**
- * libmsi_database_commit:
- * @db: a #LibmsiDatabase
- * @error: (allow-none): #GError to set on error, or %NULL
- *
- * Returns: %TRUE on success.
- **/
-gboolean
-libmsi_database_commit (LibmsiDatabase *db, GError **error)
+/* write the string table, storages, streams and tables to db->outfile */
+static unsigned database_save (LibmsiDatabase *db, GError **error)
 {
-    unsigned r = LIBMSI_RESULT_SUCCESS;
+    unsigned r;
     unsigned bytes_per_strref;
 
-    TRACE ("%p\n", db);
-
-    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
-    g_return_val_if_fail (!error || *error == NULL, FALSE);
-
-    g_object_ref(db);
-    if (db->flags & LIBMSI_DB_FLAGS_READONLY)
-        goto end;
-
-    /* FIXME: lock the database */
-
-    r = msi_save_string_table (db->strings, db, &bytes_per_strref);
+    bytes_per_strref = 0;
+    r = msi_save_string_table (db->strings, db->outfile, &bytes_per_strref);
     if (r != LIBMSI_RESULT_SUCCESS) {
         g_set_error (error, LIBMSI_RESULT_ERROR, r,
                      "failed to save string table r=%08x\n", r);
-        goto end;
+        return r;
     }
 
     r = msi_enum_db_storages (db, commit_storage, db);
     if (r != LIBMSI_RESULT_SUCCESS) {
         g_set_error (error, LIBMSI_RESULT_ERROR, r,
                      "failed to save storages r=%08x\n", r);
-        goto end;
+        return r;
     }
 
     r = msi_enum_db_streams (db, commit_stream, db);
     if (r != LIBMSI_RESULT_SUCCESS) {
         g_set_error (error, LIBMSI_RESULT_ERROR, r,
                      "failed to save streams r=%08x\n", r);
-        goto end;
+        return r;
     }
 
     r = _libmsi_database_commit_tables (db, bytes_per_strref);
     if (r != LIBMSI_RESULT_SUCCESS) {
         g_set_error (error, LIBMSI_RESULT_ERROR, r,
                      "failed to save tables r=%08x\n", r);
-        goto end;
+        return r;
     }
 
     db->bytes_per_strref = bytes_per_strref;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/**
+ * libmsi_database_commit:
+ * @db: a #LibmsiDatabase
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Returns: %TRUE on success.
+ **/
+gboolean
+libmsi_database_commit (LibmsiDatabase *db, GError **error)
+{
+    unsigned r = LIBMSI_RESULT_SUCCESS;
+    int64_t start;
+
+    TRACE ("%p\n", db);
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), FALSE);
+    g_return_val_if_fail (!error || *error == NULL, FALSE);
+
+    g_object_ref(db);
+    if (db->flags & LIBMSI_DB_FLAGS_READONLY)
+        goto end;
+
+    /* a snapshot without an output file */
+    if (!db->outfile) {
+        r = LIBMSI_RESULT_ACCESS_DENIED;
+        g_set_error (error, LIBMSI_RESULT_ERROR, r,
+                     "the database has no output file");
+        goto end;
+    }
+
+    /* FIXME: lock the database */
+
+    start = msi_span_begin ();
+    r = database_save (db, error);
+    msi_span_end ("commit", start);
+    if (r != LIBMSI_RESULT_SUCCESS)
+        goto end;
 
     /* FIXME: unlock the database */
 
@@ -2628,6 +4766,40 @@ libmsi_database_new (const gchar *path,
     return self;
 }
 
+/**
+ * libmsi_database_snapshot:
+ * @db: a #LibmsiDatabase
+ * @persist: (allow-none): path to output MSI file
+ * @error: (allow-none): #GError to set on error, or %NULL
+ *
+ * Create a copy of @db that shares its tables, strings and streams.  A
+ * row is copied the first time either database writes to it, so changes
+ * to the snapshot don't affect @db and the other way round.  The snapshot
+ * can be committed to @persist; without it, it lives in memory only.
+ *
+ * Returns: a new #LibmsiDatabase on success, %NULL if fail.
+ **/
+LibmsiDatabase *
+libmsi_database_snapshot (LibmsiDatabase *db,
+                          const char *persist,
+                          GError **error)
+{
+    LibmsiDatabase *snapshot = NULL;
+    unsigned r;
+
+    g_return_val_if_fail (LIBMSI_IS_DATABASE (db), NULL);
+    g_return_val_if_fail (!error || *error == NULL, NULL);
+
+    g_object_ref(db);
+    r = database_snapshot (db, persist, false, &snapshot, NULL);
+    g_object_unref(db);
+
+    if (r != LIBMSI_RESULT_SUCCESS)
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+
+    return snapshot;
+}
+
 /**
  * libmsi_database_set_codepage:
  * @db: a %LibmsiDatabase
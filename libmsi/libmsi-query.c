@@ -40,14 +40,13 @@ G_DEFINE_TYPE (LibmsiQuery, libmsi_query, G_TYPE_OBJECT);
 static void
 libmsi_query_init (LibmsiQuery *self)
 {
-    list_init (&self->mem);
+    msi_arena_init (&self->mem);
 }
 
 static void
 libmsi_query_finalize (GObject *object)
 {
     LibmsiQuery *self = LIBMSI_QUERY (object);
-    struct list *ptr, *t;
 
     if (self->view && self->view->ops->delete)
         self->view->ops->delete (self->view);
@@ -55,9 +54,7 @@ libmsi_query_finalize (GObject *object)
     if (self->database)
         g_object_unref (self->database);
 
-    LIST_FOR_EACH_SAFE (ptr, t, &self->mem) {
-        msi_free (ptr);
-    }
+    msi_arena_free (&self->mem);
 
     g_free (self->query);
 
@@ -270,6 +267,8 @@ LibmsiRecord *_libmsi_query_get_record( LibmsiDatabase *db, const char *fmt, ...
 
     if( r == LIBMSI_RESULT_SUCCESS )
     {
+        /* only the first row is wanted, let the view stop there */
+        msi_view_limit( view->view, 1, 0 );
         _libmsi_query_execute( view, NULL );
         _libmsi_query_fetch( view, &rec );
         libmsi_query_close( view, &error );
@@ -282,21 +281,37 @@ LibmsiRecord *_libmsi_query_get_record( LibmsiDatabase *db, const char *fmt, ...
     return rec;
 }
 
+unsigned msi_view_row_available(LibmsiView *view, unsigned row)
+{
+    unsigned row_count = 0, ret;
+
+    if (view->ops->row_available)
+        return view->ops->row_available(view, row);
+
+    ret = view->ops->get_dimensions(view, &row_count, NULL);
+    if (ret)
+        return ret;
+
+    return row < row_count ? LIBMSI_RESULT_SUCCESS : NO_MORE_ITEMS;
+}
+
 unsigned msi_view_get_row(LibmsiDatabase *db, LibmsiView *view, unsigned row, LibmsiRecord **rec)
 {
-    unsigned row_count = 0, col_count = 0, i, ival, ret, type;
+    unsigned col_count = 0, i, ival, ret, type;
 
     TRACE("%p %p %d %p\n", db, view, row, rec);
 
-    ret = view->ops->get_dimensions(view, &row_count, &col_count);
+    ret = view->ops->get_dimensions(view, NULL, &col_count);
     if (ret)
         return ret;
 
     if (!col_count)
         return LIBMSI_RESULT_INVALID_PARAMETER;
 
-    if (row >= row_count)
-        return NO_MORE_ITEMS;
+    /* views producing rows lazily need not know how many there are */
+    ret = msi_view_row_available(view, row);
+    if (ret)
+        return ret;
 
     *rec = libmsi_record_new (col_count);
     if (!*rec)
@@ -360,6 +375,71 @@ unsigned msi_view_get_row(LibmsiDatabase *db, LibmsiView *view, unsigned row, Li
     return LIBMSI_RESULT_SUCCESS;
 }
 
+unsigned msi_view_explain(LibmsiView *view, GString *str, unsigned depth)
+{
+    TRACE("%p %p %u\n", view, str, depth);
+
+    if (!view->ops->explain)
+    {
+        g_string_append_printf(str, "%*sVIEW", depth * 2, "");
+        msi_view_explain_end(view, str);
+        return LIBMSI_RESULT_SUCCESS;
+    }
+
+    return view->ops->explain(view, str, depth);
+}
+
+unsigned msi_view_limit(LibmsiView *view, unsigned limit, unsigned offset)
+{
+    TRACE("%p %u %u\n", view, limit, offset);
+
+    if (!view->ops->limit)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    return view->ops->limit(view, limit, offset);
+}
+
+unsigned msi_view_set_rows(LibmsiView *view, const unsigned *rows, unsigned count,
+                           LibmsiRecord *rec, unsigned mask)
+{
+    unsigned i, r;
+
+    TRACE("%p %p %u %p %08x\n", view, rows, count, rec, mask);
+
+    if (view->ops->set_rows)
+        return view->ops->set_rows(view, rows, count, rec, mask);
+
+    if (!view->ops->set_row)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    if (!rows)
+    {
+        r = view->ops->get_dimensions(view, &count, NULL);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        r = view->ops->set_row(view, rows ? rows[i] : i, rec, mask);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* terminates the line describing a view, with its counters when profiling */
+void msi_view_explain_end(const LibmsiView *view, GString *str)
+{
+    if (view->profile)
+        g_string_append_printf(str, " [executed %u, rows in %" G_GUINT64_FORMAT
+                               ", rows out %" G_GUINT64_FORMAT ", %.3f ms]",
+                               view->stats.executions, view->stats.rows_in,
+                               view->stats.rows_out, view->stats.time / 1000.0);
+    g_string_append_c(str, '\n');
+}
+
 LibmsiResult _libmsi_query_fetch(LibmsiQuery *query, LibmsiRecord **prec)
 {
     LibmsiView *view;
@@ -452,6 +532,8 @@ libmsi_query_close (LibmsiQuery *query, GError **error)
 LibmsiResult _libmsi_query_execute(LibmsiQuery *query, LibmsiRecord *rec )
 {
     LibmsiView *view;
+    int64_t start;
+    unsigned r;
 
     TRACE("%p %p\n", query, rec);
 
@@ -462,7 +544,10 @@ LibmsiResult _libmsi_query_execute(LibmsiQuery *query, LibmsiRecord *rec )
         return LIBMSI_RESULT_FUNCTION_FAILED;
     query->row = 0;
 
-    return view->ops->execute( view, rec );
+    start = msi_span_begin();
+    r = view->ops->execute( view, rec );
+    msi_span_end( "query_execute", start );
+    return r;
 }
 
 /**
@@ -617,6 +702,82 @@ libmsi_query_get_column_info (LibmsiQuery *query, LibmsiColInfo info, GError **e
     return rec;
 }
 
+/**
+ * libmsi_query_get_plan:
+ * @query: a #LibmsiQuery
+ * @error: (allow-none): return location for the error
+ *
+ * Describe how @query is evaluated: the views built for it, the order
+ * in which joined tables are visited, whether each of them is scanned
+ * or looked up through a column index, and the estimated number of
+ * result rows.  When profiling was enabled with
+ * libmsi_query_set_profiling(), the counters of each view are shown
+ * too.  The text is meant to be read by humans and its format may
+ * change between releases.  The same description is returned as rows
+ * by the query "EXPLAIN SELECT ...".
+ *
+ * Returns: (transfer full): a newly allocated string or %NULL on error.
+ **/
+gchar *
+libmsi_query_get_plan (LibmsiQuery *query, GError **error)
+{
+    GString *str;
+    unsigned r;
+
+    TRACE("%p\n", query);
+
+    g_return_val_if_fail (LIBMSI_IS_QUERY (query), NULL);
+    g_return_val_if_fail (!error || *error == NULL, NULL);
+
+    if (!query->view)
+    {
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR,
+                             LIBMSI_RESULT_FUNCTION_FAILED, G_STRFUNC);
+        return NULL;
+    }
+
+    g_object_ref(query);
+    str = g_string_new(NULL);
+    r = msi_view_explain(query->view, str, 0);
+    g_object_unref(query);
+
+    if (r != LIBMSI_RESULT_SUCCESS)
+    {
+        g_string_free(str, TRUE);
+        g_set_error_literal (error, LIBMSI_RESULT_ERROR, r, G_STRFUNC);
+        return NULL;
+    }
+
+    return g_string_free(str, FALSE);
+}
+
+/**
+ * libmsi_query_set_profiling:
+ * @query: a #LibmsiQuery
+ * @profiling: whether to profile the query
+ *
+ * Enable or disable profiling of @query.  While profiling, each view
+ * of the query counts its executions, the rows it reads and produces
+ * and the time spent executing.  The counters are reported by
+ * libmsi_query_get_plan() and are reset when profiling is enabled; the
+ * views below the top one pick up the change when the query is next
+ * executed.
+ **/
+void
+libmsi_query_set_profiling (LibmsiQuery *query, gboolean profiling)
+{
+    TRACE("%p %d\n", query, profiling);
+
+    g_return_if_fail (LIBMSI_IS_QUERY (query));
+
+    if (!query->view)
+        return;
+
+    query->view->profile = profiling;
+    query->view->profile_epoch++;
+    memset(&query->view->stats, 0, sizeof(query->view->stats));
+}
+
 /**
  * libmsi_query_get_error:
  * @query: a #LibmsiQuery
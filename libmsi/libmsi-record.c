@@ -472,13 +472,30 @@ libmsi_record_set_string (LibmsiRecord *rec, unsigned field, const char *szValue
     return TRUE;
 }
 
-/* read the data in a file into a memory-backed GsfInput */
+/* map regular files, so that their data is only read when it is used,
+ * usually when the database is committed; the mapping keeps the data
+ * when the file is removed, but the file must not be truncated in the
+ * meantime.  Windows locks mapped files, so there and for files that
+ * cannot be mapped, such as pipes or empty files, the data is read into
+ * memory */
 static unsigned _libmsi_addstream_from_file(const char *szFile, GsfInput **pstm)
 {
-    GsfInput *stm;
+    GsfInput *stm = NULL;
     guint8 *data;
     off_t sz;
 
+#ifndef G_OS_WIN32
+    if (g_file_test(szFile, G_FILE_TEST_IS_REGULAR))
+        stm = gsf_input_mmap_new(szFile, NULL);
+#endif
+    if (stm)
+    {
+        TRACE("mapped %s, %" PRIdMAX " bytes into GsfInput %p\n", debugstr_a(szFile),
+              (intmax_t)gsf_input_size(stm), stm);
+        *pstm = stm;
+        return LIBMSI_RESULT_SUCCESS;
+    }
+
     stm = gsf_input_stdio_new(szFile, NULL);
     if (!stm)
     {
@@ -564,7 +581,11 @@ unsigned _libmsi_record_load_stream_from_file(LibmsiRecord *rec, unsigned field,
  * @field: a field identifier
  * @filename: a filename or %NULL
  *
- * Load the file content as a stream in @field.
+ * Load the file content as a stream in @field.  The content of a
+ * regular file may only be read when it is used, for example when the
+ * database is committed, so the file must not be modified or truncated
+ * until then; removing it is fine.  On Windows, and for other kinds of
+ * files, the content is read into memory right away.
  *
  * Returns: %TRUE on success.
  **/
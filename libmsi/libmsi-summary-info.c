@@ -560,7 +560,7 @@ static unsigned suminfo_persist (LibmsiSummaryInfo *si, LibmsiDatabase *database
         cbSection += write_property_to_data( &si->property[i], NULL );
 
     sz = 28 + 20 + cbSection;
-    data = msi_alloc_zero( sz );
+    data = g_malloc0( sz );
 
     /* write the set header */
     sz = 0;
@@ -600,11 +600,11 @@ static unsigned suminfo_persist (LibmsiSummaryInfo *si, LibmsiDatabase *database
 
     assert(sz == 28 + 20 + cbSection);
 
+    /* the stream takes the data */
     r = write_raw_stream_data (database, szSumInfo, data, sz, &stm);
     if (r == 0) {
         g_object_unref(G_OBJECT(stm));
     }
-    msi_free( data );
     return r;
 }
 
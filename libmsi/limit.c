@@ -0,0 +1,267 @@
+/*
+ * Implementation of the Microsoft Installer (msi.dll)
+ *
+ * Copyright (C) 2026 msitools contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+
+#include "debug.h"
+#include "libmsi.h"
+#include "msipriv.h"
+
+#include "query.h"
+
+
+/* LIMIT and OFFSET over a view that cannot stop early by itself */
+typedef struct _LibmsiLimitView
+{
+    LibmsiView        view;
+    LibmsiDatabase   *db;
+    LibmsiView       *table;
+    unsigned           limit;
+    unsigned           offset;
+} LibmsiLimitView;
+
+static unsigned limit_view_row_count( LibmsiLimitView *lv, unsigned *rows )
+{
+    unsigned r, count = 0;
+
+    r = lv->table->ops->get_dimensions( lv->table, &count, NULL );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    count = count > lv->offset ? count - lv->offset : 0;
+    *rows = MIN( count, lv->limit );
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned limit_view_fetch_int( LibmsiView *view, unsigned row, unsigned col, unsigned *val )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p %d %d %p\n", lv, row, col, val );
+
+    if( row >= lv->limit )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    return lv->table->ops->fetch_int( lv->table, row + lv->offset, col, val );
+}
+
+static unsigned limit_view_fetch_stream( LibmsiView *view, unsigned row, unsigned col, GsfInput **stm)
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p %d %d %p\n", lv, row, col, stm );
+
+    if( row >= lv->limit || !lv->table->ops->fetch_stream )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    return lv->table->ops->fetch_stream( lv->table, row + lv->offset, col, stm );
+}
+
+static unsigned limit_view_get_row( LibmsiView *view, unsigned row, LibmsiRecord **rec )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p %d %p\n", lv, row, rec );
+
+    return msi_view_get_row( lv->db, view, row, rec );
+}
+
+static unsigned limit_view_execute( LibmsiView *view, LibmsiRecord *record )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+    int64_t start = msi_view_profile_begin( view );
+    unsigned r, rows = 0, count = 0;
+
+    TRACE("%p %p\n", lv, record);
+
+    msi_view_profile_child( view, lv->table );
+    r = lv->table->ops->execute( lv->table, record );
+    if( r == LIBMSI_RESULT_SUCCESS && view->profile )
+    {
+        lv->table->ops->get_dimensions( lv->table, &rows, NULL );
+        limit_view_row_count( lv, &count );
+        msi_view_profile_end( view, start, rows, count );
+    }
+    return r;
+}
+
+static unsigned limit_view_close( LibmsiView *view )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p\n", lv );
+
+    return lv->table->ops->close( lv->table );
+}
+
+static unsigned limit_view_get_dimensions( LibmsiView *view, unsigned *rows, unsigned *cols )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+    unsigned r;
+
+    TRACE("%p %p %p\n", lv, rows, cols );
+
+    if( rows )
+    {
+        r = limit_view_row_count( lv, rows );
+        if( r != LIBMSI_RESULT_SUCCESS )
+            return r;
+    }
+
+    return lv->table->ops->get_dimensions( lv->table, NULL, cols );
+}
+
+static unsigned limit_view_get_column_info( LibmsiView *view, unsigned n, const char **name,
+                                      unsigned *type, bool *temporary, const char **table_name )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p %d %p %p %p %p\n", lv, n, name, type, temporary, table_name );
+
+    return lv->table->ops->get_column_info( lv->table, n, name,
+                                            type, temporary, table_name );
+}
+
+static unsigned limit_view_delete( LibmsiView *view )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p\n", lv );
+
+    lv->table->ops->delete( lv->table );
+    g_object_unref(lv->db);
+    msi_free( lv );
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned limit_view_find_matching_rows( LibmsiView *view, unsigned col,
+    unsigned val, unsigned *row, MSIITERHANDLE *handle )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+    unsigned r, rows;
+
+    TRACE("%p, %d, %u, %p\n", view, col, val, *handle);
+
+    r = limit_view_row_count( lv, &rows );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    /* skip the matches outside of the window */
+    while( (r = lv->table->ops->find_matching_rows( lv->table, col, val, row, handle ))
+           == LIBMSI_RESULT_SUCCESS )
+    {
+        if( *row >= lv->offset && *row - lv->offset < rows )
+        {
+            *row -= lv->offset;
+            break;
+        }
+    }
+
+    return r;
+}
+
+static unsigned limit_view_explain( LibmsiView *view, GString *str, unsigned depth )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p %p %u\n", view, str, depth);
+
+    g_string_append_printf( str, "%*sLIMIT %u", depth * 2, "", lv->limit );
+    if( lv->offset )
+        g_string_append_printf( str, " OFFSET %u", lv->offset );
+    msi_view_explain_end( view, str );
+
+    return msi_view_explain( lv->table, str, depth + 1 );
+}
+
+static unsigned limit_view_limit( LibmsiView *view, unsigned limit, unsigned offset )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    TRACE("%p %u %u\n", view, limit, offset);
+
+    msi_narrow_limit( &lv->limit, &lv->offset, limit, offset );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned limit_view_row_available( LibmsiView *view, unsigned row )
+{
+    LibmsiLimitView *lv = (LibmsiLimitView*)view;
+
+    if( row >= lv->limit || row > G_MAXUINT - lv->offset )
+        return NO_MORE_ITEMS;
+
+    return msi_view_row_available( lv->table, row + lv->offset );
+}
+
+static const LibmsiViewOps limit_ops =
+{
+    limit_view_fetch_int,
+    limit_view_fetch_stream,
+    limit_view_get_row,
+    NULL,
+    NULL,
+    NULL,
+    limit_view_execute,
+    limit_view_close,
+    limit_view_get_dimensions,
+    limit_view_get_column_info,
+    limit_view_delete,
+    limit_view_find_matching_rows,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    limit_view_explain,
+    limit_view_limit,
+    limit_view_row_available,
+};
+
+unsigned limit_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table,
+                            unsigned limit, unsigned offset )
+{
+    LibmsiLimitView *lv;
+
+    TRACE("%p %p %u %u\n", db, table, limit, offset );
+
+    /* views that can stop producing rows early do it themselves */
+    if( msi_view_limit( table, limit, offset ) == LIBMSI_RESULT_SUCCESS )
+    {
+        *view = table;
+        return LIBMSI_RESULT_SUCCESS;
+    }
+
+    lv = msi_alloc_zero( sizeof *lv );
+    if( !lv )
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    lv->view.ops = &limit_ops;
+    lv->db = g_object_ref(db);
+    lv->table = table;
+    lv->limit = limit;
+    lv->offset = offset;
+    *view = &lv->view;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
@@ -78,6 +78,8 @@ typedef enum LibmsiCondition
 
 struct _LibmsiTable;
 typedef struct _LibmsiTable LibmsiTable;
+typedef struct _LibmsiTableImport LibmsiTableImport;
+typedef struct _LibmsiCatalog LibmsiCatalog;
 
 struct string_table;
 typedef struct string_table string_table;
@@ -103,10 +105,22 @@ struct _LibmsiDatabase
     struct list transforms;
     struct list streams;
     struct list storages;
+    GHashTable *stream_index;   /* the entries of streams by name */
+    GHashTable *storage_index;  /* the entries of storages by name */
+    LibmsiCatalog *stream_catalog;   /* the rows of _Streams, or NULL */
+    LibmsiCatalog *storage_catalog;  /* the rows of _Storages, or NULL */
 };
 
 typedef struct _LibmsiView LibmsiView;
 
+typedef struct _LibmsiArenaBlock LibmsiArenaBlock;
+
+/* memory released all at once, such as the parse tree of a query */
+typedef struct _LibmsiArena
+{
+    LibmsiArenaBlock *block;
+} LibmsiArena;
+
 struct _LibmsiQuery
 {
     GObject parent;
@@ -115,7 +129,7 @@ struct _LibmsiQuery
     unsigned row;
     LibmsiDatabase *database;
     gchar *query;
-    struct list mem;
+    LibmsiArena mem;
 };
 
 /* maybe we can use a Variant instead of doing it ourselves? */
@@ -267,15 +281,81 @@ typedef struct _LibmsiViewOps
      * drop - drops the table from the database
      */
     unsigned (*drop)( LibmsiView *view );
+
+    /*
+     * explain - describes how the view produces its rows, one line per
+     *  view or access path, indented by depth
+     */
+    unsigned (*explain)( LibmsiView *view, GString *str, unsigned depth );
+
+    /*
+     * limit - skips the first offset rows and returns at most limit rows
+     *  after them, so the view can stop producing rows early
+     */
+    unsigned (*limit)( LibmsiView *view, unsigned limit, unsigned offset );
+
+    /*
+     * row_available - returns LIBMSI_RESULT_SUCCESS if the row exists or
+     *  NO_MORE_ITEMS, without producing the rows after it
+     */
+    unsigned (*row_available)( LibmsiView *view, unsigned row );
+
+    /*
+     * set_rows - sets the fields specified by mask to the same values in
+     *  count rows, or in every row if rows is NULL
+     */
+    unsigned (*set_rows)( LibmsiView *view, const unsigned *rows, unsigned count,
+                          LibmsiRecord *rec, unsigned mask );
 } LibmsiViewOps;
 
+typedef struct _LibmsiViewStats
+{
+    unsigned executions;
+    uint64_t rows_in;   /* rows read from the views or tables below */
+    uint64_t rows_out;  /* rows produced */
+    int64_t time;       /* microseconds spent executing, views below included */
+} LibmsiViewStats;
+
 struct _LibmsiView
 {
     const LibmsiViewOps *ops;
     LibmsiDBError error;
     const char *error_column;
+    bool profile;
+    unsigned profile_epoch; /* bumped when the counters must be reset */
+    LibmsiViewStats stats;
 };
 
+/* profiling helpers, only do work when the query asked for profiling */
+static inline int64_t msi_view_profile_begin( const LibmsiView *view )
+{
+    return view->profile ? g_get_monotonic_time() : 0;
+}
+
+static inline void msi_view_profile_end( LibmsiView *view, int64_t start,
+                                         uint64_t rows_in, uint64_t rows_out )
+{
+    if (!view->profile)
+        return;
+
+    view->stats.executions++;
+    view->stats.rows_in += rows_in;
+    view->stats.rows_out += rows_out;
+    view->stats.time += g_get_monotonic_time() - start;
+}
+
+/* hands the profiling mode of a view down to a view below it */
+static inline void msi_view_profile_child( const LibmsiView *view, LibmsiView *child )
+{
+    if (child->profile == view->profile &&
+        child->profile_epoch == view->profile_epoch)
+        return;
+
+    child->profile = view->profile;
+    child->profile_epoch = view->profile_epoch;
+    memset(&child->stats, 0, sizeof(child->stats));
+}
+
 #define MSI_MAX_PROPS 20
 
 enum LibmsiOLEVariantType
@@ -349,24 +429,59 @@ extern void msi_destroy_stringtable( string_table *st );
 extern const char *msi_string_lookup_id( const string_table *st, unsigned id );
 extern string_table *msi_init_string_table( unsigned *bytes_per_strref );
 extern string_table *msi_load_string_table( GsfInfile *stg, unsigned *bytes_per_strref );
-extern unsigned msi_save_string_table( const string_table *st, LibmsiDatabase *db, unsigned *bytes_per_strref );
+extern string_table *msi_clone_string_table( string_table *st );
+extern unsigned msi_save_string_table( const string_table *st, GsfOutfile *stg, unsigned *bytes_per_strref );
 extern unsigned msi_get_string_table_codepage( const string_table *st );
+extern unsigned msi_get_string_table_count( const string_table *st );
 extern unsigned msi_set_string_table_codepage( string_table *st, unsigned codepage );
 
+/* the live strings of a string table, and its size in memory */
+typedef struct _LibmsiStringStats
+{
+    unsigned count;
+    uint64_t bytes;
+    uint64_t refs;
+    uint64_t memory;
+} LibmsiStringStats;
+
+extern void msi_get_string_table_stats( const string_table *st, LibmsiStringStats *stats );
+
 unsigned _libmsi_open_table( LibmsiDatabase *db, const char *name, bool encoded );
 extern bool table_view_exists( LibmsiDatabase *db, const char *name );
+
+/* the sizes of a table: its stream as it would be saved now, its rows in
+ * memory and the column hash indexes built so far */
+typedef struct _LibmsiTableStats
+{
+    unsigned rows;
+    unsigned columns;
+    bool loaded;
+    uint64_t stream_bytes;
+    uint64_t data_bytes;
+    uint64_t index_bytes;
+} LibmsiTableStats;
+
+extern unsigned msi_get_table_stats( LibmsiDatabase *db, const char *name, LibmsiTableStats *stats );
 extern LibmsiCondition _libmsi_database_is_table_persistent( LibmsiDatabase *db, const char *table );
+extern unsigned msi_table_import_begin( LibmsiDatabase *db, const char *name, LibmsiTableImport **pti );
+extern unsigned msi_table_import_strings( LibmsiTableImport *ti, char **fields, unsigned count );
+extern unsigned msi_table_import_row( LibmsiTableImport *ti, char **fields, unsigned count, const char *dir );
+extern unsigned msi_table_import_prepare( LibmsiTableImport *ti );
+extern unsigned msi_table_import_end( LibmsiTableImport *ti, bool install );
 
 extern unsigned read_stream_data( GsfInfile *stg, const char *stname,
                               uint8_t **pdata, unsigned *psz );
-extern unsigned write_stream_data( LibmsiDatabase *db, const char *stname,
+extern unsigned write_stream_data( GsfOutfile *stg, const char *stname,
                                const void *data, unsigned sz );
 extern unsigned write_raw_stream_data( LibmsiDatabase *db, const char *stname,
-                        const void *data, unsigned sz, GsfInput **outstm );
+                        void *data, unsigned sz, GsfInput **outstm );
 extern unsigned _libmsi_database_commit_streams( LibmsiDatabase *db );
 
 /* transform functions */
 extern unsigned msi_table_apply_transform( LibmsiDatabase *db, GsfInfile *stg );
+extern unsigned msi_table_share_tables( LibmsiDatabase *db, LibmsiDatabase *base );
+extern unsigned msi_table_generate_transform( LibmsiDatabase *db, LibmsiDatabase *ref,
+                                              GsfOutfile *stg );
 extern unsigned _libmsi_database_apply_transform( LibmsiDatabase *db,
                  const char *szTransformFile);
 extern void append_storage_to_db( LibmsiDatabase *db, GsfInfile *stg );
@@ -403,6 +518,12 @@ unsigned msi_create_storage( LibmsiDatabase *db, const char *stname, GsfInput *s
 unsigned msi_open_storage( LibmsiDatabase *db, const char *stname );
 void msi_destroy_storage( LibmsiDatabase *db, const char *stname );
 extern unsigned msi_enum_db_storages(LibmsiDatabase *, unsigned (*fn)(const char *, GsfInfile *, void *), void *);
+extern unsigned msi_get_stream_rows( LibmsiDatabase *db );
+extern unsigned msi_get_stream_row( LibmsiDatabase *db, unsigned row, unsigned *name, GsfInput **stm );
+extern unsigned msi_find_stream_row( LibmsiDatabase *db, unsigned name, unsigned *row );
+extern unsigned msi_get_storage_rows( LibmsiDatabase *db );
+extern unsigned msi_get_storage_row( LibmsiDatabase *db, unsigned row, unsigned *name );
+extern unsigned msi_find_storage_row( LibmsiDatabase *db, unsigned name, unsigned *row );
 extern unsigned _libmsi_database_open_query(LibmsiDatabase *, const char *, LibmsiQuery **);
 extern unsigned _libmsi_query_open( LibmsiDatabase *, LibmsiQuery **, const char *, ... ) G_GNUC_PRINTF(3,4);
 typedef unsigned (*record_func)( LibmsiRecord *, void *);
@@ -416,6 +537,16 @@ extern LibmsiResult _libmsi_query_fetch( LibmsiQuery*, LibmsiRecord ** );
 extern LibmsiResult _libmsi_query_get_column_info(LibmsiQuery *, LibmsiColInfo, LibmsiRecord **);
 extern unsigned _libmsi_view_find_column( LibmsiView *, const char *, const char *, unsigned *);
 extern unsigned msi_view_get_row(LibmsiDatabase *, LibmsiView *, unsigned, LibmsiRecord **);
+extern unsigned msi_view_explain(LibmsiView *, GString *, unsigned);
+extern void msi_view_explain_end(const LibmsiView *, GString *);
+extern unsigned msi_view_limit(LibmsiView *, unsigned, unsigned);
+extern unsigned msi_view_row_available(LibmsiView *, unsigned);
+extern unsigned msi_view_set_rows(LibmsiView *, const unsigned *, unsigned, LibmsiRecord *, unsigned);
+
+/* arena allocation */
+extern void msi_arena_init( LibmsiArena *arena );
+extern void *msi_arena_alloc( LibmsiArena *arena, size_t sz );
+extern void msi_arena_free( LibmsiArena *arena );
 
 /* summary information */
 extern unsigned msi_add_suminfo( LibmsiDatabase *db, char ***records, int num_records, int num_columns );
@@ -52,6 +52,11 @@
 #define EXPR_COL_NUMBER32 11
 #define EXPR_UNARY    12
 
+#define AGGREGATE_COUNT 1
+#define AGGREGATE_MIN   2
+#define AGGREGATE_MAX   3
+#define AGGREGATE_SUM   4
+
 struct sql_str {
     const char *data;
     int len;
@@ -92,8 +97,20 @@ struct expr
     } u;
 };
 
+#define NO_LIMIT (~0u)
+
+/* applies LIMIT new_limit OFFSET new_offset to the rows left by a previous limit */
+static inline void msi_narrow_limit( unsigned *limit, unsigned *offset,
+                                     unsigned new_limit, unsigned new_offset )
+{
+    unsigned skip = MIN( new_offset, *limit );
+
+    *offset = *offset > G_MAXUINT - skip ? G_MAXUINT : *offset + skip;
+    *limit = MIN( *limit - skip, new_limit );
+}
+
 unsigned _libmsi_parse_sql( LibmsiDatabase *db, const char *command, LibmsiView **phview,
-                   struct list *mem );
+                   LibmsiArena *mem );
 
 unsigned table_view_create( LibmsiDatabase *db, const char *name, LibmsiView **view );
 
@@ -102,6 +119,14 @@ unsigned select_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *
 
 unsigned distinct_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table );
 
+unsigned explain_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table );
+
+unsigned limit_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table,
+                        unsigned limit, unsigned offset );
+
+unsigned aggregate_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table,
+                        const column_info *columns );
+
 unsigned order_view_create( LibmsiDatabase *db, LibmsiView **view, LibmsiView *table,
                        column_info *columns );
 
@@ -94,16 +94,12 @@ static unsigned select_view_get_row( LibmsiView *view, unsigned row, LibmsiRecor
     return msi_view_get_row(sv->db, view, row, rec);
 }
 
-static unsigned select_view_set_row( LibmsiView *view, unsigned row, LibmsiRecord *rec, unsigned mask )
+/* expand the record to the right size for the underlying table */
+static unsigned select_view_expand_record( LibmsiSelectView *sv, LibmsiRecord *rec,
+                                           unsigned mask, LibmsiRecord **expanded,
+                                           unsigned *expanded_mask )
 {
-    LibmsiSelectView *sv = (LibmsiSelectView*)view;
-    unsigned i, expanded_mask = 0, r = LIBMSI_RESULT_SUCCESS, col_count = 0;
-    LibmsiRecord *expanded;
-
-    TRACE("%p %d %p %08x\n", sv, row, rec, mask );
-
-    if ( !sv->table )
-         return LIBMSI_RESULT_FUNCTION_FAILED;
+    unsigned i, r, col_count = 0;
 
     /* test if any of the mask bits are invalid */
     if ( mask >= (1<<sv->num_cols) )
@@ -114,23 +110,65 @@ static unsigned select_view_set_row( LibmsiView *view, unsigned row, LibmsiRecor
     if( r )
         return r;
 
-    /* expand the record to the right size for the underlying table */
-    expanded = libmsi_record_new( col_count );
-    if ( !expanded )
+    *expanded = libmsi_record_new( col_count );
+    if ( !*expanded )
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
     /* move the right fields across */
+    *expanded_mask = 0;
     for ( i=0; i<sv->num_cols; i++ )
     {
-        r = _libmsi_record_copy_field( rec, i+1, expanded, sv->cols[ i ] );
+        r = _libmsi_record_copy_field( rec, i+1, *expanded, sv->cols[ i ] );
         if (r != LIBMSI_RESULT_SUCCESS)
-            break;
-        expanded_mask |= (1<<(sv->cols[i]-1));
+        {
+            g_object_unref(*expanded);
+            return r;
+        }
+        *expanded_mask |= (1<<(sv->cols[i]-1));
     }
 
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned select_view_set_row( LibmsiView *view, unsigned row, LibmsiRecord *rec, unsigned mask )
+{
+    LibmsiSelectView *sv = (LibmsiSelectView*)view;
+    unsigned expanded_mask, r;
+    LibmsiRecord *expanded;
+
+    TRACE("%p %d %p %08x\n", sv, row, rec, mask );
+
+    if ( !sv->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    r = select_view_expand_record( sv, rec, mask, &expanded, &expanded_mask );
+    if ( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
     /* set the row in the underlying table */
-    if (r == LIBMSI_RESULT_SUCCESS)
-        r = sv->table->ops->set_row( sv->table, row, expanded, expanded_mask );
+    r = sv->table->ops->set_row( sv->table, row, expanded, expanded_mask );
+
+    g_object_unref(expanded);
+    return r;
+}
+
+static unsigned select_view_set_rows( LibmsiView *view, const unsigned *rows, unsigned count,
+                                      LibmsiRecord *rec, unsigned mask )
+{
+    LibmsiSelectView *sv = (LibmsiSelectView*)view;
+    unsigned expanded_mask, r;
+    LibmsiRecord *expanded;
+
+    TRACE("%p %p %u %p %08x\n", sv, rows, count, rec, mask );
+
+    if ( !sv->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    r = select_view_expand_record( sv, rec, mask, &expanded, &expanded_mask );
+    if ( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    r = msi_view_set_rows( sv->table, rows, count, expanded, expanded_mask );
 
     g_object_unref(expanded);
     return r;
@@ -172,13 +210,22 @@ fail:
 static unsigned select_view_execute( LibmsiView *view, LibmsiRecord *record )
 {
     LibmsiSelectView *sv = (LibmsiSelectView*)view;
+    int64_t start = msi_view_profile_begin( view );
+    unsigned r, rows = 0, cols;
 
     TRACE("%p %p\n", sv, record);
 
     if( !sv->table )
          return LIBMSI_RESULT_FUNCTION_FAILED;
 
-    return sv->table->ops->execute( sv->table, record );
+    msi_view_profile_child( view, sv->table );
+    r = sv->table->ops->execute( sv->table, record );
+    if( r == LIBMSI_RESULT_SUCCESS && view->profile )
+    {
+        sv->table->ops->get_dimensions( sv->table, &rows, &cols );
+        msi_view_profile_end( view, start, rows, rows );
+    }
+    return r;
 }
 
 static unsigned select_view_close( LibmsiView *view )
@@ -268,6 +315,52 @@ static unsigned select_view_find_matching_rows( LibmsiView *view, unsigned col,
 }
 
 
+static unsigned select_view_explain( LibmsiView *view, GString *str, unsigned depth )
+{
+    LibmsiSelectView *sv = (LibmsiSelectView*)view;
+    unsigned i;
+
+    TRACE("%p %p %u\n", view, str, depth);
+
+    if( !sv->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    g_string_append_printf( str, "%*sSELECT", depth * 2, "" );
+    for (i = 0; i < sv->num_cols; i++)
+    {
+        const char *name = NULL;
+
+        if (sv->cols[i])
+            sv->table->ops->get_column_info( sv->table, sv->cols[i], &name, NULL, NULL, NULL );
+        g_string_append_printf( str, "%s %s", i ? "," : "", name ? name : "NULL" );
+    }
+    msi_view_explain_end( view, str );
+
+    return msi_view_explain( sv->table, str, depth + 1 );
+}
+
+static unsigned select_view_limit( LibmsiView *view, unsigned limit, unsigned offset )
+{
+    LibmsiSelectView *sv = (LibmsiSelectView*)view;
+
+    TRACE("%p %u %u\n", view, limit, offset);
+
+    if( !sv->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    return msi_view_limit( sv->table, limit, offset );
+}
+
+static unsigned select_view_row_available( LibmsiView *view, unsigned row )
+{
+    LibmsiSelectView *sv = (LibmsiSelectView*)view;
+
+    if( !sv->table )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    return msi_view_row_available( sv->table, row );
+}
+
 static const LibmsiViewOps select_ops =
 {
     select_view_fetch_int,
@@ -288,6 +381,10 @@ static const LibmsiViewOps select_ops =
     NULL,
     NULL,
     NULL,
+    select_view_explain,
+    select_view_limit,
+    select_view_row_available,
+    select_view_set_rows,
 };
 
 static unsigned select_view_add_column( LibmsiSelectView *sv, const char *name,
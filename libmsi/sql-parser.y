@@ -47,7 +47,7 @@ typedef struct _LibmsiSQLInput
                       * tracks the view currently being created so we can free
                       * this view on syntax error.
                       */
-    struct list *mem;
+    LibmsiArena *mem;
 } SQL_input;
 
 static unsigned sql_unescape_string( void *info, const struct sql_str *strdata, char **str );
@@ -57,6 +57,7 @@ static int sql_lex( void *SQL_lval, SQL_input *info );
 static char *parser_add_table( void *info, const char *list, const char *table );
 static void *parser_alloc( void *info, unsigned int sz );
 static column_info *parser_alloc_column( void *info, const char *table, const char *column );
+static column_info *parser_alloc_aggregate( void *info, const char *function, column_info *column );
 
 static bool sql_mark_primary_keys( column_info **cols, column_info *keys);
 
@@ -90,13 +91,13 @@ static struct expr * build_expr_wildcard( void *info );
 }
 
 %token TK_ALTER TK_AND TK_BY TK_CHAR TK_COMMA TK_CREATE TK_DELETE TK_DROP
-%token TK_DISTINCT TK_DOT TK_EQ TK_FREE TK_FROM TK_GE TK_GT TK_HOLD TK_ADD
+%token TK_DISTINCT TK_DOT TK_EQ TK_EXPLAIN TK_FREE TK_FROM TK_GE TK_GT TK_HOLD TK_ADD
 %token <str> TK_ID
 %token TK_ILLEGAL TK_INSERT TK_INT
 %token <str> TK_INTEGER
-%token TK_INTO TK_IS TK_KEY TK_LE TK_LONG TK_LONGCHAR TK_LP TK_LT
+%token TK_INTO TK_IS TK_KEY TK_LE TK_LIMIT TK_LONG TK_LONGCHAR TK_LP TK_LT
 %token TK_LOCALIZABLE TK_MINUS TK_NE TK_NOT TK_NULL
-%token TK_OBJECT TK_OR TK_ORDER TK_PRIMARY TK_RP
+%token TK_OBJECT TK_OFFSET TK_OR TK_ORDER TK_PRIMARY TK_RP
 %token TK_SELECT TK_SET TK_SHORT TK_SPACE TK_STAR
 %token <str> TK_STRING
 %token TK_TABLE TK_TEMPORARY TK_UPDATE TK_VALUES TK_WHERE TK_WILDCARD
@@ -113,8 +114,10 @@ static struct expr * build_expr_wildcard( void *info );
 %type <string> table tablelist id string
 %type <column_list> selcollist collist selcolumn column column_and_type column_def table_def
 %type <column_list> column_assignment update_assign_list constlist
+%type <column_list> aggcollist aggcolumn
 %type <query> query from selectfrom unorderdfrom
 %type <query> oneupdate onedelete oneselect onequery onecreate oneinsert onealter onedrop
+%type <query> oneexplain unlimitedselect
 %type <expr> expr val column_val const_val
 %type <column_type> column_type data_type data_type_l data_count
 %type <integer> number alterop
@@ -137,6 +140,7 @@ query:
 
 onequery:
     oneselect
+  | oneexplain
   | onecreate
   | oneinsert
   | oneupdate
@@ -407,6 +411,34 @@ data_count:
     ;
 
 oneselect:
+    unlimitedselect
+  | unlimitedselect TK_LIMIT number
+        {
+            SQL_input* sql = (SQL_input*) info;
+            LibmsiView* limit = NULL;
+            unsigned r;
+
+            r = limit_view_create( sql->db, &limit, $1, $3, 0 );
+            if (r != LIBMSI_RESULT_SUCCESS)
+                YYABORT;
+
+            PARSER_BUBBLE_UP_VIEW( sql, $$, limit );
+        }
+  | unlimitedselect TK_LIMIT number TK_OFFSET number
+        {
+            SQL_input* sql = (SQL_input*) info;
+            LibmsiView* limit = NULL;
+            unsigned r;
+
+            r = limit_view_create( sql->db, &limit, $1, $3, $5 );
+            if (r != LIBMSI_RESULT_SUCCESS)
+                YYABORT;
+
+            PARSER_BUBBLE_UP_VIEW( sql, $$, limit );
+        }
+    ;
+
+unlimitedselect:
     TK_SELECT selectfrom
         {
             $$ = $2;
@@ -423,6 +455,33 @@ oneselect:
 
             PARSER_BUBBLE_UP_VIEW( sql, $$, distinct );
         }
+  | TK_SELECT aggcollist from
+        {
+            SQL_input* sql = (SQL_input*) info;
+            LibmsiView* aggregate = NULL;
+            unsigned r;
+
+            r = aggregate_view_create( sql->db, &aggregate, $3, $2 );
+            if (r != LIBMSI_RESULT_SUCCESS)
+                YYABORT;
+
+            PARSER_BUBBLE_UP_VIEW( sql, $$, aggregate );
+        }
+    ;
+
+oneexplain:
+    TK_EXPLAIN oneselect
+        {
+            SQL_input* sql = (SQL_input*) info;
+            LibmsiView* explain = NULL;
+            unsigned r;
+
+            r = explain_view_create( sql->db, &explain, $2 );
+            if (r != LIBMSI_RESULT_SUCCESS)
+                YYABORT;
+
+            PARSER_BUBBLE_UP_VIEW( sql, $$, explain );
+        }
     ;
 
 selectfrom:
@@ -457,6 +516,29 @@ selcollist:
         }
     ;
 
+aggcollist:
+    aggcolumn
+  | aggcolumn TK_COMMA aggcollist
+        {
+            $1->next = $3;
+        }
+    ;
+
+aggcolumn:
+    id TK_LP TK_STAR TK_RP
+        {
+            $$ = parser_alloc_aggregate( info, $1, NULL );
+            if( !$$ )
+                YYABORT;
+        }
+  | id TK_LP column TK_RP
+        {
+            $$ = parser_alloc_aggregate( info, $1, $3 );
+            if( !$$ )
+                YYABORT;
+        }
+    ;
+
 collist:
     column
   | column TK_COMMA collist
@@ -770,11 +852,8 @@ static char *parser_add_table( void *info, const char *list, const char *table )
 static void *parser_alloc( void *info, unsigned int sz )
 {
     SQL_input* sql = (SQL_input*) info;
-    struct list *mem;
 
-    mem = msi_alloc( sizeof (struct list) + sz );
-    list_add_tail( sql->mem, mem );
-    return &mem[1];
+    return msi_arena_alloc( sql->mem, sz );
 }
 
 static column_info *parser_alloc_column( void *info, const char *table, const char *column )
@@ -794,6 +873,34 @@ static column_info *parser_alloc_column( void *info, const char *table, const ch
     return col;
 }
 
+static column_info *parser_alloc_aggregate( void *info, const char *function, column_info *column )
+{
+    static const struct { const char *name; int type; } functions[] =
+    {
+        { "COUNT", AGGREGATE_COUNT },
+        { "MAX", AGGREGATE_MAX },
+        { "MIN", AGGREGATE_MIN },
+        { "SUM", AGGREGATE_SUM },
+    };
+    unsigned i;
+
+    if( !column )
+        column = parser_alloc_column( info, NULL, NULL );
+    if( !column )
+        return NULL;
+
+    for( i = 0; i < G_N_ELEMENTS(functions); i++ )
+    {
+        if( !g_ascii_strcasecmp( function, functions[i].name ) )
+        {
+            column->type = functions[i].type;
+            return column;
+        }
+    }
+
+    return NULL;
+}
+
 static int sql_lex( void *SQL_lval, SQL_input *sql )
 {
     int token, skip;
@@ -998,7 +1105,7 @@ static bool sql_mark_primary_keys( column_info **cols,
 }
 
 unsigned _libmsi_parse_sql( LibmsiDatabase *db, const char *command, LibmsiView **phview,
-                   struct list *mem )
+                   LibmsiArena *mem )
 {
     SQL_input sql;
     int r;
@@ -30,47 +30,13 @@
 #define NUM_STORAGES_COLS    2
 #define MAX_STORAGES_NAME_LEN 62
 
-typedef struct tabSTORAGE
-{
-    unsigned str_index;
-} STORAGE;
-
+/* the rows are kept by the database, see msi_get_storage_row */
 typedef struct _LibmsiStorageView
 {
     LibmsiView view;
     LibmsiDatabase *db;
-    STORAGE **storages;
-    unsigned max_storages;
-    unsigned num_rows;
-    unsigned row_size;
 } LibmsiStorageView;
 
-static bool storages_set_table_size(LibmsiStorageView *sv, unsigned size)
-{
-    if (size >= sv->max_storages)
-    {
-        sv->max_storages *= 2;
-        sv->storages = msi_realloc(sv->storages, sv->max_storages * sizeof(STORAGE *));
-        if (!sv->storages)
-            return false;
-    }
-
-    return true;
-}
-
-static STORAGE *create_storage(LibmsiStorageView *sv, const char *name)
-{
-    STORAGE *storage;
-
-    storage = msi_alloc(sizeof(STORAGE));
-    if (!storage)
-        return NULL;
-
-    storage->str_index = _libmsi_add_string(sv->db->strings, name, -1, 1, StringNonPersistent);
-
-    return storage;
-}
-
 static unsigned storages_view_fetch_int(LibmsiView *view, unsigned row, unsigned col, unsigned *val)
 {
     LibmsiStorageView *sv = (LibmsiStorageView *)view;
@@ -80,12 +46,7 @@ static unsigned storages_view_fetch_int(LibmsiView *view, unsigned row, unsigned
     if (col != 1)
         return LIBMSI_RESULT_INVALID_PARAMETER;
 
-    if (row >= sv->num_rows)
-        return NO_MORE_ITEMS;
-
-    *val = sv->storages[row]->str_index;
-
-    return LIBMSI_RESULT_SUCCESS;
+    return msi_get_storage_row(sv->db, row, val);
 }
 
 static unsigned storages_view_fetch_stream(LibmsiView *view, unsigned row, unsigned col, GsfInput **stm)
@@ -94,7 +55,7 @@ static unsigned storages_view_fetch_stream(LibmsiView *view, unsigned row, unsig
 
     TRACE("(%p, %d, %d, %p)\n", view, row, col, stm);
 
-    if (row >= sv->num_rows)
+    if (row >= msi_get_storage_rows(sv->db))
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
     return LIBMSI_RESULT_INVALID_DATA;
@@ -112,28 +73,29 @@ static unsigned storages_view_get_row( LibmsiView *view, unsigned row, LibmsiRec
 static unsigned storages_view_set_row(LibmsiView *view, unsigned row, LibmsiRecord *rec, unsigned mask)
 {
     LibmsiStorageView *sv = (LibmsiStorageView *)view;
-    STORAGE *storage;
+    unsigned count = msi_get_storage_rows(sv->db);
     GsfInput *stm;
     char *name = NULL;
     unsigned r = LIBMSI_RESULT_FUNCTION_FAILED;
+    unsigned id;
 
     TRACE("(%p, %p)\n", view, rec);
 
-    if (row > sv->num_rows)
+    if (row > count)
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
     r = _libmsi_record_get_gsf_input(rec, 2, &stm);
     if (r != LIBMSI_RESULT_SUCCESS)
         return r;
 
-    if (sv->storages[row]) {
+    if (row < count) {
         if (mask & 1) {
             g_warning("FIXME: renaming storage via UPDATE on _Storages table\n");
             goto done;
         }
 
-        storage = sv->storages[row];
-        name = strdup(msi_string_lookup_id(sv->db->strings, storage->str_index));
+        msi_get_storage_row(sv->db, row, &id);
+        name = strdup(msi_string_lookup_id(sv->db->strings, id));
     } else {
         name = strdup(_libmsi_record_get_string_raw(rec, 1));
     }
@@ -143,12 +105,8 @@ static unsigned storages_view_set_row(LibmsiView *view, unsigned row, LibmsiReco
         goto done;
     }
 
-    msi_create_storage(sv->db, name, stm);
-    storage = create_storage(sv, name);
-    if (!storage)
-        r = LIBMSI_RESULT_FUNCTION_FAILED;
-
-    sv->storages[row] = storage;
+    /* this adds the row, or replaces the data of an existing one */
+    r = msi_create_storage(sv->db, name, stm);
 
 done:
     msi_free(name);
@@ -161,27 +119,20 @@ static unsigned storages_view_insert_row(LibmsiView *view, LibmsiRecord *rec, un
 {
     LibmsiStorageView *sv = (LibmsiStorageView *)view;
 
-    if (!storages_set_table_size(sv, ++sv->num_rows))
-        return LIBMSI_RESULT_FUNCTION_FAILED;
-
-    if (row == -1)
-        row = sv->num_rows - 1;
-
-    /* FIXME have to readjust rows */
-
-    return storages_view_set_row(view, row, rec, 0);
+    /* storages are kept in the order they were added */
+    return storages_view_set_row(view, msi_get_storage_rows(sv->db), rec, 0);
 }
 
 static unsigned storages_view_delete_row(LibmsiView *view, unsigned row)
 {
     LibmsiStorageView *sv = (LibmsiStorageView *)view;
     const char *name;
-    unsigned i;
+    unsigned id;
 
-    if (row > sv->num_rows)
+    if (msi_get_storage_row(sv->db, row, &id) != LIBMSI_RESULT_SUCCESS)
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
-    name = msi_string_lookup_id(sv->db->strings, sv->storages[row]->str_index);
+    name = msi_string_lookup_id(sv->db->strings, id);
     if (!name)
     {
         g_warning("failed to retrieve storage name\n");
@@ -190,13 +141,6 @@ static unsigned storages_view_delete_row(LibmsiView *view, unsigned row)
 
     msi_destroy_storage(sv->db, name);
 
-    /* shift the remaining rows */
-    for (i = row + 1; i < sv->num_rows; i++)
-    {
-        sv->storages[i - 1] = sv->storages[i];
-    }
-    sv->num_rows--;
-
     return LIBMSI_RESULT_SUCCESS;
 }
 
@@ -219,7 +163,7 @@ static unsigned storages_view_get_dimensions(LibmsiView *view, unsigned *rows, u
     TRACE("(%p, %p, %p)\n", view, rows, cols);
 
     if (cols) *cols = NUM_STORAGES_COLS;
-    if (rows) *rows = sv->num_rows;
+    if (rows) *rows = msi_get_storage_rows(sv->db);
 
     return LIBMSI_RESULT_SUCCESS;
 }
@@ -256,15 +200,9 @@ static unsigned storages_view_get_column_info( LibmsiView *view, unsigned n, con
 static unsigned storages_view_delete(LibmsiView *view)
 {
     LibmsiStorageView *sv = (LibmsiStorageView *)view;
-    unsigned i;
 
     TRACE("(%p)\n", view);
 
-    for (i = 0; i < sv->num_rows; i++)
-        msi_free(sv->storages[i]);
-
-    msi_free(sv->storages);
-    sv->storages = NULL;
     msi_free(sv);
 
     return LIBMSI_RESULT_SUCCESS;
@@ -274,29 +212,18 @@ static unsigned storages_view_find_matching_rows(LibmsiView *view, unsigned col,
                                        unsigned val, unsigned *row, MSIITERHANDLE *handle)
 {
     LibmsiStorageView *sv = (LibmsiStorageView *)view;
-    unsigned index = (uintptr_t)*handle;
 
     TRACE("(%d, %d): %d\n", *row, col, val);
 
     if (col == 0 || col > NUM_STORAGES_COLS)
         return LIBMSI_RESULT_INVALID_PARAMETER;
 
-    while (index < sv->num_rows)
-    {
-        if (sv->storages[index]->str_index == val)
-        {
-            *row = index;
-            break;
-        }
-
-        index++;
-    }
-
-    *handle = (MSIITERHANDLE)(uintptr_t)++index;
-    if (index >= sv->num_rows)
+    /* names are unique, so there is at most one match */
+    if (*handle)
         return NO_MORE_ITEMS;
 
-    return LIBMSI_RESULT_SUCCESS;
+    *handle = (MSIITERHANDLE)(uintptr_t)1;
+    return msi_find_storage_row(sv->db, val, row);
 }
 
 static const LibmsiViewOps storages_ops =
@@ -321,39 +248,9 @@ static const LibmsiViewOps storages_ops =
     NULL,
 };
 
-static unsigned add_storage_to_table(const char *name, GsfInfile *stg, void *opaque)
-{
-    LibmsiStorageView *sv = (LibmsiStorageView *)opaque;
-    STORAGE *storage;
-
-    storage = create_storage(sv, name);
-    if (!storage)
-        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
-
-    if (!storages_set_table_size(sv, ++sv->num_rows))
-    {
-        msi_free(storage);
-        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
-    }
-
-    sv->storages[sv->num_rows - 1] = storage;
-    return LIBMSI_RESULT_SUCCESS;
-}
-
-static unsigned add_storages_to_table(LibmsiStorageView *sv)
-{
-    sv->max_storages = 1;
-    sv->storages = msi_alloc_zero(sizeof(STORAGE *));
-    if (!sv->storages)
-        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
-
-    return msi_enum_db_storages(sv->db, add_storage_to_table, sv);
-}
-
 unsigned storages_view_create(LibmsiDatabase *db, LibmsiView **view)
 {
     LibmsiStorageView *sv;
-    unsigned r;
 
     TRACE("(%p, %p)\n", db, view);
 
@@ -363,14 +260,6 @@ unsigned storages_view_create(LibmsiDatabase *db, LibmsiView **view)
 
     sv->view.ops = &storages_ops;
     sv->db = db;
-
-    r = add_storages_to_table(sv);
-    if (r)
-    {
-        msi_free( sv );
-        return r;
-    }
-
     *view = (LibmsiView *)sv;
 
     return LIBMSI_RESULT_SUCCESS;
@@ -29,60 +29,13 @@
 
 #define NUM_STREAMS_COLS    2
 
-typedef struct tabSTREAM
-{
-    unsigned str_index;
-    GsfInput *stream;
-} STREAM;
-
+/* the rows are kept by the database, see msi_get_stream_row */
 typedef struct _LibmsiStreamsView
 {
     LibmsiView view;
     LibmsiDatabase *db;
-    STREAM **streams;
-    unsigned max_streams;
-    unsigned num_rows;
-    unsigned row_size;
 } LibmsiStreamsView;
 
-static bool streams_set_table_size(LibmsiStreamsView *sv, unsigned size)
-{
-    if (size >= sv->max_streams)
-    {
-        sv->streams = msi_realloc_zero(sv->streams, sv->max_streams * sizeof(STREAM *),
-                                       sv->max_streams * 2 * sizeof(STREAM *));
-        sv->max_streams *= 2;
-        if (!sv->streams)
-            return false;
-    }
-
-    return true;
-}
-
-static STREAM *create_stream(LibmsiStreamsView *sv, const char *name, bool encoded, GsfInput *stm)
-{
-    STREAM *stream;
-    g_autofree char *decoded = NULL;
-
-    stream = msi_alloc(sizeof(STREAM));
-    if (!stream)
-        return NULL;
-
-    if (encoded)
-    {
-        decoded = decode_streamname(name);
-        TRACE("stream -> %s %s\n", debugstr_a(name), debugstr_a(decoded));
-        name = decoded;
-    }
-
-    stream->str_index = _libmsi_add_string(sv->db->strings, name, -1, 1, StringNonPersistent);
-    stream->stream = stm;
-    if (stream->stream)
-        g_object_ref(G_OBJECT(stm));
-
-    return stream;
-}
-
 static unsigned streams_view_fetch_int(LibmsiView *view, unsigned row, unsigned col, unsigned *val)
 {
     LibmsiStreamsView *sv = (LibmsiStreamsView *)view;
@@ -92,12 +45,7 @@ static unsigned streams_view_fetch_int(LibmsiView *view, unsigned row, unsigned
     if (col != 1)
         return LIBMSI_RESULT_INVALID_PARAMETER;
 
-    if (row >= sv->num_rows)
-        return NO_MORE_ITEMS;
-
-    *val = sv->streams[row]->str_index;
-
-    return LIBMSI_RESULT_SUCCESS;
+    return msi_get_stream_row(sv->db, row, val, NULL);
 }
 
 static unsigned streams_view_fetch_stream(LibmsiView *view, unsigned row, unsigned col, GsfInput **stm)
@@ -106,12 +54,9 @@ static unsigned streams_view_fetch_stream(LibmsiView *view, unsigned row, unsign
 
     TRACE("(%p, %d, %d, %p)\n", view, row, col, stm);
 
-    if (row >= sv->num_rows)
+    if (msi_get_stream_row(sv->db, row, NULL, stm) != LIBMSI_RESULT_SUCCESS)
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
-    g_object_ref(G_OBJECT(sv->streams[row]->stream));
-    *stm = sv->streams[row]->stream;
-
     return LIBMSI_RESULT_SUCCESS;
 }
 
@@ -127,52 +72,42 @@ static unsigned streams_view_get_row( LibmsiView *view, unsigned row, LibmsiReco
 static unsigned streams_view_set_row(LibmsiView *view, unsigned row, LibmsiRecord *rec, unsigned mask)
 {
     LibmsiStreamsView *sv = (LibmsiStreamsView *)view;
-    STREAM *stream = NULL;
+    unsigned count = msi_get_stream_rows(sv->db);
     GsfInput *stm;
     char *name = NULL;
-    unsigned r;
+    unsigned r, id;
 
     TRACE("(%p, %d, %p, %08x)\n", view, row, rec, mask);
 
-    if (row > sv->num_rows)
+    if (row > count)
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
     r = _libmsi_record_get_gsf_input(rec, 2, &stm);
     if (r != LIBMSI_RESULT_SUCCESS)
         return r;
 
-    if (sv->streams[row]) {
+    if (row < count) {
         if (mask & 1) {
             g_warning("FIXME: renaming stream via UPDATE on _Streams table");
             goto done;
         }
 
-        stream = sv->streams[row];
-        name = strdup(msi_string_lookup_id(sv->db->strings, stream->str_index));
+        msi_get_stream_row(sv->db, row, &id, NULL);
+        name = strdup(msi_string_lookup_id(sv->db->strings, id));
     } else {
         name = strdup(_libmsi_record_get_string_raw(rec, 1));
         if (!name)
         {
             g_warning("failed to retrieve stream name\n");
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
             goto done;
         }
-
-        stream = create_stream(sv, name, false, stm);
     }
 
-    if (!stream)
-        goto done;
-
+    /* this adds the row, or replaces the data of an existing one */
     r = msi_create_stream(sv->db, name, stm);
     if (r != LIBMSI_RESULT_SUCCESS)
-    {
         g_warning("failed to create stream: %08x\n", r);
-        g_object_unref(G_OBJECT(stream->stream));
-        msi_free(stream);
-        goto done;
-    }
-
-    sv->streams[row] = stream;
 
 done:
     msi_free(name);
@@ -185,23 +120,11 @@ done:
 static unsigned streams_view_insert_row(LibmsiView *view, LibmsiRecord *rec, unsigned row, bool temporary)
 {
     LibmsiStreamsView *sv = (LibmsiStreamsView *)view;
-    unsigned i;
 
     TRACE("(%p, %p, %d, %d)\n", view, rec, row, temporary);
 
-    if (!streams_set_table_size(sv, ++sv->num_rows))
-        return LIBMSI_RESULT_FUNCTION_FAILED;
-
-    if (row == -1)
-        row = sv->num_rows - 1;
-
-    /* shift the rows to make room for the new row */
-    for (i = sv->num_rows - 1; i > row; i--)
-    {
-        sv->streams[i] = sv->streams[i - 1];
-    }
-
-    return streams_view_set_row(view, row, rec, 0);
+    /* streams are kept in the order they were added */
+    return streams_view_set_row(view, msi_get_stream_rows(sv->db), rec, 0);
 }
 
 static unsigned streams_view_delete_row(LibmsiView *view, unsigned row)
@@ -209,12 +132,12 @@ static unsigned streams_view_delete_row(LibmsiView *view, unsigned row)
     LibmsiStreamsView *sv = (LibmsiStreamsView *)view;
     const char *name;
     char *encname;
-    unsigned i;
+    unsigned id;
 
-    if (row > sv->num_rows)
+    if (msi_get_stream_row(sv->db, row, &id, NULL) != LIBMSI_RESULT_SUCCESS)
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
-    name = msi_string_lookup_id(sv->db->strings, sv->streams[row]->str_index);
+    name = msi_string_lookup_id(sv->db->strings, id);
     if (!name)
     {
         g_warning("failed to retrieve stream name\n");
@@ -223,13 +146,7 @@ static unsigned streams_view_delete_row(LibmsiView *view, unsigned row)
 
     encname = encode_streamname(false, name);
     msi_destroy_stream(sv->db, encname);
-
-    /* shift the remaining rows */
-    for (i = row + 1; i < sv->num_rows; i++)
-    {
-        sv->streams[i - 1] = sv->streams[i];
-    }
-    sv->num_rows--;
+    msi_free(encname);
 
     return LIBMSI_RESULT_SUCCESS;
 }
@@ -253,7 +170,7 @@ static unsigned streams_view_get_dimensions(LibmsiView *view, unsigned *rows, un
     TRACE("(%p, %p, %p)\n", view, rows, cols);
 
     if (cols) *cols = NUM_STREAMS_COLS;
-    if (rows) *rows = sv->num_rows;
+    if (rows) *rows = msi_get_stream_rows(sv->db);
 
     return LIBMSI_RESULT_SUCCESS;
 }
@@ -290,21 +207,9 @@ static unsigned streams_view_get_column_info( LibmsiView *view, unsigned n, cons
 static unsigned streams_view_delete(LibmsiView *view)
 {
     LibmsiStreamsView *sv = (LibmsiStreamsView *)view;
-    unsigned i;
 
     TRACE("(%p)\n", view);
 
-    for (i = 0; i < sv->num_rows; i++)
-    {
-        if (sv->streams[i])
-        {
-            if (sv->streams[i]->stream)
-                g_object_unref(G_OBJECT(sv->streams[i]->stream));
-            msi_free(sv->streams[i]);
-        }
-    }
-
-    msi_free(sv->streams);
     msi_free(sv);
 
     return LIBMSI_RESULT_SUCCESS;
@@ -314,30 +219,18 @@ static unsigned streams_view_find_matching_rows(LibmsiView *view, unsigned col,
                                        unsigned val, unsigned *row, MSIITERHANDLE *handle)
 {
     LibmsiStreamsView *sv = (LibmsiStreamsView *)view;
-    unsigned index = (uintptr_t)(*handle);
 
     TRACE("(%p, %d, %d, %p, %p)\n", view, col, val, row, handle);
 
     if (col == 0 || col > NUM_STREAMS_COLS)
         return LIBMSI_RESULT_INVALID_PARAMETER;
 
-    while (index < sv->num_rows)
-    {
-        if (sv->streams[index]->str_index == val)
-        {
-            *row = index;
-            break;
-        }
-
-        index++;
-    }
-
-    *handle = (MSIITERHANDLE)(uintptr_t)++index;
-
-    if (index > sv->num_rows)
+    /* names are unique, so there is at most one match */
+    if (*handle)
         return NO_MORE_ITEMS;
 
-    return LIBMSI_RESULT_SUCCESS;
+    *handle = (MSIITERHANDLE)(uintptr_t)1;
+    return msi_find_stream_row(sv->db, val, row);
 }
 
 static const LibmsiViewOps streams_ops =
@@ -362,39 +255,9 @@ static const LibmsiViewOps streams_ops =
     NULL,
 };
 
-static unsigned add_stream_to_table(const char *name, GsfInput *stm, void *opaque)
-{
-    LibmsiStreamsView *sv = (LibmsiStreamsView *)opaque;
-    STREAM *stream;
-
-    stream = create_stream(sv, name, true, stm);
-    if (!stream)
-        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
-
-    if (!streams_set_table_size(sv, ++sv->num_rows))
-    {
-        msi_free(stream);
-        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
-    }
-
-    sv->streams[sv->num_rows - 1] = stream;
-    return LIBMSI_RESULT_SUCCESS;
-}
-
-static unsigned add_streams_to_table(LibmsiStreamsView *sv)
-{
-    sv->max_streams = 1;
-    sv->streams = msi_alloc_zero(sizeof(STREAM *));
-    if (!sv->streams)
-        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
-
-    return msi_enum_db_streams(sv->db, add_stream_to_table, sv);
-}
-
 unsigned streams_view_create(LibmsiDatabase *db, LibmsiView **view)
 {
     LibmsiStreamsView *sv;
-    unsigned r;
 
     TRACE("(%p, %p)\n", db, view);
 
@@ -404,13 +267,6 @@ unsigned streams_view_create(LibmsiDatabase *db, LibmsiView **view)
 
     sv->view.ops = &streams_ops;
     sv->db = db;
-    r = add_streams_to_table(sv);
-    if (r)
-    {
-        msi_free( sv );
-        return r;
-    }
-
     *view = (LibmsiView *)sv;
 
     return LIBMSI_RESULT_SUCCESS;
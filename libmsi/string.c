@@ -47,6 +47,9 @@ struct string_table
     unsigned sortcount;
     struct msistring *strings; /* an array of strings */
     unsigned *sorted;              /* index */
+    int ref_count;
+    struct string_table *parent;   /* owns the strings this table was cloned with */
+    unsigned inherited;
 };
 
 static bool validate_codepage( unsigned codepage )
@@ -103,20 +106,36 @@ static string_table *init_stringtable( int entries, unsigned codepage )
     st->freeslot = 1;
     st->codepage = codepage;
     st->sortcount = 0;
+    st->ref_count = 1;
+    st->parent = NULL;
+    st->inherited = 0;
 
     return st;
 }
 
+/* strings never change once added, so a clone uses those of its parent */
+static bool st_owns_string( const string_table *st, unsigned i )
+{
+    return !st->parent || i >= st->inherited ||
+           st->strings[i].str != st->parent->strings[i].str;
+}
+
 void msi_destroy_stringtable( string_table *st )
 {
     unsigned i;
 
+    if( __sync_sub_and_fetch( &st->ref_count, 1 ) )
+        return;
+
     for( i=0; i<st->maxcount; i++ )
     {
-        if( st->strings[i].persistent_refcount ||
-            st->strings[i].nonpersistent_refcount )
+        if( (st->strings[i].persistent_refcount ||
+             st->strings[i].nonpersistent_refcount) &&
+            st_owns_string( st, i ) )
             msi_free( st->strings[i].str );
     }
+    if( st->parent )
+        msi_destroy_stringtable( st->parent );
     msi_free( st->strings );
     msi_free( st->sorted );
     msi_free( st );
@@ -202,6 +221,7 @@ static void set_st_entry( string_table *st, unsigned n, char *str, uint16_t refc
 {
     g_return_if_fail(str != NULL);
 
+    msi_count( MSI_COUNTER_STRINGS_INTERNED, 1 );
     if (persistence == StringPersistent)
     {
         st->strings[n].persistent_refcount = refcount;
@@ -239,6 +259,7 @@ static unsigned _libmsi_id_from_string( const string_table *st, const char *buff
 
     codepage = st->codepage ? st->codepage : gsf_msole_iconv_win_codepage();
     cpconv = gsf_msole_iconv_open_codepage_for_export(codepage);
+    msi_count( MSI_COUNTER_ICONV, 1 );
     str = g_convert_with_iconv(buffer, -1, cpconv, NULL, &sz, NULL);
     g_iconv_close(cpconv);
     if( !str )
@@ -291,6 +312,7 @@ static int msi_addstring( string_table *st, unsigned n, const char *data, int le
     /* allocate a new string */
     codepage = st->codepage ? st->codepage : gsf_msole_iconv_win_codepage();
     cpconv = gsf_msole_iconv_open_for_import(codepage);
+    msi_count( MSI_COUNTER_ICONV, 1 );
     str = g_convert_with_iconv(data, len, cpconv, NULL, &sz, &err);
     g_iconv_close(cpconv);
     if (err) {
@@ -386,6 +408,7 @@ static unsigned _libmsi_string_id( const string_table *st, unsigned id, char *bu
 
     codepage = st->codepage ? st->codepage : gsf_msole_iconv_win_codepage();
     cpconv = gsf_msole_iconv_open_codepage_for_export(codepage);
+    msi_count( MSI_COUNTER_ICONV, 1 );
     str = g_convert_with_iconv(str_utf8, -1, cpconv, NULL, &len, &err);
     g_iconv_close(cpconv);
     if (err) {
@@ -461,6 +484,7 @@ static void string_totalsize( const string_table *st, unsigned *datasize, unsign
         {
             TRACE("[%u] = %s\n", i, debugstr_a(st->strings[i].str));
             cpconv = gsf_msole_iconv_open_codepage_for_export(codepage);
+            msi_count( MSI_COUNTER_ICONV, 1 );
             str = g_convert_with_iconv( st->strings[i].str, -1, cpconv, NULL, &len, &err);
             g_iconv_close(cpconv);
             if (!str) {
@@ -492,6 +516,31 @@ string_table *msi_init_string_table( unsigned *bytes_per_strref )
     return st;
 }
 
+/*
+ * A copy of st in which every string keeps its id.  The copy only has its
+ * own reference counts and index; the strings stay with st, which is kept
+ * alive until the copy is destroyed.
+ */
+string_table *msi_clone_string_table( string_table *st )
+{
+    string_table *copy;
+
+    copy = init_stringtable( st->maxcount, st->codepage );
+    if( !copy )
+        return NULL;
+
+    memcpy( copy->strings, st->strings, st->maxcount * sizeof(struct msistring) );
+    memcpy( copy->sorted, st->sorted, st->sortcount * sizeof(unsigned) );
+    copy->sortcount = st->sortcount;
+    copy->freeslot = st->freeslot;
+
+    copy->parent = st;
+    copy->inherited = st->maxcount;
+    __sync_add_and_fetch( &st->ref_count, 1 );
+
+    return copy;
+}
+
 string_table *msi_load_string_table( GsfInfile *stg, unsigned *bytes_per_strref )
 {
     string_table *st = NULL;
@@ -499,6 +548,7 @@ string_table *msi_load_string_table( GsfInfile *stg, unsigned *bytes_per_strref
     uint16_t *pool = NULL;
     unsigned r, datasize = 0, poolsize = 0, codepage;
     unsigned i, count, offset, len, n, refs;
+    int64_t start = msi_span_begin();
 
     r = read_stream_data( stg, szStringPool, (uint8_t **)&pool, &poolsize );
     if( r != LIBMSI_RESULT_SUCCESS)
@@ -576,10 +626,12 @@ end:
     msi_free( pool );
     msi_free( data );
 
+    msi_span_end( "load_string_table", start );
     return st;
 }
 
-unsigned msi_save_string_table( const string_table *st, LibmsiDatabase *db, unsigned *bytes_per_strref )
+/* bytes_per_strref is the smallest string reference size to use, 0 for any */
+unsigned msi_save_string_table( const string_table *st, GsfOutfile *stg, unsigned *bytes_per_strref )
 {
     unsigned i, datasize = 0, poolsize = 0, sz, used, r, codepage, n;
     unsigned ret = LIBMSI_RESULT_FUNCTION_FAILED;
@@ -612,7 +664,7 @@ unsigned msi_save_string_table( const string_table *st, LibmsiDatabase *db, unsi
     pool[1] = codepage >> 8;
     pool[2] = codepage >> 16;
     pool[3] = codepage >> 24;
-    if (st->maxcount > 0xffff)
+    if (st->maxcount > 0xffff || *bytes_per_strref == LONG_STR_BYTES)
     {
         pool[3] |= 0x80;
         *bytes_per_strref = LONG_STR_BYTES;
@@ -680,11 +732,11 @@ unsigned msi_save_string_table( const string_table *st, LibmsiDatabase *db, unsi
     }
 
     /* write the streams */
-    r = write_stream_data( db, szStringData, data, datasize );
+    r = write_stream_data( stg, szStringData, data, datasize );
     TRACE("Wrote StringData r=%08x\n", r);
     if( r )
         goto err;
-    r = write_stream_data( db, szStringPool, pool, poolsize );
+    r = write_stream_data( stg, szStringPool, pool, poolsize );
     TRACE("Wrote StringPool r=%08x\n", r);
     if( r )
         goto err;
@@ -704,6 +756,36 @@ unsigned msi_get_string_table_codepage( const string_table *st )
     return st->codepage;
 }
 
+/* the number of string ids, used or not */
+G_GNUC_PURE
+unsigned msi_get_string_table_count( const string_table *st )
+{
+    return st->maxcount;
+}
+
+void msi_get_string_table_stats( const string_table *st, LibmsiStringStats *stats )
+{
+    unsigned i;
+    size_t len;
+
+    memset( stats, 0, sizeof *stats );
+    stats->memory = st->maxcount * (sizeof(struct msistring) + sizeof(*st->sorted));
+
+    for( i = 1; i < st->maxcount; i++ )
+    {
+        if( !st->strings[i].persistent_refcount && !st->strings[i].nonpersistent_refcount )
+            continue;
+
+        len = strlen( st->strings[i].str );
+        stats->count++;
+        stats->bytes += len;
+        stats->refs += st->strings[i].persistent_refcount +
+                       st->strings[i].nonpersistent_refcount;
+        if( st_owns_string( st, i ) )
+            stats->memory += len + 1;
+    }
+}
+
 unsigned msi_set_string_table_codepage( string_table *st, unsigned codepage )
 {
     if (validate_codepage( codepage ))
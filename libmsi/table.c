@@ -49,13 +49,29 @@ typedef struct _LibmsiColumnInfo
     int     ref_count;
     bool    temporary;
     LibmsiColumnHashEntry **hash_table;
+    unsigned hash_size;
 } LibmsiColumnInfo;
 
+/*
+ * Rows shared by a table and its copies in other databases.  A holder
+ * owns the rows that were private to the table when it was shared, and
+ * keeps the holder of the older shared rows alive.
+ */
+typedef struct _LibmsiTableRows
+{
+    int ref_count;
+    unsigned count;
+    uint8_t **data;
+    struct _LibmsiTableRows *parent;
+} LibmsiTableRows;
+
 struct _LibmsiTable
 {
     uint8_t **data;
     bool *data_persistent;
     unsigned row_count;
+    LibmsiTableRows *shared;
+    bool *row_shared;
     struct list entry;
     LibmsiColumnInfo *colinfo;
     unsigned col_count;
@@ -307,6 +323,7 @@ unsigned read_stream_data( GsfInfile *stg, const char *stname,
 
     *pdata = data;
     *psz = sz;
+    msi_count_stream( stname, sz, 0 );
     ret = LIBMSI_RESULT_SUCCESS;
 
 end:
@@ -315,19 +332,19 @@ end:
     return ret;
 }
 
-unsigned write_stream_data( LibmsiDatabase *db, const char *stname,
+unsigned write_stream_data( GsfOutfile *stg, const char *stname,
                         const void *data, unsigned sz )
 {
     unsigned ret = LIBMSI_RESULT_FUNCTION_FAILED;
     char *encname;
     GsfOutput *stm;
 
-    if (!db->outfile)
+    if (!stg)
         return ret;
 
     encname = encode_streamname(true, stname );
 
-    stm = gsf_outfile_new_child( db->outfile, encname, false );
+    stm = gsf_outfile_new_child( stg, encname, false );
     msi_free( encname );
     if( !stm )
     {
@@ -341,6 +358,7 @@ unsigned write_stream_data( LibmsiDatabase *db, const char *stname,
         goto end;
     }
 
+    msi_count_stream( stname, 0, sz );
     ret = LIBMSI_RESULT_SUCCESS;
 
 end:
@@ -355,11 +373,36 @@ static void msi_free_colinfo( LibmsiColumnInfo *colinfo, unsigned count )
     for (i = 0; i < count; i++) msi_free( colinfo[i].hash_table );
 }
 
+static void msi_table_rows_release( LibmsiTableRows *rows )
+{
+    LibmsiTableRows *parent;
+    unsigned i;
+
+    while( rows && !__sync_sub_and_fetch( &rows->ref_count, 1 ) )
+    {
+        for( i = 0; i < rows->count; i++ )
+            msi_free( rows->data[i] );
+        parent = rows->parent;
+        msi_free( rows->data );
+        msi_free( rows );
+        rows = parent;
+    }
+}
+
+static inline bool table_row_shared( const LibmsiTable *t, unsigned row )
+{
+    return t->shared && t->row_shared[row];
+}
+
 static void free_table( LibmsiTable *table )
 {
     unsigned i;
     for( i=0; i<table->row_count; i++ )
-        msi_free( table->data[i] );
+        if( !table_row_shared( table, i ) )
+            msi_free( table->data[i] );
+    if( table->shared )
+        msi_table_rows_release( table->shared );
+    msi_free( table->row_shared );
     msi_free( table->data );
     msi_free( table->data_persistent );
     msi_free_colinfo( table->colinfo, table->col_count );
@@ -384,6 +427,93 @@ static unsigned msi_table_get_row_size( LibmsiDatabase *db, const LibmsiColumnIn
     return last_col->offset + bytes_per_column( db, last_col, bytes_per_strref );
 }
 
+/* copy a row the table shares with other databases before changing it */
+static unsigned table_make_row_writable( LibmsiDatabase *db, LibmsiTable *t, unsigned row )
+{
+    unsigned size;
+    uint8_t *data;
+
+    if( !table_row_shared( t, row ) )
+        return LIBMSI_RESULT_SUCCESS;
+
+    size = msi_table_get_row_size( db, t->colinfo, t->col_count, LONG_STR_BYTES );
+    data = msi_alloc( size );
+    if( !data )
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+
+    memcpy( data, t->data[row], size );
+    t->data[row] = data;
+    t->row_shared[row] = false;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* copy every shared row, for changes that touch all of them */
+static unsigned table_make_writable( LibmsiDatabase *db, LibmsiTable *t )
+{
+    unsigned i, r;
+
+    if( !t->shared )
+        return LIBMSI_RESULT_SUCCESS;
+
+    for( i = 0; i < t->row_count; i++ )
+    {
+        r = table_make_row_writable( db, t, i );
+        if( r != LIBMSI_RESULT_SUCCESS )
+            return r;
+    }
+
+    msi_table_rows_release( t->shared );
+    msi_free( t->row_shared );
+    t->shared = NULL;
+    t->row_shared = NULL;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* hand the rows of the table over to a holder that others can share */
+static LibmsiTableRows *table_share_rows( LibmsiTable *t )
+{
+    LibmsiTableRows *rows;
+    unsigned i;
+
+    if( !t->shared )
+    {
+        msi_free( t->row_shared );
+        t->row_shared = msi_alloc_zero( t->row_count * sizeof(bool) );
+        if( !t->row_shared )
+            return NULL;
+    }
+
+    rows = msi_alloc_zero( sizeof(LibmsiTableRows) );
+    if( !rows )
+        return NULL;
+    rows->data = msi_alloc( t->row_count * sizeof(uint8_t*) );
+    if( !rows->data )
+    {
+        msi_free( rows );
+        return NULL;
+    }
+
+    for( i = 0; i < t->row_count; i++ )
+        if( !table_row_shared( t, i ) )
+            rows->data[rows->count++] = t->data[i];
+
+    /* nothing changed since the last time, keep the holder */
+    if( t->shared && !rows->count )
+    {
+        msi_free( rows->data );
+        msi_free( rows );
+        return t->shared;
+    }
+
+    rows->ref_count = 1;
+    rows->parent = t->shared;
+    t->shared = rows;
+    for( i = 0; i < t->row_count; i++ )
+        t->row_shared[i] = true;
+
+    return rows;
+}
+
 /* add this table to the list of cached tables in the database */
 static unsigned read_table_from_storage( LibmsiDatabase *db, LibmsiTable *t, GsfInfile *stg )
 {
@@ -943,7 +1073,7 @@ static unsigned save_table( LibmsiDatabase *db, const LibmsiTable *t, unsigned b
     }
 
     TRACE("writing %d bytes\n", rawsize);
-    r = write_stream_data( db, t->name, rawdata, rawsize );
+    r = write_stream_data( db->outfile, t->name, rawdata, rawsize );
 
 err:
     msi_free( rawdata );
@@ -957,6 +1087,8 @@ static void msi_update_table_columns( LibmsiDatabase *db, const char *name )
     unsigned n;
 
     table = find_cached_table( db, name );
+    if (table_make_writable( db, table ) != LIBMSI_RESULT_SUCCESS) return;
+
     old_count = table->col_count;
     msi_free_colinfo( table->colinfo, table->col_count );
     msi_free( table->colinfo );
@@ -1009,6 +1141,66 @@ bool table_view_exists( LibmsiDatabase *db, const char *name )
     return false;
 }
 
+/* a table that is not loaded yet is sized from its stream, without
+ * reading it */
+unsigned msi_get_table_stats( LibmsiDatabase *db, const char *name, LibmsiTableStats *stats )
+{
+    LibmsiColumnInfo *colinfo = NULL;
+    LibmsiTable *table;
+    GsfInput *stm = NULL;
+    unsigned r, i, count = 0, row_size, row_size_mem;
+    char *encname;
+
+    memset( stats, 0, sizeof *stats );
+
+    table = find_cached_table( db, name );
+    if( table && table->colinfo )
+    {
+        colinfo = table->colinfo;
+        count = table->col_count;
+        stats->rows = table->row_count;
+        stats->loaded = true;
+    }
+    else
+    {
+        r = table_get_column_info( db, name, &colinfo, &count );
+        if( r != LIBMSI_RESULT_SUCCESS )
+            return r;
+    }
+
+    row_size = msi_table_get_row_size( db, colinfo, count, db->bytes_per_strref );
+    row_size_mem = msi_table_get_row_size( db, colinfo, count, LONG_STR_BYTES );
+
+    if( !stats->loaded )
+    {
+        encname = encode_streamname( true, name );
+        if( db->infile )
+            stm = gsf_infile_child_by_name( db->infile, encname );
+        msi_free( encname );
+
+        if( stm && row_size )
+            stats->rows = gsf_input_size( stm ) / row_size;
+        if( stm )
+            g_object_unref( stm );
+    }
+
+    stats->columns = count;
+    stats->stream_bytes = (uint64_t)stats->rows * row_size;
+    stats->data_bytes = (uint64_t)stats->rows *
+                        (row_size_mem + sizeof(uint8_t *) + sizeof(bool));
+
+    /* the same allocation as in table_view_find_matching_rows */
+    for( i = 0; i < count; i++ )
+        if( colinfo[i].hash_table )
+            stats->index_bytes += colinfo[i].hash_size * sizeof(LibmsiColumnHashEntry *) +
+                                  stats->rows * sizeof(LibmsiColumnHashEntry);
+
+    if( !stats->loaded )
+        msi_free( colinfo );
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
 /* below is the query interface to a table */
 
 typedef struct _LibmsiTableView
@@ -1181,9 +1373,10 @@ static unsigned table_view_fetch_stream( LibmsiView *view, unsigned row, unsigne
     return r;
 }
 
-static unsigned table_view_set_int( LibmsiTableView *tv, unsigned row, unsigned col, unsigned val )
+/* stores a raw value, leaving the column index for the caller to discard */
+static unsigned table_view_store_int( LibmsiTableView *tv, unsigned row, unsigned col, unsigned val )
 {
-    unsigned offset, n, i;
+    unsigned offset, n, i, r;
 
     if( !tv->table )
         return LIBMSI_RESULT_INVALID_PARAMETER;
@@ -1201,9 +1394,6 @@ static unsigned table_view_set_int( LibmsiTableView *tv, unsigned row, unsigned
         return LIBMSI_RESULT_FUNCTION_FAILED;
     }
 
-    msi_free( tv->columns[col-1].hash_table );
-    tv->columns[col-1].hash_table = NULL;
-
     n = bytes_per_column( tv->db, &tv->columns[col - 1], LONG_STR_BYTES );
     if ( n != 2 && n != 3 && n != 4 )
     {
@@ -1211,6 +1401,10 @@ static unsigned table_view_set_int( LibmsiTableView *tv, unsigned row, unsigned
         return LIBMSI_RESULT_FUNCTION_FAILED;
     }
 
+    r = table_make_row_writable( tv->db, tv->table, row );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
     offset = tv->columns[col-1].offset;
     for ( i = 0; i < n; i++ )
         tv->table->data[row][offset + i] = (val >> i * 8) & 0xff;
@@ -1218,6 +1412,20 @@ static unsigned table_view_set_int( LibmsiTableView *tv, unsigned row, unsigned
     return LIBMSI_RESULT_SUCCESS;
 }
 
+static unsigned table_view_set_int( LibmsiTableView *tv, unsigned row, unsigned col, unsigned val )
+{
+    unsigned r;
+
+    r = table_view_store_int( tv, row, col, val );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    msi_free( tv->columns[col-1].hash_table );
+    tv->columns[col-1].hash_table = NULL;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
 static unsigned table_view_get_row( LibmsiView *view, unsigned row, LibmsiRecord **rec )
 {
     LibmsiTableView *tv = (LibmsiTableView *)view;
@@ -1393,6 +1601,84 @@ static unsigned table_view_set_row( LibmsiView *view, unsigned row, LibmsiRecord
     return r;
 }
 
+static unsigned table_view_set_rows( LibmsiView *view, const unsigned *rows, unsigned count,
+                                     LibmsiRecord *rec, unsigned mask )
+{
+    LibmsiTableView *tv = (LibmsiTableView*)view;
+    unsigned i, j, val, r;
+
+    TRACE("%p %p %u %p %08x\n", tv, rows, count, rec, mask);
+
+    if ( !tv->table )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    /* test if any of the mask bits are invalid */
+    if ( mask >= (1<<tv->num_cols) )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    if ( !rows )
+        count = tv->table->row_count;
+
+    for ( j = 0; rows && j < count; j++ )
+        if ( rows[j] >= tv->table->row_count )
+            return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    if ( !count )
+        return LIBMSI_RESULT_SUCCESS;
+
+    for ( i = 0; i < tv->num_cols; i++ )
+    {
+        if ( !(mask&(1<<i)) )
+            continue;
+
+        /* streams are stored under a name made of the row keys */
+        if ( MSITYPE_IS_BINARY(tv->columns[ i ].type) )
+        {
+            for ( j = 0; j < count; j++ )
+            {
+                r = table_view_set_row( view, rows ? rows[j] : j, rec, 1 << i );
+                if ( r != LIBMSI_RESULT_SUCCESS )
+                    return r;
+            }
+            continue;
+        }
+
+        /* the value is converted once, for all rows */
+        val = 0;
+        if ( !libmsi_record_is_null( rec, i + 1 ) )
+        {
+            r = get_table_value_from_record( tv, rec, i + 1, &val );
+            if ( r != LIBMSI_RESULT_SUCCESS )
+            {
+                const char *sval = _libmsi_record_get_string_raw( rec, i + 1 );
+                bool persistent;
+
+                if ( !(tv->columns[i].type & MSITYPE_STRING) )
+                    return LIBMSI_RESULT_FUNCTION_FAILED;
+
+                /* a new string takes the persistence of the first row */
+                persistent = (tv->table->persistent != LIBMSI_CONDITION_FALSE) &&
+                             (tv->table->data_persistent[rows ? rows[0] : 0]);
+                val = _libmsi_add_string( tv->db->strings, sval, -1, 1,
+                      persistent ? StringPersistent : StringNonPersistent );
+            }
+        }
+
+        for ( j = 0; j < count; j++ )
+        {
+            r = table_view_store_int( tv, rows ? rows[j] : j, i + 1, val );
+            if ( r != LIBMSI_RESULT_SUCCESS )
+                return r;
+        }
+
+        /* the index is rebuilt by the next lookup */
+        msi_free( tv->columns[i].hash_table );
+        tv->columns[i].hash_table = NULL;
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
 static unsigned table_create_new_row( LibmsiView *view, unsigned *num, bool temporary )
 {
     LibmsiTableView *tv = (LibmsiTableView*)view;
@@ -1412,6 +1698,18 @@ static unsigned table_create_new_row( LibmsiView *view, unsigned *num, bool temp
     if( !row )
         return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
 
+    if( tv->table->shared )
+    {
+        b = msi_realloc( tv->table->row_shared, (tv->table->row_count + 1) * sizeof(bool) );
+        if( !b )
+        {
+            msi_free( row );
+            return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+        }
+        b[tv->table->row_count] = false;
+        tv->table->row_shared = b;
+    }
+
     row_count = &tv->table->row_count;
     data_ptr = &tv->table->data;
     data_persist_ptr = &tv->table->data_persistent;
@@ -1460,6 +1758,9 @@ static unsigned table_view_execute( LibmsiView *view, LibmsiRecord *record )
 
     TRACE("There are %d columns\n", tv->num_cols );
 
+    if( view->profile )
+        msi_view_profile_end( view, msi_view_profile_begin( view ),
+                              tv->table->row_count, tv->table->row_count );
     return LIBMSI_RESULT_SUCCESS;
 }
 
@@ -1629,7 +1930,9 @@ static int find_insert_index( LibmsiTableView *tv, LibmsiRecord *rec )
 static unsigned table_view_insert_row( LibmsiView *view, LibmsiRecord *rec, unsigned row, bool temporary )
 {
     LibmsiTableView *tv = (LibmsiTableView*)view;
-    unsigned i, r;
+    LibmsiTable *t;
+    unsigned i, r, last;
+    uint8_t *data;
 
     TRACE("%p %p %s\n", tv, rec, temporary ? "true" : "false" );
 
@@ -1646,16 +1949,31 @@ static unsigned table_view_insert_row( LibmsiView *view, LibmsiRecord *rec, unsi
     if( r != LIBMSI_RESULT_SUCCESS )
         return r;
 
-    /* shift the rows to make room for the new row */
-    for (i = tv->table->row_count - 1; i > row; i--)
+    /* move the new row into place; the rows themselves stay where they
+     * are, so shared rows are not written to */
+    t = tv->table;
+    last = t->row_count - 1;
+    data = t->data[last];
+    memmove(&t->data[row + 1], &t->data[row], (last - row) * sizeof(*t->data));
+    memmove(&t->data_persistent[row + 1], &t->data_persistent[row],
+            (last - row) * sizeof(*t->data_persistent));
+    if (t->shared)
+    {
+        memmove(&t->row_shared[row + 1], &t->row_shared[row],
+                (last - row) * sizeof(*t->row_shared));
+        t->row_shared[row] = false;
+    }
+    t->data[row] = data;
+
+    /* the rows after the new one moved */
+    for (i = 0; i < tv->num_cols; i++)
     {
-        memmove(&(tv->table->data[i][0]),
-                &(tv->table->data[i - 1][0]), tv->row_size);
-        tv->table->data_persistent[i] = tv->table->data_persistent[i - 1];
+        msi_free( tv->columns[i].hash_table );
+        tv->columns[i].hash_table = NULL;
     }
 
     /* Re-set the persistence flag */
-    tv->table->data_persistent[row] = !temporary;
+    t->data_persistent[row] = !temporary;
     return table_view_set_row( view, row, rec, (1<<tv->num_cols) - 1 );
 }
 
@@ -1686,14 +2004,17 @@ static unsigned table_view_delete_row( LibmsiView *view, unsigned row )
         tv->columns[i].hash_table = NULL;
     }
 
+    if (!table_row_shared( tv->table, row ))
+        msi_free(tv->table->data[row]);
+
     for (i = row + 1; i < num_rows; i++)
     {
-        memcpy(tv->table->data[i - 1], tv->table->data[i], tv->row_size);
+        tv->table->data[i - 1] = tv->table->data[i];
         tv->table->data_persistent[i - 1] = tv->table->data_persistent[i];
+        if (tv->table->shared)
+            tv->table->row_shared[i - 1] = tv->table->row_shared[i];
     }
 
-    msi_free(tv->table->data[num_rows - 1]);
-
     return LIBMSI_RESULT_SUCCESS;
 }
 
@@ -1729,6 +2050,7 @@ static unsigned table_view_find_matching_rows( LibmsiView *view, unsigned col,
     {
         unsigned i;
         unsigned num_rows = tv->table->row_count;
+        unsigned size = MAX( LibmsiTable_HASH_TABLE_SIZE, num_rows | 1 );
         LibmsiColumnHashEntry **hash_table;
         LibmsiColumnHashEntry *new_entry;
 
@@ -1740,41 +2062,41 @@ static unsigned table_view_find_matching_rows( LibmsiView *view, unsigned col,
         }
 
         /* allocate contiguous memory for the table and its entries so we
-         * don't have to do an expensive cleanup */
-        hash_table = msi_alloc(LibmsiTable_HASH_TABLE_SIZE * sizeof(LibmsiColumnHashEntry*) +
+         * don't have to do an expensive cleanup; there are about as many
+         * buckets as rows, so a bucket holds the rows of one value */
+        hash_table = msi_alloc(size * sizeof(LibmsiColumnHashEntry*) +
             num_rows * sizeof(LibmsiColumnHashEntry));
         if (!hash_table)
             return LIBMSI_RESULT_OUTOFMEMORY;
 
-        memset(hash_table, 0, LibmsiTable_HASH_TABLE_SIZE * sizeof(LibmsiColumnHashEntry*));
+        memset(hash_table, 0, size * sizeof(LibmsiColumnHashEntry*));
         tv->columns[col-1].hash_table = hash_table;
+        tv->columns[col-1].hash_size = size;
 
-        new_entry = (LibmsiColumnHashEntry *)(hash_table + LibmsiTable_HASH_TABLE_SIZE);
+        new_entry = (LibmsiColumnHashEntry *)(hash_table + size) + num_rows;
 
-        for (i = 0; i < num_rows; i++, new_entry++)
+        /* the rows are added backwards at the head of their bucket, which
+         * keeps the matches of a value in row order */
+        for (i = num_rows; i-- > 0; )
         {
             unsigned row_value;
 
+            new_entry--;
             if (view->ops->fetch_int( view, i, col, &row_value ) != LIBMSI_RESULT_SUCCESS)
                 continue;
 
-            new_entry->next = NULL;
             new_entry->value = row_value;
             new_entry->row = i;
-            if (hash_table[row_value % LibmsiTable_HASH_TABLE_SIZE])
-            {
-                LibmsiColumnHashEntry *prev_entry = hash_table[row_value % LibmsiTable_HASH_TABLE_SIZE];
-                while (prev_entry->next)
-                    prev_entry = prev_entry->next;
-                prev_entry->next = new_entry;
-            }
-            else
-                hash_table[row_value % LibmsiTable_HASH_TABLE_SIZE] = new_entry;
+            new_entry->next = hash_table[row_value % size];
+            hash_table[row_value % size] = new_entry;
         }
     }
 
     if( !*handle )
-        entry = tv->columns[col-1].hash_table[val % LibmsiTable_HASH_TABLE_SIZE];
+    {
+        msi_count( MSI_COUNTER_INDEX_PROBES, 1 );
+        entry = tv->columns[col-1].hash_table[val % tv->columns[col-1].hash_size];
+    }
     else
         entry = (*handle)->next;
 
@@ -1968,6 +2290,21 @@ done:
     return r;
 }
 
+static unsigned table_view_explain( LibmsiView *view, GString *str, unsigned depth )
+{
+    LibmsiTableView *tv = (LibmsiTableView*)view;
+
+    TRACE("%p %p %u\n", view, str, depth);
+
+    if( !tv->table )
+        return LIBMSI_RESULT_INVALID_PARAMETER;
+
+    g_string_append_printf( str, "%*sSCAN %s (%u rows)", depth * 2, "",
+                            tv->name, tv->table->row_count );
+    msi_view_explain_end( view, str );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
 static const LibmsiViewOps table_ops =
 {
     table_view_fetch_int,
@@ -1988,6 +2325,10 @@ static const LibmsiViewOps table_ops =
     table_view_remove_column,
     NULL,
     table_view_drop,
+    table_view_explain,
+    NULL,
+    NULL,
+    table_view_set_rows,
 };
 
 unsigned table_view_create( LibmsiDatabase *db, const char *name, LibmsiView **view )
@@ -2066,59 +2407,584 @@ unsigned _libmsi_database_commit_tables( LibmsiDatabase *db, unsigned bytes_per_
     return r;
 }
 
-LibmsiCondition _libmsi_database_is_table_persistent( LibmsiDatabase *db, const char *table )
+static unsigned table_share( LibmsiDatabase *db, LibmsiDatabase *base, const char *name )
 {
-    LibmsiTable *t;
+    LibmsiTable *t, *table;
     unsigned r;
 
-    TRACE("%p %s\n", db, debugstr_a(table));
+    if( find_cached_table( db, name ) )
+        return LIBMSI_RESULT_SUCCESS;
 
-    if (!table)
-        return LIBMSI_CONDITION_ERROR;
+    r = get_table( base, name, &t );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
 
-    r = get_table( db, table, &t );
-    if (r != LIBMSI_RESULT_SUCCESS)
-        return LIBMSI_CONDITION_NONE;
+    table = msi_alloc_zero( sizeof(LibmsiTable) + strlen( name ) * sizeof(char) );
+    if( !table )
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
 
-    return t->persistent;
-}
+    strcpy( table->name, name );
+    table->persistent = t->persistent;
 
-static unsigned read_raw_int(const uint8_t *data, unsigned col, unsigned bytes)
-{
-    unsigned ret = 0, i;
+    if( t->row_count )
+    {
+        table->data = msi_alloc( t->row_count * sizeof(uint8_t*) );
+        table->data_persistent = msi_alloc( t->row_count * sizeof(bool) );
+        table->row_shared = msi_alloc( t->row_count * sizeof(bool) );
+        if( !table->data || !table->data_persistent || !table->row_shared ||
+            !table_share_rows( t ) )
+            goto nomem;
 
-    for (i = 0; i < bytes; i++)
-        ret += (data[col + i] << i * 8);
+        memcpy( table->data, t->data, t->row_count * sizeof(uint8_t*) );
+        memcpy( table->data_persistent, t->data_persistent, t->row_count * sizeof(bool) );
+        memset( table->row_shared, true, t->row_count * sizeof(bool) );
+        table->row_count = t->row_count;
+        table->shared = t->shared;
+        __sync_add_and_fetch( &table->shared->ref_count, 1 );
+    }
 
-    return ret;
+    /* the column names point into the string table of db */
+    r = table_get_column_info( db, name, &table->colinfo, &table->col_count );
+    if( r != LIBMSI_RESULT_SUCCESS )
+    {
+        free_table( table );
+        return r;
+    }
+
+    list_add_tail( &db->tables, &table->entry );
+    return LIBMSI_RESULT_SUCCESS;
+
+nomem:
+    msi_free( table->data );
+    msi_free( table->data_persistent );
+    msi_free( table->row_shared );
+    msi_free( table );
+    return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
 }
 
-static unsigned msi_record_encoded_stream_name( const LibmsiTableView *tv, LibmsiRecord *rec, char **pstname )
+/*
+ * msi_table_share_tables
+ *
+ * Add every table of base to db, whose string table must have the same
+ * ids as the one of base.  The rows are shared until either database
+ * changes them; a row is copied the first time it is written.
+ */
+unsigned msi_table_share_tables( LibmsiDatabase *db, LibmsiDatabase *base )
 {
-    char *stname = NULL;
-    char *sval;
-    char *p;
-    unsigned len;
-    unsigned i, r;
+    LibmsiTable *t, *t2;
+    unsigned r;
 
-    TRACE("%p %p\n", tv, rec);
+    TRACE("%p %p\n", db, base);
 
-    len = strlen( tv->name ) + 1;
-    stname = msi_alloc( len*sizeof(char) );
-    if ( !stname )
+    /* the column information of the other tables comes from these */
+    r = table_share( db, base, szTables );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    r = table_share( db, base, szColumns );
+    if( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    LIST_FOR_EACH_ENTRY_SAFE( t, t2, &base->tables, LibmsiTable, entry )
     {
-       r = LIBMSI_RESULT_OUTOFMEMORY;
-       goto err;
+        r = table_share( db, base, t->name );
+        if( r != LIBMSI_RESULT_SUCCESS )
+            return r;
     }
 
-    strcpy( stname, tv->name );
+    return LIBMSI_RESULT_SUCCESS;
+}
 
-    for ( i = 0; i < tv->num_cols; i++ )
-    {
-        if ( tv->columns[i].type & MSITYPE_KEY )
-        {
-            sval = msi_dup_record_field( rec, i + 1 );
-            if ( !sval )
+
+/* rows read from a text archive, installed in the table all at once */
+typedef struct
+{
+    unsigned row;
+    unsigned col;
+    char *path;
+} IMPORTSTREAM;
+
+struct _LibmsiTableImport
+{
+    LibmsiTableView *tv;
+    uint8_t **rows;
+    unsigned count;
+    unsigned size;
+    unsigned *ids;      /* the ids of the string fields, in file order */
+    unsigned num_ids;
+    unsigned max_ids;
+    unsigned next_id;
+    IMPORTSTREAM *streams;
+    unsigned num_streams;
+    unsigned max_streams;
+    GsfInput **stms;
+    unsigned *order;    /* the rows sorted by key */
+    bool prepared;
+};
+
+/*
+ * msi_table_import_begin
+ *
+ * Start replacing the rows of a table.  The rows added with
+ * msi_table_import_strings and msi_table_import_row only reach the table
+ * in msi_table_import_end.
+ */
+unsigned msi_table_import_begin( LibmsiDatabase *db, const char *name, LibmsiTableImport **pti )
+{
+    LibmsiTableImport *ti;
+    LibmsiView *view;
+    unsigned r;
+
+    TRACE("%p %s\n", db, debugstr_a(name));
+
+    if( !strcmp( name, szStreams ) || !strcmp( name, szStorages ) )
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    ti = msi_alloc_zero( sizeof *ti );
+    if( !ti )
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+
+    r = table_view_create( db, name, &view );
+    if( r != LIBMSI_RESULT_SUCCESS )
+    {
+        msi_free( ti );
+        return r;
+    }
+
+    ti->tv = (LibmsiTableView *)view;
+    *pti = ti;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static bool import_field_is_null( const LibmsiColumnInfo *col, const char *field )
+{
+    if( !*field )
+        return true;
+
+    if( (col->type & MSITYPE_STRING) || MSITYPE_IS_BINARY(col->type) )
+        return false;
+
+    return atoi( field ) == LIBMSI_NULL_INT;
+}
+
+static bool import_field_is_string( const LibmsiColumnInfo *col, const char *field )
+{
+    return *field && !MSITYPE_IS_BINARY(col->type) && (col->type & MSITYPE_STRING);
+}
+
+static unsigned import_add_stream( LibmsiTableImport *ti, unsigned col, const char *dir, const char *file )
+{
+    IMPORTSTREAM *p;
+
+    if( ti->num_streams == ti->max_streams )
+    {
+        ti->max_streams = MAX( ti->max_streams * 2, 16 );
+        p = msi_realloc( ti->streams, ti->max_streams * sizeof *p );
+        if( !p )
+            return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+        ti->streams = p;
+    }
+
+    p = &ti->streams[ti->num_streams++];
+    p->row = ti->count;
+    p->col = col;
+    p->path = g_build_filename( dir, file, NULL );
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/*
+ * msi_table_import_strings
+ *
+ * Add the strings of a row to the string table.  This is the only part
+ * of an import that uses the string table, so the ids only depend on the
+ * order of these calls; msi_table_import_row must get the rows in the
+ * same order.
+ */
+unsigned msi_table_import_strings( LibmsiTableImport *ti, char **fields, unsigned count )
+{
+    LibmsiTableView *tv = ti->tv;
+    const LibmsiColumnInfo *col;
+    const char *field;
+    unsigned i, n, *ids;
+    int id;
+    bool persistent;
+
+    /* check there's no null values where they're not allowed, before
+     * adding any string of the row */
+    for( i = 0; i < tv->num_cols; i++ )
+    {
+        col = &tv->columns[i];
+        if( (col->type & MSITYPE_NULLABLE) || MSITYPE_IS_BINARY(col->type) )
+            continue;
+
+        if( i >= count || import_field_is_null( col, fields[i] ) )
+        {
+            TRACE("null value in column %u\n", i + 1);
+            return LIBMSI_RESULT_FUNCTION_FAILED;
+        }
+    }
+
+    persistent = tv->table->persistent != LIBMSI_CONDITION_FALSE;
+    for( i = 0; i < tv->num_cols && i < count; i++ )
+    {
+        col = &tv->columns[i];
+        field = fields[i];
+        if( !import_field_is_string( col, field ) )
+            continue;
+
+        if( ti->num_ids == ti->max_ids )
+        {
+            n = MAX( ti->max_ids * 2, 64 );
+            ids = msi_realloc( ti->ids, n * sizeof *ids );
+            if( !ids )
+                return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+            ti->ids = ids;
+            ti->max_ids = n;
+        }
+
+        /* each use is a reference, for saving the string table */
+        id = _libmsi_add_string( tv->db->strings, field, -1, 1,
+                 persistent ? StringPersistent : StringNonPersistent );
+        if( id == -1 )
+            return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+        ti->ids[ti->num_ids++] = id;
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/*
+ * msi_table_import_row
+ *
+ * Convert the text fields of a row to its raw values, taking the ids of
+ * its strings from msi_table_import_strings.  Missing fields are null,
+ * the files of binary columns are looked for in dir.  This does not use
+ * the database, so imports of different tables can run in parallel.
+ */
+unsigned msi_table_import_row( LibmsiTableImport *ti, char **fields, unsigned count, const char *dir )
+{
+    LibmsiTableView *tv = ti->tv;
+    const LibmsiColumnInfo *col;
+    const char *field;
+    uint8_t **rows, *row;
+    unsigned i, j, n, val, r;
+
+    if( ti->count == ti->size )
+    {
+        n = MAX( ti->size * 2, 64 );
+        rows = msi_realloc( ti->rows, n * sizeof *rows );
+        if( !rows )
+            return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+        ti->rows = rows;
+        ti->size = n;
+    }
+
+    row = msi_alloc_zero( MAX( tv->row_size, 1 ) );
+    if( !row )
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+
+    for( i = 0; i < tv->num_cols; i++ )
+    {
+        col = &tv->columns[i];
+        field = i < count ? fields[i] : szEmpty;
+
+        if( !*field )
+            val = 0;
+        else if( MSITYPE_IS_BINARY(col->type) )
+        {
+            r = import_add_stream( ti, i, dir, field );
+            if( r != LIBMSI_RESULT_SUCCESS )
+            {
+                msi_free( row );
+                return r;
+            }
+            val = 1; /* refers to the first key column */
+        }
+        else if( col->type & MSITYPE_STRING )
+        {
+            if( ti->next_id == ti->num_ids )
+            {
+                msi_free( row );
+                return LIBMSI_RESULT_FUNCTION_FAILED;
+            }
+            val = ti->ids[ti->next_id++];
+        }
+        else if( bytes_per_column( tv->db, col, LONG_STR_BYTES ) == 2 )
+        {
+            val = 0x8000 + atoi( field );
+            if( val & 0xffff0000 )
+            {
+                g_critical("field %u value %d out of range\n", i + 1, val - 0x8000);
+                msi_free( row );
+                return LIBMSI_RESULT_FUNCTION_FAILED;
+            }
+        }
+        else
+            val = atoi( field ) ^ 0x80000000;
+
+        n = bytes_per_column( tv->db, col, LONG_STR_BYTES );
+        for( j = 0; j < n; j++ )
+            row[col->offset + j] = (val >> j * 8) & 0xff;
+    }
+
+    ti->rows[ti->count++] = row;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* orders rows by their raw keys like table_view_insert_row does, and
+ * rows with the same keys in the order they were read */
+static int import_compare_rows( const void *a, const void *b, void *data )
+{
+    LibmsiTableImport *ti = data;
+    LibmsiTableView *tv = ti->tv;
+    unsigned i, n, x, y, ra = *(const unsigned *)a, rb = *(const unsigned *)b;
+
+    for( i = 0; i < tv->num_cols; i++ )
+    {
+        if( !(tv->columns[i].type & MSITYPE_KEY) )
+            continue;
+
+        n = bytes_per_column( tv->db, &tv->columns[i], LONG_STR_BYTES );
+        x = read_table_int( ti->rows, ra, tv->columns[i].offset, n );
+        y = read_table_int( ti->rows, rb, tv->columns[i].offset, n );
+        if( x != y )
+            return x < y ? -1 : 1;
+    }
+
+    return ra < rb ? -1 : ra > rb;
+}
+
+static bool import_same_keys( LibmsiTableImport *ti, unsigned ra, unsigned rb )
+{
+    LibmsiTableView *tv = ti->tv;
+    unsigned i, n;
+    bool keys = false;
+
+    for( i = 0; i < tv->num_cols; i++ )
+    {
+        if( !(tv->columns[i].type & MSITYPE_KEY) )
+            continue;
+
+        n = bytes_per_column( tv->db, &tv->columns[i], LONG_STR_BYTES );
+        if( read_table_int( ti->rows, ra, tv->columns[i].offset, n ) !=
+            read_table_int( ti->rows, rb, tv->columns[i].offset, n ) )
+            return false;
+        keys = true;
+    }
+
+    return keys;
+}
+
+/*
+ * msi_table_import_prepare
+ *
+ * Sort the rows, check there's no duplicate keys and load the stream
+ * files, all without using the database, so that msi_table_import_end
+ * only has to install the rows.
+ */
+unsigned msi_table_import_prepare( LibmsiTableImport *ti )
+{
+    LibmsiRecord *rec;
+    unsigned i, r;
+
+    TRACE("%p %u rows\n", ti, ti->count);
+
+    if( ti->prepared )
+        return LIBMSI_RESULT_SUCCESS;
+
+    ti->order = msi_alloc( MAX( ti->count, 1 ) * sizeof *ti->order );
+    ti->stms = msi_alloc_zero( MAX( ti->num_streams, 1 ) * sizeof *ti->stms );
+    if( !ti->order || !ti->stms )
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+
+    for( i = 0; i < ti->count; i++ )
+        ti->order[i] = i;
+    g_qsort_with_data( ti->order, ti->count, sizeof *ti->order, import_compare_rows, ti );
+
+    /* check there's no duplicate keys */
+    for( i = 1; i < ti->count; i++ )
+    {
+        if( import_same_keys( ti, ti->order[i - 1], ti->order[i] ) )
+        {
+            TRACE("rows %u and %u have the same keys\n", ti->order[i - 1], ti->order[i]);
+            return LIBMSI_RESULT_FUNCTION_FAILED;
+        }
+    }
+
+    /* load the stream files before the table changes */
+    for( i = 0; i < ti->num_streams; i++ )
+    {
+        rec = libmsi_record_new( 1 );
+        if( !rec )
+            return LIBMSI_RESULT_OUTOFMEMORY;
+
+        r = _libmsi_record_load_stream_from_file( rec, 1, ti->streams[i].path );
+        if( r == LIBMSI_RESULT_SUCCESS )
+            r = _libmsi_record_get_gsf_input( rec, 1, &ti->stms[i] );
+        g_object_unref( rec );
+        if( r != LIBMSI_RESULT_SUCCESS )
+            return LIBMSI_RESULT_FUNCTION_FAILED;
+    }
+
+    ti->prepared = true;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned import_install_rows( LibmsiTableImport *ti )
+{
+    LibmsiTableView *tv = ti->tv;
+    LibmsiTable *t = tv->table;
+    uint8_t **data;
+    bool *persistent;
+    unsigned *where;
+    unsigned i, r = LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+    char *stname;
+
+    where = msi_alloc( MAX( ti->count, 1 ) * sizeof *where );
+    data = msi_alloc( MAX( ti->count, 1 ) * sizeof *data );
+    persistent = msi_alloc( MAX( ti->count, 1 ) * sizeof *persistent );
+    if( !where || !data || !persistent )
+        goto done;
+
+    /* replace the rows; shared rows belong to their holder */
+    for( i = 0; i < t->row_count; i++ )
+        if( !table_row_shared( t, i ) )
+            msi_free( t->data[i] );
+    if( t->shared )
+        msi_table_rows_release( t->shared );
+    msi_free( t->row_shared );
+    msi_free( t->data );
+    msi_free( t->data_persistent );
+    t->shared = NULL;
+    t->row_shared = NULL;
+
+    for( i = 0; i < ti->count; i++ )
+    {
+        data[i] = ti->rows[ti->order[i]];
+        persistent[i] = true;
+        where[ti->order[i]] = i;
+    }
+    t->data = data;
+    t->data_persistent = persistent;
+    t->row_count = ti->count;
+    ti->count = 0;
+    data = NULL;
+    persistent = NULL;
+
+    for( i = 0; i < tv->num_cols; i++ )
+    {
+        msi_free( tv->columns[i].hash_table );
+        tv->columns[i].hash_table = NULL;
+    }
+
+    /* the stream names come from the keys of the rows in the table */
+    r = LIBMSI_RESULT_SUCCESS;
+    for( i = 0; i < ti->num_streams && r == LIBMSI_RESULT_SUCCESS; i++ )
+    {
+        r = msi_stream_name( tv, where[ti->streams[i].row], &stname );
+        if( r == LIBMSI_RESULT_SUCCESS )
+        {
+            r = _libmsi_add_stream( tv->db, stname, ti->stms[i] );
+            msi_free( stname );
+        }
+    }
+
+done:
+    msi_free( where );
+    msi_free( data );
+    msi_free( persistent );
+    return r;
+}
+
+/*
+ * msi_table_import_end
+ *
+ * Replace the rows of the table with the imported ones if install is
+ * set, which fails without changing the table if two rows have the
+ * same keys.  Frees the import either way.
+ */
+unsigned msi_table_import_end( LibmsiTableImport *ti, bool install )
+{
+    unsigned i, r = LIBMSI_RESULT_SUCCESS;
+
+    TRACE("%p %u rows %d\n", ti, ti->count, install);
+
+    if( install )
+        r = msi_table_import_prepare( ti );
+    if( install && r == LIBMSI_RESULT_SUCCESS )
+        r = import_install_rows( ti );
+
+    for( i = 0; i < ti->count; i++ )
+        msi_free( ti->rows[i] );
+    for( i = 0; i < ti->num_streams; i++ )
+    {
+        g_free( ti->streams[i].path );
+        if( ti->stms && ti->stms[i] )
+            g_object_unref( G_OBJECT(ti->stms[i]) );
+    }
+    msi_free( ti->rows );
+    msi_free( ti->ids );
+    msi_free( ti->streams );
+    msi_free( ti->stms );
+    msi_free( ti->order );
+    ti->tv->view.ops->delete( &ti->tv->view );
+    msi_free( ti );
+    return r;
+}
+
+LibmsiCondition _libmsi_database_is_table_persistent( LibmsiDatabase *db, const char *table )
+{
+    LibmsiTable *t;
+    unsigned r;
+
+    TRACE("%p %s\n", db, debugstr_a(table));
+
+    if (!table)
+        return LIBMSI_CONDITION_ERROR;
+
+    r = get_table( db, table, &t );
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return LIBMSI_CONDITION_NONE;
+
+    return t->persistent;
+}
+
+static unsigned read_raw_int(const uint8_t *data, unsigned col, unsigned bytes)
+{
+    unsigned ret = 0, i;
+
+    for (i = 0; i < bytes; i++)
+        ret += (data[col + i] << i * 8);
+
+    return ret;
+}
+
+static unsigned msi_record_encoded_stream_name( const LibmsiTableView *tv, LibmsiRecord *rec, char **pstname )
+{
+    char *stname = NULL;
+    char *sval;
+    char *p;
+    unsigned len;
+    unsigned i, r;
+
+    TRACE("%p %p\n", tv, rec);
+
+    len = strlen( tv->name ) + 1;
+    stname = msi_alloc( len*sizeof(char) );
+    if ( !stname )
+    {
+       r = LIBMSI_RESULT_OUTOFMEMORY;
+       goto err;
+    }
+
+    strcpy( stname, tv->name );
+
+    for ( i = 0; i < tv->num_cols; i++ )
+    {
+        if ( tv->columns[i].type & MSITYPE_KEY )
+        {
+            sval = msi_dup_record_field( rec, i + 1 );
+            if ( !sval )
             {
                 r = LIBMSI_RESULT_OUTOFMEMORY;
                 goto err;
@@ -2364,6 +3230,82 @@ static unsigned msi_table_find_row( LibmsiTableView *tv, LibmsiRecord *rec, unsi
     return r;
 }
 
+/*
+ * Transforms look up every row by its keys.  The hash index of the first
+ * key column makes that cheap, but inserting or deleting a row drops it,
+ * so it is only rebuilt after a run of linear lookups, which gets longer
+ * each time a rebuilt index was dropped before being used again.
+ */
+typedef struct
+{
+    unsigned col;
+    unsigned keymask;
+    unsigned scans;
+    unsigned backoff;
+    bool built;
+} TRANSFORMINDEX;
+
+static void msi_transform_index_init( const LibmsiTableView *tv, TRANSFORMINDEX *idx )
+{
+    unsigned i;
+
+    memset( idx, 0, sizeof(*idx) );
+    idx->backoff = 1;
+    for (i = 0; i < tv->num_cols; i++)
+    {
+        if (~tv->columns[i].type & MSITYPE_KEY)
+            continue;
+        if (!idx->col)
+            idx->col = i + 1;
+        idx->keymask |= 1 << i;
+    }
+}
+
+static unsigned msi_transform_find_row( LibmsiTableView *tv, TRANSFORMINDEX *idx,
+                                        LibmsiRecord *rec, unsigned *row )
+{
+    MSIITERHANDLE handle = NULL;
+    unsigned r = LIBMSI_RESULT_FUNCTION_FAILED, n, *data;
+
+    if (!idx->col)
+        return msi_table_find_row( tv, rec, row, NULL );
+
+    if (tv->columns[idx->col - 1].hash_table)
+    {
+        idx->built = false;
+        idx->backoff = 1;
+    }
+    else
+    {
+        if (idx->built && idx->backoff < (1u << 30))
+            idx->backoff *= 2;
+        idx->built = false;
+
+        if (++idx->scans < idx->backoff)
+            return msi_table_find_row( tv, rec, row, NULL );
+
+        idx->scans = 0;
+        idx->built = true;
+    }
+
+    data = msi_record_to_row( tv, rec );
+    if (!data)
+        return r;
+
+    while (table_view_find_matching_rows( &tv->view, idx->col, data[idx->col - 1],
+                                          &n, &handle ) == LIBMSI_RESULT_SUCCESS)
+    {
+        r = msi_row_matches( tv, n, data, NULL );
+        if (r == LIBMSI_RESULT_SUCCESS)
+        {
+            *row = n;
+            break;
+        }
+    }
+    msi_free( data );
+    return r;
+}
+
 typedef struct
 {
     struct list entry;
@@ -2378,6 +3320,7 @@ static unsigned msi_table_load_transform( LibmsiDatabase *db, GsfInfile *stg,
     LibmsiTableView *tv = NULL;
     unsigned r, n, sz, i, mask, num_cols, colcol = 0, rawsize = 0;
     LibmsiRecord *rec = NULL;
+    TRANSFORMINDEX idx;
     char coltable[32];
     const char *name;
 
@@ -2409,6 +3352,8 @@ static unsigned msi_table_load_transform( LibmsiDatabase *db, GsfInfile *stg,
     TRACE("name = %s columns = %u row_size = %u raw size = %u\n",
           debugstr_a(name), tv->num_cols, tv->row_size, rawsize );
 
+    msi_transform_index_init( tv, &idx );
+
     /* interpret the data */
     for (n = 0; n < rawsize;)
     {
@@ -2496,7 +3441,8 @@ static unsigned msi_table_load_transform( LibmsiDatabase *db, GsfInfile *stg,
 
             if (TRACE_ON) dump_record( rec );
 
-            r = msi_table_find_row( tv, rec, &row, NULL );
+            /* the keys match, so leave them and their index alone */
+            r = msi_transform_find_row( tv, &idx, rec, &row );
             if (r == LIBMSI_RESULT_SUCCESS)
             {
                 if (!mask)
@@ -2509,14 +3455,15 @@ static unsigned msi_table_load_transform( LibmsiDatabase *db, GsfInfile *stg,
                 else if (mask & 1)
                 {
                     TRACE("modifying full row [%d]:\n", row);
-                    r = table_view_set_row( &tv->view, row, rec, (1 << tv->num_cols) - 1 );
+                    r = table_view_set_row( &tv->view, row, rec,
+                                            ((1 << tv->num_cols) - 1) & ~idx.keymask );
                     if (r != LIBMSI_RESULT_SUCCESS)
                         g_warning("failed to modify row %u\n", r);
                 }
                 else
                 {
                     TRACE("modifying masked row [%d]:\n", row);
-                    r = table_view_set_row( &tv->view, row, rec, mask );
+                    r = table_view_set_row( &tv->view, row, rec, mask & ~idx.keymask );
                     if (r != LIBMSI_RESULT_SUCCESS)
                         g_warning("failed to modify row %u\n", r);
                 }
@@ -2656,3 +3603,448 @@ end:
 
     return ret;
 }
+
+typedef struct
+{
+    GsfOutfile *stg;
+    string_table *strings;
+    unsigned bytes_per_strref;
+    GsfOutput *stm;
+    uint8_t *row;
+} GENTRANSFORM;
+
+/* compares a column of rows from two tables with the same keys */
+static int msi_compare_column( LibmsiTableView *tv, unsigned row,
+                               LibmsiTableView *rv, unsigned refrow, unsigned col )
+{
+    const char *s, *t;
+    unsigned x = 0, y = 0;
+
+    table_view_fetch_int( &tv->view, row, col + 1, &x );
+    if ( col < rv->num_cols )
+        table_view_fetch_int( &rv->view, refrow, col + 1, &y );
+
+    /* string ids cannot be compared across databases */
+    if ( (tv->columns[col].type & MSITYPE_STRING) &&
+         !MSITYPE_IS_BINARY(tv->columns[col].type) )
+    {
+        s = x ? msi_string_lookup_id( tv->db->strings, x ) : NULL;
+        t = y ? msi_string_lookup_id( rv->db->strings, y ) : NULL;
+        if ( !s || !t )
+            return (s != NULL) - (t != NULL);
+        return strcmp( s, t );
+    }
+
+    return x < y ? -1 : x > y;
+}
+
+static int msi_compare_keys( LibmsiTableView *tv, unsigned row,
+                             LibmsiTableView *rv, unsigned refrow )
+{
+    unsigned i;
+    int cmp;
+
+    for ( i = 0; i < tv->num_cols; i++ )
+    {
+        if ( ~tv->columns[i].type & MSITYPE_KEY )
+            continue;
+
+        cmp = msi_compare_column( tv, row, rv, refrow, i );
+        if ( cmp )
+            return cmp;
+    }
+
+    return 0;
+}
+
+static int msi_compare_rows_by_key( const void *a, const void *b, void *data )
+{
+    LibmsiTableView *tv = data;
+
+    return msi_compare_keys( tv, *(const unsigned *)a, tv, *(const unsigned *)b );
+}
+
+/* the persistent rows of a table, ordered by primary key */
+static unsigned msi_sorted_rows( LibmsiTableView *tv, unsigned **rows, unsigned *count )
+{
+    unsigned i, n = 0;
+
+    *rows = msi_alloc( MAX(tv->table->row_count, 1) * sizeof(**rows) );
+    if ( !*rows )
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+
+    for ( i = 0; i < tv->table->row_count; i++ )
+        if ( tv->table->data_persistent[i] )
+            (*rows)[n++] = i;
+
+    g_qsort_with_data( *rows, n, sizeof(**rows), msi_compare_rows_by_key, tv );
+    *count = n;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static bool msi_streams_equal( LibmsiTableView *tv, unsigned row,
+                               LibmsiTableView *rv, unsigned refrow, unsigned col )
+{
+    GsfInput *stm = NULL, *refstm = NULL;
+    uint8_t buf[4096], refbuf[4096];
+    gsf_off_t left;
+    size_t n;
+    bool ret = false;
+
+    table_view_fetch_stream( &tv->view, row, col + 1, &stm );
+    table_view_fetch_stream( &rv->view, refrow, col + 1, &refstm );
+    if ( !stm || !refstm )
+    {
+        ret = !stm && !refstm;
+        goto done;
+    }
+
+    left = gsf_input_size( stm );
+    if ( left != gsf_input_size( refstm ) )
+        goto done;
+
+    while ( left > 0 )
+    {
+        n = MIN( left, sizeof(buf) );
+        if ( !gsf_input_read( stm, n, buf ) || !gsf_input_read( refstm, n, refbuf ) ||
+             memcmp( buf, refbuf, n ) )
+            goto done;
+        left -= n;
+    }
+    ret = true;
+
+done:
+    if ( stm )
+        g_object_unref( stm );
+    if ( refstm )
+        g_object_unref( refstm );
+    return ret;
+}
+
+static bool msi_column_changed( LibmsiTableView *tv, unsigned row,
+                                LibmsiTableView *rv, unsigned refrow, unsigned col )
+{
+    unsigned x = 0, y = 0;
+
+    if ( !MSITYPE_IS_BINARY(tv->columns[col].type) )
+        return msi_compare_column( tv, row, rv, refrow, col ) != 0;
+
+    table_view_fetch_int( &tv->view, row, col + 1, &x );
+    if ( col < rv->num_cols )
+        table_view_fetch_int( &rv->view, refrow, col + 1, &y );
+
+    if ( !x || !y )
+        return !x != !y;
+
+    return !msi_streams_equal( tv, row, rv, refrow, col );
+}
+
+/* binary fields are stored as streams named after the row keys */
+static unsigned msi_write_transform_stream( GENTRANSFORM *gt, LibmsiTableView *tv,
+                                            unsigned row, unsigned col )
+{
+    GsfInput *stm = NULL;
+    GsfOutput *out;
+    char *stname, *encname;
+    unsigned r;
+
+    r = msi_stream_name( tv, row, &stname );
+    if ( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    r = table_view_fetch_stream( &tv->view, row, col + 1, &stm );
+    if ( r != LIBMSI_RESULT_SUCCESS )
+    {
+        msi_free( stname );
+        return r;
+    }
+
+    encname = encode_streamname( false, stname );
+    msi_free( stname );
+
+    out = gsf_outfile_new_child( gt->stg, encname, false );
+    msi_free( encname );
+    if ( !out || !gsf_input_copy( stm, out ) )
+        r = LIBMSI_RESULT_FUNCTION_FAILED;
+
+    if ( out )
+    {
+        gsf_output_close( out );
+        g_object_unref( out );
+    }
+    g_object_unref( stm );
+    return r;
+}
+
+/*
+ * Writes a row in the form read by msi_get_transform_record: a full row
+ * if the low bit of mask is set, otherwise the keys and the fields in mask.
+ */
+static unsigned msi_write_transform_row( GENTRANSFORM *gt, LibmsiTableView *tv,
+                                         unsigned row, unsigned mask )
+{
+    unsigned i, k, n, val, r, size = 2;
+    const char *str;
+    char *encname;
+    int id;
+
+    if ( !gt->stm )
+    {
+        encname = encode_streamname( true, tv->name );
+        gt->stm = gsf_outfile_new_child( gt->stg, encname, false );
+        msi_free( encname );
+        if ( !gt->stm )
+            return LIBMSI_RESULT_FUNCTION_FAILED;
+    }
+
+    gt->row[0] = mask & 0xff;
+    gt->row[1] = (mask >> 8) & 0xff;
+
+    for ( i = 0; i < tv->num_cols; i++ )
+    {
+        if ( !(mask & 1) && (~tv->columns[i].type & MSITYPE_KEY) && !(mask & (1 << i)) )
+            continue;
+
+        val = 0;
+        table_view_fetch_int( &tv->view, row, i + 1, &val );
+
+        if ( MSITYPE_IS_BINARY(tv->columns[i].type) )
+        {
+            n = bytes_per_column( tv->db, &tv->columns[i], gt->bytes_per_strref );
+            if ( val )
+            {
+                r = msi_write_transform_stream( gt, tv, row, i );
+                if ( r != LIBMSI_RESULT_SUCCESS )
+                    return r;
+            }
+        }
+        else if ( tv->columns[i].type & MSITYPE_STRING )
+        {
+            n = gt->bytes_per_strref;
+            if ( val )
+            {
+                str = msi_string_lookup_id( tv->db->strings, val );
+                id = _libmsi_add_string( gt->strings, str, -1, 1, StringPersistent );
+                if ( id < 0 )
+                    return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+                val = id;
+            }
+        }
+        else
+            n = bytes_per_column( tv->db, &tv->columns[i], gt->bytes_per_strref );
+
+        for ( k = 0; k < n; k++ )
+            gt->row[size++] = (val >> k * 8) & 0xff;
+    }
+
+    if ( !gsf_output_write( gt->stm, size, gt->row ) )
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* the mask of the fields that differ, or a full row if they cannot be masked */
+static unsigned msi_changed_mask( LibmsiTableView *tv, unsigned row,
+                                  LibmsiTableView *rv, unsigned refrow )
+{
+    unsigned i, mask = 0;
+    bool full = false;
+
+    for ( i = 0; i < tv->num_cols; i++ )
+    {
+        if ( tv->columns[i].type & MSITYPE_KEY )
+            continue;
+
+        if ( !msi_column_changed( tv, row, rv, refrow, i ) )
+            continue;
+
+        if ( i == 0 || i >= 16 )
+            full = true;
+        else
+            mask |= 1 << i;
+    }
+
+    return full ? (tv->num_cols << 8) | 1 : mask;
+}
+
+/* the reference table may lack columns added at the end, nothing more */
+static unsigned msi_check_transform_columns( const LibmsiTableView *tv, const LibmsiTableView *rv )
+{
+    unsigned i;
+
+    if ( rv->num_cols > tv->num_cols )
+        return LIBMSI_RESULT_DATATYPE_MISMATCH;
+
+    for ( i = 0; i < rv->num_cols; i++ )
+    {
+        if ( strcmp( tv->columns[i].colname, rv->columns[i].colname ) ||
+             (tv->columns[i].type & ~MSITYPE_TEMPORARY) != (rv->columns[i].type & ~MSITYPE_TEMPORARY) )
+            return LIBMSI_RESULT_DATATYPE_MISMATCH;
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* merges the rows of both tables in primary key order */
+static unsigned msi_generate_table_transform( GENTRANSFORM *gt, LibmsiDatabase *db,
+                                              LibmsiDatabase *ref, const char *name )
+{
+    LibmsiTableView *tv = NULL, *rv = NULL;
+    unsigned *rows = NULL, *refrows = NULL;
+    unsigned count = 0, refcount = 0, i = 0, j = 0, mask, r;
+    int cmp;
+
+    TRACE("%p %p %s\n", db, ref, debugstr_a(name));
+
+    r = table_view_create( db, name, (LibmsiView **)&tv );
+    if ( r != LIBMSI_RESULT_SUCCESS )
+        return r;
+
+    /* temporary tables are not part of the database */
+    if ( tv->table->persistent == LIBMSI_CONDITION_FALSE )
+        goto done;
+
+    if ( table_view_exists( ref, name ) )
+    {
+        r = table_view_create( ref, name, (LibmsiView **)&rv );
+        if ( r != LIBMSI_RESULT_SUCCESS )
+            goto done;
+
+        r = msi_check_transform_columns( tv, rv );
+        if ( r != LIBMSI_RESULT_SUCCESS )
+        {
+            g_warning("columns of table %s differ\n", debugstr_a(name));
+            goto done;
+        }
+
+        r = msi_sorted_rows( rv, &refrows, &refcount );
+        if ( r != LIBMSI_RESULT_SUCCESS )
+            goto done;
+    }
+
+    r = msi_sorted_rows( tv, &rows, &count );
+    if ( r != LIBMSI_RESULT_SUCCESS )
+        goto done;
+
+    gt->row = msi_alloc( 2 + tv->num_cols * 4 );
+    if ( !gt->row )
+    {
+        r = LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+        goto done;
+    }
+
+    while ( r == LIBMSI_RESULT_SUCCESS && (i < count || j < refcount) )
+    {
+        if ( i == count )
+            cmp = 1;
+        else if ( j == refcount )
+            cmp = -1;
+        else
+            cmp = msi_compare_keys( tv, rows[i], rv, refrows[j] );
+
+        if ( cmp < 0 )
+        {
+            /* inserted row */
+            r = msi_write_transform_row( gt, tv, rows[i++], (tv->num_cols << 8) | 1 );
+        }
+        else if ( cmp > 0 )
+        {
+            /* deleted row, only the keys are written */
+            r = msi_write_transform_row( gt, rv, refrows[j++], 0 );
+        }
+        else
+        {
+            mask = msi_changed_mask( tv, rows[i], rv, refrows[j] );
+            if ( mask )
+                r = msi_write_transform_row( gt, tv, rows[i], mask );
+            i++;
+            j++;
+        }
+    }
+
+done:
+    if ( gt->stm )
+    {
+        if ( !gsf_output_close( gt->stm ) && r == LIBMSI_RESULT_SUCCESS )
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+        g_object_unref( gt->stm );
+        gt->stm = NULL;
+    }
+    msi_free( gt->row );
+    gt->row = NULL;
+    msi_free( rows );
+    msi_free( refrows );
+    if ( rv )
+        rv->view.ops->delete( &rv->view );
+    tv->view.ops->delete( &tv->view );
+    return r;
+}
+
+/*
+ * msi_table_generate_transform
+ *
+ * Write the transform that turns ref into db to a transform storage.
+ */
+unsigned msi_table_generate_transform( LibmsiDatabase *db, LibmsiDatabase *ref, GsfOutfile *stg )
+{
+    GENTRANSFORM gt;
+    LibmsiTableView *tables = NULL;
+    const char *name;
+    unsigned i, r, val, bytes_per_strref;
+
+    TRACE("%p %p %p\n", db, ref, stg );
+
+    memset( &gt, 0, sizeof(gt) );
+    gt.stg = stg;
+    gt.strings = msi_init_string_table( &bytes_per_strref );
+    if ( !gt.strings )
+        return LIBMSI_RESULT_NOT_ENOUGH_MEMORY;
+    msi_set_string_table_codepage( gt.strings, msi_get_string_table_codepage( db->strings ) );
+
+    /* rows are written as they are found, so the size of the string
+     * references must be known before the pool is complete */
+    if ( msi_get_string_table_count( db->strings ) +
+         msi_get_string_table_count( ref->strings ) > 0xffff )
+        gt.bytes_per_strref = LONG_STR_BYTES;
+    else
+        gt.bytes_per_strref = sizeof(uint16_t);
+
+    /* the table metadata comes first, as when applying the transform */
+    r = msi_generate_table_transform( &gt, db, ref, szTables );
+    if ( r == LIBMSI_RESULT_SUCCESS )
+        r = msi_generate_table_transform( &gt, db, ref, szColumns );
+    if ( r == LIBMSI_RESULT_SUCCESS )
+        r = table_view_create( db, szTables, (LibmsiView **)&tables );
+
+    for ( i = 0; r == LIBMSI_RESULT_SUCCESS && i < tables->table->row_count; i++ )
+    {
+        if ( !tables->table->data_persistent[i] )
+            continue;
+
+        r = table_view_fetch_int( &tables->view, i, 1, &val );
+        if ( r != LIBMSI_RESULT_SUCCESS )
+            break;
+
+        name = msi_string_lookup_id( db->strings, val );
+        if ( name )
+            r = msi_generate_table_transform( &gt, db, ref, name );
+    }
+
+    if ( r == LIBMSI_RESULT_SUCCESS )
+    {
+        bytes_per_strref = gt.bytes_per_strref;
+        r = msi_save_string_table( gt.strings, stg, &bytes_per_strref );
+        if ( r == LIBMSI_RESULT_SUCCESS && bytes_per_strref != gt.bytes_per_strref )
+        {
+            g_critical("string reference size changed from %u to %u\n",
+                       gt.bytes_per_strref, bytes_per_strref);
+            r = LIBMSI_RESULT_FUNCTION_FAILED;
+        }
+    }
+
+    if ( tables )
+        tables->view.ops->delete( &tables->view );
+    msi_destroy_stringtable( gt.strings );
+    return r;
+}
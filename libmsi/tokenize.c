@@ -50,6 +50,7 @@ static const Keyword aKeywordTable[] = {
   { "DELETE", TK_DELETE },
   { "DISTINCT", TK_DISTINCT },
   { "DROP", TK_DROP },
+  { "EXPLAIN", TK_EXPLAIN },
   { "FREE", TK_FREE },
   { "FROM", TK_FROM },
   { "HOLD", TK_HOLD },
@@ -60,12 +61,14 @@ static const Keyword aKeywordTable[] = {
   { "IS", TK_IS },
   { "KEY", TK_KEY },
   { "LIKE", TK_LIKE },
+  { "LIMIT", TK_LIMIT },
   { "LOCALIZABLE", TK_LOCALIZABLE },
   { "LONG", TK_LONG },
   { "LONGCHAR", TK_LONGCHAR },
   { "NOT", TK_NOT },
   { "NULL", TK_NULL },
   { "OBJECT", TK_OBJECT },
+  { "OFFSET", TK_OFFSET },
   { "OR", TK_OR },
   { "ORDER", TK_ORDER },
   { "PRIMARY", TK_PRIMARY },
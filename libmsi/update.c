@@ -50,7 +50,7 @@ static unsigned update_view_fetch_int( LibmsiView *view, unsigned row, unsigned
 static unsigned update_view_execute( LibmsiView *view, LibmsiRecord *record )
 {
     LibmsiUpdateView *uv = (LibmsiUpdateView*)view;
-    unsigned i, r, col_count = 0, row_count = 0;
+    unsigned i, r, col_count = 0;
     LibmsiRecord *values = NULL;
     LibmsiRecord *where = NULL;
     LibmsiView *wv;
@@ -92,7 +92,7 @@ static unsigned update_view_execute( LibmsiView *view, LibmsiRecord *record )
     if( r )
         goto done;
 
-    r = wv->ops->get_dimensions( wv, &row_count, &col_count );
+    r = wv->ops->get_dimensions( wv, NULL, &col_count );
     if( r )
         goto done;
 
@@ -103,12 +103,8 @@ static unsigned update_view_execute( LibmsiView *view, LibmsiRecord *record )
         goto done;
     }
 
-    for ( i=0; i<row_count; i++ )
-    {
-        r = wv->ops->set_row( wv, i, values, (1 << col_count) - 1 );
-        if (r != LIBMSI_RESULT_SUCCESS)
-            break;
-    }
+    /* the values are converted once and set in all the matching rows */
+    r = msi_view_set_rows( wv, NULL, 0, values, (1 << col_count) - 1 );
 
 done:
     if ( where ) g_object_unref(where);
@@ -21,6 +21,7 @@
 
 #include <stdarg.h>
 #include <assert.h>
+#include <math.h>
 
 #include "debug.h"
 #include "libmsi.h"
@@ -30,12 +31,6 @@
 
 
 /* below is the query interface to a table */
-typedef struct _LibmsiRowEntry
-{
-    struct _LibmsiWhereView *wv; /* used during sorting */
-    unsigned values[1];
-} LibmsiRowEntry;
-
 typedef struct tagJOINTABLE
 {
     struct tagJOINTABLE *next;
@@ -43,8 +38,21 @@ typedef struct tagJOINTABLE
     unsigned col_count;
     unsigned row_count;
     unsigned table_index;
+    unsigned *distinct;                   /* per column distinct value estimates, 0 if unknown */
+    const struct expr *probe_column;      /* column of this table looked up through its index */
+    const struct expr *probe_value;       /* value the probe column is compared to */
+    uint64_t visited;                     /* rows visited by the last execution */
+    unsigned scan;                        /* how the table is being visited, see below */
+    unsigned probe;                       /* raw value looked up when probing */
+    MSIITERHANDLE handle;                 /* position in the column index when probing */
 } JOINTABLE;
 
+/* JOINTABLE.scan */
+#define SCAN_START   0
+#define SCAN_ROWS    1
+#define SCAN_PROBE   2
+#define SCAN_RESEEK  3  /* probing, the index handle must be looked up again */
+
 typedef struct _LibmsiOrderInfo
 {
     unsigned col_count;
@@ -60,11 +68,26 @@ typedef struct _LibmsiWhereView
     unsigned           row_count;
     unsigned           col_count;
     unsigned           table_count;
-    LibmsiRowEntry  **reorder;
-    unsigned           reorder_size; /* number of entries available in reorder */
+    unsigned          *reorder;      /* table_count row indexes per result row */
+    unsigned           reorder_size; /* number of result rows available in reorder */
     struct expr   *cond;
     unsigned           rec_index;
     LibmsiOrderInfo  *order_info;
+    JOINTABLE       **plan;         /* tables in evaluation order, NULL terminated */
+    double             plan_cost;    /* estimated number of row evaluations */
+    double             plan_rows;    /* estimated number of result rows */
+    uint64_t           evaluated;    /* row combinations evaluated by the last execution */
+    unsigned           limit;        /* at most this many rows after offset, or NO_LIMIT */
+    unsigned           offset;
+    bool               top_k;        /* keep the best rows in a heap instead of stopping early */
+    bool               stop;         /* enough rows were found, end the scan */
+    unsigned          *spare;        /* candidate row and scratch space for the heap */
+    unsigned          *cursor;       /* row of each table for the combination being tested */
+    int                depth;        /* level of the plan being scanned, -1 when done */
+    bool               lazy;         /* rows are produced when they are asked for */
+    unsigned           skipped;      /* rows skipped for OFFSET by the lazy scan */
+    unsigned           error;        /* result of the lazy scan */
+    LibmsiRecord      *record;       /* parameters of the lazy scan */
 } LibmsiWhereView;
 
 static unsigned where_view_evaluate( LibmsiWhereView *wv, const unsigned rows[],
@@ -72,18 +95,13 @@ static unsigned where_view_evaluate( LibmsiWhereView *wv, const unsigned rows[],
 
 #define INITIAL_REORDER_SIZE 16
 
+/* the lazy scan produces at least this many rows at a time */
+#define LAZY_BATCH_SIZE 16
+
 #define INVALID_ROW_INDEX (-1)
 
 static void free_reorder(LibmsiWhereView *wv)
 {
-    unsigned i;
-
-    if (!wv->reorder)
-        return;
-
-    for (i = 0; i < wv->row_count; i++)
-        msi_free(wv->reorder[i]);
-
     msi_free( wv->reorder );
     wv->reorder = NULL;
     wv->reorder_size = 0;
@@ -92,7 +110,7 @@ static void free_reorder(LibmsiWhereView *wv)
 
 static unsigned init_reorder(LibmsiWhereView *wv)
 {
-    LibmsiRowEntry **new = msi_alloc_zero(sizeof(LibmsiRowEntry *) * INITIAL_REORDER_SIZE);
+    unsigned *new = msi_alloc(sizeof(unsigned) * wv->table_count * INITIAL_REORDER_SIZE);
     if (!new)
         return LIBMSI_RESULT_OUTOFMEMORY;
 
@@ -104,27 +122,94 @@ static unsigned init_reorder(LibmsiWhereView *wv)
     return LIBMSI_RESULT_SUCCESS;
 }
 
+static inline unsigned *row_entry(const LibmsiWhereView *wv, unsigned row)
+{
+    return wv->reorder + (size_t)row * wv->table_count;
+}
+
+static unsigned where_view_produce(LibmsiWhereView *wv, unsigned count);
+
 static inline unsigned find_row(LibmsiWhereView *wv, unsigned row, unsigned *(values[]))
 {
+    unsigned r;
+
+    if (row >= wv->row_count && wv->lazy)
+    {
+        r = where_view_produce(wv, row + 1);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    /* a scan that failed has no more rows */
     if (row >= wv->row_count)
-        return NO_MORE_ITEMS;
+        return wv->error != LIBMSI_RESULT_SUCCESS ? wv->error : NO_MORE_ITEMS;
 
-    *values = wv->reorder[row]->values;
+    *values = row_entry(wv, row);
 
     return LIBMSI_RESULT_SUCCESS;
 }
 
-static unsigned add_row(LibmsiWhereView *wv, unsigned vals[])
+static int compare_entry( const void *left, const void *right, void *data );
+
+static void heap_swap(LibmsiWhereView *wv, unsigned i, unsigned j)
+{
+    unsigned *tmp = wv->spare + wv->table_count;
+    size_t size = wv->table_count * sizeof(unsigned);
+
+    memcpy(tmp, row_entry(wv, i), size);
+    memcpy(row_entry(wv, i), row_entry(wv, j), size);
+    memcpy(row_entry(wv, j), tmp, size);
+}
+
+static inline int heap_compare(LibmsiWhereView *wv, unsigned i, unsigned j)
+{
+    return compare_entry(row_entry(wv, i), row_entry(wv, j), wv);
+}
+
+/* the heap keeps the greatest of the rows kept so far at the top */
+static void heap_sift_up(LibmsiWhereView *wv, unsigned i)
+{
+    while (i > 0 && heap_compare(wv, (i - 1) / 2, i) < 0)
+    {
+        heap_swap(wv, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_sift_down(LibmsiWhereView *wv, unsigned count, unsigned i)
+{
+    for (;;)
+    {
+        unsigned largest = i, child = 2 * i + 1;
+
+        if (child < count && heap_compare(wv, child, largest) > 0)
+            largest = child;
+        if (child + 1 < count && heap_compare(wv, child + 1, largest) > 0)
+            largest = child + 1;
+        if (largest == i)
+            return;
+
+        heap_swap(wv, i, largest);
+        i = largest;
+    }
+}
+
+static unsigned limit_rows(const LibmsiWhereView *wv)
 {
-    LibmsiRowEntry *new;
+    if (wv->limit == NO_LIMIT)
+        return NO_LIMIT;
+    return wv->limit > G_MAXUINT - wv->offset ? G_MAXUINT : wv->offset + wv->limit;
+}
 
+/* result rows live back to back in a single allocation */
+static unsigned append_row(LibmsiWhereView *wv, const unsigned vals[])
+{
     if (wv->reorder_size <= wv->row_count)
     {
-        LibmsiRowEntry **new_reorder;
+        unsigned *new_reorder;
         unsigned newsize = wv->reorder_size * 2;
 
-        new_reorder = msi_realloc_zero(wv->reorder, sizeof(LibmsiRowEntry *) * wv->reorder_size,
-                                       sizeof(LibmsiRowEntry *) * newsize);
+        new_reorder = msi_realloc(wv->reorder, sizeof(unsigned) * wv->table_count * newsize);
         if (!new_reorder)
             return LIBMSI_RESULT_OUTOFMEMORY;
 
@@ -132,15 +217,44 @@ static unsigned add_row(LibmsiWhereView *wv, unsigned vals[])
         wv->reorder_size = newsize;
     }
 
-    new = msi_alloc(offsetof( LibmsiRowEntry, values[wv->table_count] ));
+    memcpy(row_entry(wv, wv->row_count++), vals, wv->table_count * sizeof(unsigned));
 
-    if (!new)
-        return LIBMSI_RESULT_OUTOFMEMORY;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned add_row(LibmsiWhereView *wv, const unsigned vals[])
+{
+    unsigned max_rows = limit_rows(wv);
+    unsigned r;
+
+    if (wv->row_count >= max_rows)
+    {
+        if (!wv->top_k || !max_rows)
+        {
+            wv->stop = true;
+            return LIBMSI_RESULT_SUCCESS;
+        }
+
+        /* replace the greatest row kept if the new one sorts before it */
+        if (compare_entry(vals, row_entry(wv, 0), wv) < 0)
+        {
+            memcpy(row_entry(wv, 0), vals, wv->table_count * sizeof(unsigned));
+            heap_sift_down(wv, wv->row_count, 0);
+        }
+        return LIBMSI_RESULT_SUCCESS;
+    }
 
-    wv->reorder[wv->row_count++] = new;
+    r = append_row(wv, vals);
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
 
-    memcpy(new->values, vals, wv->table_count * sizeof(unsigned));
-    new->wv = wv;
+    if (max_rows != NO_LIMIT)
+    {
+        if (wv->top_k)
+            heap_sift_up(wv, wv->row_count - 1);
+        else if (wv->row_count >= max_rows)
+            wv->stop = true;
+    }
 
     return LIBMSI_RESULT_SUCCESS;
 }
@@ -263,23 +377,13 @@ static unsigned where_view_get_row( LibmsiView *view, unsigned row, LibmsiRecord
     return msi_view_get_row( wv->db, view, row, rec );
 }
 
-static unsigned where_view_set_row( LibmsiView *view, unsigned row, LibmsiRecord *rec, unsigned mask )
+/* key columns cannot be updated */
+static unsigned check_update_mask( LibmsiWhereView *wv, unsigned mask )
 {
-    LibmsiWhereView *wv = (LibmsiWhereView*)view;
-    unsigned i, r, offset = 0;
     JOINTABLE *table = wv->tables;
-    unsigned *rows;
+    unsigned i, r;
     unsigned mask_copy = mask;
 
-    TRACE("%p %d %p %08x\n", wv, row, rec, mask );
-
-    if( !wv->tables )
-         return LIBMSI_RESULT_FUNCTION_FAILED;
-
-    r = find_row(wv, row, &rows);
-    if (r != LIBMSI_RESULT_SUCCESS)
-        return r;
-
     if (mask >= 1 << wv->col_count)
         return LIBMSI_RESULT_INVALID_PARAMETER;
 
@@ -301,7 +405,51 @@ static unsigned where_view_set_row( LibmsiView *view, unsigned row, LibmsiRecord
     }
     while (mask_copy && (table = table->next));
 
-    table = wv->tables;
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+/* the fields of one table, taken from a record of the joined columns */
+static unsigned reduce_record( LibmsiRecord *rec, unsigned offset, unsigned col_count,
+                               LibmsiRecord **reduced )
+{
+    unsigned i, r;
+
+    *reduced = libmsi_record_new(col_count);
+    if (!*reduced)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    for (i = 1; i <= col_count; i++)
+    {
+        r = _libmsi_record_copy_field(rec, i + offset, *reduced, i);
+        if (r != LIBMSI_RESULT_SUCCESS)
+        {
+            g_object_unref(*reduced);
+            return r;
+        }
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned where_view_set_row( LibmsiView *view, unsigned row, LibmsiRecord *rec, unsigned mask )
+{
+    LibmsiWhereView *wv = (LibmsiWhereView*)view;
+    unsigned r = LIBMSI_RESULT_SUCCESS, offset = 0;
+    JOINTABLE *table = wv->tables;
+    unsigned *rows;
+
+    TRACE("%p %d %p %08x\n", wv, row, rec, mask );
+
+    if( !wv->tables )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    r = find_row(wv, row, &rows);
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
+
+    r = check_update_mask(wv, mask);
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
 
     do
     {
@@ -315,26 +463,92 @@ static unsigned where_view_set_row( LibmsiView *view, unsigned row, LibmsiRecord
             continue;
         }
 
-        reduced = libmsi_record_new(col_count);
-        if (!reduced)
-            return LIBMSI_RESULT_FUNCTION_FAILED;
+        r = reduce_record(rec, offset, col_count, &reduced);
+        offset += col_count;
 
-        for (i = 1; i <= col_count; i++)
+        if (r == LIBMSI_RESULT_SUCCESS)
         {
-            r = _libmsi_record_copy_field(rec, i + offset, reduced, i);
-            if (r != LIBMSI_RESULT_SUCCESS)
-                break;
+            r = table->view->ops->set_row(table->view, rows[table->table_index], reduced, reduced_mask);
+            g_object_unref(reduced);
+        }
+    }
+    while ((table = table->next));
+    return r;
+}
+
+static unsigned where_view_set_rows( LibmsiView *view, const unsigned *rows, unsigned count,
+                                     LibmsiRecord *rec, unsigned mask )
+{
+    LibmsiWhereView *wv = (LibmsiWhereView*)view;
+    unsigned j, n, r, offset = 0;
+    JOINTABLE *table = wv->tables;
+    unsigned *values, *table_rows;
+    uint8_t *seen;
+
+    TRACE("%p %p %u %p %08x\n", wv, rows, count, rec, mask );
+
+    if( !wv->tables )
+         return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    if (!rows)
+    {
+        r = view->ops->get_dimensions(view, &count, NULL);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    if (!count)
+        return LIBMSI_RESULT_SUCCESS;
+
+    r = check_update_mask(wv, mask);
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
+
+    do
+    {
+        const unsigned col_count = table->col_count;
+        LibmsiRecord *reduced;
+        unsigned reduced_mask = (mask >> offset) & ((1 << col_count) - 1);
+
+        if (!reduced_mask)
+        {
+            offset += col_count;
+            continue;
         }
 
+        r = reduce_record(rec, offset, col_count, &reduced);
         offset += col_count;
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+
+        /* a table row joined to several others is only set once */
+        table_rows = msi_alloc(count * sizeof(*table_rows));
+        seen = msi_alloc_zero(table->row_count);
+        if (!table_rows || !seen)
+            r = LIBMSI_RESULT_OUTOFMEMORY;
+
+        for (j = n = 0; r == LIBMSI_RESULT_SUCCESS && j < count; j++)
+        {
+            r = find_row(wv, rows ? rows[j] : j, &values);
+            if (r == LIBMSI_RESULT_SUCCESS && !seen[values[table->table_index]])
+            {
+                seen[values[table->table_index]] = 1;
+                table_rows[n++] = values[table->table_index];
+            }
+        }
 
         if (r == LIBMSI_RESULT_SUCCESS)
-            r = table->view->ops->set_row(table->view, rows[table->table_index], reduced, reduced_mask);
+            r = msi_view_set_rows(table->view, table_rows, n, reduced, reduced_mask);
 
+        msi_free(seen);
+        msi_free(table_rows);
         g_object_unref(reduced);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
     }
     while ((table = table->next));
-    return r;
+
+    return LIBMSI_RESULT_SUCCESS;
 }
 
 static unsigned where_view_delete_row(LibmsiView *view, unsigned row)
@@ -590,191 +804,719 @@ static unsigned where_view_evaluate( LibmsiWhereView *wv, const unsigned rows[],
     return LIBMSI_RESULT_SUCCESS;
 }
 
-static unsigned check_condition( LibmsiWhereView *wv, LibmsiRecord *record, JOINTABLE **tables,
-                             unsigned table_rows[] )
+/* returns the raw value the probe column of the table has to hold for the
+ * condition to be true, NO_MORE_ITEMS if no row can match or
+ * LIBMSI_RESULT_CONTINUE if the value isn't known and the table is scanned */
+static unsigned get_probe_value( LibmsiWhereView *wv, const JOINTABLE *table,
+                                 const unsigned rows[], unsigned *val )
 {
-    unsigned r = LIBMSI_RESULT_FUNCTION_FAILED;
-    int val;
+    const struct expr *value = table->probe_value;
+    const char *str;
 
-    for (table_rows[(*tables)->table_index] = 0;
-         table_rows[(*tables)->table_index] < (*tables)->row_count;
-         table_rows[(*tables)->table_index]++)
+    switch (value->type)
     {
-        val = 0;
-        wv->rec_index = 0;
-        r = where_view_evaluate( wv, table_rows, wv->cond, &val, record );
-        if (r != LIBMSI_RESULT_SUCCESS && r != LIBMSI_RESULT_CONTINUE)
-            break;
-        if (val)
+    case EXPR_UVAL:
+        if (table->probe_column->type == EXPR_COL_NUMBER32)
         {
-            if (*(tables + 1))
-            {
-                r = check_condition(wv, record, tables + 1, table_rows);
-                if (r != LIBMSI_RESULT_SUCCESS)
-                    break;
-            }
-            else
-            {
-                if (r != LIBMSI_RESULT_SUCCESS)
-                    break;
-                add_row (wv, table_rows);
-            }
+            *val = value->u.uval + 0x80000000;
+            return LIBMSI_RESULT_SUCCESS;
         }
-    }
-    table_rows[(*tables)->table_index] = INVALID_ROW_INDEX;
-    return r;
-}
+        if ((int)value->u.uval < -0x8000 || (int)value->u.uval > 0x7fff)
+            return NO_MORE_ITEMS;
+        *val = value->u.uval + 0x8000;
+        return LIBMSI_RESULT_SUCCESS;
 
-static int compare_entry( const void *left, const void *right )
-{
-    const LibmsiRowEntry *le = *(const LibmsiRowEntry**)left;
-    const LibmsiRowEntry *re = *(const LibmsiRowEntry**)right;
-    const LibmsiWhereView *wv = le->wv;
-    LibmsiOrderInfo *order = wv->order_info;
-    unsigned i, j, r, l_val, r_val;
+    case EXPR_SVAL:
+        if (_libmsi_id_from_string_utf8(wv->db->strings, value->u.sval, val) != LIBMSI_RESULT_SUCCESS)
+            return NO_MORE_ITEMS;
+        return LIBMSI_RESULT_SUCCESS;
 
-    assert(le->wv == re->wv);
+    default:
+        if (expr_fetch_value(&value->u.column, rows, val) != LIBMSI_RESULT_SUCCESS)
+            return LIBMSI_RESULT_CONTINUE;
 
-    if (order)
-    {
-        for (i = 0; i < order->col_count; i++)
+        /* NULL and empty strings compare equal, so they can't be looked up */
+        if (value->type == EXPR_COL_NUMBER_STRING)
         {
-            const union ext_column *column = &order->columns[i];
-
-            r = column->parsed.table->view->ops->fetch_int(column->parsed.table->view,
-                          le->values[column->parsed.table->table_index],
-                          column->parsed.column, &l_val);
-            if (r != LIBMSI_RESULT_SUCCESS)
-            {
-                order->error = r;
-                return 0;
-            }
-
-            r = column->parsed.table->view->ops->fetch_int(column->parsed.table->view,
-                          re->values[column->parsed.table->table_index],
-                          column->parsed.column, &r_val);
-            if (r != LIBMSI_RESULT_SUCCESS)
-            {
-                order->error = r;
-                return 0;
-            }
-
-            if (l_val != r_val)
-                return l_val < r_val ? -1 : 1;
+            str = msi_string_lookup_id(wv->db->strings, *val);
+            if (!str || !*str)
+                return LIBMSI_RESULT_CONTINUE;
         }
+        return LIBMSI_RESULT_SUCCESS;
     }
-
-    for (j = 0; j < wv->table_count; j++)
-    {
-        if (le->values[j] != re->values[j])
-            return le->values[j] < re->values[j] ? -1 : 1;
-    }
-    return 0;
 }
 
-static void add_to_array( JOINTABLE **array, JOINTABLE *elem )
+/* moves the table to the next row that may satisfy the condition, given
+ * the rows of the tables before it in the plan; NO_MORE_ITEMS when the
+ * table has no more rows to offer */
+static unsigned next_table_row( LibmsiWhereView *wv, JOINTABLE *table )
 {
-    while (*array && *array != elem)
-        array++;
-    if (!*array)
-        *array = elem;
-}
+    unsigned *row = &wv->cursor[table->table_index];
+    unsigned r, last;
 
-G_GNUC_PURE
-static bool in_array( JOINTABLE **array, JOINTABLE *elem )
-{
-    while (*array && *array != elem)
-        array++;
-    return *array != NULL;
-}
+    if (table->scan == SCAN_START)
+    {
+        r = LIBMSI_RESULT_CONTINUE;
+        if (table->probe_column)
+            r = get_probe_value(wv, table, wv->cursor, &table->probe);
 
-#define CONST_EXPR 1 /* comparison to a constant value */
-#define JOIN_TO_CONST_EXPR 0x10000 /* comparison to a table involved with
-                                      a CONST_EXPR comaprison */
+        if (r == LIBMSI_RESULT_SUCCESS)
+        {
+            table->scan = SCAN_PROBE;
+            table->handle = NULL;
+        }
+        else if (r == LIBMSI_RESULT_CONTINUE)
+        {
+            table->scan = SCAN_ROWS;
+            *row = INVALID_ROW_INDEX;
+        }
+        else
+            return r;
+    }
 
-static unsigned reorder_check( const struct expr *expr, JOINTABLE **ordered_tables,
-                           bool process_joins, JOINTABLE **lastused )
-{
-    unsigned res = 0;
+    if (table->scan == SCAN_ROWS)
+    {
+        *row = *row == INVALID_ROW_INDEX ? 0 : *row + 1;
+        return *row < table->row_count ? LIBMSI_RESULT_SUCCESS : NO_MORE_ITEMS;
+    }
 
-    switch (expr->type)
+    /* the index may have been rebuilt since the lazy scan last ran, find
+     * the position again; matches come out in row order */
+    if (table->scan == SCAN_RESEEK)
     {
-        case EXPR_WILDCARD:
-        case EXPR_SVAL:
-        case EXPR_UVAL:
-            return 0;
-        case EXPR_COL_NUMBER:
-        case EXPR_COL_NUMBER32:
-        case EXPR_COL_NUMBER_STRING:
-            if (in_array(ordered_tables, expr->u.column.parsed.table))
-                return JOIN_TO_CONST_EXPR;
-            *lastused = expr->u.column.parsed.table;
-            return CONST_EXPR;
-        case EXPR_STRCMP:
-        case EXPR_COMPLEX:
-            res = reorder_check(expr->u.expr.right, ordered_tables, process_joins, lastused);
-            /* fall through */
-        case EXPR_UNARY:
-            res += reorder_check(expr->u.expr.left, ordered_tables, process_joins, lastused);
-            if (res == 0)
-                return 0;
-            if (res == CONST_EXPR)
-                add_to_array(ordered_tables, *lastused);
-            if (process_joins && res == JOIN_TO_CONST_EXPR + CONST_EXPR)
-                add_to_array(ordered_tables, *lastused);
-            return res;
-        default:
-            g_critical("Unknown expr type: %i\n", expr->type);
-            assert(0);
-            return 0x1000000;
+        last = *row;
+        table->scan = SCAN_PROBE;
+        table->handle = NULL;
+        while ((r = table->view->ops->find_matching_rows(table->view,
+                        table->probe_column->u.column.parsed.column,
+                        table->probe, row, &table->handle)) == LIBMSI_RESULT_SUCCESS)
+        {
+            if (*row > last)
+                return r;
+        }
+        return r;
     }
+
+    /* only visit the rows the column index hands out */
+    return table->view->ops->find_matching_rows(table->view,
+                    table->probe_column->u.column.parsed.column,
+                    table->probe, row, &table->handle);
 }
 
-/* reorders the tablelist in a way to evaluate the condition as fast as possible */
-static JOINTABLE **ordertables( LibmsiWhereView *wv )
+static void reset_cursor( LibmsiWhereView *wv )
 {
     JOINTABLE *table;
-    JOINTABLE **tables;
-
-    tables = msi_alloc_zero( (wv->table_count + 1) * sizeof(*tables) );
-
-    if (wv->cond)
-    {
-        table = NULL;
-        reorder_check(wv->cond, tables, false, &table);
-        table = NULL;
-        reorder_check(wv->cond, tables, true, &table);
-    }
 
-    table = wv->tables;
-    while (table)
+    for (table = wv->tables; table; table = table->next)
     {
-        add_to_array(tables, table);
-        table = table->next;
+        table->scan = SCAN_START;
+        wv->cursor[table->table_index] = INVALID_ROW_INDEX;
     }
-    return tables;
+    wv->depth = 0;
 }
 
-static unsigned where_view_execute( LibmsiView *view, LibmsiRecord *record )
+/* finds the next combination of rows, from the tables in plan order, that
+ * satisfies the condition and leaves it in wv->cursor */
+static unsigned next_match( LibmsiWhereView *wv )
 {
-    LibmsiWhereView *wv = (LibmsiWhereView*)view;
+    JOINTABLE *table;
     unsigned r;
-    JOINTABLE *table = wv->tables;
-    unsigned *rows;
-    JOINTABLE **ordered_tables;
-    int i = 0;
+    int val;
 
-    TRACE("%p %p\n", wv, record);
+    while (wv->depth >= 0)
+    {
+        table = wv->plan[wv->depth];
+
+        r = next_table_row(wv, table);
+        if (r == NO_MORE_ITEMS)
+        {
+            table->scan = SCAN_START;
+            wv->cursor[table->table_index] = INVALID_ROW_INDEX;
+            wv->depth--;
+            continue;
+        }
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+
+        table->visited++;
+        wv->evaluated++;
+        msi_count( MSI_COUNTER_ROWS_SCANNED, 1 );
+        wv->rec_index = 0;
+        val = 0;
+        r = where_view_evaluate( wv, wv->cursor, wv->cond, &val, wv->record );
+        if (r != LIBMSI_RESULT_SUCCESS && r != LIBMSI_RESULT_CONTINUE)
+            return r;
+        if (!val)
+            continue;
+
+        if (wv->depth + 1 < wv->table_count)
+        {
+            wv->depth++;
+            continue;
+        }
+
+        return r;
+    }
+
+    return NO_MORE_ITEMS;
+}
+
+static void finish_lazy( LibmsiWhereView *wv, unsigned r )
+{
+    wv->lazy = false;
+    wv->error = r;
+    if (wv->record)
+        g_object_unref(wv->record);
+    wv->record = NULL;
+}
+
+/* runs the lazy scan until count rows are available, or a batch of them */
+static unsigned where_view_produce( LibmsiWhereView *wv, unsigned count )
+{
+    LibmsiView *view = &wv->view;
+    int64_t start = msi_view_profile_begin( view );
+    uint64_t evaluated = wv->evaluated;
+    unsigned r = LIBMSI_RESULT_SUCCESS, produced = wv->row_count;
+    JOINTABLE *table;
+
+    if (!wv->lazy)
+        return wv->error;
+
+    count = MAX(count, MIN(wv->limit, MAX(2 * wv->row_count, LAZY_BATCH_SIZE)));
+
+    for (table = wv->tables; table; table = table->next)
+        if (table->scan == SCAN_PROBE)
+            table->scan = SCAN_RESEEK;
+
+    while (wv->row_count < count && wv->row_count < wv->limit)
+    {
+        r = next_match(wv);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            break;
+
+        if (wv->skipped < wv->offset)
+        {
+            wv->skipped++;
+            continue;
+        }
+
+        r = append_row(wv, wv->cursor);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            break;
+    }
+
+    if (r == NO_MORE_ITEMS)
+        r = LIBMSI_RESULT_SUCCESS;
+    if (r != LIBMSI_RESULT_SUCCESS || wv->row_count >= wv->limit || wv->depth < 0)
+        finish_lazy(wv, r);
+
+    if (view->profile)
+    {
+        view->stats.rows_in += wv->evaluated - evaluated;
+        view->stats.rows_out += wv->row_count - produced;
+        view->stats.time += g_get_monotonic_time() - start;
+    }
+
+    return r;
+}
+
+static int compare_entry( const void *left, const void *right, void *data )
+{
+    const unsigned *le = left;
+    const unsigned *re = right;
+    const LibmsiWhereView *wv = data;
+    LibmsiOrderInfo *order = wv->order_info;
+    unsigned i, j, r, l_val, r_val;
+
+    if (order)
+    {
+        for (i = 0; i < order->col_count; i++)
+        {
+            const union ext_column *column = &order->columns[i];
+
+            r = column->parsed.table->view->ops->fetch_int(column->parsed.table->view,
+                          le[column->parsed.table->table_index],
+                          column->parsed.column, &l_val);
+            if (r != LIBMSI_RESULT_SUCCESS)
+            {
+                order->error = r;
+                return 0;
+            }
+
+            r = column->parsed.table->view->ops->fetch_int(column->parsed.table->view,
+                          re[column->parsed.table->table_index],
+                          column->parsed.column, &r_val);
+            if (r != LIBMSI_RESULT_SUCCESS)
+            {
+                order->error = r;
+                return 0;
+            }
+
+            if (l_val != r_val)
+                return l_val < r_val ? -1 : 1;
+        }
+    }
+
+    for (j = 0; j < wv->table_count; j++)
+    {
+        if (le[j] != re[j])
+            return le[j] < re[j] ? -1 : 1;
+    }
+    return 0;
+}
+
+#define WHERE_STATS_SAMPLE    1024 /* rows sampled for a distinct value estimate */
+#define WHERE_MAX_DP_TABLES   10   /* join orders are enumerated exhaustively up to this */
+#define WHERE_MAX_PLAN_TABLES 32   /* tables are tracked in a bit mask */
+
+typedef struct _LibmsiWherePredicate
+{
+    const struct expr *expr;
+    unsigned tables;        /* mask of the tables referenced by expr */
+    double selectivity;
+} LibmsiWherePredicate;
+
+static inline bool is_column_expr( const struct expr *expr )
+{
+    return expr->type == EXPR_COL_NUMBER ||
+           expr->type == EXPR_COL_NUMBER32 ||
+           expr->type == EXPR_COL_NUMBER_STRING;
+}
+
+/* estimates the number of distinct values in a column from a sample of
+ * its rows, the result is cached until the next plan is made */
+static unsigned table_column_distinct( JOINTABLE *table, unsigned col )
+{
+    GHashTable *seen;
+    unsigned i, step, val, count, sampled = 0;
+
+    if (!table->distinct)
+    {
+        table->distinct = msi_alloc_zero(table->col_count * sizeof(unsigned));
+        if (!table->distinct)
+            return 1;
+    }
+
+    if (table->distinct[col - 1])
+        return table->distinct[col - 1];
+
+    step = table->row_count > WHERE_STATS_SAMPLE ? table->row_count / WHERE_STATS_SAMPLE : 1;
+    seen = g_hash_table_new(NULL, NULL);
+    for (i = 0; i < table->row_count; i += step)
+    {
+        if (table->view->ops->fetch_int(table->view, i, col, &val) != LIBMSI_RESULT_SUCCESS)
+            continue;
+        g_hash_table_add(seen, GUINT_TO_POINTER(val));
+        sampled++;
+    }
+    count = g_hash_table_size(seen);
+    g_hash_table_destroy(seen);
+
+    /* a sample of (nearly) all different values comes from a key-like
+     * column, otherwise the number of values is taken as saturated */
+    if (sampled && sampled < table->row_count && count * 10 >= sampled * 9)
+        count = (uint64_t)count * table->row_count / sampled;
+
+    table->distinct[col - 1] = MAX(count, 1);
+    return table->distinct[col - 1];
+}
+
+static unsigned expr_column_distinct( const struct expr *expr )
+{
+    return table_column_distinct(expr->u.column.parsed.table, expr->u.column.parsed.column);
+}
+
+static unsigned expr_table_mask( const struct expr *expr )
+{
+    switch (expr->type)
+    {
+    case EXPR_COL_NUMBER:
+    case EXPR_COL_NUMBER32:
+    case EXPR_COL_NUMBER_STRING:
+        return 1u << expr->u.column.parsed.table->table_index;
+    case EXPR_STRCMP:
+    case EXPR_COMPLEX:
+        return expr_table_mask(expr->u.expr.left) | expr_table_mask(expr->u.expr.right);
+    case EXPR_UNARY:
+        return expr_table_mask(expr->u.expr.left);
+    default:
+        return 0;
+    }
+}
+
+static double expr_eq_selectivity( const struct expr *left, const struct expr *right )
+{
+    unsigned distinct = 1;
+
+    if (is_column_expr(left))
+        distinct = MAX(distinct, expr_column_distinct(left));
+    if (is_column_expr(right))
+        distinct = MAX(distinct, expr_column_distinct(right));
+    return 1.0 / distinct;
+}
+
+/* fraction of rows expected to satisfy the condition */
+static double expr_selectivity( const struct expr *expr )
+{
+    double l, r;
+
+    switch (expr->type)
+    {
+    case EXPR_STRCMP:
+    case EXPR_COMPLEX:
+        switch (expr->u.expr.op)
+        {
+        case OP_AND:
+            return expr_selectivity(expr->u.expr.left) * expr_selectivity(expr->u.expr.right);
+        case OP_OR:
+            l = expr_selectivity(expr->u.expr.left);
+            r = expr_selectivity(expr->u.expr.right);
+            return l + r - l * r;
+        case OP_EQ:
+            return expr_eq_selectivity(expr->u.expr.left, expr->u.expr.right);
+        case OP_NE:
+            return 1.0 - expr_eq_selectivity(expr->u.expr.left, expr->u.expr.right);
+        default:
+            return 1.0 / 3;
+        }
+    case EXPR_UNARY:
+        return expr->u.expr.op == OP_ISNULL ? 0.1 : 0.9;
+    default:
+        return 1.0;
+    }
+}
+
+static unsigned count_predicates( const struct expr *cond )
+{
+    if (cond->type == EXPR_COMPLEX && cond->u.expr.op == OP_AND)
+        return count_predicates(cond->u.expr.left) + count_predicates(cond->u.expr.right);
+    return 1;
+}
+
+/* splits the condition into the terms of its top level conjunction */
+static void collect_predicates( const struct expr *cond, LibmsiWherePredicate *preds,
+                                unsigned *count, bool estimate )
+{
+    if (cond->type == EXPR_COMPLEX && cond->u.expr.op == OP_AND)
+    {
+        collect_predicates(cond->u.expr.left, preds, count, estimate);
+        collect_predicates(cond->u.expr.right, preds, count, estimate);
+        return;
+    }
+
+    preds[*count].expr = cond;
+    preds[*count].tables = expr_table_mask(cond);
+    preds[*count].selectivity = estimate ? expr_selectivity(cond) : 1.0;
+    (*count)++;
+}
+
+/* checks whether column = value can be answered through the index of column */
+static bool is_probe( const struct expr *column, const struct expr *value,
+                      const JOINTABLE *table, unsigned bound )
+{
+    if (!is_column_expr(column) || column->u.column.parsed.table != table)
+        return false;
+
+    switch (value->type)
+    {
+    case EXPR_UVAL:
+        return column->type != EXPR_COL_NUMBER_STRING;
+    case EXPR_SVAL:
+        return column->type == EXPR_COL_NUMBER_STRING && value->u.sval && *value->u.sval;
+    case EXPR_COL_NUMBER:
+    case EXPR_COL_NUMBER32:
+    case EXPR_COL_NUMBER_STRING:
+        return value->type == column->type &&
+               (bound & (1u << value->u.column.parsed.table->table_index));
+    default:
+        return false;
+    }
+}
+
+/* picks the most selective equality that looks up rows of the table once
+ * the tables in bound are positioned, returns false if it has to be scanned */
+static bool find_probe( const LibmsiWherePredicate *preds, unsigned count, const JOINTABLE *table,
+                        unsigned bound, bool estimate, const struct expr **column,
+                        const struct expr **value )
+{
+    unsigned i, distinct, best = 0;
+
+    *column = NULL;
+    for (i = 0; i < count; i++)
+    {
+        const struct expr *expr = preds[i].expr, *col, *val;
+
+        if ((expr->type != EXPR_COMPLEX && expr->type != EXPR_STRCMP) ||
+            expr->u.expr.op != OP_EQ)
+            continue;
+
+        if (is_probe(expr->u.expr.left, expr->u.expr.right, table, bound))
+        {
+            col = expr->u.expr.left;
+            val = expr->u.expr.right;
+        }
+        else if (is_probe(expr->u.expr.right, expr->u.expr.left, table, bound))
+        {
+            col = expr->u.expr.right;
+            val = expr->u.expr.left;
+        }
+        else
+            continue;
+
+        if (!estimate)
+        {
+            *column = col;
+            *value = val;
+            return true;
+        }
+
+        distinct = expr_column_distinct(col);
+        if (distinct > best)
+        {
+            best = distinct;
+            *column = col;
+            *value = val;
+        }
+    }
+    return *column != NULL;
+}
+
+/* estimated number of row combinations of the tables in set that satisfy
+ * the predicates referencing only those tables */
+static double join_rows( JOINTABLE **tables, const LibmsiWherePredicate *preds,
+                         unsigned count, unsigned set )
+{
+    double rows = 1.0;
+    unsigned i;
+
+    for (i = 0; i < WHERE_MAX_PLAN_TABLES; i++)
+        if (set & (1u << i))
+            rows *= tables[i]->row_count;
+
+    for (i = 0; i < count; i++)
+        if ((preds[i].tables & set) == preds[i].tables)
+            rows *= preds[i].selectivity;
+
+    return rows;
+}
+
+/* estimated cost of visiting the table once for each combination of the
+ * tables in bound */
+static double join_step_cost( JOINTABLE **tables, const LibmsiWherePredicate *preds,
+                              unsigned count, unsigned bound, unsigned index )
+{
+    const struct expr *column, *value;
+    JOINTABLE *table = tables[index];
+    double outer = join_rows(tables, preds, count, bound);
+
+    if (find_probe(preds, count, table, bound, true, &column, &value))
+    {
+        /* building the index visits every row once */
+        return table->row_count +
+               outer * (1.0 + (double)table->row_count / expr_column_distinct(column));
+    }
+
+    return outer * table->row_count;
+}
+
+static unsigned order_tables_exhaustive( LibmsiWhereView *wv, JOINTABLE **tables,
+                                         const LibmsiWherePredicate *preds, unsigned count )
+{
+    unsigned n = wv->table_count, all = (1u << n) - 1;
+    unsigned set, i, k;
+    unsigned *last;
+    double *cost;
+
+    cost = msi_alloc((all + 1) * sizeof(double));
+    last = msi_alloc((all + 1) * sizeof(unsigned));
+    if (!cost || !last)
+    {
+        msi_free(cost);
+        msi_free(last);
+        return LIBMSI_RESULT_OUTOFMEMORY;
+    }
+
+    /* cheapest way to join each subset of tables, with the table visited last */
+    cost[0] = 0.0;
+    for (set = 1; set <= all; set++)
+    {
+        cost[set] = HUGE_VAL;
+        for (i = 0; i < n; i++)
+        {
+            double c;
+
+            if (!(set & (1u << i)))
+                continue;
+
+            c = cost[set & ~(1u << i)] +
+                join_step_cost(tables, preds, count, set & ~(1u << i), i);
+            if (c < cost[set])
+            {
+                cost[set] = c;
+                last[set] = i;
+            }
+        }
+    }
+
+    for (set = all, k = n; k > 0; k--)
+    {
+        wv->plan[k - 1] = tables[last[set]];
+        set &= ~(1u << last[set]);
+    }
+    wv->plan_cost = cost[all];
+
+    msi_free(cost);
+    msi_free(last);
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static void order_tables_greedy( LibmsiWhereView *wv, JOINTABLE **tables,
+                                 const LibmsiWherePredicate *preds, unsigned count )
+{
+    unsigned n = wv->table_count, bound = 0;
+    unsigned i, k, best = 0;
+
+    wv->plan_cost = 0.0;
+    for (k = 0; k < n; k++)
+    {
+        double c, best_cost = HUGE_VAL;
+
+        for (i = 0; i < n; i++)
+        {
+            if (bound & (1u << i))
+                continue;
+
+            c = join_step_cost(tables, preds, count, bound, i);
+            if (c < best_cost)
+            {
+                best_cost = c;
+                best = i;
+            }
+        }
+
+        wv->plan[k] = tables[best];
+        wv->plan_cost += best_cost;
+        bound |= 1u << best;
+    }
+}
+
+static void free_plan( LibmsiWhereView *wv )
+{
+    JOINTABLE *table;
+
+    for (table = wv->tables; table; table = table->next)
+    {
+        msi_free(table->distinct);
+        table->distinct = NULL;
+        table->probe_column = NULL;
+        table->probe_value = NULL;
+    }
+
+    msi_free(wv->plan);
+    wv->plan = NULL;
+}
+
+/* decides the order the tables are joined in and how each of them is
+ * accessed.  The estimates are only needed when there's a choice to make,
+ * or when somebody wants to look at them. */
+static unsigned where_view_plan( LibmsiWhereView *wv, bool estimate )
+{
+    LibmsiWherePredicate *preds = NULL;
+    JOINTABLE **tables = NULL;
+    JOINTABLE *table;
+    unsigned count = 0, bound, i, r = LIBMSI_RESULT_SUCCESS;
+
+    free_plan(wv);
+
+    wv->plan = msi_alloc_zero((wv->table_count + 1) * sizeof(*wv->plan));
+    tables = msi_alloc(wv->table_count * sizeof(*tables));
+    if (!wv->plan || !tables)
+    {
+        r = LIBMSI_RESULT_OUTOFMEMORY;
+        goto done;
+    }
+
+    for (table = wv->tables; table; table = table->next)
+        tables[table->table_index] = table;
+
+    wv->plan_cost = -1.0;
+    wv->plan_rows = -1.0;
+
+    /* the table list is too long to track, visit the tables in order */
+    if (wv->table_count > WHERE_MAX_PLAN_TABLES)
+    {
+        memcpy(wv->plan, tables, wv->table_count * sizeof(*tables));
+        goto done;
+    }
+
+    if (wv->table_count > 1)
+        estimate = true;
+
+    if (wv->cond)
+    {
+        preds = msi_alloc(count_predicates(wv->cond) * sizeof(*preds));
+        if (!preds)
+        {
+            r = LIBMSI_RESULT_OUTOFMEMORY;
+            goto done;
+        }
+        collect_predicates(wv->cond, preds, &count, estimate);
+    }
+
+    if (!estimate)
+        memcpy(wv->plan, tables, wv->table_count * sizeof(*tables));
+    else if (wv->table_count <= WHERE_MAX_DP_TABLES)
+    {
+        r = order_tables_exhaustive(wv, tables, preds, count);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            goto done;
+    }
+    else
+        order_tables_greedy(wv, tables, preds, count);
+
+    if (estimate)
+        wv->plan_rows = join_rows(tables, preds, count, (1u << wv->table_count) - 1);
+
+    for (i = 0, bound = 0; i < wv->table_count; i++)
+    {
+        table = wv->plan[i];
+        find_probe(preds, count, table, bound, estimate,
+                   &table->probe_column, &table->probe_value);
+        bound |= 1u << table->table_index;
+    }
+
+done:
+    if (r != LIBMSI_RESULT_SUCCESS)
+        free_plan(wv);
+    msi_free(preds);
+    msi_free(tables);
+    return r;
+}
+
+static unsigned where_view_execute( LibmsiView *view, LibmsiRecord *record )
+{
+    LibmsiWhereView *wv = (LibmsiWhereView*)view;
+    unsigned r;
+    JOINTABLE *table = wv->tables;
+    int64_t start = msi_view_profile_begin( view );
+    bool in_order;
+    int i = 0;
+
+    TRACE("%p %p\n", wv, record);
 
     if( !table )
          return LIBMSI_RESULT_FUNCTION_FAILED;
 
+    finish_lazy(wv, LIBMSI_RESULT_SUCCESS);
     r = init_reorder(wv);
     if (r != LIBMSI_RESULT_SUCCESS)
         return r;
 
+    wv->evaluated = 0;
     do
     {
+        table->visited = 0;
+        msi_view_profile_child(view, table->view);
         table->view->ops->execute(table->view, NULL);
 
         r = table->view->ops->get_dimensions(table->view, &table->row_count, NULL);
@@ -790,24 +1532,76 @@ static unsigned where_view_execute( LibmsiView *view, LibmsiRecord *record )
     }
     while ((table = table->next));
 
-    ordered_tables = ordertables( wv );
+    r = where_view_plan( wv, false );
+    if (r != LIBMSI_RESULT_SUCCESS)
+        return r;
 
-    rows = msi_alloc( wv->table_count * sizeof(*rows) );
+    /* rows come out of the scan in their final order unless they are
+     * sorted or the plan visits the tables in another order */
+    in_order = !wv->order_info;
     for (i = 0; i < wv->table_count; i++)
-        rows[i] = INVALID_ROW_INDEX;
+        if (wv->plan[i]->table_index != i)
+            in_order = false;
+
+    msi_free(wv->cursor);
+    wv->cursor = msi_alloc( wv->table_count * sizeof(*wv->cursor) );
+    if (!wv->cursor)
+        return LIBMSI_RESULT_OUTOFMEMORY;
+    reset_cursor(wv);
+    wv->error = LIBMSI_RESULT_SUCCESS;
+
+    /* then there is no need to look at more rows than are fetched */
+    if (in_order)
+    {
+        wv->lazy = true;
+        wv->skipped = 0;
+        wv->record = record ? g_object_ref(record) : NULL;
+        msi_view_profile_end( view, start, 0, 0 );
+        return LIBMSI_RESULT_SUCCESS;
+    }
 
-    r =  check_condition(wv, record, ordered_tables, rows);
+    /* otherwise only the first offset + limit rows are kept */
+    wv->stop = false;
+    wv->top_k = limit_rows(wv) != NO_LIMIT;
+    if (wv->top_k)
+    {
+        msi_free(wv->spare);
+        wv->spare = msi_alloc( 2 * wv->table_count * sizeof(*wv->spare) );
+        if (!wv->spare)
+            return LIBMSI_RESULT_OUTOFMEMORY;
+    }
 
     if (wv->order_info)
         wv->order_info->error = LIBMSI_RESULT_SUCCESS;
 
-    qsort(wv->reorder, wv->row_count, sizeof(LibmsiRowEntry *), compare_entry);
+    wv->record = record;
+    while ((r = next_match(wv)) == LIBMSI_RESULT_SUCCESS)
+    {
+        r = add_row(wv, wv->cursor);
+        if (r != LIBMSI_RESULT_SUCCESS || wv->stop)
+            break;
+    }
+    wv->record = NULL;
+    if (r == NO_MORE_ITEMS)
+        r = LIBMSI_RESULT_SUCCESS;
+
+    g_qsort_with_data(wv->reorder, wv->row_count, wv->table_count * sizeof(unsigned),
+                      compare_entry, wv);
 
     if (wv->order_info)
         r = wv->order_info->error;
 
-    msi_free( rows );
-    msi_free( ordered_tables );
+    /* drop the rows before OFFSET */
+    if (wv->offset)
+    {
+        unsigned skip = MIN(wv->offset, wv->row_count);
+
+        memmove(wv->reorder, row_entry(wv, skip),
+                (size_t)(wv->row_count - skip) * wv->table_count * sizeof(unsigned));
+        wv->row_count -= skip;
+    }
+
+    msi_view_profile_end( view, start, wv->evaluated, wv->row_count );
     return r;
 }
 
@@ -821,6 +1615,8 @@ static unsigned where_view_close( LibmsiView *view )
     if (!table)
         return LIBMSI_RESULT_FUNCTION_FAILED;
 
+    finish_lazy(wv, LIBMSI_RESULT_SUCCESS);
+
     do
         table->view->ops->close(table->view);
     while ((table = table->next));
@@ -831,6 +1627,7 @@ static unsigned where_view_close( LibmsiView *view )
 static unsigned where_view_get_dimensions( LibmsiView *view, unsigned *rows, unsigned *cols )
 {
     LibmsiWhereView *wv = (LibmsiWhereView*)view;
+    unsigned r;
 
     TRACE("%p %p %p\n", wv, rows, cols );
 
@@ -841,6 +1638,14 @@ static unsigned where_view_get_dimensions( LibmsiView *view, unsigned *rows, uns
     {
         if (!wv->reorder)
             return LIBMSI_RESULT_FUNCTION_FAILED;
+
+        /* the number of rows is only known once they were all produced */
+        if (wv->lazy)
+        {
+            r = where_view_produce(wv, NO_LIMIT);
+            if (r != LIBMSI_RESULT_SUCCESS)
+                return r;
+        }
         *rows = wv->row_count;
     }
 
@@ -876,6 +1681,8 @@ static unsigned where_view_delete( LibmsiView *view )
 
     TRACE("%p\n", wv );
 
+    free_plan(wv);
+
     while(table)
     {
         JOINTABLE *next;
@@ -889,7 +1696,10 @@ static unsigned where_view_delete( LibmsiView *view )
     wv->tables = NULL;
     wv->table_count = 0;
 
+    finish_lazy(wv, LIBMSI_RESULT_SUCCESS);
     free_reorder(wv);
+    msi_free(wv->spare);
+    msi_free(wv->cursor);
 
     msi_free(wv->order_info);
     wv->order_info = NULL;
@@ -904,7 +1714,7 @@ static unsigned where_view_find_matching_rows( LibmsiView *view, unsigned col,
     unsigned val, unsigned *row, MSIITERHANDLE *handle )
 {
     LibmsiWhereView *wv = (LibmsiWhereView*)view;
-    unsigned i, row_value;
+    unsigned i, r, row_value, *values;
 
     TRACE("%p, %d, %u, %p\n", view, col, val, *handle);
 
@@ -914,7 +1724,7 @@ static unsigned where_view_find_matching_rows( LibmsiView *view, unsigned col,
     if (col == 0 || col > wv->col_count)
         return LIBMSI_RESULT_INVALID_PARAMETER;
 
-    for (i = (uintptr_t)*handle; i < wv->row_count; i++)
+    for (i = (uintptr_t)*handle; (r = find_row(wv, i, &values)) == LIBMSI_RESULT_SUCCESS; i++)
     {
         if (view->ops->fetch_int( view, i, col, &row_value ) != LIBMSI_RESULT_SUCCESS)
             continue;
@@ -927,7 +1737,28 @@ static unsigned where_view_find_matching_rows( LibmsiView *view, unsigned col,
         }
     }
 
-    return NO_MORE_ITEMS;
+    return r;
+}
+
+static unsigned where_view_limit( LibmsiView *view, unsigned limit, unsigned offset )
+{
+    LibmsiWhereView *wv = (LibmsiWhereView *)view;
+
+    TRACE("%p %u %u\n", view, limit, offset);
+
+    msi_narrow_limit(&wv->limit, &wv->offset, limit, offset);
+    return LIBMSI_RESULT_SUCCESS;
+}
+
+static unsigned where_view_row_available( LibmsiView *view, unsigned row )
+{
+    LibmsiWhereView *wv = (LibmsiWhereView *)view;
+    unsigned *values;
+
+    if (!wv->tables)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    return find_row(wv, row, &values);
 }
 
 static unsigned where_view_sort(LibmsiView *view, column_info *columns)
@@ -979,6 +1810,103 @@ error:
     return r;
 }
 
+static void explain_column( GString *str, const struct expr *expr )
+{
+    const JOINTABLE *table = expr->u.column.parsed.table;
+    const char *table_name = NULL, *name = NULL;
+
+    table->view->ops->get_column_info(table->view, expr->u.column.parsed.column, &name,
+                                      NULL, NULL, &table_name);
+    g_string_append_printf(str, "%s.%s", table_name, name);
+}
+
+static unsigned where_view_explain( LibmsiView *view, GString *str, unsigned depth )
+{
+    LibmsiWhereView *wv = (LibmsiWhereView *)view;
+    JOINTABLE *table;
+    unsigned i, r;
+
+    TRACE("%p %p %u\n", view, str, depth);
+
+    if (!wv->tables)
+        return LIBMSI_RESULT_FUNCTION_FAILED;
+
+    if (!wv->plan || wv->plan_cost < 0)
+    {
+        /* planning again changes how the tables are visited */
+        if (wv->lazy)
+        {
+            r = where_view_produce(wv, NO_LIMIT);
+            if (r != LIBMSI_RESULT_SUCCESS)
+                return r;
+        }
+
+        for (table = wv->tables; table; table = table->next)
+        {
+            r = table->view->ops->get_dimensions(table->view, &table->row_count, NULL);
+            if (r != LIBMSI_RESULT_SUCCESS)
+                return r;
+        }
+
+        r = where_view_plan(wv, true);
+        if (r != LIBMSI_RESULT_SUCCESS)
+            return r;
+    }
+
+    g_string_append_printf(str, "%*sWHERE", depth * 2, "");
+    if (wv->plan_cost >= 0)
+        g_string_append_printf(str, " (estimated rows %.0f, cost %.0f)",
+                               wv->plan_rows, wv->plan_cost);
+    if (wv->order_info)
+        g_string_append(str, " ORDER BY");
+    for (i = 0; wv->order_info && i < wv->order_info->col_count; i++)
+    {
+        const union ext_column *column = &wv->order_info->columns[i];
+        const char *name = NULL;
+
+        column->parsed.table->view->ops->get_column_info(column->parsed.table->view,
+                                  column->parsed.column, &name, NULL, NULL, NULL);
+        g_string_append_printf(str, "%s %s", i ? "," : "", name);
+    }
+    if (wv->limit != NO_LIMIT)
+        g_string_append_printf(str, " LIMIT %u", wv->limit);
+    if (wv->offset)
+        g_string_append_printf(str, " OFFSET %u", wv->offset);
+    msi_view_explain_end(view, str);
+
+    for (i = 0; i < wv->table_count; i++)
+    {
+        const char *name = NULL;
+
+        table = wv->plan[i];
+        table->view->ops->get_column_info(table->view, 1, NULL, NULL, NULL, &name);
+
+        if (!table->probe_column)
+            g_string_append_printf(str, "%*sSCAN %s (%u rows)",
+                                   (depth + 1) * 2, "", name, table->row_count);
+        else
+        {
+            g_string_append_printf(str, "%*sINDEX ", (depth + 1) * 2, "");
+            explain_column(str, table->probe_column);
+            g_string_append(str, " = ");
+            if (table->probe_value->type == EXPR_UVAL)
+                g_string_append_printf(str, "%d", (int)table->probe_value->u.uval);
+            else if (table->probe_value->type == EXPR_SVAL)
+                g_string_append_printf(str, "'%s'", table->probe_value->u.sval);
+            else
+                explain_column(str, table->probe_value);
+            g_string_append_printf(str, " (%u rows, %u distinct)", table->row_count,
+                                   expr_column_distinct(table->probe_column));
+        }
+
+        if (view->profile)
+            g_string_append_printf(str, " [visited %" G_GUINT64_FORMAT "]", table->visited);
+        g_string_append_c(str, '\n');
+    }
+
+    return LIBMSI_RESULT_SUCCESS;
+}
+
 static const LibmsiViewOps where_ops =
 {
     where_view_fetch_int,
@@ -999,6 +1927,10 @@ static const LibmsiViewOps where_ops =
     NULL,
     where_view_sort,
     NULL,
+    where_view_explain,
+    where_view_limit,
+    where_view_row_available,
+    where_view_set_rows,
 };
 
 static unsigned where_view_verify_condition( LibmsiWhereView *wv, struct expr *cond,
@@ -1107,6 +2039,7 @@ unsigned where_view_create( LibmsiDatabase *db, LibmsiView **view, char *tables,
     wv->view.ops = &where_ops;
     wv->db = g_object_ref(db);
     wv->cond = cond;
+    wv->limit = NO_LIMIT;
 
     while (*tables)
     {
@@ -1115,7 +2048,7 @@ unsigned where_view_create( LibmsiDatabase *db, LibmsiView **view, char *tables,
         if ((ptr = strchr(tables, ' ')))
             *ptr = '\0';
 
-        table = msi_alloc(sizeof(JOINTABLE));
+        table = msi_alloc_zero(sizeof(JOINTABLE));
         if (!table)
         {
             r = LIBMSI_RESULT_OUTOFMEMORY;
@@ -0,0 +1,658 @@
+/*
+ * Benchmarks for the hot paths of libmsi
+ *
+ * Copyright (C) 2026 msitools contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * The benchmark creates a synthetic database in a temporary directory,
+ * times each operation over a number of iterations, and writes the
+ * results as JSON, on stdout or in the file given with --output.  The
+ * database has --tables tables T0, T1... of --rows rows each:
+ *
+ *   Id     INT, the primary key, 0 to rows - 1
+ *   Name   CHAR, one of --strings distinct strings
+ *   Value  INT, the same as Id
+ *   Ref    INT, the Id of a row of the next table, for joins
+ *
+ * and a Blobs table of --streams streams of --stream-size bytes.
+ *
+ * The load-string-table result is the load_string_table span of the
+ * libmsi profile: each sample runs the benchmark again to open the
+ * database once with LIBMSI_PROFILE set, and reads the summary.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <libmsi.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+static gint rows = 1000;
+static gint tables = 4;
+static gint strings = 500;
+static gint streams = 10;
+static gint stream_size = 4096;
+static gint iterations = 5;
+static gint probes = 1000;
+static gchar *output;
+static gchar *profile_open;
+static const char *self;
+
+static GOptionEntry options[] = {
+    { "rows", 'r', 0, G_OPTION_ARG_INT, &rows,
+      "Rows in each table (1000)", "N" },
+    { "tables", 't', 0, G_OPTION_ARG_INT, &tables,
+      "Number of tables, at least 2 (4)", "N" },
+    { "strings", 's', 0, G_OPTION_ARG_INT, &strings,
+      "Distinct strings in the string table (500)", "N" },
+    { "streams", 0, 0, G_OPTION_ARG_INT, &streams,
+      "Number of streams (10)", "N" },
+    { "stream-size", 0, 0, G_OPTION_ARG_INT, &stream_size,
+      "Size of each stream in bytes (4096)", "BYTES" },
+    { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+      "Times each operation is run (5)", "N" },
+    { "probes", 'p', 0, G_OPTION_ARG_INT, &probes,
+      "Point queries in each iteration (1000)", "N" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+      "Write the results to FILE instead of stdout", "FILE" },
+    { "profile-open", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &profile_open,
+      "Only open FILE, for load-string-table", "FILE" },
+    { NULL }
+};
+
+typedef struct {
+    const char *name;
+    guint ops;          /* operations in each sample */
+    GArray *samples;    /* gint64, microseconds */
+} Result;
+
+static GPtrArray *results;
+
+static Result *result_new(const char *name, guint ops)
+{
+    Result *res = g_new0(Result, 1);
+
+    res->name = name;
+    res->ops = ops;
+    res->samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    g_ptr_array_add(results, res);
+    return res;
+}
+
+static void result_add(Result *res, gint64 start)
+{
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    g_array_append_val(res->samples, elapsed);
+}
+
+static void result_add_sample(Result *res, gint64 elapsed)
+{
+    g_array_append_val(res->samples, elapsed);
+}
+
+static void check(gboolean success, GError *error, const char *what)
+{
+    if (success)
+        return;
+
+    fprintf(stderr, "benchmark: %s failed: %s\n", what,
+            error ? error->message : "unknown error");
+    exit(1);
+}
+
+static void run_sql(LibmsiDatabase *db, const char *sql, LibmsiRecord *rec)
+{
+    GError *error = NULL;
+    LibmsiQuery *query;
+
+    query = libmsi_query_new(db, sql, &error);
+    check(query != NULL, error, sql);
+    check(libmsi_query_execute(query, rec, &error), error, sql);
+    libmsi_query_close(query, NULL);
+    g_object_unref(query);
+}
+
+static LibmsiDatabase *open_db(const char *path, guint flags, const char *persist)
+{
+    GError *error = NULL;
+    LibmsiDatabase *db;
+
+    db = libmsi_database_new(path, flags, persist, &error);
+    check(db != NULL, error, path);
+    return db;
+}
+
+static void create_tables(LibmsiDatabase *db)
+{
+    char *sql;
+    int t;
+
+    for (t = 0; t < tables; t++) {
+        sql = g_strdup_printf("CREATE TABLE `T%d` ( `Id` LONG NOT NULL, "
+                              "`Name` CHAR(72), `Value` LONG, `Ref` LONG "
+                              "PRIMARY KEY `Id` )", t);
+        run_sql(db, sql, NULL);
+        g_free(sql);
+    }
+
+    run_sql(db, "CREATE TABLE `Blobs` ( `Name` CHAR(72) NOT NULL, "
+                "`Data` OBJECT PRIMARY KEY `Name` )", NULL);
+}
+
+static void insert_rows(LibmsiDatabase *db, GRand *rand)
+{
+    GError *error = NULL;
+    LibmsiQuery *query;
+    LibmsiRecord *rec;
+    GInputStream *in;
+    guint8 *data;
+    char *sql, *name;
+    int t, i;
+
+    rec = libmsi_record_new(4);
+    for (t = 0; t < tables; t++) {
+        sql = g_strdup_printf("INSERT INTO `T%d` ( `Id`, `Name`, `Value`, `Ref` ) "
+                              "VALUES ( ?, ?, ?, ? )", t);
+        query = libmsi_query_new(db, sql, &error);
+        check(query != NULL, error, sql);
+
+        for (i = 0; i < rows; i++) {
+            name = g_strdup_printf("string-%d", (t * rows + i) % strings);
+            libmsi_record_set_int(rec, 1, i);
+            libmsi_record_set_string(rec, 2, name);
+            libmsi_record_set_int(rec, 3, i);
+            libmsi_record_set_int(rec, 4, g_rand_int_range(rand, 0, rows));
+            check(libmsi_query_execute(query, rec, &error), error, sql);
+            libmsi_query_close(query, NULL);
+            g_free(name);
+        }
+
+        g_object_unref(query);
+        g_free(sql);
+    }
+    g_object_unref(rec);
+
+    data = g_malloc(stream_size);
+    for (i = 0; i < stream_size; i++)
+        data[i] = g_rand_int(rand);
+
+    rec = libmsi_record_new(2);
+    sql = "INSERT INTO `Blobs` ( `Name`, `Data` ) VALUES ( ?, ? )";
+    query = libmsi_query_new(db, sql, &error);
+    check(query != NULL, error, sql);
+    for (i = 0; i < streams; i++) {
+        name = g_strdup_printf("blob-%d", i);
+        in = g_memory_input_stream_new_from_data(data, stream_size, NULL);
+        libmsi_record_set_string(rec, 1, name);
+        check(libmsi_record_set_stream(rec, 2, in, stream_size, NULL, &error),
+              error, "set stream");
+        check(libmsi_query_execute(query, rec, &error), error, sql);
+        libmsi_query_close(query, NULL);
+        g_object_unref(in);
+        g_free(name);
+    }
+    g_object_unref(query);
+    g_object_unref(rec);
+    g_free(data);
+}
+
+/* the database used by the other benchmarks is the one of the last
+ * iteration */
+static void bench_create(const char *path)
+{
+    Result *insert = result_new("insert", tables * rows + streams);
+    Result *commit = result_new("commit", 1);
+    GError *error = NULL;
+    LibmsiDatabase *db;
+    GRand *rand;
+    gint64 start;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        g_unlink(path);
+        rand = g_rand_new_with_seed(42);
+        db = open_db(path, LIBMSI_DB_FLAGS_CREATE, NULL);
+        create_tables(db);
+
+        start = g_get_monotonic_time();
+        insert_rows(db, rand);
+        result_add(insert, start);
+
+        start = g_get_monotonic_time();
+        check(libmsi_database_commit(db, &error), error, "commit");
+        result_add(commit, start);
+
+        g_object_unref(db);
+        g_rand_free(rand);
+    }
+}
+
+/* the string table is loaded when the database is opened */
+static void bench_open(const char *path)
+{
+    Result *res = result_new("open", 1);
+    LibmsiDatabase *db;
+    gint64 start;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        start = g_get_monotonic_time();
+        db = open_db(path, LIBMSI_DB_FLAGS_READONLY, NULL);
+        result_add(res, start);
+        g_object_unref(db);
+    }
+}
+
+/* the load_string_table span, which the open result includes */
+static void bench_load_string_table(const char *path, const char *profile)
+{
+    Result *res = result_new("load-string-table", 1);
+    GError *error = NULL;
+    char *argv[] = { (char *)self, "--profile-open", (char *)path, NULL };
+    char **envp, *env, *summary, *line;
+    guint64 count;
+    double ms;
+    gint status;
+    int i;
+
+    env = g_strdup_printf("summary:%s", profile);
+    envp = g_environ_setenv(g_get_environ(), "LIBMSI_PROFILE", env, TRUE);
+
+    for (i = 0; i < iterations; i++) {
+        check(g_spawn_sync(NULL, argv, envp, G_SPAWN_SEARCH_PATH, NULL, NULL,
+                           NULL, NULL, &status, &error), error, "profiled open");
+        check(status == 0, NULL, "profiled open");
+        check(g_file_get_contents(profile, &summary, NULL, &error), error, profile);
+
+        line = strstr(summary, "\nload_string_table ");
+        check(line && sscanf(line + 1, "load_string_table %" G_GUINT64_FORMAT " %lf",
+                             &count, &ms) == 2 && count == 1,
+              NULL, "load_string_table span");
+        result_add_sample(res, (gint64)(ms * 1000));
+
+        g_free(summary);
+        g_remove(profile);
+    }
+
+    g_strfreev(envp);
+    g_free(env);
+}
+
+static void bench_point_query(const char *path)
+{
+    Result *res = result_new("point-query", probes);
+    GError *error = NULL;
+    LibmsiDatabase *db;
+    LibmsiQuery *query;
+    LibmsiRecord *rec, *row;
+    const char *sql;
+    GRand *rand;
+    gint64 start;
+    int i, n;
+
+    sql = "SELECT `Name` FROM `T0` WHERE `Id` = ?";
+    db = open_db(path, LIBMSI_DB_FLAGS_READONLY, NULL);
+    rec = libmsi_record_new(1);
+    rand = g_rand_new_with_seed(42);
+
+    for (i = 0; i < iterations; i++) {
+        query = libmsi_query_new(db, sql, &error);
+        check(query != NULL, error, sql);
+
+        start = g_get_monotonic_time();
+        for (n = 0; n < probes; n++) {
+            libmsi_record_set_int(rec, 1, g_rand_int_range(rand, 0, rows));
+            check(libmsi_query_execute(query, rec, &error), error, sql);
+            row = libmsi_query_fetch(query, &error);
+            check(row != NULL, error, sql);
+            g_object_unref(row);
+            libmsi_query_close(query, NULL);
+        }
+        result_add(res, start);
+
+        g_object_unref(query);
+    }
+
+    g_rand_free(rand);
+    g_object_unref(rec);
+    g_object_unref(db);
+}
+
+/* each insert drops the index of the table, which the lookup rebuilds */
+static void bench_insert_lookup(const char *path)
+{
+    Result *res = result_new("insert-lookup", probes);
+    GError *error = NULL;
+    LibmsiDatabase *db;
+    LibmsiQuery *insert, *lookup;
+    LibmsiRecord *rec, *row;
+    const char *insert_sql, *lookup_sql;
+    gint64 start;
+    int i, n;
+
+    insert_sql = "INSERT INTO `T0` ( `Id`, `Name`, `Value`, `Ref` ) VALUES ( ?, 'new', 0, 0 )";
+    lookup_sql = "SELECT `Name` FROM `T0` WHERE `Id` = ?";
+    rec = libmsi_record_new(1);
+
+    for (i = 0; i < iterations; i++) {
+        db = open_db(path, LIBMSI_DB_FLAGS_TRANSACT, NULL);
+        insert = libmsi_query_new(db, insert_sql, &error);
+        check(insert != NULL, error, insert_sql);
+        lookup = libmsi_query_new(db, lookup_sql, &error);
+        check(lookup != NULL, error, lookup_sql);
+
+        start = g_get_monotonic_time();
+        for (n = 0; n < probes; n++) {
+            libmsi_record_set_int(rec, 1, rows + n);
+            check(libmsi_query_execute(insert, rec, &error), error, insert_sql);
+            libmsi_query_close(insert, NULL);
+            check(libmsi_query_execute(lookup, rec, &error), error, lookup_sql);
+            row = libmsi_query_fetch(lookup, &error);
+            check(row != NULL, error, lookup_sql);
+            g_object_unref(row);
+            libmsi_query_close(lookup, NULL);
+        }
+        result_add(res, start);
+
+        g_object_unref(insert);
+        g_object_unref(lookup);
+        g_object_unref(db);
+    }
+
+    g_object_unref(rec);
+}
+
+static void bench_join_query(const char *path)
+{
+    Result *res = result_new("join-query", 1);
+    GError *error = NULL;
+    LibmsiDatabase *db;
+    LibmsiQuery *query;
+    LibmsiRecord *row;
+    const char *sql;
+    gint64 start;
+    int i, count;
+
+    sql = "SELECT `T0`.`Name`, `T1`.`Name` FROM `T0`, `T1` "
+          "WHERE `T0`.`Ref` = `T1`.`Id`";
+    db = open_db(path, LIBMSI_DB_FLAGS_READONLY, NULL);
+
+    for (i = 0; i < iterations; i++) {
+        start = g_get_monotonic_time();
+        query = libmsi_query_new(db, sql, &error);
+        check(query != NULL, error, sql);
+        check(libmsi_query_execute(query, NULL, &error), error, sql);
+        for (count = 0; (row = libmsi_query_fetch(query, NULL)); count++)
+            g_object_unref(row);
+        g_object_unref(query);
+        result_add(res, start);
+
+        if (count != rows) {
+            fprintf(stderr, "benchmark: %s returned %d rows\n", sql, count);
+            exit(1);
+        }
+    }
+
+    g_object_unref(db);
+}
+
+static void bench_export(const char *path, const char *dir)
+{
+    Result *res = result_new("export", tables + 1);
+    GError *error = NULL;
+    LibmsiDatabase *db;
+    gint64 start;
+    int i;
+
+    db = open_db(path, LIBMSI_DB_FLAGS_READONLY, NULL);
+
+    for (i = 0; i < iterations; i++) {
+        start = g_get_monotonic_time();
+        check(libmsi_database_export_all(db, dir, &error), error, "export");
+        result_add(res, start);
+    }
+
+    g_object_unref(db);
+}
+
+static void bench_import(const char *path, const char *dir)
+{
+    Result *res = result_new("import", tables + 1);
+    GError *error = NULL;
+    LibmsiDatabase *db;
+    GPtrArray *paths;
+    gint64 start;
+    int i;
+
+    paths = g_ptr_array_new_with_free_func(g_free);
+    for (i = 0; i < tables; i++)
+        g_ptr_array_add(paths, g_strdup_printf("%s/T%d.idt", dir, i));
+    g_ptr_array_add(paths, g_strdup_printf("%s/Blobs.idt", dir));
+    g_ptr_array_add(paths, NULL);
+
+    for (i = 0; i < iterations; i++) {
+        g_unlink(path);
+        db = open_db(path, LIBMSI_DB_FLAGS_CREATE, NULL);
+
+        start = g_get_monotonic_time();
+        check(libmsi_database_import_tables(db, (const char * const *)paths->pdata,
+                                            &error), error, "import");
+        result_add(res, start);
+
+        g_object_unref(db);
+    }
+
+    g_ptr_array_free(paths, TRUE);
+}
+
+static void bench_merge(const char *path, const char *target)
+{
+    Result *res = result_new("merge", tables + 1);
+    GError *error = NULL;
+    LibmsiDatabase *db, *merge;
+    gint64 start;
+    int i;
+
+    merge = open_db(path, LIBMSI_DB_FLAGS_READONLY, NULL);
+
+    for (i = 0; i < iterations; i++) {
+        g_unlink(target);
+        db = open_db(target, LIBMSI_DB_FLAGS_CREATE, NULL);
+
+        start = g_get_monotonic_time();
+        check(libmsi_database_merge(db, merge, NULL, &error), error, "merge");
+        result_add(res, start);
+
+        g_object_unref(db);
+    }
+
+    g_object_unref(merge);
+}
+
+/* a tenth of the rows of T0 change, a tenth of T1 are deleted */
+static void bench_transform(const char *path, const char *changed, const char *mst)
+{
+    Result *res = result_new("transform", 1);
+    GError *error = NULL;
+    LibmsiDatabase *db, *ref;
+    gint64 start;
+    char *sql;
+    int i;
+
+    ref = open_db(path, LIBMSI_DB_FLAGS_READONLY, NULL);
+    db = open_db(path, LIBMSI_DB_FLAGS_TRANSACT, changed);
+
+    sql = g_strdup_printf("UPDATE `T0` SET `Name` = 'changed' WHERE `Value` < %d",
+                          rows / 10);
+    run_sql(db, sql, NULL);
+    g_free(sql);
+    sql = g_strdup_printf("DELETE FROM `T1` WHERE `Value` >= %d", rows - rows / 10);
+    run_sql(db, sql, NULL);
+    g_free(sql);
+
+    check(libmsi_database_generate_transform(db, ref, mst, &error), error,
+          "generate transform");
+    g_object_unref(db);
+    g_object_unref(ref);
+
+    for (i = 0; i < iterations; i++) {
+        db = open_db(path, LIBMSI_DB_FLAGS_TRANSACT, NULL);
+
+        start = g_get_monotonic_time();
+        check(libmsi_database_apply_transform(db, mst, &error), error,
+              "apply transform");
+        result_add(res, start);
+
+        g_object_unref(db);
+    }
+}
+
+static gint compare_samples(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void write_results(FILE *out)
+{
+    Result *res;
+    gint64 total, *samples;
+    guint i, j, n;
+
+    fprintf(out, "{\n  \"parameters\": {\n");
+    fprintf(out, "    \"rows\": %d,\n    \"tables\": %d,\n    \"strings\": %d,\n",
+            rows, tables, strings);
+    fprintf(out, "    \"streams\": %d,\n    \"stream-size\": %d,\n", streams, stream_size);
+    fprintf(out, "    \"iterations\": %d,\n    \"probes\": %d\n  },\n", iterations, probes);
+    fprintf(out, "  \"results\": [\n");
+
+    for (i = 0; i < results->len; i++) {
+        res = results->pdata[i];
+        g_array_sort(res->samples, compare_samples);
+        samples = (gint64 *)res->samples->data;
+        n = res->samples->len;
+
+        total = 0;
+        for (j = 0; j < n; j++)
+            total += samples[j];
+
+        fprintf(out, "    { \"name\": \"%s\", \"ops\": %u, \"min-us\": %" G_GINT64_FORMAT
+                ", \"median-us\": %" G_GINT64_FORMAT ", \"mean-us\": %" G_GINT64_FORMAT
+                ", \"max-us\": %" G_GINT64_FORMAT " }%s\n",
+                res->name, res->ops, samples[0], samples[n / 2], total / n,
+                samples[n - 1], i + 1 < results->len ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+static void remove_tree(const char *path)
+{
+    const char *name;
+    char *child;
+    GDir *dir;
+
+    dir = g_dir_open(path, 0, NULL);
+    if (dir) {
+        while ((name = g_dir_read_name(dir))) {
+            child = g_build_filename(path, name, NULL);
+            remove_tree(child);
+            g_free(child);
+        }
+        g_dir_close(dir);
+    }
+    g_remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    GError *error = NULL;
+    GOptionContext *context;
+    char *tmpdir, *base, *other, *dir, *mst, *profile;
+    FILE *out = stdout;
+
+#if !GLIB_CHECK_VERSION(2,35,1)
+    g_type_init ();
+#endif
+
+    context = g_option_context_new("- benchmark libmsi");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        fprintf(stderr, "benchmark: %s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (profile_open) {
+        g_object_unref(open_db(profile_open, LIBMSI_DB_FLAGS_READONLY, NULL));
+        return 0;
+    }
+    self = argv[0];
+
+    if (rows < 1 || tables < 2 || strings < 1 || streams < 0 ||
+        stream_size < 1 || iterations < 1 || probes < 1) {
+        fprintf(stderr, "benchmark: invalid parameters\n");
+        return 1;
+    }
+
+    tmpdir = g_dir_make_tmp("libmsi-benchmark-XXXXXX", &error);
+    check(tmpdir != NULL, error, "temporary directory");
+    base = g_build_filename(tmpdir, "base.msi", NULL);
+    other = g_build_filename(tmpdir, "other.msi", NULL);
+    mst = g_build_filename(tmpdir, "changes.mst", NULL);
+    profile = g_build_filename(tmpdir, "profile.txt", NULL);
+    dir = g_build_filename(tmpdir, "export", NULL);
+    g_mkdir(dir, 0755);
+
+    results = g_ptr_array_new();
+    bench_create(base);
+    bench_open(base);
+    bench_load_string_table(base, profile);
+    bench_point_query(base);
+    bench_insert_lookup(base);
+    bench_join_query(base);
+    bench_export(base, dir);
+    bench_import(other, dir);
+    bench_merge(base, other);
+    bench_transform(base, other, mst);
+
+    if (output) {
+        out = fopen(output, "w");
+        if (!out) {
+            fprintf(stderr, "benchmark: cannot write %s: %s\n", output, g_strerror(errno));
+            return 1;
+        }
+    }
+    write_results(out);
+    if (out != stdout)
+        fclose(out);
+
+    remove_tree(tmpdir);
+    g_free(tmpdir);
+    g_free(base);
+    g_free(other);
+    g_free(mst);
+    g_free(profile);
+    g_free(dir);
+    return 0;
+}
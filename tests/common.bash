@@ -8,6 +8,7 @@ testrecord="$BUILDDIR/tests/testrecord$EXT"
 testsuminfo="$BUILDDIR/tests/testsuminfo$EXT"
 msibuild="$BUILDDIR/tools/msibuild$EXT"
 msiinfo="$BUILDDIR/tools/msiinfo$EXT"
+msidump="$BUILDDIR/tools/msidump$EXT"
 wixl="$BUILDDIR/tools/wixl/wixl$EXT"
 wixlheat="$BUILDDIR/tools/wixl/wixl-heat$EXT"
 
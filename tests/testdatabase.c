@@ -1410,6 +1410,292 @@ static void test_binary(void)
     unlink( msifile );
 }
 
+static void test_many_streams(void)
+{
+    GInputStream *in;
+    LibmsiDatabase *hdb;
+    LibmsiQuery *query;
+    LibmsiRecord *rec;
+    char name[32], buf[32];
+    unsigned r, count;
+    gssize size;
+    int i;
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    r = run_query(hdb, 0, "CREATE TABLE `Binary` ( `Name` CHAR(72) NOT NULL, "
+                          "`Data` OBJECT PRIMARY KEY `Name`)");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Cannot create Binary table: %d\n", r);
+
+    rec = NULL;
+    do_query(hdb, "SELECT `Name` FROM `_Streams`", &rec);
+    ok(!rec, "expected no streams\n");
+
+    for (i = 0; i < 300; i++)
+    {
+        sprintf(name, "stream%d", i);
+        create_file(name);
+        rec = libmsi_record_new(2);
+        libmsi_record_set_string(rec, 1, name);
+        r = libmsi_record_load_stream(rec, 2, name);
+        ok(r, "Failed to add stream data to the record\n");
+        unlink(name);
+
+        r = run_query(hdb, rec, "INSERT INTO `Binary` ( `Name`, `Data` ) VALUES ( ?, ? )");
+        ok(r == LIBMSI_RESULT_SUCCESS, "Insert into Binary table failed: %d\n", r);
+        g_object_unref(rec);
+    }
+
+    /* replace one stream and drop another */
+    create_file("replaced");
+    rec = libmsi_record_new(1);
+    r = libmsi_record_load_stream(rec, 1, "replaced");
+    ok(r, "Failed to add stream data to the record\n");
+    unlink("replaced");
+    r = run_query(hdb, rec, "UPDATE `Binary` SET `Data` = ? WHERE `Name` = 'stream7'");
+    ok(r == LIBMSI_RESULT_SUCCESS, "UPDATE failed: %d\n", r);
+    g_object_unref(rec);
+
+    r = run_query(hdb, 0, "DELETE FROM `Binary` WHERE `Name` = 'stream8'");
+    ok(r == LIBMSI_RESULT_SUCCESS, "DELETE failed: %d\n", r);
+    r = run_query(hdb, 0, "DELETE FROM `_Streams` WHERE `Name` = 'Binary.stream8'");
+    ok(r == LIBMSI_RESULT_SUCCESS, "DELETE failed: %d\n", r);
+
+    /* _Streams follows the changes made through the table */
+    r = do_query(hdb, "SELECT `Name` FROM `_Streams` WHERE `Name` = 'Binary.stream299'", &rec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "SELECT query failed: %d\n", r);
+    check_record_string(rec, 1, "Binary.stream299");
+    g_object_unref(rec);
+
+    rec = NULL;
+    do_query(hdb, "SELECT `Name` FROM `_Streams` WHERE `Name` = 'Binary.stream8'", &rec);
+    ok(!rec, "deleted stream is still listed\n");
+
+    r = do_query(hdb, "SELECT `Name` FROM `_Streams` WHERE `Name` = 'Binary.stream9'", &rec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "SELECT query failed: %d\n", r);
+    check_record_string(rec, 1, "Binary.stream9");
+    g_object_unref(rec);
+
+    r = libmsi_database_commit(hdb, NULL);
+    ok(r, "Failed to commit database\n");
+    g_object_unref(hdb);
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    query = libmsi_query_new(hdb, "SELECT `Name` FROM `_Streams`", NULL);
+    ok(query, "failed to open the query\n");
+    r = libmsi_query_execute(query, NULL, NULL);
+    ok(r, "failed to execute the query\n");
+    count = 0;
+    while ((rec = libmsi_query_fetch(query, NULL)))
+    {
+        char *stname = libmsi_record_get_string(rec, 1);
+
+        if (g_str_has_prefix(stname, "Binary."))
+            count++;
+        g_free(stname);
+        g_object_unref(rec);
+    }
+    ok(count == 299, "expected 299 Binary streams, got %u\n", count);
+    libmsi_query_close(query, NULL);
+    g_object_unref(query);
+
+    r = do_query(hdb, "SELECT `Data` FROM `Binary` WHERE `Name` = 'stream7'", &rec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "SELECT query failed: %d\n", r);
+    memset(buf, 0, sizeof(buf));
+    in = libmsi_record_get_stream(rec, 1);
+    ok(in, "Failed to get stream\n");
+    size = g_input_stream_read(in, buf, sizeof(buf) - 1, NULL, NULL);
+    ok(size == 9 && g_str_equal(buf, "replaced\n"), "Expected 'replaced\\n', got %s\n", buf);
+    g_object_unref(in);
+    g_object_unref(rec);
+
+    r = do_query(hdb, "SELECT `Data` FROM `Binary` WHERE `Name` = 'stream299'", &rec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "SELECT query failed: %d\n", r);
+    memset(buf, 0, sizeof(buf));
+    in = libmsi_record_get_stream(rec, 1);
+    ok(in, "Failed to get stream\n");
+    g_input_stream_read(in, buf, sizeof(buf) - 1, NULL, NULL);
+    ok(g_str_equal(buf, "stream299\n"), "Expected 'stream299\\n', got %s\n", buf);
+    g_object_unref(in);
+    g_object_unref(rec);
+
+    g_object_unref(hdb);
+    unlink(msifile);
+}
+
+static void test_stream_from_file(void)
+{
+    LibmsiSummaryInfo *hsi;
+    GInputStream *in;
+    LibmsiDatabase *hdb;
+    LibmsiRecord *rec;
+    char *data, *buf;
+    gsize size;
+    unsigned r;
+    int i, fd;
+
+    /* a file larger than a few pages, removed before the commit */
+    size = 1024 * 1024 + 17;
+    data = g_malloc(size);
+    for (i = 0; i < size; i++)
+        data[i] = i * 7 + i / 4096;
+    create_file_data("payload.bin", data, size);
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    rec = libmsi_record_new(2);
+    libmsi_record_set_string(rec, 1, "payload");
+    r = libmsi_record_load_stream(rec, 2, "payload.bin");
+    ok(r, "Failed to add stream data to the record\n");
+    unlink("payload.bin");
+
+    /* and replaced by another one, which the stream doesn't see */
+    create_file_data("payload.bin", "replaced", 8);
+
+    r = run_query(hdb, rec, "INSERT INTO `_Streams` ( `Name`, `Data` ) VALUES ( ?, ? )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Insert into _Streams failed: %d\n", r);
+    g_object_unref(rec);
+
+    hsi = libmsi_summary_info_new(hdb, 1, NULL);
+    ok(hsi, "libmsi_summary_info_new() failed\n");
+    libmsi_summary_info_set_int(hsi, LIBMSI_PROPERTY_SECURITY, 2, NULL);
+    r = libmsi_summary_info_persist(hsi, NULL);
+    ok(r, "Failed to save summary information\n");
+    g_object_unref(hsi);
+
+    r = libmsi_database_commit(hdb, NULL);
+    ok(r, "Failed to commit database\n");
+    g_object_unref(hdb);
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    r = do_query(hdb, "SELECT `Data` FROM `_Streams` WHERE `Name` = 'payload'", &rec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "SELECT query failed: %d\n", r);
+    in = libmsi_record_get_stream(rec, 1);
+    ok(in, "Failed to get stream\n");
+    buf = g_malloc0(size + 1);
+    r = g_input_stream_read_all(in, buf, size + 1, &size, NULL, NULL);
+    ok(r && size == 1024 * 1024 + 17, "read %u bytes\n", (unsigned)size);
+    ok(!memcmp(buf, data, size), "data doesn't match\n");
+    g_object_unref(in);
+    g_object_unref(rec);
+    g_free(buf);
+    buf = NULL;
+
+    /* the same data, written straight to a file */
+    fd = open("payload.out", O_WRONLY | O_BINARY | O_CREAT | O_TRUNC, 0644);
+    ok(fd != -1, "open failed\n");
+    r = libmsi_database_extract_stream_to_fd(hdb, "payload", fd, NULL);
+    ok(r, "libmsi_database_extract_stream_to_fd failed\n");
+    r = libmsi_database_extract_stream_to_fd(hdb, "nonexistent", fd, NULL);
+    ok(!r, "extracted a nonexistent stream\n");
+    close(fd);
+
+    /* names starting with \5 are not encoded in the storage */
+    fd = open("suminfo.out", O_WRONLY | O_BINARY | O_CREAT | O_TRUNC, 0644);
+    ok(fd != -1, "open failed\n");
+    r = libmsi_database_extract_stream_to_fd(hdb, "\5SummaryInformation", fd, NULL);
+    ok(r, "libmsi_database_extract_stream_to_fd failed\n");
+    close(fd);
+    r = g_file_get_contents("suminfo.out", &buf, &size, NULL);
+    ok(r && size > 0, "extracted %u bytes\n", (unsigned)size);
+    g_free(buf);
+    buf = NULL;
+    unlink("suminfo.out");
+
+    r = g_file_get_contents("payload.out", &buf, &size, NULL);
+    ok(r && size == 1024 * 1024 + 17, "extracted %u bytes\n", (unsigned)size);
+    ok(r && !memcmp(buf, data, size), "data doesn't match\n");
+    unlink("payload.out");
+    unlink("payload.bin");
+
+    g_free(buf);
+    g_free(data);
+    g_object_unref(hdb);
+    unlink(msifile);
+}
+
+static void test_extract_streams(void)
+{
+    static const char *names[] = { "one", "two", "three" };
+    LibmsiSummaryInfo *hsi;
+    LibmsiDatabase *hdb;
+    LibmsiRecord *rec;
+    char *path, *data;
+    gsize size;
+    unsigned r;
+    int i;
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    for (i = 0; i < G_N_ELEMENTS(names); i++)
+    {
+        create_file(names[i]);
+        rec = libmsi_record_new(2);
+        libmsi_record_set_string(rec, 1, names[i]);
+        r = libmsi_record_load_stream(rec, 2, names[i]);
+        ok(r, "Failed to add stream data to the record\n");
+        unlink(names[i]);
+
+        r = run_query(hdb, rec, "INSERT INTO `_Streams` ( `Name`, `Data` ) VALUES ( ?, ? )");
+        ok(r == LIBMSI_RESULT_SUCCESS, "Insert into _Streams failed: %d\n", r);
+        g_object_unref(rec);
+    }
+
+    hsi = libmsi_summary_info_new(hdb, 1, NULL);
+    ok(hsi, "libmsi_summary_info_new() failed\n");
+    libmsi_summary_info_set_int(hsi, LIBMSI_PROPERTY_SECURITY, 2, NULL);
+    r = libmsi_summary_info_persist(hsi, NULL);
+    ok(r, "Failed to save summary information\n");
+    g_object_unref(hsi);
+
+    r = libmsi_database_commit(hdb, NULL);
+    ok(r, "Failed to commit database\n");
+    g_object_unref(hdb);
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    mkdir("streams", 0755);
+    r = libmsi_database_extract_streams(hdb, "t*", "streams", NULL);
+    ok(r, "libmsi_database_extract_streams failed\n");
+    r = g_file_test("streams/one", G_FILE_TEST_EXISTS);
+    ok(!r, "extracted a stream that does not match\n");
+
+    r = libmsi_database_extract_streams(hdb, NULL, "streams", NULL);
+    ok(r, "libmsi_database_extract_streams failed\n");
+
+    for (i = 0; i < G_N_ELEMENTS(names); i++)
+    {
+        path = g_build_filename("streams", names[i], NULL);
+        data = NULL;
+        r = g_file_get_contents(path, &data, &size, NULL);
+        ok(r, "failed to read %s\n", path);
+        ok(r && size == strlen(names[i]) + 1 && !memcmp(data, names[i], size - 1),
+           "wrong data in %s\n", path);
+        unlink(path);
+        g_free(path);
+        g_free(data);
+    }
+
+    /* the summary information is a stream too, stored unencoded */
+    path = g_build_filename("streams", "\5SummaryInformation", NULL);
+    r = g_file_test(path, G_FILE_TEST_EXISTS);
+    ok(r, "the summary information was not extracted\n");
+    unlink(path);
+    g_free(path);
+    rmdir("streams");
+
+    g_object_unref(hdb);
+    unlink(msifile);
+}
+
 static void test_where_not_in_selected(void)
 {
     LibmsiDatabase *hdb = 0;
@@ -2022,6 +2308,11 @@ static const char bin_import_dat[] = "Name\tData\r\n"
                                      "Binary\tName\r\n"
                                      "filename1\tfilename1.ibd\r\n";
 
+static const char bin_import_missing_dat[] = "Name\tData\r\n"
+                                             "s72\tV0\r\n"
+                                             "Binary\tName\r\n"
+                                             "filename2\tfilename2.ibd\r\n";
+
 static void test_binary_import(void)
 {
     GInputStream *in;
@@ -2063,116 +2354,405 @@ static void test_binary_import(void)
     g_object_unref(in);
     g_object_unref(rec);
 
+    /* a missing stream file leaves the table alone */
+    write_file("bin_import.idt", bin_import_missing_dat,
+          (sizeof(bin_import_missing_dat) - 1) * sizeof(char));
+    r = libmsi_database_import(hdb, "bin_import.idt", NULL);
+    ok(!r, "imported a missing stream file\n");
+
+    rec = NULL;
+    r = do_query(hdb, "SELECT `Name` FROM `Binary`", &rec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "SELECT query failed: %d\n", r);
+    check_record_string(rec, 1, "filename1");
+    g_object_unref(rec);
+
+    rec = NULL;
+    r = do_query(hdb, "SELECT COUNT(*) FROM `Binary`", &rec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "SELECT query failed: %d\n", r);
+    ok(libmsi_record_get_int(rec, 1) == 1, "expected 1 row\n");
+    g_object_unref(rec);
+
     g_object_unref(hdb);
 
+    unlink("Binary/filename1.ibd");
+    rmdir("Binary");
     unlink("bin_import/filename1.ibd");
     rmdir("bin_import");
     unlink("bin_import.idt");
 }
 
-static void test_markers(void)
+static const char shared_dat[] = "Key\tName\r\n"
+                                 "i2\ts72\r\n"
+                                 "Shared\tKey\r\n"
+                                 "1\tshared\r\n"
+                                 "2\tshared\r\n";
+
+static void test_import_rows(void)
 {
     LibmsiDatabase *hdb;
-    LibmsiRecord *rec;
-    const char *sql;
-    unsigned r = 0;
+    LibmsiQuery *hquery;
+    LibmsiRecord *hrec;
+    GString *data;
+    char *text;
+    unsigned r;
+    int i;
 
     hdb = create_db();
-    ok( hdb, "failed to create db\n");
-
-    rec = libmsi_record_new(3);
-    libmsi_record_set_string(rec, 1, "Table");
-    libmsi_record_set_string(rec, 2, "Apples");
-    libmsi_record_set_string(rec, 3, "Oranges");
+    ok(hdb, "failed to create db\n");
 
-    /* try a legit create */
-    sql = "CREATE TABLE `Table` ( `One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
-    r = run_query(hdb, 0, sql);
-    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
-    g_object_unref(rec);
+    /* rows out of order, a line longer than the read buffer and the
+     * lines ending in different ways */
+    text = g_strnfill(100000, 'x');
+    data = g_string_new("Key\tName\tText\r\ni2\ts72\tL0\r\nBulk\tKey\r\n");
+    for (i = 2000; i > 0; i--)
+        g_string_append_printf(data, "%d\tname%d\t%s%s", i, i,
+                               i == 1000 ? text : "", i % 2 ? "\r\n" : "\n");
+    write_file("bulk.idt", data->str, data->len);
 
-    /* try table name as marker */
-    rec = libmsi_record_new(1);
-    libmsi_record_set_string(rec, 1, "Fable");
-    sql = "CREATE TABLE `?` ( `One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    r = libmsi_database_import(hdb, "bulk.idt", NULL);
+    ok(r, "libmsi_database_import() failed\n");
 
-    /* verify that we just created a table called '?', not 'Fable' */
-    r = try_query(hdb, "SELECT * from `Fable`");
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    hrec = NULL;
+    r = do_query(hdb, "SELECT COUNT(*) FROM `Bulk`", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    ok(libmsi_record_get_int(hrec, 1) == 2000, "expected 2000 rows\n");
+    g_object_unref(hrec);
 
-    r = try_query(hdb, "SELECT * from `?`");
-    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `Name`, `Text` FROM `Bulk` WHERE `Key` = 1000", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "name1000");
+    check_record_string(hrec, 2, text);
+    g_object_unref(hrec);
 
-    /* try table name as marker without backticks */
-    libmsi_record_set_string(rec, 1, "Mable");
-    sql = "CREATE TABLE ? ( `One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    /* the rows are in key order */
+    hquery = libmsi_query_new(hdb, "SELECT `Key` FROM `Bulk`", NULL);
+    ok(hquery, "failed to create query\n");
+    r = libmsi_query_execute(hquery, NULL, NULL);
+    ok(r, "failed to execute query\n");
+    for (i = 1; i <= 3; i++)
+    {
+        hrec = libmsi_query_fetch(hquery, NULL);
+        ok(hrec, "query fetch failed\n");
+        ok(libmsi_record_get_int(hrec, 1) == i, "expected %d, got %d\n",
+           i, libmsi_record_get_int(hrec, 1));
+        g_object_unref(hrec);
+    }
+    libmsi_query_close(hquery, NULL);
+    g_object_unref(hquery);
 
-    /* try one column name as marker */
-    libmsi_record_set_string(rec, 1, "One");
-    sql = "CREATE TABLE `Mable` ( `?` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
-    g_object_unref(rec);
+    /* duplicate keys leave the table alone */
+    g_string_append(data, "1500\tagain\t\n");
+    write_file("bulk.idt", data->str, data->len);
 
-    /* try column names as markers */
-    rec = libmsi_record_new(2);
-    libmsi_record_set_string(rec, 1, "One");
-    libmsi_record_set_string(rec, 2, "Two");
-    sql = "CREATE TABLE `Mable` ( `?` SHORT NOT NULL, `?` CHAR(255) PRIMARY KEY `One`)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
-    g_object_unref(rec);
+    r = libmsi_database_import(hdb, "bulk.idt", NULL);
+    ok(!r, "libmsi_database_import() succeeded\n");
 
-    /* try names with backticks */
-    rec = libmsi_record_new(3);
-    libmsi_record_set_string(rec, 1, "One");
-    libmsi_record_set_string(rec, 2, "Two");
-    libmsi_record_set_string(rec, 3, "One");
-    sql = "CREATE TABLE `Mable` ( `?` SHORT NOT NULL, `?` CHAR(255) PRIMARY KEY `?`)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `Name` FROM `Bulk` WHERE `Key` = 1500", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "name1500");
+    g_object_unref(hrec);
 
-    /* try names with backticks, minus definitions */
-    sql = "CREATE TABLE `Mable` ( `?`, `?` PRIMARY KEY `?`)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    /* imported rows hold a persistent reference on strings that only a
+     * temporary table used, which keeps them in the saved string table */
+    r = run_query(hdb, 0, "CREATE TABLE `Other` ( `Name` CHAR(72) TEMPORARY "
+                          "PRIMARY KEY `Name` ) HOLD");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to create table\n");
+    r = run_query(hdb, 0, "INSERT INTO `Other` ( `Name` ) VALUES ( 'shared' ) TEMPORARY");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to insert row\n");
 
-    /* try names without backticks */
-    sql = "CREATE TABLE `Mable` ( ? SHORT NOT NULL, ? CHAR(255) PRIMARY KEY ?)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
-    g_object_unref(rec);
+    write_file("shared.idt", shared_dat, sizeof(shared_dat) - 1);
+    r = libmsi_database_import(hdb, "shared.idt", NULL);
+    ok(r, "libmsi_database_import() failed\n");
 
-    /* try one long marker */
-    rec = libmsi_record_new(1);
-    libmsi_record_set_string(rec, 1, "`One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`");
-    sql = "CREATE TABLE `Mable` ( ? )";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
-    g_object_unref(rec);
+    r = libmsi_database_commit(hdb, NULL);
+    ok(r, "failed to commit database\n");
+    g_object_unref(hdb);
 
-    /* try all names as markers */
-    rec = libmsi_record_new(4);
-    libmsi_record_set_string(rec, 1, "Mable");
-    libmsi_record_set_string(rec, 2, "One");
-    libmsi_record_set_string(rec, 3, "Two");
-    libmsi_record_set_string(rec, 4, "One");
-    sql = "CREATE TABLE `?` ( `?` SHORT NOT NULL, `?` CHAR(255) PRIMARY KEY `?`)";
-    r = run_query(hdb, rec, sql);
-    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
-    g_object_unref(rec);
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(hdb, "failed to open database\n");
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `Name` FROM `Shared` WHERE `Key` = 2", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "shared");
+    g_object_unref(hrec);
+    unlink("shared.idt");
 
-    /* try a legit insert */
-    sql = "INSERT INTO `Table` ( `One`, `Two` ) VALUES ( 5, 'hello' )";
-    r = run_query(hdb, 0, sql);
-    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    g_string_free(data, TRUE);
+    g_free(text);
+    g_object_unref(hdb);
+    unlink("bulk.idt");
+    unlink(msifile);
+}
 
-    r = try_query(hdb, "SELECT * from `Table`");
-    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+static void test_import_tables(void)
+{
+    static const char one_dat[] = "A\tB\n" "s72\ti2\n" "One\tA\n" "x\t1\n" "y\t2\n";
+    static const char two_dat[] = "C\n" "s72\n" "Two\tC\n" "z\n";
+    static const char three_dat[] = "D\n" "i2\n" "Three\tD\n" "3\n";
+    const char *paths[] = { "idt_tables", "three.idt", NULL };
+    const char *missing[] = { "three.idt", "missing.idt", NULL };
+    LibmsiDatabase *hdb;
+    LibmsiRecord *hrec;
+    GError *error = NULL;
+    unsigned r;
+
+    mkdir("idt_tables", 0755);
+    write_file("idt_tables/one.idt", one_dat, sizeof(one_dat) - 1);
+    write_file("idt_tables/two.idt", two_dat, sizeof(two_dat) - 1);
+    write_file("idt_tables/notes.txt", "not a table", 11);
+    write_file("three.idt", three_dat, sizeof(three_dat) - 1);
+
+    hdb = create_db();
+    ok(hdb, "failed to create db\n");
+
+    r = libmsi_database_import_tables(hdb, paths, NULL);
+    ok(r, "libmsi_database_import_tables() failed\n");
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `A` FROM `One` WHERE `B` = 2", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "y");
+    g_object_unref(hrec);
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `C` FROM `Two`", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "z");
+    g_object_unref(hrec);
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `D` FROM `Three`", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    ok(libmsi_record_get_int(hrec, 1) == 3, "expected 3\n");
+    g_object_unref(hrec);
+
+    r = libmsi_database_import_tables(hdb, missing, &error);
+    ok(!r, "libmsi_database_import_tables() succeeded\n");
+    g_assert_error(error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_OPEN_FAILED);
+    g_clear_error(&error);
+
+    g_object_unref(hdb);
+    unlink("idt_tables/one.idt");
+    unlink("idt_tables/two.idt");
+    unlink("idt_tables/notes.txt");
+    rmdir("idt_tables");
+    unlink("three.idt");
+    unlink(msifile);
+}
+
+static void test_export_large(void)
+{
+    LibmsiDatabase *hdb;
+    GString *data;
+    char *exported = NULL;
+    gsize length = 0;
+    unsigned r;
+    int fd, i;
+
+    hdb = create_db();
+    ok(hdb, "failed to create db\n");
+
+    /* more than fits in the export buffer */
+    data = g_string_new("Key\tName\r\ni2\ts72\r\nBig\tKey\r\n");
+    for (i = 1; i <= 5000; i++)
+        g_string_append_printf(data, "%d\tname%d\r\n", i, i);
+    write_file("big.idt", data->str, data->len);
+
+    r = libmsi_database_import(hdb, "big.idt", NULL);
+    ok(r, "libmsi_database_import() failed\n");
+
+    fd = open("big.txt", O_WRONLY | O_BINARY | O_CREAT | O_TRUNC, 0644);
+    ok(fd != -1, "open failed\n");
+    r = libmsi_database_export(hdb, "Big", fd, NULL);
+    ok(r, "libmsi_database_export failed\n");
+    close(fd);
+
+    r = g_file_get_contents("big.txt", &exported, &length, NULL);
+    ok(r, "failed to read the export\n");
+    ok(length == data->len, "expected %u bytes, got %u\n",
+       (unsigned)data->len, (unsigned)length);
+    ok(exported && !memcmp(exported, data->str, data->len), "data doesn't match\n");
+
+    g_free(exported);
+    g_string_free(data, TRUE);
+    g_object_unref(hdb);
+    unlink("big.idt");
+    unlink("big.txt");
+    unlink(msifile);
+}
+
+static void test_export_all(void)
+{
+    static const char *names[] = { "One", "Two", "Three", "Four" };
+    LibmsiDatabase *hdb;
+    GString *data;
+    char *path, *exported = NULL;
+    gsize length = 0;
+    unsigned r;
+    int i, j;
+
+    hdb = create_db();
+    ok(hdb, "failed to create db\n");
+
+    for (i = 0; i < G_N_ELEMENTS(names); i++)
+    {
+        data = g_string_new("Key\tName\r\ni2\ts72\r\n");
+        g_string_append_printf(data, "%s\tKey\r\n", names[i]);
+        for (j = 1; j <= 1000; j++)
+            g_string_append_printf(data, "%d\t%s%d\r\n", j, names[i], j);
+        write_file("table.idt", data->str, data->len);
+        g_string_free(data, TRUE);
+
+        r = libmsi_database_import(hdb, "table.idt", NULL);
+        ok(r, "libmsi_database_import() failed\n");
+    }
+    unlink("table.idt");
+
+    mkdir("exportall", 0755);
+    r = libmsi_database_export_all(hdb, "exportall", NULL);
+    ok(r, "libmsi_database_export_all failed\n");
+
+    /* each file is what exporting the table alone gives */
+    for (i = 0; i < G_N_ELEMENTS(names); i++)
+    {
+        int fd = open("table.txt", O_WRONLY | O_BINARY | O_CREAT | O_TRUNC, 0644);
+        char *single = NULL;
+        gsize size = 0;
+
+        r = libmsi_database_export(hdb, names[i], fd, NULL);
+        ok(r, "libmsi_database_export failed\n");
+        close(fd);
+        g_file_get_contents("table.txt", &single, &size, NULL);
+
+        path = g_strdup_printf("exportall/%s.idt", names[i]);
+        r = g_file_get_contents(path, &exported, &length, NULL);
+        ok(r, "failed to read %s\n", path);
+        ok(length == size && single && exported && !memcmp(exported, single, size),
+           "%s doesn't match\n", path);
+        unlink(path);
+        g_free(path);
+        g_free(exported);
+        g_free(single);
+    }
+    unlink("table.txt");
+
+    r = g_file_test("exportall/_ForceCodepage.idt", G_FILE_TEST_EXISTS);
+    ok(r, "_ForceCodepage.idt is missing\n");
+    r = g_file_test("exportall/_SummaryInformation.idt", G_FILE_TEST_EXISTS);
+    ok(r, "_SummaryInformation.idt is missing\n");
+    unlink("exportall/_ForceCodepage.idt");
+    unlink("exportall/_SummaryInformation.idt");
+    rmdir("exportall");
+
+    g_object_unref(hdb);
+    unlink(msifile);
+}
+
+static void test_markers(void)
+{
+    LibmsiDatabase *hdb;
+    LibmsiRecord *rec;
+    const char *sql;
+    unsigned r = 0;
+
+    hdb = create_db();
+    ok( hdb, "failed to create db\n");
+
+    rec = libmsi_record_new(3);
+    libmsi_record_set_string(rec, 1, "Table");
+    libmsi_record_set_string(rec, 2, "Apples");
+    libmsi_record_set_string(rec, 3, "Oranges");
+
+    /* try a legit create */
+    sql = "CREATE TABLE `Table` ( `One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
+    r = run_query(hdb, 0, sql);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    g_object_unref(rec);
+
+    /* try table name as marker */
+    rec = libmsi_record_new(1);
+    libmsi_record_set_string(rec, 1, "Fable");
+    sql = "CREATE TABLE `?` ( `One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+
+    /* verify that we just created a table called '?', not 'Fable' */
+    r = try_query(hdb, "SELECT * from `Fable`");
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+
+    r = try_query(hdb, "SELECT * from `?`");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+
+    /* try table name as marker without backticks */
+    libmsi_record_set_string(rec, 1, "Mable");
+    sql = "CREATE TABLE ? ( `One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+
+    /* try one column name as marker */
+    libmsi_record_set_string(rec, 1, "One");
+    sql = "CREATE TABLE `Mable` ( `?` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    g_object_unref(rec);
+
+    /* try column names as markers */
+    rec = libmsi_record_new(2);
+    libmsi_record_set_string(rec, 1, "One");
+    libmsi_record_set_string(rec, 2, "Two");
+    sql = "CREATE TABLE `Mable` ( `?` SHORT NOT NULL, `?` CHAR(255) PRIMARY KEY `One`)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    g_object_unref(rec);
+
+    /* try names with backticks */
+    rec = libmsi_record_new(3);
+    libmsi_record_set_string(rec, 1, "One");
+    libmsi_record_set_string(rec, 2, "Two");
+    libmsi_record_set_string(rec, 3, "One");
+    sql = "CREATE TABLE `Mable` ( `?` SHORT NOT NULL, `?` CHAR(255) PRIMARY KEY `?`)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+
+    /* try names with backticks, minus definitions */
+    sql = "CREATE TABLE `Mable` ( `?`, `?` PRIMARY KEY `?`)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+
+    /* try names without backticks */
+    sql = "CREATE TABLE `Mable` ( ? SHORT NOT NULL, ? CHAR(255) PRIMARY KEY ?)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    g_object_unref(rec);
+
+    /* try one long marker */
+    rec = libmsi_record_new(1);
+    libmsi_record_set_string(rec, 1, "`One` SHORT NOT NULL, `Two` CHAR(255) PRIMARY KEY `One`");
+    sql = "CREATE TABLE `Mable` ( ? )";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    g_object_unref(rec);
+
+    /* try all names as markers */
+    rec = libmsi_record_new(4);
+    libmsi_record_set_string(rec, 1, "Mable");
+    libmsi_record_set_string(rec, 2, "One");
+    libmsi_record_set_string(rec, 3, "Two");
+    libmsi_record_set_string(rec, 4, "One");
+    sql = "CREATE TABLE `?` ( `?` SHORT NOT NULL, `?` CHAR(255) PRIMARY KEY `?`)";
+    r = run_query(hdb, rec, sql);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+    g_object_unref(rec);
+
+    /* try a legit insert */
+    sql = "INSERT INTO `Table` ( `One`, `Two` ) VALUES ( 5, 'hello' )";
+    r = run_query(hdb, 0, sql);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+
+    r = try_query(hdb, "SELECT * from `Table`");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
 
     /* try values as markers */
     rec = libmsi_record_new(2);
@@ -3211,129 +3791,926 @@ static void test_join(void)
         g_object_unref(hrec);
     }
 
-    ok( data_correct, "data returned in the wrong order\n");
-    ok( i == 6, "Expected 6 rows, got %d\n", i );
-    g_assert_no_error(error);
+    ok( data_correct, "data returned in the wrong order\n");
+    ok( i == 6, "Expected 6 rows, got %d\n", i );
+    g_assert_no_error(error);
+
+    libmsi_query_close(hquery, NULL);
+    g_object_unref(hquery);
+
+    sql = "SELECT * FROM `StdDlls`, `Binary` ";
+    hquery = libmsi_query_new(hdb, sql, NULL);
+    ok(hquery, "failed to open query\n");
+
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query: %d\n", r );
+
+    i = 0;
+    data_correct = true;
+    while ((hrec = libmsi_query_fetch(hquery, &error)) != NULL)
+    {
+        count = libmsi_record_get_field_count( hrec );
+        ok( count == 4, "Expected 4 record fields, got %d\n", count );
+
+        str = libmsi_record_get_string(hrec, 1);
+        ok(str, "failed to get record string\n");
+        if (strcmp(str, join_res_eighth[i].one))
+            data_correct = false;
+        g_free(str);
+
+        str = libmsi_record_get_string(hrec, 2);
+        ok(str, "failed to get record string\n");
+        if (strcmp(str, join_res_eighth[i].two))
+            data_correct = false;
+        g_free(str);
+
+        str = libmsi_record_get_string(hrec, 3);
+        ok(str, "failed to get record string\n");
+        if (strcmp(str, join_res_eighth[i].three))
+            data_correct = false;
+        g_free(str);
+
+        str = libmsi_record_get_string(hrec, 4);
+        ok(str, "failed to get record string\n");
+        if (strcmp(str, join_res_eighth[i].four))
+            data_correct = false;
+        g_free(str);
+
+        i++;
+        g_object_unref(hrec);
+    }
+    ok( data_correct, "data returned in the wrong order\n");
+
+    ok( i == 6, "Expected 6 rows, got %d\n", i );
+    g_assert_no_error(error);
+
+    libmsi_query_close(hquery, NULL);
+    g_object_unref(hquery);
+
+    sql = "SELECT * FROM `One`, `Two`, `Three` ";
+    hquery = libmsi_query_new(hdb, sql, NULL);
+    ok(hquery, "failed to open query\n");
+
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query: %d\n", r );
+
+    i = 0;
+    data_correct = true;
+    while ((hrec = libmsi_query_fetch(hquery, &error)) != NULL)
+    {
+        count = libmsi_record_get_field_count( hrec );
+        ok( count == 6, "Expected 6 record fields, got %d\n", count );
+
+        r = libmsi_record_get_int( hrec, 1 );
+        if( r != join_res_ninth[i].one )
+            data_correct = false;
+
+        r = libmsi_record_get_int( hrec, 2 );
+        if( r != join_res_ninth[i].two )
+            data_correct = false;
+
+        r = libmsi_record_get_int( hrec, 3 );
+        if( r != join_res_ninth[i].three )
+            data_correct = false;
+
+        r = libmsi_record_get_int( hrec, 4 );
+        if( r != join_res_ninth[i].four )
+            data_correct = false;
+
+        r = libmsi_record_get_int( hrec, 5 );
+        if( r != join_res_ninth[i].five )
+            data_correct = false;
+
+        r = libmsi_record_get_int( hrec, 6);
+        if( r != join_res_ninth[i].six )
+            data_correct = false;
+
+        i++;
+        g_object_unref(hrec);
+    }
+    ok( data_correct, "data returned in the wrong order\n");
+
+    ok( i == 6, "Expected 6 rows, got %d\n", i );
+    g_assert_no_error(error);
+
+    libmsi_query_close(hquery, NULL);
+    g_object_unref(hquery);
+
+    sql = "SELECT * FROM `Four`, `Five`";
+    hquery = libmsi_query_new(hdb, sql, NULL);
+    ok(hquery, "failed to open query\n");
+
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query: %d\n", r );
+
+    query_check_no_more(hquery);
+
+    libmsi_query_close(hquery, NULL);
+    g_object_unref(hquery);
+
+    sql = "SELECT * FROM `Nonexistent`, `One`";
+    hquery = libmsi_query_new(hdb, sql, &error);
+    g_assert_error(error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_BAD_QUERY_SYNTAX);
+    g_clear_error(&error);
+    g_object_unref(hdb);
+    unlink(msifile);
+}
+
+static void test_query_plan(void)
+{
+    GError *error = NULL;
+    LibmsiDatabase *hdb;
+    LibmsiQuery *hquery;
+    LibmsiRecord *hrec;
+    const char *sql;
+    gchar *plan;
+    unsigned r;
+
+    hdb = create_db();
+    ok( hdb, "failed to create db\n");
+
+    r = create_component_table( hdb );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot create Component table: %d\n", r );
+
+    r = add_component_entry( hdb, "'zygomatic', 'malar', 'INSTALLDIR', 0, '', ''" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add component: %d\n", r );
+
+    r = add_component_entry( hdb, "'maxilla', 'alveolar', 'INSTALLDIR', 0, '', ''" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add component: %d\n", r );
+
+    r = add_component_entry( hdb, "'nasal', 'septum', 'INSTALLDIR', 0, '', ''" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add component: %d\n", r );
+
+    r = create_feature_components_table( hdb );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot create FeatureComponents table: %d\n", r );
+
+    r = add_feature_components_entry( hdb, "'procerus', 'maxilla'" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add feature components: %d\n", r );
+
+    r = add_feature_components_entry( hdb, "'procerus', 'nasal'" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add feature components: %d\n", r );
+
+    r = add_feature_components_entry( hdb, "'nasalis', 'nasal'" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add feature components: %d\n", r );
+
+    /* constant comparison is answered through the column index */
+    sql = "SELECT `ComponentId` FROM `Component` WHERE `Component` = 'nasal'";
+    hquery = libmsi_query_new(hdb, sql, &error);
+    ok( hquery, "failed to open query\n");
+    g_assert_no_error(error);
+
+    plan = libmsi_query_get_plan(hquery, &error);
+    g_assert_no_error(error);
+    ok( plan != NULL, "expected a plan\n");
+    ok( strstr(plan, "SELECT ComponentId") != NULL, "unexpected plan %s\n", plan );
+    ok( strstr(plan, "INDEX Component.Component = 'nasal'") != NULL, "unexpected plan %s\n", plan );
+    g_free(plan);
+
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query\n");
+
+    hrec = libmsi_query_fetch(hquery, NULL);
+    ok( hrec, "Expected result\n");
+    check_record_string(hrec, 1, "septum");
+    g_object_unref( hrec );
+
+    query_check_no_more(hquery);
+    libmsi_query_close(hquery, NULL);
+    g_object_unref( hquery );
+
+    /* one of the tables is looked up through the join column */
+    sql = "SELECT `Feature_`, `ComponentId` FROM `FeatureComponents`, `Component` "
+          "WHERE `Component`.`Component` = `FeatureComponents`.`Component_` "
+          "ORDER BY `Feature_`";
+    hquery = libmsi_query_new(hdb, sql, &error);
+    ok( hquery, "failed to open query\n");
+    g_assert_no_error(error);
+
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query\n");
+
+    plan = libmsi_query_get_plan(hquery, &error);
+    g_assert_no_error(error);
+    ok( plan != NULL, "expected a plan\n");
+    ok( strstr(plan, "WHERE (estimated rows") != NULL, "unexpected plan %s\n", plan );
+    ok( strstr(plan, "SCAN ") != NULL, "unexpected plan %s\n", plan );
+    ok( strstr(plan, "INDEX ") != NULL, "unexpected plan %s\n", plan );
+    g_free(plan);
+
+    hrec = libmsi_query_fetch(hquery, NULL);
+    ok( hrec, "Expected result\n");
+    check_record_string(hrec, 1, "procerus");
+    check_record_string(hrec, 2, "alveolar");
+    g_object_unref( hrec );
+
+    hrec = libmsi_query_fetch(hquery, NULL);
+    ok( hrec, "Expected result\n");
+    check_record_string(hrec, 1, "procerus");
+    check_record_string(hrec, 2, "septum");
+    g_object_unref( hrec );
+
+    hrec = libmsi_query_fetch(hquery, NULL);
+    ok( hrec, "Expected result\n");
+    check_record_string(hrec, 1, "nasalis");
+    check_record_string(hrec, 2, "septum");
+    g_object_unref( hrec );
+
+    query_check_no_more(hquery);
+    libmsi_query_close(hquery, NULL);
+
+    /* profiling counts the rows flowing through each view */
+    libmsi_query_set_profiling(hquery, TRUE);
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query\n");
+
+    plan = libmsi_query_get_plan(hquery, &error);
+    g_assert_no_error(error);
+    ok( strstr(plan, "[executed 1, rows in 3, rows out 3") != NULL, "unexpected plan %s\n", plan );
+    ok( strstr(plan, "[visited ") != NULL, "unexpected plan %s\n", plan );
+    g_free(plan);
+    libmsi_query_close(hquery, NULL);
+
+    /* enabling profiling again resets the views below the top one too */
+    libmsi_query_set_profiling(hquery, TRUE);
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query\n");
+
+    plan = libmsi_query_get_plan(hquery, &error);
+    g_assert_no_error(error);
+    ok( strstr(plan, "[executed 2") == NULL, "unexpected plan %s\n", plan );
+    g_free(plan);
+
+    libmsi_query_close(hquery, NULL);
+    g_object_unref( hquery );
+
+    /* EXPLAIN returns the plan as rows */
+    sql = "EXPLAIN SELECT `ComponentId` FROM `Component` WHERE `Component` = 'nasal'";
+    hquery = libmsi_query_new(hdb, sql, &error);
+    ok( hquery, "failed to open query\n");
+    g_assert_no_error(error);
+
+    r = libmsi_query_execute(hquery, 0, NULL);
+    ok( r, "failed to execute query\n");
+
+    hrec = libmsi_query_fetch(hquery, NULL);
+    ok( hrec, "Expected result\n");
+    check_record_string(hrec, 1, "SELECT ComponentId");
+    g_object_unref( hrec );
+
+    hrec = libmsi_query_fetch(hquery, NULL);
+    ok( hrec, "Expected result\n");
+    g_object_unref( hrec );
+
+    hrec = libmsi_query_fetch(hquery, NULL);
+    ok( hrec, "Expected result\n");
+    check_record_string(hrec, 1, "    INDEX Component.Component = 'nasal' (3 rows, 3 distinct)");
+    g_object_unref( hrec );
+
+    query_check_no_more(hquery);
+    libmsi_query_close(hquery, NULL);
+    g_object_unref( hquery );
+
+    g_object_unref( hdb );
+}
+
+static void test_aggregates(void)
+{
+    LibmsiDatabase *hdb;
+    LibmsiRecord *hrec = NULL;
+    unsigned r;
+
+    hdb = create_db();
+    ok( hdb, "failed to create db\n");
+
+    r = create_custom_action_table( hdb );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot create CustomAction table: %d\n", r );
+
+    r = do_query( hdb, "SELECT COUNT(*) FROM `CustomAction`", &hrec );
+    ok( r == LIBMSI_RESULT_SUCCESS, "query failed: %d\n", r );
+    ok( libmsi_record_get_int( hrec, 1 ) == 0, "expected no rows\n" );
+    g_object_unref( hrec );
+
+    /* MIN and MAX of no values are NULL */
+    hrec = NULL;
+    r = do_query( hdb, "SELECT MIN(`Type`), MAX(`Type`) FROM `CustomAction`", &hrec );
+    ok( r == LIBMSI_RESULT_SUCCESS, "query failed: %d\n", r );
+    ok( libmsi_record_is_null( hrec, 1 ), "expected NULL\n" );
+    ok( libmsi_record_is_null( hrec, 2 ), "expected NULL\n" );
+    g_object_unref( hrec );
+
+    r = add_custom_action_entry( hdb, "'one', 5, 'a', NULL" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add custom action: %d\n", r );
+
+    r = add_custom_action_entry( hdb, "'two', 51, 'b', 'x'" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add custom action: %d\n", r );
+
+    r = add_custom_action_entry( hdb, "'three', 19, 'c', 'y'" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot add custom action: %d\n", r );
+
+    hrec = NULL;
+    r = do_query( hdb, "SELECT count(*), MIN(`Type`), MAX(`Type`), SUM(`Type`), "
+                  "COUNT(`Target`) FROM `CustomAction`", &hrec );
+    ok( r == LIBMSI_RESULT_SUCCESS, "query failed: %d\n", r );
+    ok( libmsi_record_get_field_count( hrec ) == 5, "expected 5 fields\n" );
+    ok( libmsi_record_get_int( hrec, 1 ) == 3, "expected 3 rows\n" );
+    ok( libmsi_record_get_int( hrec, 2 ) == 5, "expected min 5\n" );
+    ok( libmsi_record_get_int( hrec, 3 ) == 51, "expected max 51\n" );
+    ok( libmsi_record_get_int( hrec, 4 ) == 75, "expected sum 75\n" );
+    ok( libmsi_record_get_int( hrec, 5 ) == 2, "expected 2 targets\n" );
+    g_object_unref( hrec );
+
+    hrec = NULL;
+    r = do_query( hdb, "SELECT COUNT(*), SUM(`Type`) FROM `CustomAction` "
+                  "WHERE `Type` > 10", &hrec );
+    ok( r == LIBMSI_RESULT_SUCCESS, "query failed: %d\n", r );
+    ok( libmsi_record_get_int( hrec, 1 ) == 2, "expected 2 rows\n" );
+    ok( libmsi_record_get_int( hrec, 2 ) == 70, "expected sum 70\n" );
+    g_object_unref( hrec );
+
+    /* only integer columns can be summed */
+    hrec = NULL;
+    r = do_query( hdb, "SELECT SUM(`Source`) FROM `CustomAction`", &hrec );
+    ok( r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "expected failure: %d\n", r );
+
+    r = do_query( hdb, "SELECT AVG(`Type`) FROM `CustomAction`", &hrec );
+    ok( r == LIBMSI_RESULT_BAD_QUERY_SYNTAX, "expected failure: %d\n", r );
+
+    g_object_unref( hdb );
+}
+
+static void test_limit(void)
+{
+    static const char *actions[] = { "one", "two", "three", "four", "five" };
+    static const int types[] = { 40, 10, 50, 20, 30 };
+    GError *error = NULL;
+    LibmsiDatabase *hdb;
+    LibmsiQuery *hquery;
+    LibmsiRecord *hrec;
+    gchar *all[5];
+    char sql[128];
+    unsigned r, i;
+
+    hdb = create_db();
+    ok( hdb, "failed to create db\n");
+
+    r = create_custom_action_table( hdb );
+    ok( r == LIBMSI_RESULT_SUCCESS, "cannot create CustomAction table: %d\n", r );
+
+    for (i = 0; i < 5; i++)
+    {
+        sprintf( sql, "'%s', %d, 'src%d', NULL", actions[i], types[i], i % 2 );
+        r = add_custom_action_entry( hdb, sql );
+        ok( r == LIBMSI_RESULT_SUCCESS, "cannot add custom action: %d\n", r );
+    }
+
+    /* the rows of an unlimited query, in the order they are returned */
+    hquery = libmsi_query_new( hdb, "SELECT `Action` FROM `CustomAction` WHERE `Type` > 0", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    for (i = 0; i < 5; i++)
+    {
+        hrec = libmsi_query_fetch( hquery, NULL );
+        ok( hrec, "Expected result\n" );
+        all[i] = libmsi_record_get_string( hrec, 1 );
+        g_object_unref( hrec );
+    }
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    /* without ORDER BY the scan stops once enough rows are found */
+    hquery = libmsi_query_new( hdb, "SELECT `Action` FROM `CustomAction` WHERE `Type` > 0 "
+                               "LIMIT 2 OFFSET 1", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    for (i = 1; i < 3; i++)
+    {
+        hrec = libmsi_query_fetch( hquery, NULL );
+        ok( hrec, "Expected result\n" );
+        check_record_string( hrec, 1, all[i] );
+        g_object_unref( hrec );
+    }
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    /* plain table */
+    hquery = libmsi_query_new( hdb, "SELECT * FROM `CustomAction` LIMIT 1 OFFSET 4", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    hrec = libmsi_query_fetch( hquery, NULL );
+    ok( hrec, "Expected result\n" );
+    check_record_string( hrec, 1, all[4] );
+    g_object_unref( hrec );
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    /* ORDER BY keeps the first rows in sort order */
+    hquery = libmsi_query_new( hdb, "SELECT `Action` FROM `CustomAction` ORDER BY `Type` "
+                               "LIMIT 3", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    hrec = libmsi_query_fetch( hquery, NULL );
+    check_record_string( hrec, 1, "two" );
+    g_object_unref( hrec );
+    hrec = libmsi_query_fetch( hquery, NULL );
+    check_record_string( hrec, 1, "four" );
+    g_object_unref( hrec );
+    hrec = libmsi_query_fetch( hquery, NULL );
+    check_record_string( hrec, 1, "five" );
+    g_object_unref( hrec );
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    hquery = libmsi_query_new( hdb, "SELECT `Action` FROM `CustomAction` ORDER BY `Type` "
+                               "LIMIT 10 OFFSET 4", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    hrec = libmsi_query_fetch( hquery, NULL );
+    check_record_string( hrec, 1, "three" );
+    g_object_unref( hrec );
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    hquery = libmsi_query_new( hdb, "SELECT `Action` FROM `CustomAction` LIMIT 0", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    /* LIMIT counts distinct rows */
+    hquery = libmsi_query_new( hdb, "SELECT DISTINCT `Source` FROM `CustomAction` "
+                               "LIMIT 5", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    for (i = 0; i < 2; i++)
+    {
+        hrec = libmsi_query_fetch( hquery, NULL );
+        ok( hrec, "Expected result\n" );
+        g_object_unref( hrec );
+    }
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    for (i = 0; i < 5; i++)
+        g_free( all[i] );
+
+    g_object_unref( hdb );
+}
+
+static void test_where_batches(void)
+{
+    GError *error = NULL;
+    LibmsiDatabase *hdb;
+    LibmsiQuery *hquery;
+    LibmsiRecord *hrec;
+    char sql[128];
+    unsigned r, i;
+
+    hdb = create_db();
+    ok( hdb, "failed to create db\n");
+
+    r = run_query( hdb, 0, "CREATE TABLE `Big` ( `Key` INT PRIMARY KEY `Key`, `Group` INT )" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "failed to create table: %d\n", r );
+    r = run_query( hdb, 0, "CREATE TABLE `Small` ( `Group` INT, `Name` CHAR(16) PRIMARY KEY `Group` )" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "failed to create table: %d\n", r );
+
+    for (i = 0; i < 100; i++)
+    {
+        sprintf( sql, "INSERT INTO `Big` ( `Key`, `Group` ) VALUES ( %u, %u )", i, i % 3 );
+        r = run_query( hdb, 0, sql );
+        ok( r == LIBMSI_RESULT_SUCCESS, "failed to insert row: %d\n", r );
+    }
+    for (i = 0; i < 3; i++)
+    {
+        sprintf( sql, "INSERT INTO `Small` ( `Group`, `Name` ) VALUES ( %u, 'group%u' )", i, i );
+        r = run_query( hdb, 0, sql );
+        ok( r == LIBMSI_RESULT_SUCCESS, "failed to insert row: %d\n", r );
+    }
+
+    /* rows come out in table order, across several batches */
+    hquery = libmsi_query_new( hdb, "SELECT `Key` FROM `Big` WHERE `Key` < 70", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    for (i = 0; i < 70; i++)
+    {
+        hrec = libmsi_query_fetch( hquery, NULL );
+        ok( hrec, "Expected result\n" );
+        r = libmsi_record_get_int( hrec, 1 );
+        ok( r == i, "expected %u, got %u\n", i, r );
+        g_object_unref( hrec );
+    }
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    /* a join probing the second table between batches */
+    hquery = libmsi_query_new( hdb, "SELECT `Big`.`Key`, `Small`.`Name` FROM `Big`, `Small` "
+                               "WHERE `Big`.`Group` = `Small`.`Group`", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    for (i = 0; i < 100; i++)
+    {
+        hrec = libmsi_query_fetch( hquery, NULL );
+        ok( hrec, "Expected result\n" );
+        r = libmsi_record_get_int( hrec, 1 );
+        ok( r == i, "expected %u, got %u\n", i, r );
+        sprintf( sql, "group%u", i % 3 );
+        check_record_string( hrec, 2, sql );
+        g_object_unref( hrec );
+    }
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    /* each insert drops the index that the next lookup rebuilds */
+    for (i = 100; i < 400; i++)
+    {
+        sprintf( sql, "INSERT INTO `Big` ( `Key`, `Group` ) VALUES ( %u, %u )", i, i % 3 );
+        r = run_query( hdb, 0, sql );
+        ok( r == LIBMSI_RESULT_SUCCESS, "failed to insert row: %d\n", r );
+
+        sprintf( sql, "SELECT `Group` FROM `Big` WHERE `Key` = %u", i );
+        hrec = NULL;
+        r = do_query( hdb, sql, &hrec );
+        ok( r == LIBMSI_RESULT_SUCCESS, "query failed: %d\n", r );
+        ok( hrec, "Expected result\n" );
+        r = libmsi_record_get_int( hrec, 1 );
+        ok( r == i % 3, "expected %u, got %u\n", i % 3, r );
+        g_object_unref( hrec );
+    }
+
+    /* the matches of a value come out in table order */
+    hquery = libmsi_query_new( hdb, "SELECT `Key` FROM `Big` WHERE `Group` = 1", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    for (i = 1; i < 400; i += 3)
+    {
+        hrec = libmsi_query_fetch( hquery, NULL );
+        ok( hrec, "Expected result\n" );
+        r = libmsi_record_get_int( hrec, 1 );
+        ok( r == i, "expected %u, got %u\n", i, r );
+        g_object_unref( hrec );
+    }
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    g_object_unref( hdb );
+}
+
+static void test_update_rows(void)
+{
+    GError *error = NULL;
+    LibmsiDatabase *hdb;
+    LibmsiQuery *hquery;
+    LibmsiRecord *hrec;
+    char sql[128];
+    unsigned r, i, count;
+
+    hdb = create_db();
+    ok( hdb, "failed to create db\n");
+
+    r = run_query( hdb, 0, "CREATE TABLE `Item` ( `Key` INT, `Name` CHAR(16), `Size` INT "
+                   "PRIMARY KEY `Key`)" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "failed to create table: %d\n", r );
+
+    for (i = 0; i < 50; i++)
+    {
+        sprintf( sql, "INSERT INTO `Item` ( `Key`, `Name`, `Size` ) VALUES ( %u, 'old', %u )", i, i );
+        r = run_query( hdb, 0, sql );
+        ok( r == LIBMSI_RESULT_SUCCESS, "failed to insert row: %d\n", r );
+    }
+
+    /* a string not yet in the pool, set in many rows at once */
+    r = run_query( hdb, 0, "UPDATE `Item` SET `Name` = 'new', `Size` = 7 WHERE `Key` >= 20" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "failed to update rows: %d\n", r );
+
+    /* lookups see the new values */
+    hquery = libmsi_query_new( hdb, "SELECT `Key`, `Size` FROM `Item` WHERE `Name` = 'new'", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    for (count = 0; (hrec = libmsi_query_fetch( hquery, NULL )); count++)
+    {
+        r = libmsi_record_get_int( hrec, 1 );
+        ok( r == count + 20, "expected %u, got %u\n", count + 20, r );
+        r = libmsi_record_get_int( hrec, 2 );
+        ok( r == 7, "expected 7, got %u\n", r );
+        g_object_unref( hrec );
+    }
+    ok( count == 30, "expected 30 rows, got %u\n", count );
+    g_object_unref( hquery );
+
+    r = run_query( hdb, 0, "UPDATE `Item` SET `Name` = 'old'" );
+    ok( r == LIBMSI_RESULT_SUCCESS, "failed to update rows: %d\n", r );
+
+    hquery = libmsi_query_new( hdb, "SELECT `Key` FROM `Item` WHERE `Name` = 'new'", &error );
+    g_assert_no_error(error);
+    r = libmsi_query_execute( hquery, 0, NULL );
+    ok( r, "failed to execute query\n" );
+    query_check_no_more( hquery );
+    g_object_unref( hquery );
+
+    /* key columns cannot be set */
+    r = run_query( hdb, 0, "UPDATE `Item` SET `Key` = 1 WHERE `Size` = 7" );
+    ok( r == LIBMSI_RESULT_FUNCTION_FAILED, "expected LIBMSI_RESULT_FUNCTION_FAILED, got %d\n", r );
+
+    g_object_unref( hdb );
+}
+
+static void test_generate_transform(void)
+{
+    LibmsiDatabase *hdb, *href;
+    LibmsiRecord *hrec;
+    const char *sql;
+    unsigned r;
+
+    unlink(mstfile);
+
+    hdb = create_db();
+    ok(hdb, "failed to create db\n");
+
+    sql = "CREATE TABLE `MOO` ( `NOO` SHORT NOT NULL, `OOO` CHAR(255) PRIMARY KEY `NOO`)";
+    r = run_query(hdb, 0, sql);
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add table\n");
+
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 1, 'a' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 2, 'b' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 3, 'c' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+
+    r = libmsi_database_commit(hdb, NULL);
+    ok(r, "Failed to commit database\n");
+    g_object_unref(hdb);
+
+    /* the reference is the committed database, the other one changes it */
+    href = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(href, "Failed to open database\n");
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_TRANSACT, msifile2, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    r = run_query(hdb, 0, "UPDATE `MOO` SET `OOO` = 'bee' WHERE `NOO` = 2");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to update row\n");
+    r = run_query(hdb, 0, "DELETE FROM `MOO` WHERE `NOO` = 3");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to delete row\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 4, 'd' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+
+    r = run_query(hdb, 0, "CREATE TABLE `NEW` ( `A` INT, `B` CHAR(16) PRIMARY KEY `A`)");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add table\n");
+    r = run_query(hdb, 0, "INSERT INTO `NEW` ( `A`, `B` ) VALUES ( 7, 'new' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+
+    r = libmsi_database_generate_transform(hdb, href, mstfile, NULL);
+    ok(r, "libmsi_database_generate_transform() failed\n");
+
+    g_object_unref(hdb);
+    g_object_unref(href);
+
+    /* applying the transform to the reference gives the changed database */
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_TRANSACT, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    r = libmsi_database_apply_transform(hdb, mstfile, NULL);
+    ok(r, "libmsi_database_apply_transform() failed\n");
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 1", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "a");
+    g_object_unref(hrec);
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 2", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "bee");
+    g_object_unref(hrec);
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 3", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    ok(hrec == NULL, "expected no row\n");
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 4", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "d");
+    g_object_unref(hrec);
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `B` FROM `NEW` WHERE `A` = 7", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "new");
+    g_object_unref(hrec);
+
+    g_object_unref(hdb);
+
+    unlink(msifile);
+    unlink(msifile2);
+    unlink(mstfile);
+}
+
+static void test_apply_transforms(void)
+{
+    static const char *msifile3 = "winetst3-db.msi";
+    const char *transforms[] = { mstfile, mstfile, NULL };
+    const char *outputs[] = { msifile2, msifile3, NULL };
+    LibmsiDatabase *hdb, *href;
+    LibmsiRecord *hrec;
+    char sql[128];
+    unsigned r, i;
+
+    unlink(mstfile);
+
+    hdb = create_db();
+    ok(hdb, "failed to create db\n");
+
+    r = run_query(hdb, 0, "CREATE TABLE `MOO` ( `NOO` SHORT NOT NULL, `OOO` CHAR(255) PRIMARY KEY `NOO`)");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add table\n");
+
+    for (i = 1; i <= 50; i++)
+    {
+        sprintf(sql, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( %u, 'row%u' )", i, i);
+        r = run_query(hdb, 0, sql);
+        ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+    }
+
+    r = libmsi_database_commit(hdb, NULL);
+    ok(r, "Failed to commit database\n");
+    g_object_unref(hdb);
 
-    libmsi_query_close(hquery, NULL);
-    g_object_unref(hquery);
+    /* the transform changes most rows, deletes one and adds one */
+    href = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(href, "Failed to open database\n");
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_TRANSACT, msifile2, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    r = run_query(hdb, 0, "UPDATE `MOO` SET `OOO` = 'changed' WHERE `NOO` > 10");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to update rows\n");
+    r = run_query(hdb, 0, "DELETE FROM `MOO` WHERE `NOO` = 3");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to delete row\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 51, 'new' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
 
-    sql = "SELECT * FROM `StdDlls`, `Binary` ";
-    hquery = libmsi_query_new(hdb, sql, NULL);
-    ok(hquery, "failed to open query\n");
+    r = libmsi_database_generate_transform(hdb, href, mstfile, NULL);
+    ok(r, "libmsi_database_generate_transform() failed\n");
 
-    r = libmsi_query_execute(hquery, 0, NULL);
-    ok( r, "failed to execute query: %d\n", r );
+    g_object_unref(hdb);
+    g_object_unref(href);
+    unlink(msifile2);
 
-    i = 0;
-    data_correct = true;
-    while ((hrec = libmsi_query_fetch(hquery, &error)) != NULL)
-    {
-        count = libmsi_record_get_field_count( hrec );
-        ok( count == 4, "Expected 4 record fields, got %d\n", count );
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
 
-        str = libmsi_record_get_string(hrec, 1);
-        ok(str, "failed to get record string\n");
-        if (strcmp(str, join_res_eighth[i].one))
-            data_correct = false;
-        g_free(str);
+    r = libmsi_database_apply_transforms(hdb, transforms, outputs, NULL);
+    ok(r, "libmsi_database_apply_transforms() failed\n");
 
-        str = libmsi_record_get_string(hrec, 2);
-        ok(str, "failed to get record string\n");
-        if (strcmp(str, join_res_eighth[i].two))
-            data_correct = false;
-        g_free(str);
+    /* the base database is left alone */
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 20", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "row20");
+    g_object_unref(hrec);
+    g_object_unref(hdb);
 
-        str = libmsi_record_get_string(hrec, 3);
-        ok(str, "failed to get record string\n");
-        if (strcmp(str, join_res_eighth[i].three))
-            data_correct = false;
-        g_free(str);
+    for (i = 0; outputs[i]; i++)
+    {
+        hdb = libmsi_database_new(outputs[i], LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+        ok(hdb, "Failed to open database\n");
 
-        str = libmsi_record_get_string(hrec, 4);
-        ok(str, "failed to get record string\n");
-        if (strcmp(str, join_res_eighth[i].four))
-            data_correct = false;
-        g_free(str);
+        hrec = NULL;
+        r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 2", &hrec);
+        ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+        check_record_string(hrec, 1, "row2");
+        g_object_unref(hrec);
 
-        i++;
+        hrec = NULL;
+        r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 3", &hrec);
+        ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+        ok(hrec == NULL, "expected no row\n");
+
+        hrec = NULL;
+        r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 20", &hrec);
+        ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+        check_record_string(hrec, 1, "changed");
         g_object_unref(hrec);
-    }
-    ok( data_correct, "data returned in the wrong order\n");
 
-    ok( i == 6, "Expected 6 rows, got %d\n", i );
-    g_assert_no_error(error);
+        hrec = NULL;
+        r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 51", &hrec);
+        ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+        check_record_string(hrec, 1, "new");
+        g_object_unref(hrec);
 
-    libmsi_query_close(hquery, NULL);
-    g_object_unref(hquery);
+        g_object_unref(hdb);
+        unlink(outputs[i]);
+    }
 
-    sql = "SELECT * FROM `One`, `Two`, `Three` ";
-    hquery = libmsi_query_new(hdb, sql, NULL);
-    ok(hquery, "failed to open query\n");
+    unlink(msifile);
+    unlink(mstfile);
+}
 
-    r = libmsi_query_execute(hquery, 0, NULL);
-    ok( r, "failed to execute query: %d\n", r );
+static void test_snapshot(void)
+{
+    LibmsiDatabase *hdb, *hsnap, *hsnap2;
+    LibmsiRecord *hrec;
+    GError *error = NULL;
+    unsigned r;
 
-    i = 0;
-    data_correct = true;
-    while ((hrec = libmsi_query_fetch(hquery, &error)) != NULL)
-    {
-        count = libmsi_record_get_field_count( hrec );
-        ok( count == 6, "Expected 6 record fields, got %d\n", count );
+    hdb = create_db();
+    ok(hdb, "failed to create db\n");
 
-        r = libmsi_record_get_int( hrec, 1 );
-        if( r != join_res_ninth[i].one )
-            data_correct = false;
+    r = run_query(hdb, 0, "CREATE TABLE `MOO` ( `NOO` SHORT NOT NULL, `OOO` CHAR(255) PRIMARY KEY `NOO`)");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add table\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 1, 'a' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 2, 'b' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 3, 'c' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
 
-        r = libmsi_record_get_int( hrec, 2 );
-        if( r != join_res_ninth[i].two )
-            data_correct = false;
+    hsnap = libmsi_database_snapshot(hdb, NULL, NULL);
+    ok(hsnap, "libmsi_database_snapshot() failed\n");
 
-        r = libmsi_record_get_int( hrec, 3 );
-        if( r != join_res_ninth[i].three )
-            data_correct = false;
+    /* changes to the snapshot don't show in the database */
+    r = run_query(hsnap, 0, "UPDATE `MOO` SET `OOO` = 'bee' WHERE `NOO` = 2");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to update row\n");
+    r = run_query(hsnap, 0, "DELETE FROM `MOO` WHERE `NOO` = 1");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to delete row\n");
 
-        r = libmsi_record_get_int( hrec, 4 );
-        if( r != join_res_ninth[i].four )
-            data_correct = false;
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 2", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "b");
+    g_object_unref(hrec);
 
-        r = libmsi_record_get_int( hrec, 5 );
-        if( r != join_res_ninth[i].five )
-            data_correct = false;
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 1", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "a");
+    g_object_unref(hrec);
 
-        r = libmsi_record_get_int( hrec, 6);
-        if( r != join_res_ninth[i].six )
-            data_correct = false;
+    /* and the other way round */
+    r = run_query(hdb, 0, "UPDATE `MOO` SET `OOO` = 'sea' WHERE `NOO` = 3");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to update row\n");
+    r = run_query(hdb, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 4, 'd' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
 
-        i++;
-        g_object_unref(hrec);
-    }
-    ok( data_correct, "data returned in the wrong order\n");
+    hrec = NULL;
+    r = do_query(hsnap, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 3", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "c");
+    g_object_unref(hrec);
 
-    ok( i == 6, "Expected 6 rows, got %d\n", i );
-    g_assert_no_error(error);
+    hrec = NULL;
+    r = do_query(hsnap, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 4", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    ok(hrec == NULL, "expected no row\n");
 
-    libmsi_query_close(hquery, NULL);
-    g_object_unref(hquery);
+    /* a snapshot of a snapshot outlives both */
+    hsnap2 = libmsi_database_snapshot(hsnap, msifile2, NULL);
+    ok(hsnap2, "libmsi_database_snapshot() failed\n");
+    g_object_unref(hsnap);
+    g_object_unref(hdb);
 
-    sql = "SELECT * FROM `Four`, `Five`";
-    hquery = libmsi_query_new(hdb, sql, NULL);
-    ok(hquery, "failed to open query\n");
+    r = run_query(hsnap2, 0, "INSERT INTO `MOO` ( `NOO`, `OOO` ) VALUES ( 5, 'e' )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "failed to add row\n");
 
-    r = libmsi_query_execute(hquery, 0, NULL);
-    ok( r, "failed to execute query: %d\n", r );
+    r = libmsi_database_commit(hsnap2, NULL);
+    ok(r, "Failed to commit database\n");
 
-    query_check_no_more(hquery);
+    hrec = NULL;
+    r = do_query(hsnap2, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 2", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "bee");
+    g_object_unref(hrec);
 
-    libmsi_query_close(hquery, NULL);
-    g_object_unref(hquery);
+    hrec = NULL;
+    r = do_query(hsnap2, "SELECT `OOO` FROM `MOO` WHERE `NOO` = 5", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "select query failed\n");
+    check_record_string(hrec, 1, "e");
+    g_object_unref(hrec);
 
-    sql = "SELECT * FROM `Nonexistent`, `One`";
-    hquery = libmsi_query_new(hdb, sql, &error);
-    g_assert_error(error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_BAD_QUERY_SYNTAX);
+    /* without an output file there is nothing to commit to */
+    hsnap = libmsi_database_snapshot(hsnap2, NULL, NULL);
+    ok(hsnap, "libmsi_database_snapshot() failed\n");
+    r = libmsi_database_commit(hsnap, &error);
+    ok(!r, "libmsi_database_commit() succeeded\n");
+    g_assert_error(error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_ACCESS_DENIED);
     g_clear_error(&error);
-    g_object_unref(hdb);
+
+    g_object_unref(hsnap);
+    g_object_unref(hsnap2);
+
     unlink(msifile);
+    unlink(msifile2);
 }
 
 static void test_temporary_table(void)
@@ -6642,6 +8019,306 @@ static void test_dbmerge(void)
     unlink("binary.dat");
 }
 
+static void add_diff_stream(LibmsiDatabase *hdb, const char *name, const char *data)
+{
+    LibmsiRecord *rec;
+    unsigned r;
+
+    create_file_data(name, data, strlen(data));
+    rec = libmsi_record_new(2);
+    libmsi_record_set_string(rec, 1, name);
+    r = libmsi_record_load_stream(rec, 2, name);
+    ok(r, "Failed to add stream data to the record\n");
+    unlink(name);
+
+    r = run_query(hdb, rec, "INSERT INTO `_Streams` ( `Name`, `Data` ) VALUES ( ?, ? )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Insert into _Streams failed: %d\n", r);
+    g_object_unref(rec);
+}
+
+static char *diff_output(LibmsiDatabase *hdb, LibmsiDatabase *href, guint flags, guint *count)
+{
+    char *data = NULL;
+    unsigned r;
+    int fd;
+
+    fd = open("diff.txt", O_WRONLY | O_BINARY | O_CREAT | O_TRUNC, 0644);
+    r = libmsi_database_diff(hdb, href, flags, fd, count, NULL);
+    ok(r, "libmsi_database_diff failed\n");
+    close(fd);
+
+    g_file_get_contents("diff.txt", &data, NULL, NULL);
+    unlink("diff.txt");
+    return data;
+}
+
+/* the rows of the merged database are matched by their primary keys */
+static void test_dbmerge_keys(void)
+{
+    GError *error = NULL;
+    LibmsiDatabase *hdb, *href;
+    LibmsiRecord *hrec;
+    unsigned r;
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(hdb, "Failed to create database\n");
+
+    href = libmsi_database_new("refdb.msi", LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(href, "Failed to create database\n");
+
+    r = run_query(hdb, 0, "CREATE TABLE `Multi` ( `K1` INT, `K2` CHAR(8), `V` INT PRIMARY KEY `K1`, `K2` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    r = run_query(href, 0, "CREATE TABLE `Multi` ( `K1` INT, `K2` CHAR(8), `V` INT PRIMARY KEY `K1`, `K2` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    r = run_query(href, 0, "CREATE TABLE `Extra` ( `A` INT, `B` CHAR(8) PRIMARY KEY `A` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+
+    /* K2 is null in the second row of each database */
+    run_query(hdb, 0, "INSERT INTO `Multi` ( `K1`, `K2`, `V` ) VALUES ( 1, 'a', 10 )");
+    run_query(hdb, 0, "INSERT INTO `Multi` ( `K1`, `V` ) VALUES ( 2, 20 )");
+    run_query(href, 0, "INSERT INTO `Multi` ( `K1`, `K2`, `V` ) VALUES ( 1, 'b', 30 )");
+    run_query(href, 0, "INSERT INTO `Multi` ( `K1`, `V` ) VALUES ( 2, 20 )");
+    run_query(href, 0, "INSERT INTO `Multi` ( `K1`, `K2`, `V` ) VALUES ( 1, 'a', 10 )");
+    run_query(href, 0, "INSERT INTO `Multi` ( `K1`, `V` ) VALUES ( 3, 40 )");
+    run_query(href, 0, "INSERT INTO `Extra` ( `A`, `B` ) VALUES ( 1, 'x' )");
+
+    /* identical rows are skipped, new rows and tables are added */
+    r = libmsi_database_merge(hdb, href, "MergeErrors", &error);
+    g_assert_no_error(error);
+    ok(r, "libmsi_database_merge() failed\n");
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT COUNT(*) FROM `Multi`", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    ok(hrec && libmsi_record_get_int(hrec, 1) == 4, "Expected 4 rows\n");
+    if (hrec)
+        g_object_unref(hrec);
+    hrec = NULL;
+
+    r = do_query(hdb, "SELECT `V` FROM `Multi` WHERE `K1` = 1 AND `K2` = 'b'", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    ok(hrec && libmsi_record_get_int(hrec, 1) == 30, "Expected 30\n");
+    if (hrec)
+        g_object_unref(hrec);
+    hrec = NULL;
+
+    r = do_query(hdb, "SELECT `V` FROM `Multi` WHERE `K1` = 3 AND `K2` IS NULL", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    ok(hrec && libmsi_record_get_int(hrec, 1) == 40, "Expected 40\n");
+    if (hrec)
+        g_object_unref(hrec);
+    hrec = NULL;
+
+    r = do_query(hdb, "SELECT `B` FROM `Extra` WHERE `A` = 1", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    ok(hrec != NULL, "Expected a row\n");
+    if (hrec)
+        check_record_string(hrec, 1, "x");
+    if (hrec)
+        g_object_unref(hrec);
+    hrec = NULL;
+
+    r = do_query(hdb, "SELECT * FROM `MergeErrors`", &hrec);
+    ok(r == LIBMSI_RESULT_BAD_QUERY_SYNTAX,
+       "Expected LIBMSI_RESULT_BAD_QUERY_SYNTAX, got %d\n", r);
+
+    /* a row with the keys of another but other data is a conflict, and
+     * no row of its table is merged */
+    run_query(href, 0, "UPDATE `Multi` SET `V` = 99 WHERE `K1` = 1 AND `K2` = 'a'");
+    run_query(href, 0, "INSERT INTO `Multi` ( `K1`, `K2`, `V` ) VALUES ( 5, 'c', 50 )");
+
+    r = libmsi_database_merge(hdb, href, "MergeErrors", &error);
+    g_assert_error(error, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_FUNCTION_FAILED);
+    g_clear_error(&error);
+    ok(!r, "Expected libmsi_database_merge() to fail\n");
+
+    hrec = NULL;
+    r = do_query(hdb, "SELECT `NumRowMergeConflicts` FROM `MergeErrors` WHERE `Table` = 'Multi'", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    ok(hrec && libmsi_record_get_int(hrec, 1) == 1, "Expected 1 conflict\n");
+    if (hrec)
+        g_object_unref(hrec);
+    hrec = NULL;
+
+    r = do_query(hdb, "SELECT `V` FROM `Multi` WHERE `K1` = 1 AND `K2` = 'a'", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    ok(hrec && libmsi_record_get_int(hrec, 1) == 10, "Expected 10\n");
+    if (hrec)
+        g_object_unref(hrec);
+    hrec = NULL;
+
+    r = do_query(hdb, "SELECT `V` FROM `Multi` WHERE `K1` = 5", &hrec);
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    ok(hrec == NULL, "Expected no row\n");
+    if (hrec)
+        g_object_unref(hrec);
+    hrec = NULL;
+
+    g_object_unref(hdb);
+    g_object_unref(href);
+    unlink(msifile);
+    unlink("refdb.msi");
+}
+
+static void test_dbdiff(void)
+{
+    LibmsiDatabase *hdb, *href;
+    char *data;
+    guint count;
+    unsigned r;
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(hdb, "Failed to create database\n");
+
+    href = libmsi_database_new("refdb.msi", LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(href, "Failed to create database\n");
+
+    r = run_query(hdb, 0, "CREATE TABLE `Property` ( `Property` CHAR(72) NOT NULL, "
+                  "`Value` CHAR(0) PRIMARY KEY `Property` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    r = run_query(href, 0, "CREATE TABLE `Property` ( `Property` CHAR(72) NOT NULL, "
+                  "`Value` CHAR(0) PRIMARY KEY `Property` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+
+    /* the same rows in another order are not differences */
+    run_query(hdb, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'A', '1' )");
+    run_query(hdb, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'B', '2' )");
+    run_query(hdb, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'C', '3' )");
+    run_query(href, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'D', '4' )");
+    run_query(href, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'C', '3' )");
+    run_query(href, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'B', 'two' )");
+
+    /* nor are they with two key columns */
+    r = run_query(hdb, 0, "CREATE TABLE `R` ( `K1` INT, `K2` CHAR(8), `V` INT PRIMARY KEY `K1`, `K2` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    r = run_query(href, 0, "CREATE TABLE `R` ( `K1` INT, `K2` CHAR(8), `V` INT PRIMARY KEY `K1`, `K2` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    run_query(hdb, 0, "INSERT INTO `R` ( `K1`, `K2`, `V` ) VALUES ( 1, 'x', 10 )");
+    run_query(hdb, 0, "INSERT INTO `R` ( `K1`, `K2`, `V` ) VALUES ( 1, 'y', 20 )");
+    run_query(hdb, 0, "INSERT INTO `R` ( `K1`, `K2`, `V` ) VALUES ( 2, 'x', 30 )");
+    run_query(href, 0, "INSERT INTO `R` ( `K1`, `K2`, `V` ) VALUES ( 2, 'x', 30 )");
+    run_query(href, 0, "INSERT INTO `R` ( `K1`, `K2`, `V` ) VALUES ( 1, 'y', 20 )");
+    run_query(href, 0, "INSERT INTO `R` ( `K1`, `K2`, `V` ) VALUES ( 1, 'x', 10 )");
+
+    r = run_query(hdb, 0, "CREATE TABLE `Old` ( `A` INT PRIMARY KEY `A` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+
+    r = run_query(hdb, 0, "CREATE TABLE `T` ( `K` INT, `X` INT PRIMARY KEY `K` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+    r = run_query(href, 0, "CREATE TABLE `T` ( `K` INT, `Y` INT PRIMARY KEY `K` )");
+    ok(r == LIBMSI_RESULT_SUCCESS, "Expected LIBMSI_RESULT_SUCCESS, got %d\n", r);
+
+    /* same length, different data */
+    add_diff_stream(hdb, "s", "abc");
+    add_diff_stream(href, "s", "abd");
+    add_diff_stream(href, "t", "new");
+
+    data = diff_output(hdb, hdb, 0, &count);
+    ok(count == 0, "Expected no differences, got %u\n", count);
+    ok(data && !*data, "Expected no output, got %s\n", data);
+    g_free(data);
+
+    data = diff_output(hdb, href, 0, &count);
+    ok(count == 8, "Expected 8 differences, got %u\n", count);
+    ok(data && strstr(data, "~ row Property ['B'] Value: '2' -> 'two'\n"), "missing changed row: %s\n", data);
+    ok(data && strstr(data, "- row Property ['A'] Value='1'\n"), "missing removed row: %s\n", data);
+    ok(data && strstr(data, "+ row Property ['D'] Value='4'\n"), "missing added row: %s\n", data);
+    ok(data && !strstr(data, "['C']"), "unchanged row reported: %s\n", data);
+    ok(data && strstr(data, "- table Old\n"), "missing removed table: %s\n", data);
+    ok(data && strstr(data, "- column T.X\n"), "missing removed column: %s\n", data);
+    ok(data && strstr(data, "+ column T.Y "), "missing added column: %s\n", data);
+    ok(data && strstr(data, "~ stream s: sha256 "), "missing changed stream: %s\n", data);
+    ok(data && strstr(data, "+ stream t\n"), "missing added stream: %s\n", data);
+    g_free(data);
+
+    /* the other way round */
+    data = diff_output(href, hdb, 0, &count);
+    ok(count == 8, "Expected 8 differences, got %u\n", count);
+    ok(data && strstr(data, "~ row Property ['B'] Value: 'two' -> '2'\n"), "missing changed row: %s\n", data);
+    ok(data && strstr(data, "+ row Property ['A'] Value='1'\n"), "missing added row: %s\n", data);
+    ok(data && strstr(data, "- row Property ['D'] Value='4'\n"), "missing removed row: %s\n", data);
+    ok(data && !strstr(data, " R"), "reordered rows reported: %s\n", data);
+    g_free(data);
+
+    data = diff_output(hdb, href, LIBMSI_DIFF_FLAGS_FAST, &count);
+    ok(count == 5, "Expected 5 differences, got %u\n", count);
+    ok(data && strstr(data, "~ table Property\n"), "missing changed table: %s\n", data);
+    ok(data && strstr(data, "~ table T\n"), "missing changed table: %s\n", data);
+    ok(data && !strstr(data, "row"), "rows reported in fast mode: %s\n", data);
+    g_free(data);
+
+    g_object_unref(hdb);
+    g_object_unref(href);
+    unlink(msifile);
+    unlink("refdb.msi");
+}
+
+static void test_stats(void)
+{
+    LibmsiDatabase *hdb;
+    GVariant *stats;
+    GVariantIter *iter;
+    const char *name;
+    guint32 strref, strings, streams, rows, columns;
+    guint64 bytes, data, index, memory;
+    gboolean found = FALSE;
+
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_CREATE, NULL, NULL);
+    ok(hdb, "Failed to create database\n");
+
+    run_query(hdb, 0, "CREATE TABLE `Property` ( `Property` CHAR(72) NOT NULL, "
+              "`Value` CHAR(0) PRIMARY KEY `Property` )");
+    run_query(hdb, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'A', '1' )");
+    run_query(hdb, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'B', '2' )");
+    run_query(hdb, 0, "INSERT INTO `Property` ( `Property`, `Value` ) VALUES ( 'C', '3' )");
+    add_diff_stream(hdb, "big", "a larger stream");
+    add_diff_stream(hdb, "small", "tiny");
+
+    ok(libmsi_database_commit(hdb, NULL), "Failed to commit database\n");
+    g_object_unref(hdb);
+
+    /* the Property table is sized from its stream */
+    hdb = libmsi_database_new(msifile, LIBMSI_DB_FLAGS_READONLY, NULL, NULL);
+    ok(hdb, "Failed to open database\n");
+
+    stats = libmsi_database_get_stats(hdb, NULL);
+    ok(stats != NULL, "libmsi_database_get_stats failed\n");
+
+    g_variant_lookup(stats, "bytes-per-strref", "u", &strref);
+    ok(strref == 2, "Expected 2 bytes per string reference, got %u\n", strref);
+    g_variant_lookup(stats, "strings", "u", &strings);
+    ok(strings >= 8, "Expected at least 8 strings, got %u\n", strings);
+    g_variant_lookup(stats, "streams", "u", &streams);
+    ok(streams == 2, "Expected 2 streams, got %u\n", streams);
+    g_variant_lookup(stats, "memory", "t", &memory);
+    ok(memory > 0, "Expected a memory estimate\n");
+
+    g_variant_lookup(stats, "tables", "a(suuttt)", &iter);
+    while (g_variant_iter_loop(iter, "(&suuttt)", &name, &rows, &columns, &bytes, &data, &index))
+    {
+        if (strcmp(name, "Property"))
+            continue;
+
+        found = TRUE;
+        ok(rows == 3, "Expected 3 rows, got %u\n", rows);
+        ok(columns == 2, "Expected 2 columns, got %u\n", columns);
+        ok(bytes == 12, "Expected a 12 bytes stream, got %" G_GUINT64_FORMAT "\n", bytes);
+        ok(index == 0, "Expected no index, got %" G_GUINT64_FORMAT "\n", index);
+    }
+    g_variant_iter_free(iter);
+    ok(found, "Property table not found\n");
+
+    g_variant_lookup(stats, "largest-streams", "a(st)", &iter);
+    ok(g_variant_iter_next(iter, "(&st)", &name, &bytes), "Expected a stream\n");
+    ok(!strcmp(name, "big") && bytes == strlen("a larger stream"),
+       "Expected the largest stream first, got %s\n", name);
+    g_variant_iter_free(iter);
+
+    g_variant_unref(stats);
+    g_object_unref(hdb);
+    unlink(msifile);
+}
+
 static void test_select_with_tablenames(void)
 {
     LibmsiDatabase *hdb;
@@ -7479,19 +9156,34 @@ int main()
     test_querygetcolumninfo();
     test_getcolinfo();
     test_msiexport();
+    test_export_large();
+    test_export_all();
     test_longstrings();
     test_streamtable();
     test_binary();
+    test_many_streams();
+    test_stream_from_file();
+    test_extract_streams();
     test_where_not_in_selected();
     test_where();
     test_msiimport();
     test_binary_import();
+    test_import_rows();
+    test_import_tables();
     test_markers();
     test_handle_limit();
 #if 0
     test_try_transform();
 #endif
+    test_generate_transform();
+    test_apply_transforms();
+    test_snapshot();
     test_join();
+    test_query_plan();
+    test_aggregates();
+    test_limit();
+    test_where_batches();
+    test_update_rows();
     test_temporary_table();
     test_alter();
     test_integers();
@@ -7519,6 +9211,9 @@ int main()
 #if 0
     test_dbmerge();
 #endif
+    test_dbmerge_keys();
+    test_dbdiff();
+    test_stats();
     test_select_with_tablenames();
     test_insertorder();
     test_columnorder();
@@ -119,6 +119,12 @@ Binary" ]
   [ "$output" = "$exp" ]
 }
 
+@test "msibuild - import a missing table" {
+  run "$msibuild" out.msi -i tables.txt missing.idt
+  [ "$status" -ne 0 ]
+  [[ "$output" == *"failed to import table missing.idt"* ]]
+}
+
 @test "msibuild - add table with stream" {
   run "$msibuild" out.msi -i tables.txt columns.txt icon.txt
   run "$msiinfo" streams out.msi
@@ -147,3 +153,73 @@ Restrict: 0 (0)
 Application: Windows Installer XML (3.7.1119.0)
 Security: 2 (2)" ]
 }
+
+@test "msidump - tables and streams" {
+  run "$msibuild" out.msi -i tables.txt columns.txt button.txt icon.txt
+  mkdir dump
+  run "$msidump" -t -s -d dump out.msi
+  [ "$status" -eq 0 ]
+  echo "$output" | grep "^Exporting table RadioButton...$"
+  echo "$output" | grep "^Exporting stream Icon.firefox.16.0.2.0.ico.exe...$"
+  [ "$(cat dump/RadioButton.idt)" = "$(cat button.txt)" ]
+  [ "$(cat dump/Icon.idt)" = "$("$msiinfo" export out.msi Icon)" ]
+  output=$(cat dump/_Streams/Icon.firefox.16.0.2.0.ico.exe | sha1sum)
+  exp=$(cat Icon/firefox.16.0.2.0.ico.exe | sha1sum)
+  [ "$output" = "$exp" ]
+  [ -s dump/_Streams/$'\005SummaryInformation' ]
+}
+
+@test "msidump - unsigned package" {
+  run "$msibuild" out.msi -i tables.txt columns.txt button.txt
+  mkdir dump
+  run "$msidump" -S -d dump out.msi
+  [ "$status" -eq 0 ]
+  [ "$output" = "Exporting asn1parsed dump/signature ..." ]
+  [ -f dump/signature ] && [ ! -s dump/signature ]
+}
+
+@test "msidump - invalid command line" {
+  run "$msidump"
+  [ "$status" -eq 1 ]
+  run "$msidump" missing.msi
+  [ "$status" -eq 1 ]
+  [ "$output" = "Error: file does not exist: 'missing.msi'" ]
+}
+
+@test "msiinfo - diff" {
+  run "$msibuild" out.msi -i tables.txt columns.txt button.txt
+  cp out.msi out2.msi
+  run "$msiinfo" diff out.msi out2.msi
+  [ "$status" -eq 0 ]
+  [ "$output" = "" ]
+  echo "This is test.txt" > test.txt
+  run "$msibuild" out2.msi -a Binary.testtxt test.txt
+  run "$msiinfo" diff out.msi out2.msi
+  [ "$status" -eq 1 ]
+  echo "$output" | grep "^+ stream Binary.testtxt$"
+  run "$msiinfo" diff --fast out.msi out2.msi
+  [ "$status" -eq 1 ]
+  echo "$output" | grep "^+ stream Binary.testtxt$"
+  run "$msiinfo" diff out.msi missing.msi
+  [ "$status" -eq 2 ]
+}
+
+@test "msiinfo - stats" {
+  run "$msibuild" out.msi -i tables.txt columns.txt button.txt
+  run "$msiinfo" stats out.msi
+  [ "$status" -eq 0 ]
+  echo "$output" | grep "^String reference: 2 bytes$"
+  echo "$output" | grep "^RadioButton "
+}
+
+@test "LIBMSI_PROFILE - summary and trace" {
+  run "$msibuild" out.msi -i tables.txt columns.txt button.txt
+  LIBMSI_PROFILE=summary:profile.txt run "$msiinfo" export out.msi RadioButton
+  [ "$status" -eq 0 ]
+  grep "^rows-scanned " profile.txt
+  grep "^query_execute " profile.txt
+  LIBMSI_PROFILE=trace:trace.json run "$msiinfo" export out.msi RadioButton
+  [ "$status" -eq 0 ]
+  grep '^{"traceEvents":' trace.json
+  grep '"name":"open"' trace.json
+}
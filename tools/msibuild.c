@@ -124,17 +124,10 @@ end:
 
 static LibmsiDatabase *db;
 
-static gboolean import_table(char *table, GError **error)
+/* the error names the table that failed to import */
+static gboolean import_tables(const char * const *tables, GError **error)
 {
-    gboolean success = TRUE;
-
-    if (!libmsi_database_import(db, table, error))
-    {
-        fprintf(stderr, "failed to import table %s\n", table);
-        success = FALSE;
-    }
-
-    return success;
+    return libmsi_database_import_tables(db, tables, error);
 }
 
 static gboolean add_summary_info(const char *name, const char *author,
@@ -245,8 +238,12 @@ static void show_usage(void)
         "Options:\n"
         "  -s name [author] [template] [uuid] Set summary information.\n"
         "  -q query         Execute SQL query/queries.\n"
-        "  -i table1.idt    Import one table into the database.\n"
+        "  -i table1.idt [table2.idt|dir]...\n"
+        "                   Import tables into the database, or the .idt files\n"
+        "                   of a directory.\n"
         "  -a stream file   Add 'stream' to storage with contents of 'file'.\n"
+        "  -t mst output    Write 'output' with transform 'mst' applied, after the\n"
+        "                   other options; repeat for more outputs.\n"
         "\nExisting tables or streams will be overwritten. If package.msi does not exist a new file\n"
         "will be created with an empty database.\n"
   );
@@ -256,6 +253,9 @@ int main(int argc, char *argv[])
 {
     GError *error = NULL;
     gboolean success = FALSE;
+    GPtrArray *transforms = g_ptr_array_new();
+    GPtrArray *outputs = g_ptr_array_new();
+    GPtrArray *tables;
     int n;
 
 #if !GLIB_CHECK_VERSION(2,35,1)
@@ -301,13 +301,18 @@ int main(int argc, char *argv[])
             argc -= n + 1, argv += n + 1;
             break;
         case 'i':
+            /* the tables are read in parallel */
+            tables = g_ptr_array_new();
             do {
-                if (!import_table(argv[1], &error))
-                    break;
-
+                g_ptr_array_add(tables, argv[1]);
                 argc--, argv++;
             } while (argv[1] && argv[1][0] != '-');
             argc--, argv++;
+            g_ptr_array_add(tables, NULL);
+            success = import_tables((const char * const *)tables->pdata, &error);
+            g_ptr_array_free(tables, TRUE);
+            if (!success)
+                goto end;
             break;
         case 'q':
             do {
@@ -328,6 +333,12 @@ int main(int argc, char *argv[])
                 goto end;
             argc -= 3, argv += 3;
             break;
+        case 't':
+            if (argc < 3) break;
+            g_ptr_array_add(transforms, argv[1]);
+            g_ptr_array_add(outputs, argv[2]);
+            argc -= 3, argv += 3;
+            break;
         default:
             fprintf(stdout, "unknown option\n");
             show_usage();
@@ -338,7 +349,19 @@ int main(int argc, char *argv[])
     if (!libmsi_database_commit(db, &error))
         goto end;
 
+    if (transforms->len) {
+        g_ptr_array_add(transforms, NULL);
+        g_ptr_array_add(outputs, NULL);
+        if (!libmsi_database_apply_transforms(db,
+                                              (const char * const *)transforms->pdata,
+                                              (const char * const *)outputs->pdata,
+                                              &error))
+            goto end;
+    }
+
 end:
+    g_ptr_array_free(transforms, TRUE);
+    g_ptr_array_free(outputs, TRUE);
     g_object_unref(db);
 
     if (error != NULL) {
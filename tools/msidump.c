@@ -0,0 +1,246 @@
+/*
+ * msidump - dump raw MSI tables and stream content
+ *
+ * Copyright (c) 2013 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "libmsi.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static void usage(FILE *out)
+{
+    fprintf(out, "Usage: msidump [OPTION]... MSI-FILE\n\n");
+    fprintf(out, "Options:\n");
+    fprintf(out, "  -t, --tables         Dump tables.  This is the default.\n");
+    fprintf(out, "  -s, --streams        Dump streams\n");
+    fprintf(out, "  -S, --signature      Dump asn1parse of digital signature.\n");
+    fprintf(out, "  -d, --directory DIR  Dump to given directory DIR\n");
+    fprintf(out, "  -h, --help           Print help message and exit.\n");
+    fprintf(out, "  -v, --version        Print version information and exit.\n\n");
+    fprintf(out, "More than one of -t, -s or -S may be specified.\n");
+}
+
+static void help(void)
+{
+    printf("msidump dumps MSI tables as idt text and streams\n");
+    usage(stdout);
+    printf("\n");
+    printf("Report bugs to <%s>.\n", PACKAGE_BUGREPORT);
+}
+
+/* print the names in the first column of query, as the tables and
+ * streams subcommands of msiinfo do */
+static bool print_names(LibmsiDatabase *db, const char *sql,
+                        const char *format, GError **error)
+{
+    LibmsiQuery *query;
+    LibmsiRecord *rec;
+    gchar *name;
+
+    query = libmsi_query_new(db, sql, error);
+    if (!query)
+        return false;
+
+    if (libmsi_query_execute(query, NULL, error)) {
+        while ((rec = libmsi_query_fetch(query, error))) {
+            name = libmsi_record_get_string(rec, 1);
+            printf(format, name);
+            g_free(name);
+            g_object_unref(rec);
+        }
+    }
+
+    g_object_unref(query);
+    return !*error;
+}
+
+static bool dump_tables(LibmsiDatabase *db, const char *destdir, GError **error)
+{
+    printf("Exporting table %s...\n", "_SummaryInformation");
+    printf("Exporting table %s...\n", "_ForceCodepage");
+    if (!print_names(db, "SELECT `Name` FROM `_Tables`",
+                     "Exporting table %s...\n", error))
+        return false;
+
+    fflush(stdout);
+    return libmsi_database_export_all(db, destdir, error);
+}
+
+static bool dump_streams(LibmsiDatabase *db, const char *destdir, GError **error)
+{
+    g_autofree char *dir = g_build_filename(destdir, "_Streams", NULL);
+
+    if (g_mkdir_with_parents(dir, 0755) == -1) {
+        fprintf(stderr, "Error: cannot create '%s': %s\n", dir, g_strerror(errno));
+        exit(1);
+    }
+
+    if (!print_names(db, "SELECT `Name` FROM `_Streams`",
+                     "Exporting stream %s...\n", error))
+        return false;
+
+    fflush(stdout);
+    return libmsi_database_extract_streams(db, NULL, dir, error);
+}
+
+/* an unsigned package still gives an empty file, and the errors of
+ * openssl are only reported */
+static void dump_signature(LibmsiDatabase *db, const char *destdir)
+{
+    g_autofree char *signature = g_build_filename(destdir, "signature", NULL);
+    g_autofree char *tmp = NULL;
+    g_autoptr(GSubprocessLauncher) launcher = NULL;
+    g_autoptr(GSubprocess) openssl = NULL;
+    g_autoptr(GError) err = NULL;
+    int fd;
+
+    printf("Exporting asn1parsed %s ...\n", signature);
+    fflush(stdout);
+    g_unlink(signature);
+
+    fd = g_file_open_tmp("msidump-XXXXXX", &tmp, &err);
+    if (fd == -1) {
+        fprintf(stderr, "Error: %s\n", err->message);
+        return;
+    }
+
+    if (!libmsi_database_extract_stream_to_fd(db, "\005DigitalSignature", fd, &err)) {
+        close(fd);
+        g_unlink(tmp);
+        /* not found is not an error, the package is just not signed */
+        if (!g_error_matches(err, LIBMSI_RESULT_ERROR, LIBMSI_RESULT_INVALID_PARAMETER))
+            fprintf(stderr, "Error: %s\n", err->message);
+        g_file_set_contents(signature, "", 0, NULL);
+        return;
+    }
+    close(fd);
+
+    launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
+    g_subprocess_launcher_set_stdin_file_path(launcher, tmp);
+    g_subprocess_launcher_set_stdout_file_path(launcher, signature);
+    openssl = g_subprocess_launcher_spawn(launcher, &err, "openssl", "asn1parse",
+                                          "-i", "-inform", "de", NULL);
+    if (openssl)
+        g_subprocess_wait(openssl, NULL, NULL);
+    else
+        fprintf(stderr, "Error: %s\n", err->message);
+
+    g_unlink(tmp);
+}
+
+int main(int argc, char **argv)
+{
+    GError *error = NULL;
+    LibmsiDatabase *db;
+    const char *destdir = ".";
+    const char *file;
+    bool tables = false, streams = false, signature = false;
+    int i;
+
+#if !GLIB_CHECK_VERSION(2,35,1)
+    g_type_init ();
+#endif
+    g_set_prgname ("msidump");
+
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (!strcmp(arg, "-t") || !strcmp(arg, "--tables")) {
+            tables = true;
+        } else if (!strcmp(arg, "-s") || !strcmp(arg, "--streams")) {
+            streams = true;
+        } else if (!strcmp(arg, "-S") || !strcmp(arg, "--signature")) {
+            signature = true;
+        } else if (!strcmp(arg, "-d") || !strcmp(arg, "--directory")) {
+            if (++i == argc) {
+                usage(stdout);
+                exit(1);
+            }
+            destdir = argv[i];
+        } else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            help();
+            exit(0);
+        } else if (!strcmp(arg, "-v") || !strcmp(arg, "--version")) {
+            printf("%s\n", PACKAGE_VERSION);
+            exit(0);
+        } else {
+            break;
+        }
+    }
+
+    if (i == argc) {
+        usage(stdout);
+        exit(1);
+    }
+
+    file = argv[i];
+    if (!g_file_test(file, G_FILE_TEST_IS_REGULAR)) {
+        if (g_file_test(file, G_FILE_TEST_EXISTS))
+            fprintf(stderr, "Error: not a regular file: '%s'\n", file);
+        else
+            fprintf(stderr, "Error: file does not exist: '%s'\n", file);
+        exit(1);
+    }
+
+    if (!g_file_test(destdir, G_FILE_TEST_IS_DIR)) {
+        fprintf(stderr, "Error: directory does not exist: '%s'\n", destdir);
+        exit(1);
+    }
+
+    /* tables mode is the default */
+    if (!tables && !streams && !signature)
+        tables = true;
+
+    db = libmsi_database_new(file, LIBMSI_DB_FLAGS_READONLY, NULL, &error);
+    if (!db)
+        goto end;
+
+    if (tables && !dump_tables(db, destdir, &error))
+        goto end;
+
+    if (streams && !dump_streams(db, destdir, &error))
+        goto end;
+
+    if (signature)
+        dump_signature(db, destdir);
+
+end:
+    if (db)
+        g_object_unref(db);
+
+    if (error) {
+        g_printerr("error: %s\n", error->message);
+        g_clear_error(&error);
+        return 1;
+    }
+
+    return 0;
+}
@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <errno.h>
 
 struct Command {
     const char *cmd;
@@ -335,28 +336,10 @@ static int cmd_suminfo(struct Command *cmd, int argc, char **argv, GError **erro
     return *error ? 1 : 0;
 }
 
-static void full_write(int fd, char *buf, size_t sz)
-{
-    while (sz > 0) {
-        ssize_t rc = write(fd, buf, sz);
-        if (rc < 0) {
-            perror("write");
-            exit(1);
-        }
-        buf += rc;
-        sz -= rc;
-    }
-}
-
 static int cmd_extract(struct Command *cmd, int argc, char **argv, GError **error)
 {
     LibmsiDatabase *db = NULL;
-    LibmsiQuery *query = NULL;
-    LibmsiRecord *rec = NULL;
-    GInputStream *in = NULL;
     int r = 1;
-    char buffer[4096];
-    size_t n_read;
 
     if (argc != 3) {
         cmd_usage(stderr, cmd);
@@ -366,46 +349,14 @@ static int cmd_extract(struct Command *cmd, int argc, char **argv, GError **erro
     if (!db)
         goto end;
 
-    query = libmsi_query_new(db, "SELECT `Data` FROM `_Streams` WHERE `Name` = ?", error);
-    if (*error)
-        goto end;
-
-    rec = libmsi_record_new(1);
-    libmsi_record_set_string(rec, 1, argv[2]);
-    r = libmsi_query_execute(query, rec, error);
-    if (*error)
-        goto end;
-    g_object_unref(rec);
-
-    rec = libmsi_query_fetch(query, error);
-    if (*error)
-        goto end;
-
 #if O_BINARY
     _setmode(STDOUT_FILENO, O_BINARY);
 #endif
 
-    in = G_INPUT_STREAM (libmsi_record_get_stream(rec, 1));
-    for (;;) {
-        n_read = g_input_stream_read (in, buffer, sizeof (buffer), NULL, error);
-        if (n_read == -1)
-            goto end;
-        if (n_read == 0)
-            break;
-
-	full_write (STDOUT_FILENO, buffer, n_read);
-    }
-
-    if (!*error)
+    if (libmsi_database_extract_stream_to_fd(db, argv[2], STDOUT_FILENO, error))
         r = 0;
 
 end:
-    if (in)
-        g_object_unref(in);
-    if (rec)
-        g_object_unref(rec);
-    if (query)
-        g_object_unref(query);
     if (db)
         g_object_unref(db);
 
@@ -633,6 +584,37 @@ done:
     return success;
 }
 
+static int cmd_extract_all(struct Command *cmd, int argc, char **argv, GError **error)
+{
+    LibmsiDatabase *db = NULL;
+    const char *pattern = NULL;
+
+    if (argc > 2 && !strcmp(argv[1], "--match")) {
+        pattern = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc != 3) {
+        cmd_usage(stderr, cmd);
+    }
+
+    db = libmsi_database_new(argv[1], LIBMSI_DB_FLAGS_READONLY, NULL, error);
+    if (!db)
+        return 1;
+
+    if (g_mkdir_with_parents(argv[2], 0755) == -1) {
+        fprintf(stderr, "cannot create %s: %s\n", argv[2], g_strerror(errno));
+        g_object_unref(db);
+        return 1;
+    }
+
+    libmsi_database_extract_streams(db, pattern, argv[2], error);
+    g_object_unref(db);
+
+    return *error ? 1 : 0;
+}
+
 static int cmd_export(struct Command *cmd, int argc, char **argv, GError **error)
 {
     LibmsiDatabase *db = NULL;
@@ -670,6 +652,133 @@ end:
     return *error ? 1 : 0;
 }
 
+static int cmd_export_all(struct Command *cmd, int argc, char **argv, GError **error)
+{
+    LibmsiDatabase *db = NULL;
+
+    if (argc != 3) {
+        cmd_usage(stderr, cmd);
+    }
+
+    db = libmsi_database_new(argv[1], LIBMSI_DB_FLAGS_READONLY, NULL, error);
+    if (!db)
+        return 1;
+
+    if (g_mkdir_with_parents(argv[2], 0755) == -1) {
+        fprintf(stderr, "cannot create %s: %s\n", argv[2], g_strerror(errno));
+        g_object_unref(db);
+        return 1;
+    }
+
+    libmsi_database_export_all(db, argv[2], error);
+    g_object_unref(db);
+
+    return *error ? 1 : 0;
+}
+
+static int cmd_diff(struct Command *cmd, int argc, char **argv, GError **error)
+{
+    LibmsiDatabase *db = NULL, *other = NULL;
+    guint flags = 0, count = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "--fast")) {
+        flags |= LIBMSI_DIFF_FLAGS_FAST;
+        argc--;
+        argv++;
+    }
+
+    if (argc != 3) {
+        cmd_usage(stderr, cmd);
+    }
+
+    db = libmsi_database_new(argv[1], LIBMSI_DB_FLAGS_READONLY, NULL, error);
+    if (!db)
+        return 2;
+
+    other = libmsi_database_new(argv[2], LIBMSI_DB_FLAGS_READONLY, NULL, error);
+    if (!other)
+        goto end;
+
+    libmsi_database_diff(db, other, flags, STDOUT_FILENO, &count, error);
+
+end:
+    if (other)
+        g_object_unref(other);
+    g_object_unref(db);
+
+    /* like diff(1) */
+    if (*error)
+        return 2;
+    return count ? 1 : 0;
+}
+
+static int cmd_stats(struct Command *cmd, int argc, char **argv, GError **error)
+{
+    LibmsiDatabase *db = NULL;
+    GVariant *stats;
+    GVariantIter *iter;
+    const char *name;
+    guint32 codepage, strref, strings, streams, rows, columns;
+    guint64 string_bytes, string_refs, pool_bytes, string_memory;
+    guint64 stream_bytes, memory, bytes, data, index;
+
+    if (argc != 2) {
+        cmd_usage(stderr, cmd);
+    }
+
+    db = libmsi_database_new(argv[1], LIBMSI_DB_FLAGS_READONLY, NULL, error);
+    if (!db)
+        return 1;
+
+    stats = libmsi_database_get_stats(db, error);
+    if (!stats)
+        goto end;
+
+    g_variant_lookup(stats, "codepage", "u", &codepage);
+    g_variant_lookup(stats, "bytes-per-strref", "u", &strref);
+    g_variant_lookup(stats, "strings", "u", &strings);
+    g_variant_lookup(stats, "string-bytes", "t", &string_bytes);
+    g_variant_lookup(stats, "string-refs", "t", &string_refs);
+    g_variant_lookup(stats, "string-pool-bytes", "t", &pool_bytes);
+    g_variant_lookup(stats, "string-memory", "t", &string_memory);
+    g_variant_lookup(stats, "streams", "u", &streams);
+    g_variant_lookup(stats, "stream-bytes", "t", &stream_bytes);
+    g_variant_lookup(stats, "memory", "t", &memory);
+
+    printf("Codepage: %u\n", codepage);
+    printf("String reference: %u bytes\n", strref);
+    printf("Strings: %u, %" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT " references\n",
+           strings, string_bytes, string_refs);
+    printf("String pool: %" G_GUINT64_FORMAT " bytes\n", pool_bytes);
+    printf("Streams: %u, %" G_GUINT64_FORMAT " bytes\n", streams, stream_bytes);
+    printf("Memory: %" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT " for strings\n",
+           memory, string_memory);
+
+    printf("\n%-32s %8s %7s %12s %12s %10s\n",
+           "Table", "Rows", "Columns", "Stream", "Memory", "Indexes");
+    g_variant_lookup(stats, "tables", "a(suuttt)", &iter);
+    while (g_variant_iter_loop(iter, "(&suuttt)", &name, &rows, &columns,
+                               &bytes, &data, &index)) {
+        printf("%-32s %8u %7u %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT
+               " %10" G_GUINT64_FORMAT "\n", name, rows, columns, bytes, data, index);
+    }
+    g_variant_iter_free(iter);
+
+    printf("\nLargest streams:\n");
+    g_variant_lookup(stats, "largest-streams", "a(st)", &iter);
+    while (g_variant_iter_loop(iter, "(&st)", &name, &bytes)) {
+        printf("%12" G_GUINT64_FORMAT " %s\n", bytes, name);
+    }
+    g_variant_iter_free(iter);
+
+    g_variant_unref(stats);
+
+end:
+    g_object_unref(db);
+
+    return *error ? 1 : 0;
+}
+
 static int cmd_version(struct Command *cmd, int argc, char **argv, GError **error)
 {
     printf("%s (%s) version %s\n", g_get_prgname (), PACKAGE_NAME, PACKAGE_VERSION);
@@ -715,6 +824,13 @@ static struct Command cmds[] = {
         .desc = "Extract a binary stream from an .msi file",
         .func = cmd_extract,
     },
+    {
+        .cmd = "extract-all",
+        .opts = "[--match GLOB] FILE DIR\n\nOptions:\n"
+                "  --match GLOB      Only extract the streams matching GLOB",
+        .desc = "Extract all binary streams from an .msi file to a directory",
+        .func = cmd_extract_all,
+    },
     {
         .cmd = "export",
         .opts = "[-s] FILE TABLE\n\nOptions:\n"
@@ -722,6 +838,27 @@ static struct Command cmds[] = {
         .desc = "Export a table in text form from an .msi file",
         .func = cmd_export,
     },
+    {
+        .cmd = "export-all",
+        .opts = "FILE DIR",
+        .desc = "Export all tables in text form to a directory",
+        .func = cmd_export_all,
+    },
+    {
+        .cmd = "diff",
+        .opts = "[--fast] FROM-FILE TO-FILE\n\nOptions:\n"
+                "  --fast            Only list the tables and streams that differ",
+        .desc = "Compare the tables and streams of two .msi files",
+        .help = "Rows are matched by primary key.  The exit status is 0 if the\n"
+                "files are the same, 1 if they differ and 2 on errors.",
+        .func = cmd_diff,
+    },
+    {
+        .cmd = "stats",
+        .opts = "FILE",
+        .desc = "Print the sizes of the tables, strings and streams",
+        .func = cmd_stats,
+    },
     {
         .cmd = "suminfo",
         .opts = "FILE",
@@ -350,11 +350,18 @@ namespace Wixl {
 
                 var cab = new GCab.Cabinet ();
                 cab.add_folder (folder);
-                var output = new MemoryOutputStream (null, realloc, free);
-                cab.write (output, null, null, null);
-                var input = new MemoryInputStream.from_data (output.get_data ()[0:output.data_size], null);
-                if (parse_yesno (m.EmbedCab))
-                    db.table_streams.add (m.Cabinet, input, output.data_size);
+                // written to a file, so that libmsi maps it instead of
+                // keeping the cabinet in memory until the commit
+                FileIOStream iostream;
+                var tmp = File.new_tmp ("wixl-XXXXXX.cab", out iostream);
+                try {
+                    cab.write (iostream.output_stream, null, null, null);
+                    iostream.close ();
+                    if (parse_yesno (m.EmbedCab))
+                        db.table_streams.add_file (m.Cabinet, tmp.get_path ());
+                } finally {
+                    tmp.delete ();
+                }
 
                 db.table_media.set_last_sequence (m.record, sequence);
             }
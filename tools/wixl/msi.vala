@@ -969,6 +969,15 @@ namespace Wixl {
             records.append (rec);
         }
 
+        public void add_file (string name, string filename) throws GLib.Error {
+            var rec = new Libmsi.Record (2);
+            if (!rec.set_string (1, name) ||
+                !rec.load_stream (2, filename))
+                throw new Wixl.Error.FAILED ("failed to add record");
+
+            records.append (rec);
+        }
+
         public override void create (Libmsi.Database db) throws GLib.Error {
             var query = new Libmsi.Query (db, "INSERT INTO `_Streams` (`Name`, `Data`) VALUES (?, ?)");
             foreach (var r in records)